@@ -0,0 +1,912 @@
+/* aept-archive-bench.c - benchmarks of archive.c on synthetic packages
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * For each shape and each codec libarchive can both write and read by
+ * itself, an .aep file is generated under the work directory whose
+ * data tarball has that shape and is compressed with that codec.  The
+ * listing and extraction entry points of archive.c are then run on it
+ * a number of times and reported as one JSON object per line, with the
+ * throughput at the median time and the number of heap allocations of
+ * a run.  The package stays in the page cache, and the files are
+ * extracted into the work directory, so put that on a tmpfs to measure
+ * archive.c rather than the disk.  Progress and errors go to stderr.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "aept/aept.h"
+#include "aept/archive.h"
+#include "aept/util.h"
+
+#include "bench-common.h"
+
+#define MTIME 1700000000
+#define BLOCK (64 * 1024)
+
+static struct {
+    int runs;
+    int threads;          /* xz decoder threads, as decompress_threads */
+    double scale;
+    int keep;
+    char *workdir;
+} opt = { 5, 1, 1.0, 0, NULL };
+
+/* ── Allocation counting ─────────────────────────────────────────── */
+
+/*
+ * malloc, calloc and realloc are replaced in this program, so that the
+ * calls of libaept, libarchive and the decompressors are all counted
+ * while a benchmark is measured.  Only done with glibc, which exports
+ * its allocator under other names to forward to; elsewhere the counts
+ * stay 0.
+ */
+
+static int counting;
+static unsigned long long n_allocs, alloc_bytes;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static void count_alloc(size_t size)
+{
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size)
+{
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static void count_begin(void)
+{
+    n_allocs = alloc_bytes = 0;
+    __atomic_store_n(&counting, 1, __ATOMIC_SEQ_CST);
+}
+
+static void count_end(void)
+{
+    __atomic_store_n(&counting, 0, __ATOMIC_SEQ_CST);
+}
+
+/* ── Helpers ─────────────────────────────────────────────────────── */
+
+/* Remove what the previous run extracted to dir and recreate it. */
+static int fresh_dir(const char *dir)
+{
+    bench_rm_tree(dir);
+    return aept_file_mkdir_hier(dir, 0755);
+}
+
+/* ── Content ─────────────────────────────────────────────────────── */
+
+#define N_WORDS 512
+
+static char words[N_WORDS][12];
+
+/* xorshift64* */
+static unsigned long long next_rand(unsigned long long *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static void init_words(void)
+{
+    unsigned long long state = 88172645463325252ULL;
+    int i, j, len;
+
+    for (i = 0; i < N_WORDS; i++) {
+        len = 2 + next_rand(&state) % 9;
+        for (j = 0; j < len; j++)
+            words[i][j] = 'a' + next_rand(&state) % 26;
+        words[i][len] = '\0';
+    }
+}
+
+/* Fill buf with lines of words from a small vocabulary, which compress
+ * about as well as the text and code of real packages. */
+static void fill_text(char *buf, size_t len, unsigned long long *state)
+{
+    size_t pos = 0;
+
+    while (pos < len) {
+        unsigned long long r = next_rand(state);
+        const char *w = words[r % N_WORDS];
+
+        while (*w && pos < len)
+            buf[pos++] = *w++;
+        if (pos < len)
+            buf[pos++] = (r >> 32) % 10 == 0 ? '\n' : ' ';
+    }
+}
+
+/* ── Shapes ──────────────────────────────────────────────────────── */
+
+/*
+ * A package holds `files` regular files of file_size bytes, named by
+ * path(), and `conffiles` files of cf_size bytes under ./etc/bench, all
+ * of which are listed as conffiles.  --scale multiplies the counts, or
+ * the file size instead for shapes of files bigger than a block.
+ */
+typedef struct {
+    const char *name;
+    int files;
+    size_t file_size;
+    void (*path)(int i, char *buf, size_t len);
+    int conffiles;
+    size_t cf_size;
+} shape_t;
+
+static void tiny_path(int i, char *buf, size_t len)
+{
+    snprintf(buf, len, "./usr/share/bench/d%03d/f%05d", i / 100, i);
+}
+
+static void huge_path(int i, char *buf, size_t len)
+{
+    snprintf(buf, len, "./usr/lib/bench/huge%d.bin", i);
+}
+
+/* Eight files per leaf of a binary tree twelve levels deep */
+static void deep_path(int i, char *buf, size_t len)
+{
+    int leaf = i / 8, pos, level;
+
+    pos = snprintf(buf, len, "./usr/share/bench");
+    for (level = 0; level < 12; level++)
+        pos += snprintf(buf + pos, len - pos, "/b%d",
+                        (leaf >> (11 - level)) & 1);
+    snprintf(buf + pos, len - pos, "/f%05d", i);
+}
+
+static void flat_path(int i, char *buf, size_t len)
+{
+    snprintf(buf, len, "./usr/share/bench/f%05d", i);
+}
+
+static void cf_path(int i, char *buf, size_t len)
+{
+    snprintf(buf, len, "./etc/bench/s%02d/c%05d", i / 50, i);
+}
+
+static const shape_t shapes[] = {
+    { "tiny",      20000, 128,             tiny_path, 4,    1024 },
+    { "huge",      4,     8 * 1024 * 1024, huge_path, 1,    1024 },
+    { "deep",      2000,  1024,            deep_path, 4,    1024 },
+    { "conffiles", 200,   1024,            flat_path, 2000, 2048 },
+};
+
+#define N_SHAPES (int)(sizeof(shapes) / sizeof(shapes[0]))
+
+static int scaled(int n)
+{
+    int r = (int)(n * opt.scale);
+
+    return r > 0 ? r : 1;
+}
+
+static int shape_files(const shape_t *sh)
+{
+    return sh->file_size >= BLOCK ? sh->files : scaled(sh->files);
+}
+
+static size_t shape_file_size(const shape_t *sh)
+{
+    return sh->file_size >= BLOCK ? (size_t)(sh->file_size * opt.scale)
+                                  : sh->file_size;
+}
+
+/* The conffiles of a package in the form of its .conffiles file */
+static void shape_conffiles(const shape_t *sh, aept_fileset_t *fs)
+{
+    char path[256];
+    int i, n = scaled(sh->conffiles);
+
+    aept_fileset_init(fs);
+    for (i = 0; i < n; i++) {
+        cf_path(i, path, sizeof(path));
+        aept_fileset_add(fs, path + 1);
+    }
+}
+
+/* ── Codecs ──────────────────────────────────────────────────────── */
+
+typedef struct {
+    const char *name;
+    const char *suffix;
+    int (*add_write)(struct archive *a);
+    int (*support_read)(struct archive *a);
+} codec_t;
+
+static const codec_t codecs[] = {
+    { "gzip",  "gz",  archive_write_add_filter_gzip,
+      archive_read_support_filter_gzip },
+    { "xz",    "xz",  archive_write_add_filter_xz,
+      archive_read_support_filter_xz },
+    { "bzip2", "bz2", archive_write_add_filter_bzip2,
+      archive_read_support_filter_bzip2 },
+    { "lz4",   "lz4", archive_write_add_filter_lz4,
+      archive_read_support_filter_lz4 },
+    { "zstd",  "zst", archive_write_add_filter_zstd,
+      archive_read_support_filter_zstd },
+};
+
+#define N_CODECS (int)(sizeof(codecs) / sizeof(codecs[0]))
+
+/* Whether libarchive handles the codec itself.  With ARCHIVE_WARN it
+ * would run an external program, which is not what is to be measured. */
+static int codec_available(const codec_t *c)
+{
+    struct archive *w = archive_write_new();
+    struct archive *r = archive_read_new();
+    int ok = c->add_write(w) == ARCHIVE_OK && c->support_read(r) == ARCHIVE_OK;
+
+    archive_write_free(w);
+    archive_read_free(r);
+    return ok;
+}
+
+/* ── Package generation ──────────────────────────────────────────── */
+
+typedef struct {
+    const shape_t *shape;
+    const codec_t *codec;
+    char *path;
+    int entries;                /* in the data tarball, directories too */
+    unsigned long long bytes;   /* of file content */
+    unsigned long long packed;  /* size of the .aep file */
+    aept_fileset_t conffiles;
+} package_t;
+
+static void write_dir_entry(struct archive *a, struct archive_entry *e,
+                            const char *path, package_t *pkg)
+{
+    archive_entry_clear(e);
+    archive_entry_set_pathname(e, path);
+    archive_entry_set_filetype(e, AE_IFDIR);
+    archive_entry_set_perm(e, 0755);
+    archive_entry_set_mtime(e, MTIME, 0);
+    archive_write_header(a, e);
+    pkg->entries++;
+}
+
+/* Write the entries of the directories of path below "./" that are not
+ * in made yet, as tar does when it walks a tree. */
+static void write_dirs(struct archive *a, struct archive_entry *e,
+                       aept_fileset_t *made, const char *path,
+                       package_t *pkg)
+{
+    char dir[256];
+    const char *slash;
+
+    for (slash = strchr(path + 2, '/'); slash;
+         slash = strchr(slash + 1, '/')) {
+        size_t len = slash - path + 1;
+
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+        if (aept_fileset_contains(made, dir))
+            continue;
+        aept_fileset_add(made, dir);
+        write_dir_entry(a, e, dir, pkg);
+    }
+}
+
+static int write_file_entry(struct archive *a, struct archive_entry *e,
+                            const char *path, size_t size, char *buf,
+                            unsigned long long *state, package_t *pkg)
+{
+    size_t done, n;
+
+    archive_entry_clear(e);
+    archive_entry_set_pathname(e, path);
+    archive_entry_set_filetype(e, AE_IFREG);
+    archive_entry_set_perm(e, 0644);
+    archive_entry_set_size(e, size);
+    archive_entry_set_mtime(e, MTIME, 0);
+    if (archive_write_header(a, e) != ARCHIVE_OK)
+        return -1;
+
+    for (done = 0; done < size; done += n) {
+        n = size - done < BLOCK ? size - done : BLOCK;
+        fill_text(buf, n, state);
+        if (archive_write_data(a, buf, n) != (la_ssize_t)n)
+            return -1;
+    }
+
+    pkg->entries++;
+    pkg->bytes += size;
+    return 0;
+}
+
+/* Write the data tarball of pkg to path. */
+static int write_data_tar(package_t *pkg, const char *path)
+{
+    const shape_t *sh = pkg->shape;
+    struct archive *a = archive_write_new();
+    struct archive_entry *e = archive_entry_new();
+    unsigned long long state = 0x9e3779b97f4a7c15ULL;
+    char *buf = aept_malloc(BLOCK);
+    char name[256];
+    aept_fileset_t made;
+    int i, n, r = -1;
+
+    aept_fileset_init(&made);
+    archive_write_set_format_ustar(a);
+    pkg->codec->add_write(a);
+    if (archive_write_open_filename(a, path) != ARCHIVE_OK) {
+        fprintf(stderr, "aept-archive-bench: %s: %s\n", path,
+                archive_error_string(a));
+        goto cleanup;
+    }
+
+    write_dir_entry(a, e, "./", pkg);
+
+    n = scaled(sh->conffiles);
+    for (i = 0; i < n; i++) {
+        cf_path(i, name, sizeof(name));
+        write_dirs(a, e, &made, name, pkg);
+        if (write_file_entry(a, e, name, sh->cf_size, buf, &state, pkg) < 0)
+            goto cleanup;
+    }
+
+    n = shape_files(sh);
+    for (i = 0; i < n; i++) {
+        sh->path(i, name, sizeof(name));
+        write_dirs(a, e, &made, name, pkg);
+        if (write_file_entry(a, e, name, shape_file_size(sh), buf, &state,
+                             pkg) < 0)
+            goto cleanup;
+    }
+
+    if (archive_write_close(a) == ARCHIVE_OK)
+        r = 0;
+
+cleanup:
+    if (r < 0)
+        fprintf(stderr, "aept-archive-bench: writing %s failed: %s\n", path,
+                archive_error_string(a));
+    archive_write_free(a);
+    archive_entry_free(e);
+    aept_fileset_free(&made);
+    free(buf);
+    return r;
+}
+
+static int append_ar_header(FILE *fp, const char *name, size_t size)
+{
+    char hdr[BENCH_AR_HEADER_SIZE + 1];
+
+    bench_ar_header(hdr, name, size);
+    return fwrite(hdr, 1, BENCH_AR_HEADER_SIZE, fp) == BENCH_AR_HEADER_SIZE ?
+        0 : -1;
+}
+
+static int append_ar_member(FILE *fp, const char *name, const void *data,
+                            size_t size)
+{
+    if (append_ar_header(fp, name, size) < 0 ||
+            fwrite(data, 1, size, fp) != size)
+        return -1;
+    return size % 2 ? (fputc('\n', fp) == EOF ? -1 : 0) : 0;
+}
+
+static int append_ar_file(FILE *fp, const char *name, const char *path)
+{
+    FILE *in = fopen(path, "r");
+    char *buf = aept_malloc(BLOCK);
+    struct stat st;
+    size_t n;
+    int r = -1;
+
+    if (!in || fstat(fileno(in), &st) < 0 ||
+            append_ar_header(fp, name, st.st_size) < 0)
+        goto cleanup;
+
+    while ((n = fread(buf, 1, BLOCK, in)) > 0) {
+        if (fwrite(buf, 1, n, fp) != n)
+            goto cleanup;
+    }
+    if (ferror(in))
+        goto cleanup;
+    if (st.st_size % 2 && fputc('\n', fp) == EOF)
+        goto cleanup;
+    r = 0;
+
+cleanup:
+    if (in)
+        fclose(in);
+    free(buf);
+    return r;
+}
+
+/* Gzipped tar holding a control file */
+static void *control_tar(const char *shape, size_t *len_out)
+{
+    struct archive *a = archive_write_new();
+    struct archive_entry *e = archive_entry_new();
+    size_t cap = 4096, used = 0;
+    void *buf = aept_malloc(cap);
+    char *control = NULL;
+
+    aept_asprintf(&control,
+        "Package: bench-%s\n"
+        "Version: 1.0\n"
+        "Architecture: all\n"
+        "Description: synthetic %s package\n",
+        shape, shape);
+
+    archive_write_set_format_ustar(a);
+    archive_write_add_filter_gzip(a);
+    archive_write_open_memory(a, buf, cap, &used);
+
+    archive_entry_set_pathname(e, "./control");
+    archive_entry_set_filetype(e, AE_IFREG);
+    archive_entry_set_perm(e, 0644);
+    archive_entry_set_size(e, strlen(control));
+    archive_entry_set_mtime(e, MTIME, 0);
+    archive_write_header(a, e);
+    archive_write_data(a, control, strlen(control));
+
+    archive_write_close(a);
+    archive_write_free(a);
+    archive_entry_free(e);
+    free(control);
+
+    *len_out = used;
+    return buf;
+}
+
+static int package_create(package_t *pkg, const shape_t *sh,
+                          const codec_t *c)
+{
+    char *tar = NULL, *member = NULL;
+    void *ctrl = NULL;
+    size_t ctrl_len;
+    struct stat st;
+    double t0 = bench_now();
+    FILE *fp = NULL;
+    int r = -1;
+
+    memset(pkg, 0, sizeof(*pkg));
+    pkg->shape = sh;
+    pkg->codec = c;
+    shape_conffiles(sh, &pkg->conffiles);
+    aept_asprintf(&pkg->path, "%s/%s-%s.aep", opt.workdir, sh->name,
+                  c->name);
+    aept_asprintf(&tar, "%s/data.tar.%s", opt.workdir, c->suffix);
+    aept_asprintf(&member, "data.tar.%s", c->suffix);
+
+    fprintf(stderr, "aept-archive-bench: generating %s\n", pkg->path);
+
+    if (write_data_tar(pkg, tar) < 0)
+        goto cleanup;
+
+    fp = fopen(pkg->path, "w");
+    if (!fp) {
+        fprintf(stderr, "aept-archive-bench: %s: %s\n", pkg->path,
+                strerror(errno));
+        goto cleanup;
+    }
+
+    ctrl = control_tar(sh->name, &ctrl_len);
+    if (fputs("!<arch>\n", fp) == EOF ||
+            append_ar_member(fp, "debian-binary", "2.0\n", 4) < 0 ||
+            append_ar_member(fp, "control.tar.gz", ctrl, ctrl_len) < 0 ||
+            append_ar_file(fp, member, tar) < 0) {
+        fprintf(stderr, "aept-archive-bench: writing %s failed\n",
+                pkg->path);
+        goto cleanup;
+    }
+
+    if (fclose(fp) != 0 || stat(pkg->path, &st) < 0) {
+        fp = NULL;
+        goto cleanup;
+    }
+    fp = NULL;
+    pkg->packed = st.st_size;
+
+    fprintf(stderr, "aept-archive-bench: generated in %.1fs\n", bench_now() - t0);
+    r = 0;
+
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (tar)
+        unlink(tar);
+    free(tar);
+    free(member);
+    free(ctrl);
+    return r;
+}
+
+static void package_free(package_t *pkg)
+{
+    if (!opt.keep && pkg->path)
+        unlink(pkg->path);
+    free(pkg->path);
+    aept_fileset_free(&pkg->conffiles);
+}
+
+/* ── Benchmarks ──────────────────────────────────────────────────── */
+
+/* Each benchmark prepares its own state, calls count_begin() and
+ * count_end() around the measured part, stores its duration in
+ * *elapsed, and returns 0 or -1. */
+typedef int (*bench_fn)(package_t *pkg, const char *dest, double *elapsed);
+
+static int bench_list_data_paths(package_t *pkg, const char *dest,
+                                 double *elapsed)
+{
+    aept_ar_file_list_t fl;
+    double t0;
+    int r;
+
+    (void)dest;
+    aept_ar_file_list_init(&fl);
+
+    count_begin();
+    t0 = bench_now();
+    r = aept_ar_list_data_paths(pkg->path, 1, opt.threads, &fl);
+    *elapsed = bench_now() - t0;
+    count_end();
+
+    aept_ar_file_list_free(&fl);
+    return r;
+}
+
+static int extract_all(package_t *pkg, const char *dest, double *elapsed,
+                       int record)
+{
+    aept_ar_file_list_t recorded;
+    unsigned long size = 0;
+    struct aept_ar *ar;
+    double t0;
+    int r = -1;
+
+    if (fresh_dir(dest) < 0)
+        return -1;
+    aept_ar_file_list_init(&recorded);
+
+    count_begin();
+    t0 = bench_now();
+    ar = aept_ar_open_pkg_data_archive(pkg->path, 1, opt.threads);
+    if (ar) {
+        r = aept_ar_extract_all(ar, dest, &size, &pkg->conffiles,
+                                ".aept-new", record ? &recorded : NULL,
+                                NULL);
+        aept_ar_close(ar);
+    }
+    *elapsed = bench_now() - t0;
+    count_end();
+
+    aept_ar_file_list_free(&recorded);
+    return r;
+}
+
+static int bench_extract_all(package_t *pkg, const char *dest,
+                             double *elapsed)
+{
+    return extract_all(pkg, dest, elapsed, 0);
+}
+
+static int bench_extract_all_recorded(package_t *pkg, const char *dest,
+                                      double *elapsed)
+{
+    return extract_all(pkg, dest, elapsed, 1);
+}
+
+/* Extract the conffiles only, as done for ones that were missing */
+static int bench_extract_selected(package_t *pkg, const char *dest,
+                                  double *elapsed)
+{
+    struct aept_ar *ar;
+    double t0;
+    int r = -1;
+
+    if (fresh_dir(dest) < 0)
+        return -1;
+
+    count_begin();
+    t0 = bench_now();
+    ar = aept_ar_open_pkg_data_archive(pkg->path, 1, opt.threads);
+    if (ar) {
+        r = aept_ar_extract_selected(ar, &pkg->conffiles, dest);
+        aept_ar_close(ar);
+    }
+    *elapsed = bench_now() - t0;
+    count_end();
+
+    return r;
+}
+
+static const struct {
+    const char *name;
+    bench_fn fn;
+} benchmarks[] = {
+    { "list_data_paths",      bench_list_data_paths },
+    { "extract_all",          bench_extract_all },
+    { "extract_all_recorded", bench_extract_all_recorded },
+    { "extract_selected",     bench_extract_selected },
+};
+
+#define N_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* Throughput is that of the whole package at the median time, also for
+ * extract_selected, which has to decompress all of it too. */
+static int run_benchmark(package_t *pkg, const char *dest, int b)
+{
+    double *t = aept_malloc(opt.runs * sizeof(*t));
+    unsigned long long *allocs = aept_malloc(opt.runs * sizeof(*allocs));
+    unsigned long long *bytes = aept_malloc(opt.runs * sizeof(*bytes));
+    bench_times_t times;
+    int i, r = -1;
+
+    for (i = 0; i < opt.runs; i++) {
+        if (benchmarks[b].fn(pkg, dest, &t[i]) < 0) {
+            fprintf(stderr, "aept-archive-bench: %s failed on %s\n",
+                    benchmarks[b].name, pkg->path);
+            goto cleanup;
+        }
+        allocs[i] = n_allocs;
+        bytes[i] = alloc_bytes;
+    }
+
+    bench_times(t, opt.runs, &times);
+    qsort(allocs, opt.runs, sizeof(*allocs), bench_cmp_ull);
+    qsort(bytes, opt.runs, sizeof(*bytes), bench_cmp_ull);
+
+    printf("{\"benchmark\":\"%s\",\"codec\":\"%s\",\"shape\":\"%s\","
+           "\"entries\":%d,\"bytes\":%llu,\"packed\":%llu,",
+           benchmarks[b].name, pkg->codec->name, pkg->shape->name,
+           pkg->entries, pkg->bytes, pkg->packed);
+    bench_print_times(&times);
+    printf(",\"mb_per_s\":%.2f,\"entries_per_s\":%.0f,"
+           "\"allocs\":%llu,\"alloc_bytes\":%llu}\n",
+           times.median > 0 ? pkg->bytes / times.median / 1e6 : 0.0,
+           times.median > 0 ? pkg->entries / times.median : 0.0,
+           allocs[opt.runs / 2], bytes[opt.runs / 2]);
+    fflush(stdout);
+    r = 0;
+
+cleanup:
+    free(t);
+    free(allocs);
+    free(bytes);
+    return r;
+}
+
+/* ── Main ────────────────────────────────────────────────────────── */
+
+static void usage(FILE *out)
+{
+    int i;
+
+    fprintf(out,
+        "Usage: aept-archive-bench [options] [benchmark...]\n"
+        "\n"
+        "Options:\n"
+        "  -c, --codecs=NAME,... Codecs of the data tarball (default: all\n"
+        "                        libarchive supports itself)\n"
+        "  -p, --shapes=NAME,... Package shapes (default: all)\n"
+        "  -r, --runs=N          Runs per benchmark (default %d)\n"
+        "  -x, --scale=F         Multiply the file counts and the size of\n"
+        "                        huge files by F (default %g)\n"
+        "  -t, --threads=N       xz decoder threads, 0 for one per CPU\n"
+        "                        (default %d)\n"
+        "  -w, --workdir=DIR     Where to generate packages and extract\n"
+        "                        them (default: a new directory under "
+        "$TMPDIR)\n"
+        "  -k, --keep            Keep the generated packages\n"
+        "  -h, --help            Show this help\n"
+        "\n"
+        "Benchmarks:\n",
+        opt.runs, opt.scale, opt.threads);
+    for (i = 0; i < N_BENCHMARKS; i++)
+        fprintf(out, "  %s\n", benchmarks[i].name);
+    fprintf(out, "\nCodecs:\n");
+    for (i = 0; i < N_CODECS; i++)
+        fprintf(out, "  %s%s\n", codecs[i].name,
+                codec_available(&codecs[i]) ? "" : " (not available)");
+    fprintf(out, "\nShapes:\n");
+    for (i = 0; i < N_SHAPES; i++)
+        fprintf(out, "  %s\n", shapes[i].name);
+}
+
+/* Mark the names of list in selected, all of them if list is NULL.
+ * Returns 0, or -1 if a name is unknown. */
+static int select_names(const char *list, const char *what,
+                        const char *(*name)(int i), int n, int *selected)
+{
+    char *copy, *tok, *save = NULL;
+    int i, r = 0;
+
+    for (i = 0; i < n; i++)
+        selected[i] = list == NULL;
+    if (!list)
+        return 0;
+
+    copy = aept_strdup(list);
+    for (tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < n; i++)
+            if (strcmp(tok, name(i)) == 0)
+                break;
+        if (i == n) {
+            fprintf(stderr, "aept-archive-bench: unknown %s '%s'\n",
+                    what, tok);
+            r = -1;
+            break;
+        }
+        selected[i] = 1;
+    }
+    free(copy);
+    return r;
+}
+
+static const char *codec_name(int i)
+{
+    return codecs[i].name;
+}
+
+static const char *shape_name(int i)
+{
+    return shapes[i].name;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "codecs",  required_argument, NULL, 'c' },
+        { "shapes",  required_argument, NULL, 'p' },
+        { "runs",    required_argument, NULL, 'r' },
+        { "scale",   required_argument, NULL, 'x' },
+        { "threads", required_argument, NULL, 't' },
+        { "workdir", required_argument, NULL, 'w' },
+        { "keep",    no_argument,       NULL, 'k' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *codec_list = NULL, *shape_list = NULL;
+    int sel_codec[N_CODECS], sel_shape[N_SHAPES], selected[N_BENCHMARKS];
+    int c, b, i, s, made_workdir = 0, rc = 0;
+    char *dest = NULL;
+    aept_ctx_t *ctx;
+
+    while ((c = getopt_long(argc, argv, "c:p:r:x:t:w:kh", long_opts,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'c': codec_list = optarg; break;
+        case 'p': shape_list = optarg; break;
+        case 'r': opt.runs = atoi(optarg); break;
+        case 'x': opt.scale = atof(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'w': opt.workdir = aept_strdup(optarg); break;
+        case 'k': opt.keep = 1; break;
+        case 'h': usage(stdout); return 0;
+        default:  usage(stderr); return 2;
+        }
+    }
+
+    if (opt.runs < 1 || opt.scale <= 0 || opt.threads < 0) {
+        usage(stderr);
+        return 2;
+    }
+
+    if (select_names(codec_list, "codec", codec_name, N_CODECS,
+                     sel_codec) < 0 ||
+            select_names(shape_list, "shape", shape_name, N_SHAPES,
+                         sel_shape) < 0)
+        return 2;
+
+    for (b = 0; b < N_BENCHMARKS; b++)
+        selected[b] = optind == argc;
+    for (i = optind; i < argc; i++) {
+        for (b = 0; b < N_BENCHMARKS; b++)
+            if (strcmp(argv[i], benchmarks[b].name) == 0)
+                break;
+        if (b == N_BENCHMARKS) {
+            fprintf(stderr, "aept-archive-bench: unknown benchmark '%s'\n",
+                    argv[i]);
+            return 2;
+        }
+        selected[b] = 1;
+    }
+
+    for (i = 0; i < N_CODECS; i++) {
+        if (sel_codec[i] && !codec_available(&codecs[i])) {
+            if (codec_list)
+                fprintf(stderr, "aept-archive-bench: libarchive cannot "
+                        "handle %s by itself, skipping it\n",
+                        codecs[i].name);
+            sel_codec[i] = 0;
+        }
+    }
+
+    if (!opt.workdir) {
+        const char *tmp = getenv("TMPDIR");
+
+        aept_asprintf(&opt.workdir, "%s/aept-archive-bench.XXXXXX",
+                      tmp ? tmp : "/tmp");
+        if (!mkdtemp(opt.workdir)) {
+            fprintf(stderr, "aept-archive-bench: %s: %s\n", opt.workdir,
+                    strerror(errno));
+            return 1;
+        }
+        made_workdir = 1;
+    } else if (aept_file_mkdir_hier(opt.workdir, 0755) < 0) {
+        fprintf(stderr, "aept-archive-bench: cannot create %s\n",
+                opt.workdir);
+        return 1;
+    }
+    aept_asprintf(&dest, "%s/root", opt.workdir);
+
+    /* For the log of archive.c */
+    ctx = aept_init();
+    aept_set_log_fn(ctx, bench_quiet_log, "aept-archive-bench");
+    init_words();
+
+    for (s = 0; s < N_SHAPES && rc == 0; s++) {
+        for (i = 0; i < N_CODECS && rc == 0; i++) {
+            package_t pkg;
+
+            if (!sel_shape[s] || !sel_codec[i])
+                continue;
+
+            if (package_create(&pkg, &shapes[s], &codecs[i]) < 0) {
+                fprintf(stderr, "aept-archive-bench: cannot generate "
+                        "package\n");
+                rc = 1;
+            }
+
+            for (b = 0; b < N_BENCHMARKS && rc == 0; b++)
+                if (selected[b] && run_benchmark(&pkg, dest, b) < 0)
+                    rc = 1;
+
+            package_free(&pkg);
+        }
+    }
+
+    bench_rm_tree(dest);
+    free(dest);
+    aept_cleanup(ctx);
+
+    if (made_workdir && !opt.keep)
+        rmdir(opt.workdir);
+    free(opt.workdir);
+    return rc;
+}
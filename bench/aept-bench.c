@@ -0,0 +1,769 @@
+/* aept-bench.c - benchmarks on synthetic repositories and databases
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * For each size N, a fixture is generated under the work directory:
+ * a Packages list of N entries (pkgI depends on pkg((I-1)/2)), an
+ * installed database holding the first N/2 of them with their .control
+ * and .list files, and real .aep files for the packages the install
+ * benchmark needs.  Every benchmark is then run a number of times and
+ * reported as one JSON object per line on stdout, so that results can
+ * be compared mechanically.  Progress and errors go to stderr.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <solv/chksum.h>
+#include <solv/knownid.h>
+
+#include "aept/aept.h"
+#include "aept/internal.h"
+#include "aept/owner_index.h"
+#include "aept/solver.h"
+#include "aept/status.h"
+#include "aept/util.h"
+
+#include "bench-common.h"
+
+#define VERSION "1.0"
+
+/* Packages resolved by the solver benchmark */
+#define RESOLVE_COUNT 100
+
+static const char *default_sizes = "1000,10000,100000";
+
+static struct {
+    int runs;
+    int files;            /* data files per package */
+    int install_count;    /* packages installed by the install benchmark */
+    int keep;
+    char *workdir;
+} opt = { 5, 8, 200, 0, NULL };
+
+typedef struct {
+    int size;
+    char *dir;
+    char *root;           /* offline root with the installed database */
+    char *pool;           /* generated .aep files */
+} fixture_t;
+
+/* ── Helpers ─────────────────────────────────────────────────────── */
+
+static void quiet_display(const aept_transaction_t *txn, void *userdata)
+{
+    (void)txn;
+    (void)userdata;
+}
+
+static int always_confirm(void *userdata)
+{
+    (void)userdata;
+    return 1;
+}
+
+static int write_file(const char *path, const void *data, size_t len)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "aept-bench: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fwrite(data, 1, len, fp) != len || fclose(fp) != 0) {
+        fprintf(stderr, "aept-bench: writing %s failed\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Write the configuration of an offline root and create its directories. */
+static int make_root(const char *root)
+{
+    static const char *dirs[] = {
+        "/etc/aept", "/var/lib/aept/info", "/var/lib/aept/lists",
+        "/var/cache/aept",
+    };
+    static const char conf[] =
+        "src/gz bench http://127.0.0.1:9\n"
+        "arch all\n"
+        "option check_signature 0\n"
+        "option ignore_uid 1\n"
+        "option durability none\n";
+    char *path = NULL;
+    size_t i;
+    int r;
+
+    for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        aept_asprintf(&path, "%s%s", root, dirs[i]);
+        r = aept_file_mkdir_hier(path, 0755);
+        free(path);
+        if (r < 0)
+            return -1;
+    }
+
+    aept_asprintf(&path, "%s/etc/aept/aept.conf", root);
+    r = write_file(path, conf, sizeof(conf) - 1);
+    free(path);
+    return r;
+}
+
+static aept_ctx_t *open_ctx(const char *root)
+{
+    aept_ctx_t *ctx = aept_init();
+    char *conf = NULL;
+
+    aept_set_log_fn(ctx, bench_quiet_log, "aept-bench");
+    aept_set_display_fn(ctx, quiet_display, NULL);
+    aept_set_confirm_fn(ctx, always_confirm, NULL);
+    aept_set_offline_root(ctx, root);
+
+    aept_asprintf(&conf, "%s/etc/aept/aept.conf", root);
+    if (aept_load_config(ctx, conf) < 0) {
+        free(conf);
+        aept_cleanup(ctx);
+        return NULL;
+    }
+    free(conf);
+
+    aept_set_flag(ctx, AEPT_FLAG_NON_INTERACTIVE, 1);
+    return ctx;
+}
+
+/* ── Fixture generation ──────────────────────────────────────────── */
+
+static void append_ar_member(char **buf, size_t *len, const char *name,
+                             const void *data, size_t size)
+{
+    char hdr[BENCH_AR_HEADER_SIZE + 1];
+
+    bench_ar_header(hdr, name, size);
+
+    *buf = aept_realloc(*buf, *len + BENCH_AR_HEADER_SIZE + size + 1);
+    memcpy(*buf + *len, hdr, BENCH_AR_HEADER_SIZE);
+    memcpy(*buf + *len + BENCH_AR_HEADER_SIZE, data, size);
+    *len += BENCH_AR_HEADER_SIZE + size;
+    if (size % 2)
+        (*buf)[(*len)++] = '\n';
+}
+
+/* Gzipped tar of count members; a NULL data entry is a directory. */
+static void *tar_gz(const char **names, const char **data, int count,
+                    size_t *len_out)
+{
+    struct archive *a = archive_write_new();
+    struct archive_entry *e = archive_entry_new();
+    size_t cap = 4096, used = 0;
+    void *buf;
+    int i;
+
+    for (i = 0; i < count; i++)
+        cap += 1024 + (data[i] ? strlen(data[i]) : 0);
+    buf = aept_malloc(cap);
+
+    archive_write_set_format_ustar(a);
+    archive_write_add_filter_gzip(a);
+    archive_write_open_memory(a, buf, cap, &used);
+
+    for (i = 0; i < count; i++) {
+        archive_entry_clear(e);
+        archive_entry_set_pathname(e, names[i]);
+        archive_entry_set_mtime(e, 1700000000, 0);
+        if (data[i]) {
+            archive_entry_set_filetype(e, AE_IFREG);
+            archive_entry_set_perm(e, 0644);
+            archive_entry_set_size(e, strlen(data[i]));
+            archive_write_header(a, e);
+            archive_write_data(a, data[i], strlen(data[i]));
+        } else {
+            archive_entry_set_filetype(e, AE_IFDIR);
+            archive_entry_set_perm(e, 0755);
+            archive_write_header(a, e);
+        }
+    }
+
+    archive_write_close(a);
+    archive_write_free(a);
+    archive_entry_free(e);
+
+    *len_out = used;
+    return buf;
+}
+
+static char *control_stanza(int i)
+{
+    char *s = NULL, *deps = NULL;
+
+    if (i > 0)
+        aept_asprintf(&deps, "Depends: pkg%d\n", (i - 1) / 2);
+
+    aept_asprintf(&s,
+        "Package: pkg%d\n"
+        "Version: " VERSION "\n"
+        "Architecture: all\n"
+        "%s"
+        "Installed-Size: %d\n"
+        "Description: synthetic package %d\n",
+        i, deps ? deps : "", opt.files, i);
+    free(deps);
+    return s;
+}
+
+/* Write pkgI as an .aep file to path and return its SHA-256 as hex. */
+static char *make_aep(int i, const char *path, size_t *size_out)
+{
+    int n = 3 + opt.files;
+    const char **names = aept_malloc(n * sizeof(*names));
+    const char **data = aept_malloc(n * sizeof(*data));
+    char **owned = aept_malloc(n * sizeof(*owned));
+    const char *cname = "./control";
+    char *control = control_stanza(i);
+    char *ar = NULL, *hex = NULL;
+    size_t ar_len = 0, len;
+    void *tgz;
+    const unsigned char *digest;
+    Chksum *chk;
+    int j, k = 0, digest_len;
+
+    memset(owned, 0, n * sizeof(*owned));
+    names[k] = "./usr/"; data[k++] = NULL;
+    names[k] = "./usr/share/"; data[k++] = NULL;
+    aept_asprintf(&owned[k], "./usr/share/pkg%d/", i);
+    names[k] = owned[k]; data[k++] = NULL;
+    for (j = 0; j < opt.files; j++) {
+        aept_asprintf(&owned[k], "./usr/share/pkg%d/f%d", i, j);
+        names[k] = owned[k];
+        data[k] = owned[k];
+        k++;
+    }
+
+    ar = aept_strdup("!<arch>\n");
+    ar_len = strlen(ar);
+    append_ar_member(&ar, &ar_len, "debian-binary", "2.0\n", 4);
+
+    tgz = tar_gz(&cname, (const char **)&control, 1, &len);
+    append_ar_member(&ar, &ar_len, "control.tar.gz", tgz, len);
+    free(tgz);
+
+    tgz = tar_gz(names, data, n, &len);
+    append_ar_member(&ar, &ar_len, "data.tar.gz", tgz, len);
+    free(tgz);
+
+    if (write_file(path, ar, ar_len) == 0) {
+        chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+        solv_chksum_add(chk, ar, ar_len);
+        digest = solv_chksum_get(chk, &digest_len);
+        hex = aept_malloc(2 * digest_len + 1);
+        for (j = 0; j < digest_len; j++)
+            sprintf(hex + 2 * j, "%02x", digest[j]);
+        solv_chksum_free(chk, NULL);
+        *size_out = ar_len;
+    }
+
+    for (j = 0; j < n; j++)
+        free(owned[j]);
+    free(owned);
+    free(names);
+    free(data);
+    free(control);
+    free(ar);
+    return hex;
+}
+
+static int write_installed(const fixture_t *fx, int i)
+{
+    char *path = NULL, *stanza = control_stanza(i), *s = NULL;
+    FILE *fp;
+    int j, r;
+
+    aept_asprintf(&path, "%s/var/lib/aept/info/pkg%d.control", fx->root, i);
+    aept_asprintf(&s, "%sStatus: install ok installed\n", stanza);
+    r = write_file(path, s, strlen(s));
+    free(path);
+    free(stanza);
+    free(s);
+    if (r < 0)
+        return -1;
+
+    aept_asprintf(&path, "%s/var/lib/aept/info/pkg%d.list", fx->root, i);
+    fp = fopen(path, "w");
+    free(path);
+    if (!fp)
+        return -1;
+
+    fprintf(fp, "./usr/\t040755\n./usr/share/\t040755\n"
+                "./usr/share/pkg%d/\t040755\n", i);
+    for (j = 0; j < opt.files; j++)
+        fprintf(fp, "./usr/share/pkg%d/f%d\t0100644\n", i, j);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int fixture_create(fixture_t *fx, int size)
+{
+    char *path = NULL;
+    FILE *fp;
+    int i, n_aep = opt.install_count < size ? opt.install_count : size;
+    double t0 = bench_now();
+
+    memset(fx, 0, sizeof(*fx));
+    fx->size = size;
+    aept_asprintf(&fx->dir, "%s/%d", opt.workdir, size);
+    aept_asprintf(&fx->root, "%s/root", fx->dir);
+    aept_asprintf(&fx->pool, "%s/pool", fx->dir);
+
+    bench_rm_tree(fx->dir);
+    if (make_root(fx->root) < 0 || aept_file_mkdir_hier(fx->pool, 0755) < 0)
+        return -1;
+
+    fprintf(stderr, "aept-bench: generating %d packages in %s\n",
+            size, fx->dir);
+
+    aept_asprintf(&path, "%s/var/lib/aept/lists/bench", fx->root);
+    fp = fopen(path, "w");
+    free(path);
+    if (!fp)
+        return -1;
+
+    for (i = 0; i < size; i++) {
+        char *stanza = control_stanza(i);
+        char *hex = NULL;
+        size_t aep_size = 0;
+
+        if (i < n_aep) {
+            aept_asprintf(&path, "%s/pkg%d_" VERSION "_all.aep", fx->pool, i);
+            hex = make_aep(i, path, &aep_size);
+            free(path);
+            if (!hex) {
+                free(stanza);
+                fclose(fp);
+                return -1;
+            }
+        }
+
+        fprintf(fp, "%sFilename: pkg%d_" VERSION "_all.aep\n"
+                    "Size: %zu\nSHA256sum: %s\n\n",
+                stanza, i, aep_size,
+                hex ? hex : "0000000000000000000000000000000000000000"
+                            "000000000000000000000000");
+        free(stanza);
+        free(hex);
+
+        if (i < size / 2 && write_installed(fx, i) < 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    if (fclose(fp) != 0)
+        return -1;
+
+    fprintf(stderr, "aept-bench: generated in %.1fs\n", bench_now() - t0);
+    return 0;
+}
+
+static void fixture_free(fixture_t *fx)
+{
+    if (!opt.keep && fx->dir)
+        bench_rm_tree(fx->dir);
+    free(fx->dir);
+    free(fx->root);
+    free(fx->pool);
+}
+
+/* ── Benchmarks ──────────────────────────────────────────────────── */
+
+/* Each benchmark prepares its own state, stores the duration of the
+ * measured part in *elapsed, and returns 0 or -1. */
+typedef int (*bench_fn)(fixture_t *fx, double *elapsed);
+
+static int load_status(fixture_t *fx, double *elapsed, int snapshot)
+{
+    aept_ctx_t *ctx = open_ctx(fx->root);
+    char *solv = NULL;
+    double t0;
+    int r = -1;
+
+    if (!ctx)
+        return -1;
+
+    aept_asprintf(&solv, "%s.solv", ctx->config.info_dir);
+    if (!snapshot)
+        unlink(solv);
+    else if (!aept_file_exists(solv)) {
+        /* Loading once writes the snapshot */
+        if (aept_solver_init(ctx) < 0 || aept_status_load(ctx) < 0)
+            goto cleanup;
+        aept_solver_fini(ctx);
+    }
+
+    if (aept_solver_init(ctx) < 0)
+        goto cleanup;
+
+    t0 = bench_now();
+    r = aept_status_load(ctx);
+    *elapsed = bench_now() - t0;
+
+cleanup:
+    aept_solver_fini(ctx);
+    aept_cleanup(ctx);
+    free(solv);
+    return r;
+}
+
+static int bench_status_load(fixture_t *fx, double *elapsed)
+{
+    return load_status(fx, elapsed, 0);
+}
+
+static int bench_status_load_snapshot(fixture_t *fx, double *elapsed)
+{
+    return load_status(fx, elapsed, 1);
+}
+
+static int bench_owner_index_build(fixture_t *fx, double *elapsed)
+{
+    aept_ctx_t *ctx = open_ctx(fx->root);
+    aept_owner_index_t idx;
+    double t0;
+    int r;
+
+    if (!ctx)
+        return -1;
+
+    aept_owner_index_init(&idx);
+    t0 = bench_now();
+    r = aept_owner_index_build(ctx, &idx);
+    *elapsed = bench_now() - t0;
+
+    aept_owner_index_free(&idx);
+    aept_cleanup(ctx);
+    return r;
+}
+
+static int bench_solver_resolve_install(fixture_t *fx, double *elapsed)
+{
+    aept_ctx_t *ctx = open_ctx(fx->root);
+    const char **names = NULL;
+    char **owned = NULL;
+    char *list = NULL, *cache = NULL;
+    int i, count = 0, first = fx->size - fx->size / 2;
+    double t0;
+    FILE *fp;
+    int r = -1;
+
+    if (!ctx)
+        return -1;
+
+    /* Packages from the end of the list, none of them installed */
+    count = first < RESOLVE_COUNT ? first : RESOLVE_COUNT;
+    names = aept_malloc(count * sizeof(*names));
+    owned = aept_malloc(count * sizeof(*owned));
+    for (i = 0; i < count; i++) {
+        aept_asprintf(&owned[i], "pkg%d", fx->size - 1 - i);
+        names[i] = owned[i];
+    }
+
+    aept_asprintf(&list, "%s/bench", ctx->config.lists_dir);
+    aept_asprintf(&cache, "%s.solv", list);
+
+    if (aept_solver_init(ctx) < 0 || aept_status_load(ctx) < 0)
+        goto cleanup;
+
+    fp = fopen(list, "r");
+    if (!fp)
+        goto cleanup;
+    r = aept_solver_load_repo(ctx, "bench", fp, cache, 0);
+    fclose(fp);
+    if (r < 0)
+        goto cleanup;
+
+    t0 = bench_now();
+    r = aept_solver_resolve_install(ctx, names, count, NULL, 0);
+    *elapsed = bench_now() - t0;
+
+cleanup:
+    aept_solver_fini(ctx);
+    aept_cleanup(ctx);
+    for (i = 0; i < count; i++)
+        free(owned[i]);
+    free(owned);
+    free(names);
+    free(list);
+    free(cache);
+    return r;
+}
+
+static int bench_list(fixture_t *fx, double *elapsed)
+{
+    aept_ctx_t *ctx = open_ctx(fx->root);
+    aept_pkg_list_t list;
+    double t0;
+    int r;
+
+    if (!ctx)
+        return -1;
+
+    t0 = bench_now();
+    r = aept_list(ctx, NULL, 0, 0, &list);
+    *elapsed = bench_now() - t0;
+
+    if (r == 0)
+        aept_pkg_list_free(&list);
+    aept_cleanup(ctx);
+    return r;
+}
+
+static int bench_owns(fixture_t *fx, double *elapsed)
+{
+    aept_ctx_t *ctx = open_ctx(fx->root);
+    char *path = NULL;
+    char **owners = NULL;
+    double t0;
+    int i, count = 0, r;
+
+    if (!ctx)
+        return -1;
+
+    aept_asprintf(&path, "/usr/share/pkg%d/f0", fx->size / 4);
+
+    t0 = bench_now();
+    r = aept_owns(ctx, path, &owners, &count);
+    *elapsed = bench_now() - t0;
+
+    for (i = 0; i < count; i++)
+        free(owners[i]);
+    free(owners);
+    free(path);
+    aept_cleanup(ctx);
+    return r;
+}
+
+/* Install pkg0..pkgM-1 into an empty offline root, with the packages
+ * already in the cache so that nothing is fetched. */
+static int bench_install(fixture_t *fx, double *elapsed)
+{
+    int i, count = opt.install_count < fx->size ? opt.install_count
+                                                : fx->size;
+    const char **names = aept_malloc(count * sizeof(*names));
+    char **owned = aept_malloc(count * sizeof(*owned));
+    char *root = NULL, *src = NULL, *dst = NULL;
+    aept_ctx_t *ctx = NULL;
+    double t0;
+    int r = -1;
+
+    memset(owned, 0, count * sizeof(*owned));
+    aept_asprintf(&root, "%s/install", fx->dir);
+    bench_rm_tree(root);
+    if (make_root(root) < 0)
+        goto cleanup;
+
+    aept_asprintf(&src, "%s/var/lib/aept/lists/bench", fx->root);
+    aept_asprintf(&dst, "%s/var/lib/aept/lists/bench", root);
+    r = aept_file_copy(src, dst);
+    free(src);
+    free(dst);
+    if (r < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        aept_asprintf(&owned[i], "pkg%d", i);
+        names[i] = owned[i];
+
+        aept_asprintf(&src, "%s/pkg%d_" VERSION "_all.aep", fx->pool, i);
+        aept_asprintf(&dst, "%s/var/cache/aept/pkg%d_" VERSION "_all.aep",
+                      root, i);
+        r = link(src, dst) == 0 ? 0 : aept_file_copy(src, dst);
+        free(src);
+        free(dst);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    ctx = open_ctx(root);
+    if (!ctx) {
+        r = -1;
+        goto cleanup;
+    }
+
+    t0 = bench_now();
+    r = aept_install(ctx, names, count, NULL, 0);
+    *elapsed = bench_now() - t0;
+
+cleanup:
+    if (ctx)
+        aept_cleanup(ctx);
+    bench_rm_tree(root);
+    for (i = 0; i < count; i++)
+        free(owned[i]);
+    free(owned);
+    free(names);
+    free(root);
+    return r;
+}
+
+static const struct {
+    const char *name;
+    bench_fn fn;
+} benchmarks[] = {
+    { "status_load",            bench_status_load },
+    { "status_load_snapshot",   bench_status_load_snapshot },
+    { "owner_index_build",      bench_owner_index_build },
+    { "solver_resolve_install", bench_solver_resolve_install },
+    { "list",                   bench_list },
+    { "owns",                   bench_owns },
+    { "install",                bench_install },
+};
+
+#define N_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static int run_benchmark(fixture_t *fx, int b)
+{
+    double *t = aept_malloc(opt.runs * sizeof(*t));
+    bench_times_t times;
+    int i;
+
+    for (i = 0; i < opt.runs; i++) {
+        if (benchmarks[b].fn(fx, &t[i]) < 0) {
+            fprintf(stderr, "aept-bench: %s failed at size %d\n",
+                    benchmarks[b].name, fx->size);
+            free(t);
+            return -1;
+        }
+    }
+
+    bench_times(t, opt.runs, &times);
+    printf("{\"benchmark\":\"%s\",\"size\":%d,\"files\":%d,",
+           benchmarks[b].name, fx->size, opt.files);
+    bench_print_times(&times);
+    printf("}\n");
+    fflush(stdout);
+
+    free(t);
+    return 0;
+}
+
+/* ── Main ────────────────────────────────────────────────────────── */
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "Usage: aept-bench [options] [benchmark...]\n"
+        "\n"
+        "Options:\n"
+        "  -s, --sizes=N,...     Package counts to generate (default %s)\n"
+        "  -r, --runs=N          Runs per benchmark (default %d)\n"
+        "  -f, --files=N         Data files per package (default %d)\n"
+        "  -i, --install=N       Packages installed by 'install' (default %d)\n"
+        "  -w, --workdir=DIR     Where to generate fixtures (default: a new\n"
+        "                        directory under $TMPDIR)\n"
+        "  -k, --keep            Keep the generated fixtures\n"
+        "  -h, --help            Show this help\n"
+        "\n"
+        "Benchmarks:\n",
+        default_sizes, opt.runs, opt.files, opt.install_count);
+    for (int b = 0; b < N_BENCHMARKS; b++)
+        fprintf(out, "  %s\n", benchmarks[b].name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "sizes",   required_argument, NULL, 's' },
+        { "runs",    required_argument, NULL, 'r' },
+        { "files",   required_argument, NULL, 'f' },
+        { "install", required_argument, NULL, 'i' },
+        { "workdir", required_argument, NULL, 'w' },
+        { "keep",    no_argument,       NULL, 'k' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *sizes = default_sizes;
+    char *sizes_copy, *tok, *save = NULL;
+    int selected[N_BENCHMARKS];
+    int c, b, i, made_workdir = 0, rc = 0;
+
+    while ((c = getopt_long(argc, argv, "s:r:f:i:w:kh", long_opts,
+                            NULL)) != -1) {
+        switch (c) {
+        case 's': sizes = optarg; break;
+        case 'r': opt.runs = atoi(optarg); break;
+        case 'f': opt.files = atoi(optarg); break;
+        case 'i': opt.install_count = atoi(optarg); break;
+        case 'w': opt.workdir = aept_strdup(optarg); break;
+        case 'k': opt.keep = 1; break;
+        case 'h': usage(stdout); return 0;
+        default:  usage(stderr); return 2;
+        }
+    }
+
+    if (opt.runs < 1 || opt.files < 0 || opt.install_count < 1) {
+        usage(stderr);
+        return 2;
+    }
+
+    for (b = 0; b < N_BENCHMARKS; b++)
+        selected[b] = optind == argc;
+    for (i = optind; i < argc; i++) {
+        for (b = 0; b < N_BENCHMARKS; b++)
+            if (strcmp(argv[i], benchmarks[b].name) == 0)
+                break;
+        if (b == N_BENCHMARKS) {
+            fprintf(stderr, "aept-bench: unknown benchmark '%s'\n", argv[i]);
+            return 2;
+        }
+        selected[b] = 1;
+    }
+
+    if (!opt.workdir) {
+        const char *tmp = getenv("TMPDIR");
+
+        aept_asprintf(&opt.workdir, "%s/aept-bench.XXXXXX",
+                      tmp ? tmp : "/tmp");
+        if (!mkdtemp(opt.workdir)) {
+            fprintf(stderr, "aept-bench: %s: %s\n", opt.workdir,
+                    strerror(errno));
+            return 1;
+        }
+        made_workdir = 1;
+    }
+
+    sizes_copy = aept_strdup(sizes);
+    for (tok = strtok_r(sizes_copy, ",", &save); tok && rc == 0;
+         tok = strtok_r(NULL, ",", &save)) {
+        fixture_t fx;
+        int size = atoi(tok);
+
+        if (size < 2) {
+            fprintf(stderr, "aept-bench: invalid size '%s'\n", tok);
+            rc = 2;
+            break;
+        }
+
+        if (fixture_create(&fx, size) < 0) {
+            fprintf(stderr, "aept-bench: cannot generate fixture\n");
+            rc = 1;
+        }
+
+        for (b = 0; b < N_BENCHMARKS && rc == 0; b++)
+            if (selected[b] && run_benchmark(&fx, b) < 0)
+                rc = 1;
+
+        fixture_free(&fx);
+    }
+    free(sizes_copy);
+
+    if (made_workdir && !opt.keep)
+        rmdir(opt.workdir);
+    free(opt.workdir);
+    return rc;
+}
@@ -0,0 +1,90 @@
+/* bench-common.c - helpers shared by the benchmark programs
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "aept/aept.h"
+#include "aept/util.h"
+
+#include "bench-common.h"
+
+double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int bench_cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+void bench_quiet_log(int level, const char *msg, void *userdata)
+{
+    if (level == AEPT_LOG_ERROR)
+        fprintf(stderr, "%s: %s\n", (const char *)userdata, msg);
+}
+
+static int rm_entry(const char *path, const struct stat *st, int type,
+                    struct FTW *ftw)
+{
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+void bench_rm_tree(const char *path)
+{
+    if (aept_file_exists(path))
+        nftw(path, rm_entry, 32, FTW_DEPTH | FTW_PHYS);
+}
+
+void bench_ar_header(char hdr[BENCH_AR_HEADER_SIZE + 1], const char *name,
+                     size_t size)
+{
+    snprintf(hdr, BENCH_AR_HEADER_SIZE + 1, "%-16s%-12d%-6d%-6d%-8s%-10zu`\n",
+             name, 0, 0, 0, "100644", size);
+}
+
+void bench_times(double *t, int runs, bench_times_t *out)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < runs; i++)
+        sum += t[i];
+    qsort(t, runs, sizeof(*t), bench_cmp_double);
+
+    out->runs = runs;
+    out->min = t[0];
+    out->median = t[runs / 2];
+    out->mean = sum / runs;
+    out->max = t[runs - 1];
+}
+
+void bench_print_times(const bench_times_t *times)
+{
+    printf("\"runs\":%d,\"min\":%.6f,\"median\":%.6f,\"mean\":%.6f,"
+           "\"max\":%.6f", times->runs, times->min, times->median,
+           times->mean, times->max);
+}
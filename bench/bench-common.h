@@ -0,0 +1,49 @@
+/* bench-common.h - helpers shared by the benchmark programs
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef BENCH_COMMON_H_7BF97F
+#define BENCH_COMMON_H_7BF97F
+
+#include <stddef.h>
+
+/* Size of an ar member header, without the terminating NUL */
+#define BENCH_AR_HEADER_SIZE 60
+
+/* Times of the runs of one benchmark, in seconds */
+typedef struct {
+    int runs;
+    double min;
+    double median;
+    double mean;
+    double max;
+} bench_times_t;
+
+/* CLOCK_MONOTONIC in seconds */
+double bench_now(void);
+
+/* qsort() comparators */
+int bench_cmp_double(const void *a, const void *b);
+int bench_cmp_ull(const void *a, const void *b);
+
+/* Log callback that prints errors only, prefixed with the program name
+ * passed as userdata. */
+void bench_quiet_log(int level, const char *msg, void *userdata);
+
+/* Remove path and everything below it, if it exists. */
+void bench_rm_tree(const char *path);
+
+/* Format the header of an ar member of size bytes into hdr. */
+void bench_ar_header(char hdr[BENCH_AR_HEADER_SIZE + 1], const char *name,
+                     size_t size);
+
+/* Sort the runs durations in t and summarize them. */
+void bench_times(double *t, int runs, bench_times_t *out);
+
+/* Print the fields of times into the JSON object of a result, without
+ * the braces. */
+void bench_print_times(const bench_times_t *times);
+
+#endif
@@ -26,6 +26,12 @@ int  aept_load_config(aept_ctx_t *ctx, const char *path);
 void aept_set_offline_root(aept_ctx_t *ctx, const char *path);
 void aept_set_verbosity(aept_ctx_t *ctx, int level);
 
+/* Number of packages fetched concurrently (clamped to 1..64). */
+void aept_set_download_jobs(aept_ctx_t *ctx, int jobs);
+
+/* Cap all downloads together at kib KiB/s, 0 for no cap. */
+void aept_set_download_rate(aept_ctx_t *ctx, int kib);
+
 /* --- Flags --------------------------------------------------------------- */
 
 enum {
@@ -42,6 +48,8 @@ enum {
     AEPT_FLAG_CHECK_SIGNATURE,
     AEPT_FLAG_IGNORE_UID,
     AEPT_FLAG_KEEP_GOING,
+    AEPT_FLAG_PIPELINE_DOWNLOADS,
+    AEPT_FLAG_PREFETCH,
 };
 
 void aept_set_flag(aept_ctx_t *ctx, int flag, int value);
@@ -56,6 +64,8 @@ enum {
     AEPT_LOG_DEBUG   = 3,
 };
 
+/* Called from whichever thread logs, possibly from several at once, and
+ * without any lock of aept held, so that it may call back into aept. */
 typedef void (*aept_log_fn)(int level, const char *msg, void *userdata);
 void aept_set_log_fn(aept_ctx_t *ctx, aept_log_fn fn, void *userdata);
 
@@ -73,16 +83,141 @@ void aept_set_display_fn(aept_ctx_t *ctx, aept_display_fn fn, void *userdata);
 typedef int (*aept_confirm_fn)(void *userdata);
 void aept_set_confirm_fn(aept_ctx_t *ctx, aept_confirm_fn fn, void *userdata);
 
+/* Progress of one item: a download, the unpacking of a package or a
+ * maintainer script, in phase AEPT_PHASE_DOWNLOAD, _UNPACK or _SCRIPTS.
+ * Called when the item starts, at most every 100 ms while it runs, and
+ * once more when it ends, with done == total if it succeeded.  total is
+ * 0 if unknown, and for unpacking it is the package's Installed-Size,
+ * which done may exceed.  Scripts report no bytes.  Downloads running
+ * concurrently report one at a time from their own threads. */
+typedef void (*aept_progress_fn)(int phase, const char *package,
+                                 unsigned long long done,
+                                 unsigned long long total, void *userdata);
+void aept_set_progress_fn(aept_ctx_t *ctx, aept_progress_fn fn,
+                          void *userdata);
+
 /* --- Cancellation -------------------------------------------------------- */
 
 void aept_cancel(aept_ctx_t *ctx);
 
+/* --- Event queue --------------------------------------------------------- */
+
+/* Instead of calling back for every message, a context can queue them for
+ * another thread to collect in batches.  aept_events_open() enables the
+ * queue and returns a file descriptor that is readable while events are
+ * pending, for an event loop to wait on; it stays owned by the context.
+ * Log messages and progress reports then go to the queue rather than to
+ * the log and progress callbacks.
+ * aept_events_take() moves up to max pending events into out and returns
+ * how many; free their strings with aept_events_free().  Both may be
+ * called from any thread while an operation runs on the context.  If
+ * events are not collected, the oldest are dropped rather than letting
+ * the queue grow without bound, and a warning saying how many is queued
+ * in their place. */
+enum {
+    AEPT_EVENT_LOG = 0,
+    AEPT_EVENT_PROGRESS = 1,
+};
+
+typedef struct aept_event {
+    int type;                   /* AEPT_EVENT_* */
+    int level;                  /* AEPT_LOG_* for AEPT_EVENT_LOG */
+    char *text;                 /* message, or package of a progress
+                                 * report */
+    int phase;                  /* the rest as for aept_progress_fn */
+    unsigned long long done;
+    unsigned long long total;
+} aept_event_t;
+
+int  aept_events_open(aept_ctx_t *ctx);
+int  aept_events_take(aept_ctx_t *ctx, aept_event_t *out, int max);
+void aept_events_free(aept_event_t *events, int count);
+
+/* --- Statistics ---------------------------------------------------------- */
+
+enum {
+    AEPT_PHASE_LOAD,        /* reading package lists */
+    AEPT_PHASE_SOLVE,
+    AEPT_PHASE_DOWNLOAD,
+    AEPT_PHASE_VERIFY,      /* checksums and signatures */
+    AEPT_PHASE_CLASH,
+    AEPT_PHASE_UNPACK,
+    AEPT_PHASE_REMOVE,
+    AEPT_PHASE_SCRIPTS,
+    AEPT_PHASE_TRIGGERS,
+    AEPT_PHASE_COUNT
+};
+
+typedef struct {
+    double wall;                /* seconds */
+    double cpu;                 /* seconds, of the aept threads only */
+    unsigned long count;        /* times the phase was entered */
+} aept_phase_stats_t;
+
+typedef struct {
+    aept_phase_stats_t phase[AEPT_PHASE_COUNT];
+    unsigned long long bytes_downloaded;
+    unsigned long long files_downloaded;
+    unsigned long long bytes_extracted;
+    unsigned long long files_extracted;
+    unsigned long long files_unchanged;    /* left alone by upgrades */
+    unsigned long long files_removed;
+    unsigned long long scripts_run;
+    unsigned long long peak_rss;           /* bytes, of the whole process
+                                            * and not reset */
+} aept_stats_t;
+
+/* Time spent in each phase and counters, accumulated since aept_init()
+ * or the last aept_reset_stats().  Phases don't overlap within a
+ * thread: time in a maintainer script run during removal counts for
+ * AEPT_PHASE_SCRIPTS only.  Work done on several threads at once is
+ * summed, so a phase can exceed the elapsed time. */
+void aept_get_stats(aept_ctx_t *ctx, aept_stats_t *out);
+void aept_reset_stats(aept_ctx_t *ctx);
+
+/* Short lowercase name of an AEPT_PHASE_* value, or NULL. */
+const char *aept_phase_name(int phase);
+
+/* What was measured of one mirror of a source. */
+typedef struct {
+    const char *source;         /* borrowed from the configuration */
+    const char *url;
+    double latency;             /* seconds until the last response,
+                                 * < 0 if there was none */
+    double throughput;          /* bytes per second, 0 if unknown */
+    unsigned long long bytes_downloaded;
+    unsigned long requests;
+    unsigned long failures;
+    int down;                   /* the last request failed */
+} aept_mirror_stats_t;
+
+/* Fill out[0..max) with the mirrors of all sources, in the order of the
+ * configuration, and return how many there are.  Unlike the phase
+ * statistics these are kept by aept_reset_stats(), because they decide
+ * which mirror is tried first. */
+int aept_get_mirror_stats(aept_ctx_t *ctx, aept_mirror_stats_t *out,
+                          int max);
+
 /* --- Mutating operations ------------------------------------------------- */
 
 int aept_update(aept_ctx_t *ctx);
 int aept_install(aept_ctx_t *ctx, const char **names, int name_count,
                  const char **local_paths, int local_count);
 int aept_upgrade(aept_ctx_t *ctx);
+
+/* Install into each of the nroots offline roots what aept_install()
+ * would, or upgrade them if names and local_paths are both empty.  The
+ * transaction is resolved and downloaded once, against roots[0], and
+ * then applied to all roots on up to root_jobs threads.  A root whose
+ * installed packages or pins differ from those of roots[0] is resolved
+ * on its own.  The package lists and the cache of ctx are shared; the
+ * package database, marks and pins are kept per root.  results[i]
+ * receives the result of roots[i].  Returns 0 if all roots succeeded,
+ * -1 otherwise. */
+int aept_install_roots(aept_ctx_t *ctx, const char *const *roots, int nroots,
+                       const char **names, int name_count,
+                       const char **local_paths, int local_count,
+                       int *results);
 int aept_remove(aept_ctx_t *ctx, const char **names, int count);
 int aept_autoremove(aept_ctx_t *ctx);
 int aept_clean(aept_ctx_t *ctx);
@@ -93,8 +228,22 @@ int aept_mark_auto(aept_ctx_t *ctx, const char **names, int count);
 int aept_mark_manual(aept_ctx_t *ctx, const char **names, int count);
 int aept_mark_manual_all(aept_ctx_t *ctx);
 
+/* The consolidated package database {info_dir}.db, used with the
+ * info_db option.  aept_db_import() creates it from info_dir or brings
+ * it up to date, aept_db_compact() drops the records later ones
+ * replaced, and aept_db_export() writes the files it holds to dir in
+ * the layout of info_dir, e.g. to restore a lost info_dir.  Each takes
+ * the lock.  Return 0 on success, -1 on error. */
+int aept_db_import(aept_ctx_t *ctx);
+int aept_db_export(aept_ctx_t *ctx, const char *dir);
+int aept_db_compact(aept_ctx_t *ctx);
+
 /* --- Query: list --------------------------------------------------------- */
 
+/* Queries take no lock.  They read the package database as the last
+ * finished install, upgrade or removal left it, so they are not held up
+ * by a running transaction and don't see it half done. */
+
 typedef struct {
     char *name;
     char *version;
@@ -108,11 +257,27 @@ typedef struct {
     int count;
 } aept_pkg_list_t;
 
+/* Return nonzero to stop the iteration early. */
+typedef int (*aept_list_fn)(const aept_pkg_entry_t *entry, void *userdata);
+
 int  aept_list(aept_ctx_t *ctx, const char *pattern,
                int filter_installed, int filter_upgradable,
                aept_pkg_list_t *out);
+int  aept_list_foreach(aept_ctx_t *ctx, const char *pattern,
+                       int filter_installed, int filter_upgradable,
+                       aept_list_fn fn, void *userdata);
 void aept_pkg_list_free(aept_pkg_list_t *list);
 
+/* The upgradable packages matching pattern, as aept_list(ctx, pattern,
+ * 0, 1, out) returns them, but answered from a summary kept in
+ * upgradable_file without loading any package list, as long as
+ * lists_dir, info_dir, the auto-installed marks and the list of each
+ * source are unchanged since it was written.  Otherwise it is
+ * recomputed and saved, if possible.  Once the summary exists,
+ * aept_update() and the mutating operations keep it up to date. */
+int  aept_list_upgradable_cached(aept_ctx_t *ctx, const char *pattern,
+                                 aept_pkg_list_t *out);
+
 /* --- Query: show --------------------------------------------------------- */
 
 typedef struct {
@@ -148,6 +313,113 @@ int aept_files(aept_ctx_t *ctx, const char *name,
 int aept_owns(aept_ctx_t *ctx, const char *path,
               char ***owners_out, int *count_out);
 
+/* Owners of one path in an aept_owns_many() batch. */
+typedef struct {
+    char **owners;
+    int    count;
+} aept_owns_result_t;
+
+/* Batched aept_owns(): looks up paths[0..count) in a single pass over
+ * the owner index. (*results_out)[i] holds the owners of paths[i], with
+ * count 0 if there are none. Free with aept_owns_results_free().
+ * Returns 0 on success, -1 on error. */
+int  aept_owns_many(aept_ctx_t *ctx, const char *const *paths, int count,
+                    aept_owns_result_t **results_out);
+void aept_owns_results_free(aept_owns_result_t *results, int count);
+
 int aept_architectures(aept_ctx_t *ctx, char ***archs_out, int *count_out);
 
+/* --- Query: reverse dependencies ---------------------------------------- */
+
+/* aept_whatdepends() flags */
+enum {
+    AEPT_WHATDEPENDS_RECURSIVE = 1  /* also packages that depend on it
+                                     * through others */
+};
+
+/* Installed packages that require the installed package name, sorted
+ * by name.  Returns 0 on success, 1 if name is not installed, -1 on
+ * error. */
+int aept_whatdepends(aept_ctx_t *ctx, const char *name, int flags,
+                     char ***names_out, int *count_out);
+
+/* Auto-installed packages that aept_autoremove() would remove, sorted
+ * by name, found without locking or changing anything.  Returns 0 on
+ * success, -1 on error. */
+int aept_autoremovable(aept_ctx_t *ctx, char ***names_out, int *count_out);
+
+/* --- Query: sessions ---------------------------------------------------- */
+
+/* A query session loads the package pool and the owner index once, on
+ * first use, and keeps them for later calls, which take the same
+ * arguments and return the same results as the one-shot functions
+ * above.  Each call first checks lists_dir, info_dir, the
+ * auto-installed marks and the source lists, and reloads if one of
+ * them has changed, so that updates and installs made in the meantime
+ * are seen.  A session must not outlive
+ * its context or be used from several threads at once. */
+typedef struct aept_query aept_query_t;
+
+aept_query_t *aept_query_open(aept_ctx_t *ctx);
+void aept_query_close(aept_query_t *q);
+
+int aept_query_list(aept_query_t *q, const char *pattern,
+                    int filter_installed, int filter_upgradable,
+                    aept_pkg_list_t *out);
+int aept_query_list_foreach(aept_query_t *q, const char *pattern,
+                            int filter_installed, int filter_upgradable,
+                            aept_list_fn fn, void *userdata);
+int aept_query_show(aept_query_t *q, const char *name, aept_pkg_info_t *out);
+
+/* Batched aept_query_show(): (*infos_out)[i] describes names[i], and is
+ * all zero (name NULL) if there is no such package. Free with
+ * aept_pkg_infos_free(). Returns 0 on success, -1 on error. */
+int  aept_query_show_many(aept_query_t *q, const char *const *names,
+                          int count, aept_pkg_info_t **infos_out);
+void aept_pkg_infos_free(aept_pkg_info_t *infos, int count);
+
+int aept_query_files(aept_query_t *q, const char *name,
+                     char ***paths_out, int *count_out);
+int aept_query_owns(aept_query_t *q, const char *path,
+                    char ***owners_out, int *count_out);
+int aept_query_owns_many(aept_query_t *q, const char *const *paths,
+                         int count, aept_owns_result_t **results_out);
+int aept_query_whatdepends(aept_query_t *q, const char *name, int flags,
+                           char ***names_out, int *count_out);
+int aept_query_autoremovable(aept_query_t *q, char ***names_out,
+                             int *count_out);
+
+/* --- Query: verify ------------------------------------------------------- */
+
+/* What is wrong with a file found by aept_verify() */
+enum {
+    AEPT_VERIFY_MISSING    = 1,   /* file is gone */
+    AEPT_VERIFY_MODIFIED   = 2,   /* content, size, type or link target
+                                   * differs from the package */
+    AEPT_VERIFY_UNREADABLE = 3    /* file could not be read */
+};
+
+/* aept_verify() flags */
+enum {
+    AEPT_VERIFY_QUICK      = 1    /* trust files whose size and mtime are
+                                   * unchanged instead of hashing them */
+};
+
+typedef struct {
+    char *package;
+    char *path;                   /* as in the .list file */
+    int   problem;                /* AEPT_VERIFY_* */
+} aept_verify_problem_t;
+
+/* Check the installed files of names[0..count), or of every installed
+ * package if count is 0, against the digests recorded when they were
+ * extracted. Files are hashed on up to verify_jobs threads; conffiles
+ * and files installed before digests were recorded are skipped.
+ * *problems_out gets one entry per file that does not match, free with
+ * aept_verify_problems_free(). Returns 0 if every file matches, 1 if
+ * there are problems, -1 on error. */
+int  aept_verify(aept_ctx_t *ctx, const char **names, int count, int flags,
+                 aept_verify_problem_t **problems_out, int *count_out);
+void aept_verify_problems_free(aept_verify_problem_t *problems, int count);
+
 #endif
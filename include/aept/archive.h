@@ -8,6 +8,7 @@
 #define ARCHIVE_H_7BF97F
 
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "aept/util.h"
 
@@ -20,12 +21,42 @@ struct aept_ar {
 struct aept_ar *aept_ar_open_pkg_control_archive(const char *filename);
 
 /* Open the data tarball from an IPK file.
- * If ignore_uid is non-zero, extracted files will not preserve ownership. */
+ * If ignore_uid is non-zero, extracted files will not preserve ownership.
+ * An xz-compressed tarball is decoded on up to threads threads (0 for
+ * one per online CPU, 1 for libarchive's single-threaded decoder). */
 struct aept_ar *aept_ar_open_pkg_data_archive(const char *filename,
-                                              int ignore_uid);
-
-/* Open a gzip-compressed file for streaming decompression. */
-struct aept_ar *aept_ar_open_compressed_file(const char *filename);
+                                              int ignore_uid, int threads);
+
+/* Decompress the data tarball of an IPK into spool_path as a plain tar,
+ * so that it can be listed and then extracted without being decompressed
+ * twice. threads as for aept_ar_open_pkg_data_archive(). Returns 0 on
+ * success, -1 on error. */
+int aept_ar_spool_pkg_data_archive(const char *filename,
+                                   const char *spool_path, int threads);
+
+/* Open a data tarball written by aept_ar_spool_pkg_data_archive(), with
+ * the same extraction behavior as aept_ar_open_pkg_data_archive(). */
+struct aept_ar *aept_ar_open_spooled_data_archive(const char *spool_path,
+                                                  int ignore_uid);
+
+/* Open a gzip- or xz-compressed file for streaming decompression.
+ * threads as for aept_ar_open_pkg_data_archive(). */
+struct aept_ar *aept_ar_open_compressed_file(const char *filename,
+                                             int threads);
+
+/* Reader for aept_ar_open_compressed_stream(). Fills buf with up to size
+ * bytes and returns their count, 0 at end of input or -1 on error. */
+typedef ssize_t (*aept_ar_read_fn)(void *userdata, void *buf, size_t size);
+
+/* Like aept_ar_open_compressed_file(), but pulls the compressed data
+ * from read instead of a file. */
+struct aept_ar *aept_ar_open_compressed_stream(aept_ar_read_fn read,
+                                               void *userdata);
+
+/* Read up to size bytes of the decompressed content of a file opened
+ * with aept_ar_open_compressed_file() or _stream(). Returns their count,
+ * 0 at the end or -1 on error. */
+ssize_t aept_ar_read(struct aept_ar *ar, void *buf, size_t size);
 
 /* Copy decompressed content to a stream. */
 int aept_ar_copy_to_stream(struct aept_ar *ar, FILE *stream);
@@ -38,19 +69,45 @@ typedef struct {
     char *path;                 /* archive path, e.g. "./usr/bin/foo" */
     char *link_target;          /* NULL if not a symlink */
     unsigned int mode;          /* st_mode from the archive header */
+    char *digest;               /* SHA-256 of a regular file's content in
+                                 * hex, NULL if it was not extracted */
+    unsigned long long size;    /* size and mtime of a file with a digest */
+    long long mtime;
 } aept_ar_file_entry_t;
 
 typedef struct {
     aept_ar_file_entry_t *entries;
     int count;
     int alloc;
+    aept_arena_t strings;       /* the strings of all entries */
 } aept_ar_file_list_t;
 
 void aept_ar_file_list_init(aept_ar_file_list_t *fl);
 void aept_ar_file_list_free(aept_ar_file_list_t *fl);
 
+/* The files of the installed version of a package, read back from its
+ * .list and looked up by path, for extracting a new version over it. */
+typedef struct {
+    aept_ar_file_list_t files;
+    aept_pathmap_t index;       /* path -> entry of files */
+    unsigned long unchanged;    /* files extraction left alone */
+} aept_ar_installed_t;
+
+void aept_ar_installed_init(aept_ar_installed_t *in);
+void aept_ar_installed_free(aept_ar_installed_t *in);
+
+/* Read the .list file at path into the empty in.  Returns 0 on
+ * success, -1 if it can't be opened. */
+int aept_ar_installed_load(aept_ar_installed_t *in, const char *path);
+
+/* The record of path in in, or NULL if it has none. */
+const aept_ar_file_entry_t *aept_ar_installed_find(
+        const aept_ar_installed_t *in, const char *path);
+
 /* Write a collected file list to stream in .list format, i.e.
- * "<path>\t<mode>[\t<symlink_target>]\n".  Returns 0 on success. */
+ * "<path>\t<mode>[\t<symlink_target>]\n", or for a regular file with a
+ * digest "<path>\t<mode>\t<size>\t<mtime>\t<sha256>\n".  Returns 0 on
+ * success. */
 int aept_ar_file_list_write(const aept_ar_file_list_t *fl, FILE *stream);
 
 /* Extract all files to a directory.
@@ -59,22 +116,66 @@ int aept_ar_file_list_write(const aept_ar_file_list_t *fl, FILE *stream);
  * (e.g. ".aept-new") instead of overwriting the original.
  * If recorded is non-NULL, each successfully extracted entry is
  * appended to it (archive path, mode, symlink target) so callers can
- * avoid a second pass over the archive to produce the .list file. */
+ * avoid a second pass over the archive to produce the .list file.
+ * Regular files also get the SHA-256 of their content, hashed while it
+ * is written out.
+ * If installed is non-NULL, a regular file that is not a conffile and
+ * whose content, mode and size are those installed is left alone, see
+ * aept_extract_keep(), and counted in installed->unchanged.  It is
+ * still recorded as if it had been extracted. */
 int aept_ar_extract_all(struct aept_ar *ar, const char *prefix,
                    unsigned long *size, aept_fileset_t *conffiles,
                    const char *cf_suffix,
-                   aept_ar_file_list_t *recorded);
+                   aept_ar_file_list_t *recorded,
+                   aept_ar_installed_t *installed);
 
 /* Extract only files whose paths are in the given set.
  * Clears NO_OVERWRITE so that existing files are replaced. */
 int aept_ar_extract_selected(struct aept_ar *ar, aept_fileset_t *selected,
                         const char *prefix);
 
+/* List non-directory file paths from an open data archive, consuming
+ * it. Same output as aept_ar_list_data_paths(). */
+int aept_ar_list_paths(struct aept_ar *ar, aept_ar_file_list_t *out);
+
 /* List non-directory file paths from an IPK's data archive.
  * Fills out with archive paths (e.g. "./usr/bin/foo") and symlink
  * targets where applicable.  Returns 0 on success, -1 on error. */
 int aept_ar_list_data_paths(const char *ipk_path, int ignore_uid,
-                            aept_ar_file_list_t *out);
+                            int threads, aept_ar_file_list_t *out);
+
+/* Header of an archive entry as passed to an aept_ar_walk_fn.  Strings
+ * are owned by the archive and valid during the callback only. */
+typedef struct {
+    const char *path;           /* archive path, e.g. "./usr/bin/foo" */
+    const char *link_target;    /* NULL if not a symlink */
+    const char *hardlink;       /* archive path of the hard link target,
+                                 * NULL if not a hard link */
+    const char *uname;          /* owner names, NULL if not recorded */
+    const char *gname;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    long long size;
+    long long mtime;
+    long mtime_nsec;
+} aept_ar_header_t;
+
+/* Called for each entry by aept_ar_walk().  Returns 0 to continue. */
+typedef int (*aept_ar_walk_fn)(void *userdata, struct aept_ar *ar,
+                               const aept_ar_header_t *hdr);
+
+/* Call fn for every entry of an open data archive in order, consuming
+ * it.  Unsafe paths are refused as by aept_ar_extract_all().  Returns 0
+ * once all entries were seen, -1 on a read error or whatever nonzero
+ * value fn returned. */
+int aept_ar_walk(struct aept_ar *ar, aept_ar_walk_fn fn, void *userdata);
+
+/* From an aept_ar_walk_fn, write the content of the current regular
+ * file of size bytes to fd, keeping holes, and store the SHA-256 of
+ * the content in hex in digest.  Returns 0 on success, -1 on error. */
+int aept_ar_copy_data(struct aept_ar *ar, int fd, long long size,
+                      char digest[65]);
 
 /* Close and free archive handle. */
 void aept_ar_close(struct aept_ar *ar);
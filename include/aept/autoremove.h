@@ -7,8 +7,21 @@
 #ifndef AUTOREMOVE_H_7BF97F
 #define AUTOREMOVE_H_7BF97F
 
+#include <stdint.h>
+
+#include <solv/pool.h>
+
+#include "aept/depgraph.h"
+
 struct aept_ctx;
 
+/* Mark in unneeded, a bitmap over the nodes of g, the auto-installed
+ * packages that no manually installed package needs, directly or
+ * through others.  These are what aept_op_autoremove() removes.
+ * Returns the number marked, or -1 on error. */
+int aept_autoremove_unneeded(struct aept_ctx *ctx, Pool *pool,
+                             const aept_depgraph_t *g, uint64_t *unneeded);
+
 /* Remove auto-installed packages that are no longer needed. */
 int aept_op_autoremove(struct aept_ctx *ctx);
 
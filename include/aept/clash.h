@@ -9,16 +9,19 @@
 
 #include <solv/pool.h>
 
+#include "aept/archive.h"
 #include "aept/owner_index.h"
 #include "aept/util.h"
 
 struct aept_ctx;
 
 /* Check for file clashes before extracting a package.
+ * new_files: the package's data paths, see aept_ar_list_paths().
  * old_files: fileset of old version (for upgrades), or NULL.
  * owners: file->owner index covering the current transaction state.
- * Returns the number of clashes (0 = OK), -1 on error. */
-int aept_clash_check(struct aept_ctx *ctx, const char *ipk_path,
+ * Returns the number of clashes (0 = OK). */
+int aept_clash_check(struct aept_ctx *ctx,
+                     const aept_ar_file_list_t *new_files,
                      Pool *pool, Id p,
                      aept_fileset_t *old_files,
                      aept_owner_index_t *owners);
@@ -7,8 +7,20 @@
 #ifndef AEPT_CLEAN_H_7BF97F
 #define AEPT_CLEAN_H_7BF97F
 
+#include <solv/pool.h>
+#include <solv/transaction.h>
+
 struct aept_ctx;
 
 int aept_op_clean(struct aept_ctx *ctx);
 
+/*
+ * Evict the least recently used packages from cache_dir until it holds
+ * no more than cache_limit MiB.  A package is used when it is
+ * downloaded or taken from the cache.  Packages of the versions that
+ * were installed before trans, and those trans installs, are never
+ * evicted.  Does nothing without a cache_limit.
+ */
+void aept_cache_trim(struct aept_ctx *ctx, Pool *pool, Transaction *trans);
+
 #endif
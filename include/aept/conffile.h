@@ -7,6 +7,8 @@
 #ifndef CONFFILE_H_7BF97F
 #define CONFFILE_H_7BF97F
 
+#include "aept/util.h"
+
 struct aept_ctx;
 
 typedef struct {
@@ -18,11 +20,13 @@ typedef struct {
     aept_conffile_t *entries;
     int count;
     int alloc;
+    aept_pathmap_t index;   /* path -> first entry for it */
 } aept_conffile_set_t;
 
 void aept_conffile_set_init(aept_conffile_set_t *cs);
 void aept_conffile_set_add(aept_conffile_set_t *cs, const char *path,
                       const char *md5);
+/* The saved md5 of path, or NULL.  A leading "/" is optional. */
 const char *aept_conffile_set_lookup(const aept_conffile_set_t *cs,
                                 const char *path);
 void aept_conffile_set_free(aept_conffile_set_t *cs);
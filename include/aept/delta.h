@@ -0,0 +1,28 @@
+/* delta.h - rebuilding packages from delta files
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef DELTA_H_7BF97F
+#define DELTA_H_7BF97F
+
+/*
+ * A delta is a gzip- or xz-compressed (or plain) stream of:
+ *
+ *   "AEPTDLT1"                         magic
+ *   'C' <offset:u64> <length:u64>      copy bytes of the old package
+ *   'I' <length:u64> <data>            insert literal bytes
+ *   'E'                                end of the delta
+ *
+ * with all integers 64-bit big-endian.  The new package is the
+ * concatenation of the copies and inserts in order.
+ */
+
+/* Rebuild the package at out_path from old_path and delta_path.  The
+ * caller verifies the result.  Returns 0 on success, -1 on error, with
+ * out_path removed. */
+int aept_delta_apply(const char *old_path, const char *delta_path,
+                     const char *out_path);
+
+#endif
@@ -0,0 +1,55 @@
+/* depgraph.h - dependency graph of the installed packages
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef DEPGRAPH_H_7BF97F
+#define DEPGRAPH_H_7BF97F
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <solv/pool.h>
+
+/*
+ * The requires of every installed package, resolved once to the
+ * installed packages that provide them, and kept as adjacency arrays
+ * in both directions.  Node i is solvable start + i of the installed
+ * repo.  Nodes are marked in bitmaps of aept_depgraph_words() words,
+ * and aept_depgraph_reach() extends a marking to everything reachable
+ * from it without recursion, so a long dependency chain cannot
+ * exhaust the stack.
+ */
+typedef struct {
+    Id start;
+    int n;
+    int *fwd_off;   /* n + 1 offsets into fwd */
+    int *fwd;       /* packages that node i requires */
+    int *rev_off;   /* n + 1 offsets into rev */
+    int *rev;       /* packages that require node i */
+} aept_depgraph_t;
+
+/* Build the graph of pool's installed repo.  Creates the whatprovides
+ * index if the pool has none yet.  The graph is empty if nothing is
+ * installed. */
+void aept_depgraph_build(aept_depgraph_t *g, Pool *pool);
+void aept_depgraph_free(aept_depgraph_t *g);
+
+/* Node of installed solvable p, or -1 if p is not one. */
+int aept_depgraph_node(const aept_depgraph_t *g, Id p);
+
+/* Number of words in a bitmap over the nodes of g. */
+size_t aept_depgraph_words(const aept_depgraph_t *g);
+
+/* Add to mark every node reachable from a node marked in it, following
+ * requires, or with reverse set, following them backwards, i.e. the
+ * packages that depend on the marked ones. */
+void aept_depgraph_reach(const aept_depgraph_t *g, uint64_t *mark,
+                         int reverse);
+
+/* Bit i of mark. */
+int  aept_depgraph_test(const uint64_t *mark, int i);
+void aept_depgraph_set(uint64_t *mark, int i);
+
+#endif
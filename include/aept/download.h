@@ -7,19 +7,78 @@
 #ifndef DOWNLOAD_H_7BF97F
 #define DOWNLOAD_H_7BF97F
 
+#include <time.h>
+
 #include <solv/pool.h>
 
 struct aept_ctx;
+struct aept_mirror;
+
+/* Prepare process-wide download settings. Must be called before threads
+ * that use aept_download() or aept_download_if_modified() are started. */
+void aept_download_init(struct aept_ctx *ctx);
 
-/* Download url to dest file. Returns 0 on success, -1 on error. */
+/* Download url to dest file. The request is accounted to mirror, which
+ * may be NULL. Returns 0 on success, -1 on error. */
 int aept_download(struct aept_ctx *ctx, const char *url, const char *dest,
-                  const char *name);
+                  const char *name, struct aept_mirror *mirror);
+
+/* Conditional download. If *mtime > 0, url is only fetched if it changed
+ * on the server since then. Returns 1 if it did not (dest is untouched),
+ * 0 after a download, with *mtime set to the server's Last-Modified time
+ * (0 if not sent), and -1 on error. */
+int aept_download_if_modified(struct aept_ctx *ctx, const char *url,
+                              const char *dest, const char *name,
+                              time_t *mtime, struct aept_mirror *mirror);
 
-/* Download a package identified by solvable p.
- * Uses cache if available and checksum matches.
+/* Like aept_download_if_modified(), but url is gzip-compressed and is
+ * decompressed while it is received, so that only the plain document is
+ * written to dest. */
+int aept_download_gunzip(struct aept_ctx *ctx, const char *url,
+                         const char *dest, const char *name, time_t *mtime,
+                         struct aept_mirror *mirror);
+
+/* Download a package identified by solvable p, from the first mirror of
+ * its source that delivers it, see mirror.h.
+ * Uses cache if available and checksum matches.  A cached package that
+ * was verified before and has not changed since is not hashed again.
  * On success, *dest_out is set to the local path (caller frees).
  * Returns 0 on success, -1 on error. */
 int aept_download_package(struct aept_ctx *ctx, Id p, Pool *pool,
                           char **dest_out);
 
+/* Delete a downloaded package from the cache together with the record
+ * of its verification.  Packages in shared_cache_dir are kept. */
+void aept_download_discard(struct aept_ctx *ctx, const char *path);
+
+/* Queue of package downloads processed by up to download_jobs worker
+ * threads in the background, so that the caller can consume packages in
+ * order while later ones are still being fetched. */
+typedef struct aept_download_queue aept_download_queue_t;
+
+/* Start downloading pkgs[0..count). Entries that are 0 are skipped.
+ * All pool lookups are done before this returns. If window > 0, workers
+ * stay at most window packages ahead of the last one waited for, which
+ * bounds the cache usage. Returns NULL on error. */
+aept_download_queue_t *aept_download_start(struct aept_ctx *ctx, Pool *pool,
+                                           const Id *pkgs, int count,
+                                           int window);
+
+/* Block until pkgs[i] is downloaded and verified. On success, *dest_out
+ * is set to the local path (caller frees) and 0 is returned. Returns -1
+ * if the download failed, another download failed first, or the
+ * operation was cancelled. */
+int aept_download_wait(aept_download_queue_t *q, int i, char **dest_out);
+
+/* Stop the workers and free the queue. If discard is set, packages that
+ * were downloaded but never waited for are deleted. */
+void aept_download_finish(aept_download_queue_t *q, int discard);
+
+/* Download count packages in parallel and wait for all of them. On
+ * success, paths_out[i] is set for every nonzero pkgs[i] (caller frees)
+ * and 0 is returned. On error or cancellation, paths_out is left
+ * untouched and -1 is returned. */
+int aept_download_packages(struct aept_ctx *ctx, Pool *pool, const Id *pkgs,
+                           int count, char **paths_out);
+
 #endif
@@ -0,0 +1,38 @@
+/* event.h - queue of events collected by another thread
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef EVENT_H_7BF97F
+#define EVENT_H_7BF97F
+
+#include "aept/aept.h"
+
+struct aept_ctx;
+
+/* Pending events of a context, see aept_events_open().  A ring of
+ * AEPT_EVENT_QUEUE_MAX entries guarded by lock; the pipe holds one byte
+ * while the ring is not empty. */
+typedef struct aept_event_queue aept_event_queue_t;
+
+#define AEPT_EVENT_QUEUE_MAX 4096
+
+/* Create ctx's queue if it has none.  Returns the read end of the
+ * pipe, or -1 if it could not be created. */
+int aept_event_queue_open(struct aept_ctx *ctx);
+void aept_event_queue_free(struct aept_ctx *ctx);
+
+/* Queue a copy of text.  Returns 0, or -1 if ctx has no queue. */
+int aept_event_push(struct aept_ctx *ctx, int type, int level,
+                    const char *text);
+
+/* Queue a progress report, see aept_progress_fn.  Returns 0, or -1 if
+ * ctx has no queue. */
+int aept_event_push_progress(struct aept_ctx *ctx, int phase,
+                             const char *package, unsigned long long done,
+                             unsigned long long total);
+
+int aept_event_take(struct aept_ctx *ctx, aept_event_t *out, int max);
+
+#endif
@@ -0,0 +1,73 @@
+/* extract.h - directory fd relative file creation
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef EXTRACT_H_7BF97F
+#define EXTRACT_H_7BF97F
+
+#include <sys/stat.h>
+
+#include "aept/archive.h"
+
+/*
+ * Creates the entries of a package below a root directory the way
+ * libarchive's disk writer does for a data archive, but relative to
+ * open directory handles instead of by absolute path.  Directories are
+ * opened component by component with O_NOFOLLOW, so a symlink in the
+ * root is never followed, and the handles of recently used directories
+ * are kept so that consecutive entries below the same tree cost one
+ * openat() at most.  Each file is created under a temporary name in
+ * its directory and renamed over the destination.
+ *
+ * Callers check paths with aept_archive_path_is_safe() first.
+ */
+
+typedef struct aept_extract aept_extract_t;
+
+/* Fill the temporary file fd with the content of a regular file entry.
+ * Returns 0 on success, -1 on error. */
+typedef int (*aept_extract_fill_fn)(void *userdata, int fd);
+
+/* Start extracting below prefix.  With owner set, entries get the owner
+ * recorded in the package.  Returns NULL on error. */
+aept_extract_t *aept_extract_begin(const char *prefix, int owner);
+
+/* Apply the mode, owner and times of the directories that were created,
+ * deepest first, and free x. */
+void aept_extract_end(aept_extract_t *x);
+
+/* Non-zero if hdr is a regular file, directory, symlink or hard link,
+ * which is all that aept_extract_entry() can create. */
+int aept_extract_supported(const aept_ar_header_t *hdr);
+
+/* Create hdr below the root, with suffix (if non-NULL) appended to its
+ * name.  The content of a regular file comes from fill.  An existing
+ * directory is kept and anything else is replaced.  Returns 0 on
+ * success, 1 if hdr is the root itself and -1 on error, which has been
+ * logged. */
+int aept_extract_entry(aept_extract_t *x, const aept_ar_header_t *hdr,
+                       const char *suffix, aept_extract_fill_fn fill,
+                       void *userdata);
+
+/* Create regular file hdr as a hard link to from in directory from_dfd,
+ * whose status is obj, if obj already has the mode, times and owner
+ * that hdr asks for.  Returns 0 if linked, 1 if obj does not match or
+ * the link failed, and -1 on error. */
+int aept_extract_link(aept_extract_t *x, const aept_ar_header_t *hdr,
+                      const char *suffix, int from_dfd, const char *from,
+                      const struct stat *obj);
+
+/* Leave regular file hdr below the root as it is if it is still old,
+ * its record in the .list of the installed version: hdr has the size
+ * and mode of old, and the file has the size and mtime recorded in old
+ * and the mode and owner hdr asks for.  The file itself is not opened.
+ * With digest, the SHA-256 of hdr's content, it must also match old's,
+ * and hdr's mtime is applied to the kept file.  Without, this only
+ * tells whether the content is worth hashing.  Returns 0 if the file
+ * is kept (or can be), 1 if it has to be extracted. */
+int aept_extract_keep(aept_extract_t *x, const aept_ar_header_t *hdr,
+                      const aept_ar_file_entry_t *old, const char *digest);
+
+#endif
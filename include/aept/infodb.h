@@ -0,0 +1,74 @@
+/* infodb.h - consolidated package database
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef INFODB_H_7BF97F
+#define INFODB_H_7BF97F
+
+#include <stddef.h>
+
+struct aept_ctx;
+
+/*
+ * With info_db set, the files every installed package keeps in info_dir
+ * (.control, .list, .conffiles, scripts, .triggers) are also kept in one
+ * file, {info_dir}.db, that the bulk readers map instead of opening
+ * thousands of small files.  info_dir stays as it is, since maintainer
+ * scripts and the per-package code paths read it; the database follows
+ * it and is only used while it matches.  See infodb.c for the format.
+ */
+
+typedef struct aept_infodb aept_infodb_t;
+
+/* One file of a package, pointing into the mapped database */
+typedef struct {
+    const char *name;       /* package */
+    const char *ext;        /* "control", "list", "conffiles", ... */
+    const char *data;       /* content, NUL-terminated */
+    size_t len;
+    unsigned int mode;
+    long long mtime_sec;
+    long mtime_nsec;
+} aept_infodb_file_t;
+
+/* Called for each file by aept_infodb_foreach().  Returns 0 to go on. */
+typedef int (*aept_infodb_fn)(const aept_infodb_file_t *f, void *userdata);
+
+/* Map the database of info_dir if info_db is set and it matches
+ * info_dir, bringing it up to date first if ctx holds the lock.
+ * Returns NULL if it can't be used; callers then read info_dir. */
+aept_infodb_t *aept_infodb_open(struct aept_ctx *ctx);
+void aept_infodb_close(aept_infodb_t *db);
+
+/* Call fn for the file with extension ext of every package, in no
+ * particular order.  Returns 0, or what fn returned if not 0. */
+int aept_infodb_foreach(aept_infodb_t *db, const char *ext,
+                        aept_infodb_fn fn, void *userdata);
+
+/* Find file name.ext.  Returns 0, or -1 if there is none. */
+int aept_infodb_get(aept_infodb_t *db, const char *name, const char *ext,
+                    aept_infodb_file_t *out);
+
+/* Bring the database up to date with info_dir, creating it if there is
+ * none.  Only the packages whose files changed are read and appended.
+ * Called with the lock held.  Returns 0 on success, -1 on error. */
+int aept_infodb_sync(struct aept_ctx *ctx);
+
+/* Rewrite the database without the records later ones replaced.
+ * Called with the lock held.  Returns 0 on success, -1 on error. */
+int aept_infodb_compact(struct aept_ctx *ctx);
+
+/* Write the files of every package in the database to dir in the
+ * layout of info_dir.  Returns 0 on success, -1 on error. */
+int aept_infodb_export(struct aept_ctx *ctx, const char *dir);
+
+/* Let the readers of generation dir, a copy of info_dir, use the
+ * database as it is now.  See aept_status_publish(). */
+int aept_infodb_publish(struct aept_ctx *ctx, const char *dir);
+
+/* Remove what aept_infodb_publish() left for dir */
+void aept_infodb_unpublish(const char *dir);
+
+#endif
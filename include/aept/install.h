@@ -15,4 +15,24 @@ struct aept_ctx;
 int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                     const char **local_paths, int local_count);
 
+/* A transaction resolved once and applied to several offline roots, see
+ * aept_install_roots().  The reference run, with capture set, records
+ * the state it resolved against and downloads the packages without
+ * installing them.  A later run whose root is in the same state loads
+ * only those package files instead of the package lists. */
+typedef struct aept_plan {
+    int capture;
+    int ready;                  /* the reference run was not declined */
+    unsigned char state[32];    /* digest of installed packages and pins */
+    char **paths;               /* downloaded package files */
+    int npaths;
+} aept_plan_t;
+
+/* Like aept_op_install(), following or capturing plan. */
+int aept_op_install_plan(struct aept_ctx *ctx, const char **names,
+                         int name_count, const char **local_paths,
+                         int local_count, aept_plan_t *plan);
+
+void aept_plan_free(aept_plan_t *plan);
+
 #endif
@@ -0,0 +1,19 @@
+/* integrity.h - installed file verification
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef INTEGRITY_H_7BF97F
+#define INTEGRITY_H_7BF97F
+
+#include "aept/aept.h"
+
+struct aept_ctx;
+
+/* See aept_verify(). */
+int aept_op_verify(struct aept_ctx *ctx, const char **names, int count,
+                   int flags, aept_verify_problem_t **problems_out,
+                   int *count_out);
+
+#endif
@@ -8,13 +8,29 @@
 #define INTERNAL_H_7BF97F
 
 #include <stdatomic.h>
+#include <sys/types.h>
 
 #include "aept/aept.h"
 
+/* One URL a source is served from, with what was measured of it.  The
+ * counters are updated by download workers, see mirror.h. */
+typedef struct aept_mirror {
+    char *url;
+    _Atomic long long latency_ns;       /* of the last request, -1 if none */
+    _Atomic unsigned long long bytes;   /* received from it */
+    _Atomic unsigned long long ns;      /* spent receiving them */
+    _Atomic unsigned long requests;
+    _Atomic unsigned long failures;
+    _Atomic int down;                   /* its last request failed */
+} aept_mirror_t;
+
 typedef struct {
     char *name;
-    char *url;
+    char *url;              /* the first of mirrors */
+    aept_mirror_t *mirrors;
+    int nmirrors;
     int gzip;
+    int probed;             /* mirrors have been probed, see mirror.h */
 } aept_source_t;
 
 typedef struct aept_config {
@@ -26,12 +42,16 @@ typedef struct aept_config {
     char *lists_dir;        /* default "/var/lib/aept/lists" */
     char *cache_dir;        /* default "/var/cache/aept" */
     char *tmp_dir;          /* default "/tmp" */
+    char *shared_cache_dir; /* checksum-named packages, default NULL */
+    char *unpacked_store;   /* unpacked packages, default NULL */
     char *lock_file;        /* default "/var/lib/aept/lock" */
     char *usign_keydir;     /* default "/etc/aept/usign/trustdb" */
     char *auto_file;        /* default "/var/lib/aept/auto-installed" */
     char *pin_file;         /* default "/var/lib/aept/pinned-packages" */
+    char *upgradable_file;  /* default "/var/lib/aept/upgradable" */
     char *ssl_client_cert;  /* NULL or path to client certificate */
     char *ssl_client_key;   /* NULL or path to client private key */
+    char *trace_file;       /* NULL or path of a trace to write */
 
     char **archs;
     int narchs;
@@ -42,6 +62,7 @@ typedef struct aept_config {
     int force_depends;
     int noaction;
     int download_only;
+    int prefetch;           /* download only, in the background */
     int reinstall;
     int no_cache;
     int force_confnew;
@@ -50,11 +71,47 @@ typedef struct aept_config {
     int non_interactive;
     int keep_going;
     int verbosity;
+    int download_jobs;      /* default 4 */
+    int pipeline_downloads; /* default 0 */
+    int download_rate;      /* KiB/s over all downloads, default 0 (no cap) */
+    int connection_cache;   /* idle HTTP connections kept, default 8 */
+    int spool_data;         /* default 1 */
+    int delta_downloads;    /* default 1 */
+    int durability;         /* AEPT_DURABILITY_*, default transaction */
+    int decompress_threads; /* xz decoder threads, default 0 (per CPU) */
+    int install_jobs;       /* packages unpacked in parallel, default 1 */
+    int verify_jobs;        /* verify threads, default 0 (per CPU) */
+    int remove_jobs;        /* file removal threads, default 1 */
+    int store_hardlinks;    /* link files from unpacked_store, default 0 */
+    int mirror_split;       /* spread downloads over mirrors, default 0 */
+    int cache_limit;        /* MiB kept in cache_dir, default 0 (no limit) */
+    int root_jobs;          /* roots installed in parallel, default 0 (per CPU) */
+    int info_db;            /* keep {info_dir}.db, default 0 */
+    int low_memory;         /* trade speed for a smaller footprint */
 } aept_config_t;
 
 /* Forward declaration */
 struct aept_solver;
 
+/* Counters behind aept_get_stats(), updated from any thread */
+enum {
+    AEPT_STAT_BYTES_DOWNLOADED,
+    AEPT_STAT_FILES_DOWNLOADED,
+    AEPT_STAT_BYTES_EXTRACTED,
+    AEPT_STAT_FILES_EXTRACTED,
+    AEPT_STAT_FILES_UNCHANGED,
+    AEPT_STAT_FILES_REMOVED,
+    AEPT_STAT_SCRIPTS_RUN,
+    AEPT_STAT_COUNT
+};
+
+struct aept_stats {
+    _Atomic unsigned long long wall_ns[AEPT_PHASE_COUNT];
+    _Atomic unsigned long long cpu_ns[AEPT_PHASE_COUNT];
+    _Atomic unsigned long count[AEPT_PHASE_COUNT];
+    _Atomic unsigned long long counter[AEPT_STAT_COUNT];
+};
+
 /* Full definition of the opaque context handle (aept_ctx_t). */
 struct aept_ctx {
     aept_config_t config;
@@ -68,13 +125,55 @@ struct aept_ctx {
     void           *display_userdata;
     aept_confirm_fn confirm_fn;
     void           *confirm_userdata;
+    aept_progress_fn progress_fn;
+    void           *progress_userdata;
+
+    /* NULL unless aept_events_open() was called, see event.h */
+    struct aept_event_queue *events;
+
+    /* NULL unless a trace file is written, see trace.h */
+    struct aept_trace *trace;
+
+    /* Auto-installed set of the running transaction, see status.h */
+    struct aept_auto_set *auto_set;
+
+    struct aept_stats stats;
+
+    /* Earliest CLOCK_MONOTONIC time in ns at which download_rate lets
+     * the next transfer finish, see download.c */
+    _Atomic long long rate_next;
+
+    /* Helper spawning commands in the offline root, see util.c */
+    int root_helper_fd;
+    pid_t root_helper_pid;
 
     _Atomic int cancelled;
+
+    /* The context of aept_install_roots() while installing into one of
+     * its roots; cancelling it cancels this one, too. */
+    struct aept_ctx *parent;
+
     int use_color;
     int config_loaded;
 };
 
-#define AEPT_USIGN_BIN "/usr/bin/usign"
+/* Upper bound for the download_jobs option */
+#define AEPT_MAX_DOWNLOAD_JOBS 64
+
+/* Upper bound for the install_jobs option */
+#define AEPT_MAX_INSTALL_JOBS 64
+
+/* Transfer attempts per package before a download is given up */
+#define AEPT_DOWNLOAD_ATTEMPTS 3
+
+/* Default for the connection_cache option */
+#define AEPT_CONNECTION_CACHE_DEFAULT 8
+
+/* Values of the durability option: when installed files and the
+ * package database are flushed to disk */
+#define AEPT_DURABILITY_NONE        0
+#define AEPT_DURABILITY_PACKAGE     1
+#define AEPT_DURABILITY_TRANSACTION 2
 
 /* Child process exit codes */
 #define AEPT_EXIT_EXEC_FAILED  255
@@ -0,0 +1,53 @@
+/* mirror.h - choosing among the mirrors of a source
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MIRROR_H_7BF97F
+#define MIRROR_H_7BF97F
+
+#include <time.h>
+
+#include "aept/internal.h"
+
+/*
+ * A source may list several mirror URLs.  Every request to one records
+ * how long it took to get a response and how fast the data came, and
+ * whether it failed.  Mirrors are tried best first: those whose last
+ * request succeeded before those whose last one failed, and among them
+ * the one expected to deliver a typical package soonest.  A failed
+ * download moves on to the next mirror.  Sources with a single URL skip
+ * all of this.
+ */
+
+/* A request to mirror m, which may be NULL for one that is not */
+typedef struct {
+    aept_mirror_t *mirror;
+    struct timespec start;
+    struct timespec first;      /* response received */
+    unsigned long long bytes;
+    int responded;
+} aept_mirror_req_t;
+
+void aept_mirror_begin(aept_mirror_req_t *req, aept_mirror_t *m);
+void aept_mirror_responded(aept_mirror_req_t *req);
+void aept_mirror_received(aept_mirror_req_t *req, unsigned long long n);
+void aept_mirror_end(aept_mirror_req_t *req, int ok);
+
+/* Time a HEAD request for the package list on every mirror of each
+ * source that has more than one and was not probed before, in parallel
+ * on up to download_jobs threads.  Call before workers start. */
+void aept_mirror_probe(struct aept_ctx *ctx);
+
+/* Indices of the mirrors of source src, best first, into order, which
+ * has room for nmirrors.  With mirror_split set, the mirrors that did
+ * not fail are rotated by shift, so that consecutive downloads start
+ * at different ones.  Returns nmirrors. */
+int aept_mirror_order(struct aept_ctx *ctx, int src, unsigned int shift,
+                      int *order);
+
+/* Warn about sources with a mirror that is not reached over https. */
+void aept_mirror_check_transport(struct aept_ctx *ctx);
+
+#endif
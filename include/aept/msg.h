@@ -21,6 +21,12 @@ enum aept_log_level {
  * cleared by aept_cleanup().  Immutable after aept_init() returns. */
 void aept_log_set_ctx(struct aept_ctx *ctx);
 
+/* Set the log callback of ctx.  The callback is called without any
+ * lock held, from whichever thread logs, and may call into aept. */
+void aept_log_set_fn(struct aept_ctx *ctx,
+                     void (*fn)(int level, const char *msg, void *userdata),
+                     void *userdata);
+
 void aept_log(int level, const char *file, int line, const char *fmt, ...)
     __attribute__((format(printf, 4, 5)));
 
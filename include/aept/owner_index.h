@@ -18,25 +18,56 @@ struct aept_ctx;
  * and threads it through do_install_package, do_upgrade_package, and
  * aept_do_remove so that later clash checks see the effects of
  * earlier steps in the same transaction.
+ *
+ * The index is persisted in {info_dir}.owners, keyed on the state of
+ * info_dir.  A transaction that completes saves the updated index, and
+ * the next one maps it in place of rebuilding it from the .list files.
+ * An index built from the .list files is kept in memory in the same
+ * compact form, with the paths sorted and front coded (see
+ * owner_index.c), so that no path costs an allocation of its own.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aept/archive.h"
+#include "aept/util.h"
+
+/* Records per front-coded block of the main index */
+#define AEPT_OWNER_INDEX_BLOCK 16
+
 typedef struct {
-    char *path;            /* normalized: no leading "./" or "/" */
+    const char *path;      /* no leading "./" or "/", root is "." */
     const char *owner;     /* shared pointer into owners[] */
 } aept_owner_entry_t;
 
 typedef struct aept_owner_index {
-    /* Main index, sorted by path.  Populated once at build time. */
-    aept_owner_entry_t *entries;
-    int count;
-    int alloc;
+    /* Main index, sorted by path and front coded: the paths of a block
+     * of records start at blocks[n / AEPT_OWNER_INDEX_BLOCK].  Either
+     * mapped from disk (map set) or built from the .list files (the
+     * built_ arrays set). */
+    void *map;
+    size_t map_size;
+    uint32_t *built_blocks;
+    uint32_t *built_slots;
+    char *built_paths;
+    const uint32_t *blocks;
+    size_t n_blocks;
+    const uint32_t *rec_slots; /* owner slot of each record */
+    size_t n_recs;
+    const char *paths;
+    size_t paths_size;
+    const char **rec_owners;   /* owner slot -> pointer into owners[] */
+    uint32_t n_rec_owners;
 
-    /* Entries added during the transaction, sorted by path. */
+    /* Entries added during the transaction, sorted by path.  Their
+     * paths live in recent_paths. */
     aept_owner_entry_t *recent;
     int n_recent;
     int recent_alloc;
+    aept_arena_t recent_paths;
 
-    /* Live interned owner-name strings referenced by entries[]/recent[]. */
+    /* Live interned owner-name strings referenced by the main index and recent[]. */
     char **owners;
     int n_owners;
     int owners_alloc;
@@ -56,15 +87,40 @@ void aept_owner_index_free(aept_owner_index_t *idx);
 /* Walk {info_dir} and populate the index from every *.list file. */
 int aept_owner_index_build(struct aept_ctx *ctx, aept_owner_index_t *idx);
 
+/* Map the persistent index into the empty idx.  Returns -1 if it is
+ * missing, corrupt, or was saved for a different state of info_dir. */
+int aept_owner_index_load(struct aept_ctx *ctx, aept_owner_index_t *idx);
+
+/* Load the persistent index into the empty idx, or build it if that
+ * fails.  In low-memory mode a built index is saved and mapped again,
+ * so that its tables are backed by the file rather than the heap.  Called
+ * with the lock held.  Returns 0 on success, -1 on error. */
+int aept_owner_index_open(struct aept_ctx *ctx, aept_owner_index_t *idx);
+
+/* Persist idx, including the changes made during the transaction, for
+ * the current state of info_dir.  Returns 0 on success, -1 on error. */
+int aept_owner_index_save(struct aept_ctx *ctx, aept_owner_index_t *idx);
+
+/* Delete the persistent index, e.g. after a transaction failed part way
+ * and the changes it tracked may not match info_dir. */
+void aept_owner_index_discard(struct aept_ctx *ctx);
+
 /* Return the package that owns path, or NULL if unknown.  The returned
  * pointer is owned by the index. */
 const char *aept_owner_index_find(aept_owner_index_t *idx, const char *path);
 
-/* Notify the index that owner_name has been (re)installed.  Reads
- * list_path (a freshly written .list file) and appends its entries. */
-int aept_owner_index_add_owner_files(aept_owner_index_t *idx,
-                                     const char *owner_name,
-                                     const char *list_path);
+/* Call fn for every package whose file list contains exactly path, in
+ * no particular order.  A package may be reported more than once. */
+void aept_owner_index_foreach_owner(aept_owner_index_t *idx, const char *path,
+                                    void (*fn)(const char *owner,
+                                               void *userdata),
+                                    void *userdata);
+
+/* Notify the index that owner_name has been (re)installed with files,
+ * the entries its .list file was written from. */
+void aept_owner_index_add_files(aept_owner_index_t *idx,
+                                const char *owner_name,
+                                const aept_ar_file_list_t *files);
 
 /* Notify the index that owner_name has been removed.  All entries
  * referencing the owner's current live pointer are invalidated. */
@@ -0,0 +1,48 @@
+/* progress.h - progress reports of downloads, unpacking and scripts
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PROGRESS_H_7BF97F
+#define PROGRESS_H_7BF97F
+
+struct aept_ctx;
+
+/* Minimum time between two reports of the same item */
+#define AEPT_PROGRESS_INTERVAL_NS 100000000LL
+
+/* A running item, on the stack of the thread working on it.  Like the
+ * phase timers, items nest per thread, and aept_progress_add() counts
+ * towards the innermost one.  Without a progress callback or event
+ * queue, an item is inactive and adding to it costs a branch. */
+typedef struct aept_progress {
+    struct aept_ctx *ctx;
+    struct aept_progress *parent;
+    const char *package;
+    unsigned long long done;
+    unsigned long long total;
+    long long next;             /* CLOCK_MONOTONIC ns of the next report */
+    int phase;
+    int active;
+} aept_progress_t;
+
+/* Start an item of phase (AEPT_PHASE_*) for package, total bytes long,
+ * or 0 if unknown.  Reported at once. */
+void aept_progress_begin(struct aept_ctx *ctx, aept_progress_t *p,
+                         int phase, const char *package,
+                         unsigned long long total);
+
+/* Count n more bytes done, or restart at done bytes, on the calling
+ * thread's innermost item.  Reported if the last report is old enough. */
+void aept_progress_add(unsigned long long n);
+void aept_progress_set(unsigned long long done);
+
+/* Set the total of the calling thread's innermost item once it becomes
+ * known, e.g. from the response headers of a download. */
+void aept_progress_total(unsigned long long total);
+
+/* End the item; if ok, it is reported as complete. */
+void aept_progress_end(aept_progress_t *p, int ok);
+
+#endif
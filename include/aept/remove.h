@@ -12,8 +12,9 @@
 struct aept_ctx;
 struct aept_owner_index;
 
-/* Remove package files listed in {info_dir}/{name}.list.
- * Files present in protected are skipped. */
+/* Remove package files listed in {info_dir}/{name}.list on up to
+ * remove_jobs threads, then the directories that are left empty.
+ * Files present in protected and modified conffiles are skipped. */
 int aept_remove_files(struct aept_ctx *ctx, const char *name,
                       aept_fileset_t *protected);
 
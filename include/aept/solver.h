@@ -8,6 +8,7 @@
 #define SOLVER_H_7BF97F
 
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include <solv/pool.h>
 #include <solv/solver.h>
@@ -15,8 +16,8 @@
 
 struct aept_ctx;
 
-#define AEPT_MAX_REPOS   64
-#define AEPT_MAX_CMDLINE 256
+/* Repo key holding the Delta-From field of a package, one delta per line */
+#define AEPT_DELTA_FROM_KEY "aept:delta-from"
 
 typedef struct {
     Id id;
@@ -31,14 +32,16 @@ typedef struct {
 typedef struct aept_solver {
     Pool *pool;
     Repo *installed_repo;
-    Repo *repos[AEPT_MAX_REPOS];
-    int repo_source_index[AEPT_MAX_REPOS];
+    Repo **repos;
+    int *repo_source_index;
     int nrepos;
+    int repos_alloc;
     Solver *solv;
     Transaction *trans;
     Repo *commandline_repo;
-    aept_cmdline_entry_t cmdline_entries[AEPT_MAX_CMDLINE];
+    aept_cmdline_entry_t *cmdline_entries;   /* sorted by id */
     int ncmdline;
+    int cmdline_alloc;
     aept_pin_entry_t *pins;
     int npins;
 } aept_solver_t;
@@ -47,10 +50,35 @@ typedef struct aept_solver {
 
 int  aept_solver_init(struct aept_ctx *ctx);
 void aept_solver_fini(struct aept_ctx *ctx);
+/* Load the Packages list fp as repo name. If cache_path is set, a binary
+ * cache kept there is used instead of parsing fp when it is current, and
+ * (re)written otherwise. */
 int  aept_solver_load_repo(struct aept_ctx *ctx, const char *name,
-                           FILE *fp, int source_index);
+                           FILE *fp, const char *cache_path,
+                           int source_index);
 int  aept_solver_load_installed(struct aept_ctx *ctx, FILE *fp);
-Id   aept_solver_load_local(struct aept_ctx *ctx, const char *path);
+
+/* Header identifying the state st of a cached repo's source, for the
+ * snapshot functions below. Caller frees. */
+char *aept_solver_cache_key(struct aept_ctx *ctx, const struct stat *st);
+
+/* Create the installed repo from the snapshot at cache_path. Returns -1,
+ * leaving no installed repo, if there is none or it was not saved with
+ * the same key. */
+int  aept_solver_load_installed_snapshot(struct aept_ctx *ctx,
+                                         const char *cache_path,
+                                         const char *key);
+
+/* Save the installed repo as a snapshot. Failure is not an error. */
+void aept_solver_save_installed_snapshot(struct aept_ctx *ctx,
+                                         const char *cache_path,
+                                         const char *key);
+/* Add the local package files paths[0..count) to the command line repo,
+ * with ids[i] set to the solvable of paths[i]. The control files are
+ * read on up to install_jobs threads. Returns 0 on success, -1 if a
+ * package cannot be read. */
+int  aept_solver_load_locals(struct aept_ctx *ctx, const char **paths,
+                             int count, Id *ids);
 int  aept_solver_resolve_install(struct aept_ctx *ctx,
                                  const char **names, int count,
                                  const Id *local_ids, int local_count);
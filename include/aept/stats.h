@@ -0,0 +1,36 @@
+/* stats.h - phase timers and counters
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STATS_H_7BF97F
+#define STATS_H_7BF97F
+
+#include <time.h>
+
+struct aept_ctx;
+
+/* A running phase timer, on the stack of the thread that started it. */
+typedef struct aept_stats_timer {
+    struct aept_ctx *ctx;
+    struct aept_stats_timer *parent;
+    struct timespec wall;
+    struct timespec cpu;
+    int phase;
+} aept_stats_timer_t;
+
+/* Start charging the calling thread's time to phase (AEPT_PHASE_*).
+ * A phase started while another one runs on the same thread pauses
+ * the outer one until aept_stats_end(). */
+void aept_stats_begin(struct aept_ctx *ctx, aept_stats_timer_t *t,
+                      int phase);
+void aept_stats_end(aept_stats_timer_t *t);
+
+/* Add n to counter (AEPT_STAT_*). */
+void aept_stats_add(struct aept_ctx *ctx, int counter, unsigned long long n);
+
+/* Seconds since t was started, for log messages. */
+double aept_stats_elapsed(const aept_stats_timer_t *t);
+
+#endif
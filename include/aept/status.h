@@ -12,15 +12,38 @@
 struct aept_ctx;
 
 /* Load the installed-package database from {info_dir}/*.control into
- * the solver as the installed repo. */
+ * the solver as the installed repo. A binary snapshot in {info_dir}.solv
+ * is used instead while info_dir is unchanged, and refreshed otherwise.
+ * With info_db set, the stanzas come from {info_dir}.db. */
 int aept_status_load(struct aept_ctx *ctx);
 
+/* Publish the state of info_dir as the next generation for queries,
+ * if it changed since the last one, bringing {info_dir}.db up to date
+ * first.  Called with the lock held at the end of a transaction.
+ * Returns 0 on success, -1 on error. */
+int aept_status_publish(struct aept_ctx *ctx);
+
+/* The directory queries read the package database from: the last
+ * published generation, or info_dir if there is none.  Needs no lock.
+ * The caller frees the result. */
+char *aept_status_read_dir(struct aept_ctx *ctx);
+
 /* Read raw control fields from control_src, append a
  * "Status: install ok <state>" line, and write the result to
  * dest_path atomically (tmp + rename). */
 int aept_status_add(struct aept_ctx *ctx, const char *control_src,
                     const char *dest_path, const char *state);
 
+/* Begin a transaction on the auto-installed set.  The set is read from
+ * auto_file once and kept in memory until the matching commit; nested
+ * begin/commit pairs join the outermost one. */
+void aept_status_auto_begin(struct aept_ctx *ctx);
+
+/* End a transaction begun by aept_status_auto_begin().  The outermost
+ * commit writes a changed set back to auto_file atomically (tmp +
+ * rename) and drops it. */
+int aept_status_auto_commit(struct aept_ctx *ctx);
+
 /* Mark a package as auto-installed. */
 int aept_status_mark_auto(struct aept_ctx *ctx, const char *name);
 
@@ -0,0 +1,49 @@
+/* store.h - unpacked package store
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STORE_H_7BF97F
+#define STORE_H_7BF97F
+
+#include <solv/pool.h>
+
+#include "aept/archive.h"
+#include "aept/util.h"
+
+struct aept_ctx;
+
+/* Directory of the store entry for solvable p, or NULL if no
+ * unpacked_store is configured or p has no checksum.  The entry need
+ * not exist yet.  Caller frees. */
+char *aept_store_entry_path(struct aept_ctx *ctx, Pool *pool, Id p);
+
+/* Non-zero if the entry has been published. */
+int aept_store_exists(const char *entry);
+
+/* List the data paths of a published entry like aept_ar_list_paths().
+ * Returns 0 on success, -1 on error. */
+int aept_store_list(const char *entry, aept_ar_file_list_t *out);
+
+/* Unpack an open data archive into a new store entry and publish it.
+ * If another process publishes the same entry first, its copy is kept.
+ * Returns 0 on success, 1 if the archive holds something the store
+ * cannot represent, such as a device node, and -1 on error. */
+int aept_store_add(struct aept_ctx *ctx, const char *entry,
+                   struct aept_ar *ar);
+
+/* Create the files of a published entry below prefix, with the same
+ * arguments and results as aept_ar_extract_all().  With store_hardlinks
+ * set, files in no_link (if non-NULL) are still copied rather than
+ * linked, so that editing them cannot change the store.  The manifest
+ * has the digest of each file, so the unchanged ones are found without
+ * reading any content. */
+int aept_store_extract(struct aept_ctx *ctx, const char *entry,
+                       const char *prefix, unsigned long *size,
+                       aept_fileset_t *conffiles, const char *cf_suffix,
+                       aept_fileset_t *no_link,
+                       aept_ar_file_list_t *recorded,
+                       aept_ar_installed_t *installed);
+
+#endif
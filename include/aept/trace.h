@@ -0,0 +1,40 @@
+/* trace.h - trace-event spans for profiling transactions
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TRACE_H_7BF97F
+#define TRACE_H_7BF97F
+
+struct aept_ctx;
+
+/* Spans are written as complete events ("ph":"X") of the Chrome trace
+ * event format, which Perfetto and chrome://tracing load, one track per
+ * thread. */
+typedef struct aept_trace aept_trace_t;
+
+/* A running span, on the stack of the thread that started it.  what
+ * and package are borrowed until aept_trace_end(). */
+typedef struct aept_trace_span {
+    struct aept_ctx *ctx;
+    const char *what;
+    const char *package;
+    long long start;            /* CLOCK_MONOTONIC ns, 0 if not traced */
+} aept_trace_span_t;
+
+/* Start writing spans to the file named by $AEPT_TRACE or else by the
+ * trace_file option, if either is set.  Returns -1 if it cannot be
+ * created. */
+int aept_trace_open(struct aept_ctx *ctx);
+
+/* Finish the file, if any. */
+void aept_trace_close(struct aept_ctx *ctx);
+
+/* Time what (e.g. "solve", "postinst") for package, or NULL.  Without
+ * a trace file these cost a branch. */
+void aept_trace_begin(struct aept_ctx *ctx, aept_trace_span_t *span,
+                      const char *what, const char *package);
+void aept_trace_end(aept_trace_span_t *span);
+
+#endif
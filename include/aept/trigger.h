@@ -25,7 +25,8 @@ typedef struct {
 void aept_trigger_ctx_init(aept_trigger_ctx_t *tctx);
 void aept_trigger_ctx_free(aept_trigger_ctx_t *tctx);
 
-/* Record a directory path as modified.  Deduplicates. */
+/* Record a directory path as modified.  Duplicates are dropped when
+ * the triggers run. */
 void aept_trigger_ctx_add_dir(aept_trigger_ctx_t *tctx, const char *dir);
 
 /* Record a package as freshly installed/upgraded. */
@@ -36,8 +37,13 @@ int aept_trigger_ctx_collect_dirs(struct aept_ctx *ctx,
                                   aept_trigger_ctx_t *tctx,
                                   const char *name);
 
-/* Fire all pending triggers after transaction completes.
- * Scans info_dir/*.triggers directly to find interested packages. */
+/* Fire all pending triggers after transaction completes.  Interested
+ * packages come from the trigger index in {info_dir}.triggers, which is
+ * rebuilt from info_dir/*.triggers when any of them has changed. */
 int aept_trigger_run_all(struct aept_ctx *ctx, aept_trigger_ctx_t *tctx);
 
+/* Drop the trigger index.  Called whenever a .triggers file is installed
+ * so the next aept_trigger_run_all() picks it up. */
+void aept_trigger_index_invalidate(struct aept_ctx *ctx);
+
 #endif
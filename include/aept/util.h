@@ -12,19 +12,58 @@
 
 struct aept_ctx;
 
+/* Strings that are freed together.  Each one costs its length plus the
+ * terminator, and strings added one after the other are adjacent in
+ * memory.  A zeroed arena is empty. */
+typedef struct aept_arena_chunk aept_arena_chunk_t;
+
+typedef struct {
+    aept_arena_chunk_t *head;
+    size_t used;
+    size_t size;
+} aept_arena_t;
+
+/* Open-addressing hash table from paths to non-negative ints.  Leading
+ * "./" and "/" are ignored, so "/etc/foo" and "etc/foo" are the same
+ * key.  Keys are not copied and must outlive the map.  Each slot keeps
+ * the full hash of its key, so a probe compares strings only on a hash
+ * match and never allocates. */
+typedef struct {
+    const char *key;       /* NULL if free */
+    unsigned int hash;
+    int value;             /* -1 for a deleted entry */
+} aept_pathmap_slot_t;
+
+typedef struct {
+    aept_pathmap_slot_t *slots;
+    unsigned int mask;     /* number of slots - 1, a power of two */
+    int count;             /* live entries */
+    int used;              /* live and deleted entries */
+} aept_pathmap_t;
+
+/* Set of normalized paths in insertion order, indexed by a path map.
+ * Adding a path that is present already does nothing. */
 typedef struct {
-    char **paths;
+    char **paths;          /* point into strings */
     int count;
     int alloc;
-    int sorted;
+    aept_pathmap_t index;  /* path -> position in paths */
+    aept_arena_t strings;
 } aept_fileset_t;
 
 void *aept_malloc(size_t size);
 void *aept_realloc(void *ptr, size_t size);
 char *aept_strdup(const char *s);
+char *aept_strndup(const char *s, size_t n);
 int aept_asprintf(char **strp, const char *fmt, ...)
 	__attribute__((format(printf, 2, 3)));
 
+/* Copy s, or its first len bytes, into the arena.  The copy lives
+ * until aept_arena_free(). */
+char *aept_arena_strdup(aept_arena_t *a, const char *s);
+char *aept_arena_strndup(aept_arena_t *a, const char *s, size_t len);
+void aept_arena_free(aept_arena_t *a);
+
 int aept_pkg_name_is_safe(const char *name);
 int aept_symlink_target_is_recordable(const char *target);
 int aept_archive_path_is_safe(const char *path);
@@ -35,13 +74,50 @@ int aept_file_is_dir(const char *path);
 int aept_file_copy(const char *src, const char *dst);
 int aept_file_mkdir_hier(const char *path, mode_t mode);
 
+/* Flush the filesystems holding the package root and the package
+ * database if the durability option asks for it at this scope
+ * (AEPT_DURABILITY_PACKAGE after each package, _TRANSACTION at the end
+ * of a transaction). */
+void aept_durability_barrier(struct aept_ctx *ctx, int scope);
+
 int aept_system(const char *argv[]);
+/* Run argv and return its exit status, or -1 if it could not be run or
+ * was killed.  With offline_root set, argv runs chrooted there and, when
+ * not root, in a user namespace mapping the caller to root.  Those are
+ * entered once, by a helper process started on the first call that
+ * spawns all later commands until aept_root_helper_stop(). If setting
+ * them up fails, the result is AEPT_EXIT_SETUP_FAILED. */
 int aept_system_offline_root(struct aept_ctx *ctx, const char *argv[]);
 
+/* End the helper of aept_system_offline_root(), if one is running. */
+void aept_root_helper_stop(struct aept_ctx *ctx);
+
+void aept_pathmap_init(aept_pathmap_t *m);
+void aept_pathmap_free(aept_pathmap_t *m);
+/* Map key to value, replacing the value of an equal key. */
+void aept_pathmap_put(aept_pathmap_t *m, const char *key, int value);
+/* Return the value of key, or -1 if it is not in m. */
+int aept_pathmap_get(const aept_pathmap_t *m, const char *key);
+/* Remove key.  Returns its value, or -1 if it was not in m. */
+int aept_pathmap_del(aept_pathmap_t *m, const char *key);
+
 void aept_fileset_init(aept_fileset_t *fs);
 void aept_fileset_add(aept_fileset_t *fs, const char *path);
+/* Put the paths in strcmp() order, for writing them out */
 void aept_fileset_sort(aept_fileset_t *fs);
 int aept_fileset_contains(aept_fileset_t *fs, const char *path);
+int aept_fileset_remove(aept_fileset_t *fs, const char *path);
 void aept_fileset_free(aept_fileset_t *fs);
 
+/* Task callback for aept_parallel_run(). Returns 0 or -1. */
+typedef int (*aept_task_fn)(struct aept_ctx *ctx, int i, void *arg);
+
+/* Run fn(ctx, i, arg) for every i in [0, count) on up to jobs threads,
+ * the calling thread included. Tasks are started in index order and no
+ * new ones are started once the operation is cancelled. results[i] gets
+ * the return value of task i and is left untouched for tasks that never
+ * ran. Worker threads have the logging context set to ctx. */
+void aept_parallel_run(struct aept_ctx *ctx, int count, int jobs,
+                       aept_task_fn fn, void *arg, int *results);
+
 #endif
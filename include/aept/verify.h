@@ -9,7 +9,8 @@
 
 struct aept_ctx;
 
-/* Verify file signature using usign. Returns 0 on success, -1 on failure. */
+/* Verify the usign signature sigfile of file against the keys in
+ * usign_keydir.  Returns 0 on success, -1 on failure. */
 int aept_verify_signature(struct aept_ctx *ctx, const char *file,
                           const char *sigfile);
 
@@ -44,6 +44,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -292,6 +293,7 @@ fetch_connect(struct url *cache_url, struct url *url, int af, int verbose)
 	return (conn);
 }
 
+static pthread_mutex_t connection_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 static conn_t *connection_cache;
 static int cache_global_limit = 0;
 static int cache_per_host_limit = 0;
@@ -303,6 +305,7 @@ void
 fetchConnectionCacheInit(int global_limit, int per_host_limit)
 {
 
+	pthread_mutex_lock(&connection_cache_lock);
 	if (global_limit < 0)
 		cache_global_limit = INT_MAX;
 	else if (per_host_limit > global_limit)
@@ -313,6 +316,7 @@ fetchConnectionCacheInit(int global_limit, int per_host_limit)
 		cache_per_host_limit = INT_MAX;
 	else
 		cache_per_host_limit = per_host_limit;
+	pthread_mutex_unlock(&connection_cache_lock);
 }
 
 /*
@@ -323,10 +327,12 @@ fetchConnectionCacheClose(void)
 {
 	conn_t *conn;
 
+	pthread_mutex_lock(&connection_cache_lock);
 	while ((conn = connection_cache) != NULL) {
 		connection_cache = conn->next_cached;
 		(*conn->cache_close)(conn);
 	}
+	pthread_mutex_unlock(&connection_cache_lock);
 }
 
 /*
@@ -338,6 +344,7 @@ fetch_cache_get(const struct url *url, int af)
 {
 	conn_t *conn, *last_conn = NULL;
 
+	pthread_mutex_lock(&connection_cache_lock);
 	for (conn = connection_cache; conn; conn = conn->next_cached) {
 		if (conn->cache_url->port == url->port &&
 		    strcmp(conn->cache_url->scheme, url->scheme) == 0 &&
@@ -350,9 +357,12 @@ fetch_cache_get(const struct url *url, int af)
 				last_conn->next_cached = conn->next_cached;
 			else
 				connection_cache = conn->next_cached;
+			pthread_mutex_unlock(&connection_cache_lock);
 			return conn;
 		}
+		last_conn = conn;
 	}
+	pthread_mutex_unlock(&connection_cache_lock);
 
 	return NULL;
 }
@@ -373,6 +383,7 @@ fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 		return;
 	}
 
+	pthread_mutex_lock(&connection_cache_lock);
 	global_count = host_count = 0;
 	last = NULL;
 	for (iter = connection_cache; iter; iter = next_cached) {
@@ -396,6 +407,7 @@ fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 	conn->cache_close = closecb;
 	conn->next_cached = connection_cache;
 	connection_cache = conn;
+	pthread_mutex_unlock(&connection_cache_lock);
 }
 
 /*
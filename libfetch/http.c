@@ -187,6 +187,11 @@ http_fillbuf(struct httpio *io, size_t len)
 			io->error = 1;
 			return (-1);
 		}
+		/* connection closed before the announced length arrived */
+		if (io->buflen == 0 && io->contentlength > 0) {
+			io->error = 1;
+			return (-1);
+		}
 		if (io->contentlength)
 			io->contentlength -= io->buflen;
 		io->bufpos = 0;
@@ -285,7 +290,9 @@ http_closefn(void *v)
 	struct httpio *io = (struct httpio *)v;
 	conn_t *conn = io->conn;
 
-	if (io->keep_alive) {
+	/* Only recycle connections whose response body was fully consumed */
+	if (io->keep_alive && !io->error &&
+	    (io->chunked ? io->eof : io->contentlength == 0)) {
 		fetch_cache_put(conn, fetch_close);
 	} else {
 		fetch_close(conn);
@@ -999,6 +1006,9 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 			/* fall through so we can get the full error message */
 		}
 
+		/* HTTP/1.1 connections are persistent unless told otherwise */
+		keep_alive = strncmp(conn->buf, "HTTP/1.1", 8) == 0;
+
 		/* get headers */
 		do {
 			switch ((h = http_next_header(conn, &p))) {
@@ -1009,7 +1019,10 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				goto protocol_error;
 			case hdr_connection:
 				/* XXX too weak? */
-				keep_alive = (strcasecmp(p, "keep-alive") == 0);
+				if (strcasecmp(p, "keep-alive") == 0)
+					keep_alive = 1;
+				else if (strcasecmp(p, "close") == 0)
+					keep_alive = 0;
 				break;
 			case hdr_content_length:
 				clength = fetch_parseuint(p, &q, 10, OFF_MAX);
@@ -7,15 +7,26 @@ from .aept import (
     LogLevel,
     PkgEntry,
     PkgInfo,
+    Progress,
+    Query,
     Transaction,
+    VerifyProblem,
+    VerifyResult,
 )
+from .aio import AsyncAept, LogEvent
 
 __all__ = [
     "Aept",
     "AeptError",
+    "AsyncAept",
     "Flag",
+    "LogEvent",
     "LogLevel",
     "PkgEntry",
     "PkgInfo",
+    "Progress",
+    "Query",
     "Transaction",
+    "VerifyProblem",
+    "VerifyResult",
 ]
@@ -18,6 +18,8 @@ void aept_cleanup(aept_ctx_t *ctx);
 int  aept_load_config(aept_ctx_t *ctx, const char *path);
 void aept_set_offline_root(aept_ctx_t *ctx, const char *path);
 void aept_set_verbosity(aept_ctx_t *ctx, int level);
+void aept_set_download_jobs(aept_ctx_t *ctx, int jobs);
+void aept_set_download_rate(aept_ctx_t *ctx, int kib);
 
 /* --- Flags --------------------------------------------------------------- */
 
@@ -34,6 +36,9 @@ enum {
     AEPT_FLAG_NON_INTERACTIVE,
     AEPT_FLAG_CHECK_SIGNATURE,
     AEPT_FLAG_IGNORE_UID,
+    AEPT_FLAG_KEEP_GOING,
+    AEPT_FLAG_PIPELINE_DOWNLOADS,
+    AEPT_FLAG_PREFETCH,
 };
 
 void aept_set_flag(aept_ctx_t *ctx, int flag, int value);
@@ -64,16 +69,97 @@ void aept_set_display_fn(aept_ctx_t *ctx, aept_display_fn fn, void *userdata);
 typedef int (*aept_confirm_fn)(void *userdata);
 void aept_set_confirm_fn(aept_ctx_t *ctx, aept_confirm_fn fn, void *userdata);
 
+typedef void (*aept_progress_fn)(int phase, const char *package,
+                                 unsigned long long done,
+                                 unsigned long long total, void *userdata);
+void aept_set_progress_fn(aept_ctx_t *ctx, aept_progress_fn fn,
+                          void *userdata);
+
 /* --- Cancellation -------------------------------------------------------- */
 
 void aept_cancel(aept_ctx_t *ctx);
 
+/* --- Event queue --------------------------------------------------------- */
+
+enum {
+    AEPT_EVENT_LOG = 0,
+    AEPT_EVENT_PROGRESS = 1,
+};
+
+typedef struct aept_event {
+    int type;
+    int level;
+    char *text;
+    int phase;
+    unsigned long long done;
+    unsigned long long total;
+} aept_event_t;
+
+int  aept_events_open(aept_ctx_t *ctx);
+int  aept_events_take(aept_ctx_t *ctx, aept_event_t *out, int max);
+void aept_events_free(aept_event_t *events, int count);
+
+/* --- Statistics ---------------------------------------------------------- */
+
+enum {
+    AEPT_PHASE_LOAD     = 0,
+    AEPT_PHASE_SOLVE    = 1,
+    AEPT_PHASE_DOWNLOAD = 2,
+    AEPT_PHASE_VERIFY   = 3,
+    AEPT_PHASE_CLASH    = 4,
+    AEPT_PHASE_UNPACK   = 5,
+    AEPT_PHASE_REMOVE   = 6,
+    AEPT_PHASE_SCRIPTS  = 7,
+    AEPT_PHASE_TRIGGERS = 8,
+    AEPT_PHASE_COUNT    = 9
+};
+
+typedef struct {
+    double wall;
+    double cpu;
+    unsigned long count;
+} aept_phase_stats_t;
+
+typedef struct {
+    aept_phase_stats_t phase[9];
+    unsigned long long bytes_downloaded;
+    unsigned long long files_downloaded;
+    unsigned long long bytes_extracted;
+    unsigned long long files_extracted;
+    unsigned long long files_unchanged;
+    unsigned long long files_removed;
+    unsigned long long scripts_run;
+    unsigned long long peak_rss;
+} aept_stats_t;
+
+void aept_get_stats(aept_ctx_t *ctx, aept_stats_t *out);
+void aept_reset_stats(aept_ctx_t *ctx);
+const char *aept_phase_name(int phase);
+
+typedef struct {
+    const char *source;
+    const char *url;
+    double latency;
+    double throughput;
+    unsigned long long bytes_downloaded;
+    unsigned long requests;
+    unsigned long failures;
+    int down;
+} aept_mirror_stats_t;
+
+int aept_get_mirror_stats(aept_ctx_t *ctx, aept_mirror_stats_t *out,
+                          int max);
+
 /* --- Mutating operations ------------------------------------------------- */
 
 int aept_update(aept_ctx_t *ctx);
 int aept_install(aept_ctx_t *ctx, const char **names, int name_count,
                  const char **local_paths, int local_count);
 int aept_upgrade(aept_ctx_t *ctx);
+int aept_install_roots(aept_ctx_t *ctx, const char *const *roots, int nroots,
+                       const char **names, int name_count,
+                       const char **local_paths, int local_count,
+                       int *results);
 int aept_remove(aept_ctx_t *ctx, const char **names, int count);
 int aept_autoremove(aept_ctx_t *ctx);
 int aept_clean(aept_ctx_t *ctx);
@@ -84,6 +170,10 @@ int aept_mark_auto(aept_ctx_t *ctx, const char **names, int count);
 int aept_mark_manual(aept_ctx_t *ctx, const char **names, int count);
 int aept_mark_manual_all(aept_ctx_t *ctx);
 
+int aept_db_import(aept_ctx_t *ctx);
+int aept_db_export(aept_ctx_t *ctx, const char *dir);
+int aept_db_compact(aept_ctx_t *ctx);
+
 /* --- Query: list --------------------------------------------------------- */
 
 typedef struct {
@@ -99,10 +189,18 @@ typedef struct {
     int count;
 } aept_pkg_list_t;
 
+/* Return nonzero to stop the iteration early. */
+typedef int (*aept_list_fn)(const aept_pkg_entry_t *entry, void *userdata);
+
 int  aept_list(aept_ctx_t *ctx, const char *pattern,
                int filter_installed, int filter_upgradable,
                aept_pkg_list_t *out);
+int  aept_list_foreach(aept_ctx_t *ctx, const char *pattern,
+                       int filter_installed, int filter_upgradable,
+                       aept_list_fn fn, void *userdata);
 void aept_pkg_list_free(aept_pkg_list_t *list);
+int  aept_list_upgradable_cached(aept_ctx_t *ctx, const char *pattern,
+                                 aept_pkg_list_t *out);
 
 /* --- Query: show --------------------------------------------------------- */
 
@@ -136,7 +234,76 @@ int aept_files(aept_ctx_t *ctx, const char *name,
 int aept_owns(aept_ctx_t *ctx, const char *path,
               char ***owners_out, int *count_out);
 
+typedef struct {
+    char **owners;
+    int    count;
+} aept_owns_result_t;
+
+int  aept_owns_many(aept_ctx_t *ctx, const char *const *paths, int count,
+                    aept_owns_result_t **results_out);
+void aept_owns_results_free(aept_owns_result_t *results, int count);
+
 int aept_architectures(aept_ctx_t *ctx, char ***archs_out, int *count_out);
+
+/* --- Query: reverse dependencies ---------------------------------------- */
+
+enum {
+    AEPT_WHATDEPENDS_RECURSIVE = 1
+};
+
+int aept_whatdepends(aept_ctx_t *ctx, const char *name, int flags,
+                     char ***names_out, int *count_out);
+int aept_autoremovable(aept_ctx_t *ctx, char ***names_out, int *count_out);
+
+/* --- Query: sessions ---------------------------------------------------- */
+
+typedef struct aept_query aept_query_t;
+
+aept_query_t *aept_query_open(aept_ctx_t *ctx);
+void aept_query_close(aept_query_t *q);
+
+int aept_query_list(aept_query_t *q, const char *pattern,
+                    int filter_installed, int filter_upgradable,
+                    aept_pkg_list_t *out);
+int aept_query_list_foreach(aept_query_t *q, const char *pattern,
+                            int filter_installed, int filter_upgradable,
+                            aept_list_fn fn, void *userdata);
+int aept_query_show(aept_query_t *q, const char *name, aept_pkg_info_t *out);
+int  aept_query_show_many(aept_query_t *q, const char *const *names,
+                          int count, aept_pkg_info_t **infos_out);
+void aept_pkg_infos_free(aept_pkg_info_t *infos, int count);
+int aept_query_files(aept_query_t *q, const char *name,
+                     char ***paths_out, int *count_out);
+int aept_query_owns(aept_query_t *q, const char *path,
+                    char ***owners_out, int *count_out);
+int aept_query_owns_many(aept_query_t *q, const char *const *paths,
+                         int count, aept_owns_result_t **results_out);
+int aept_query_whatdepends(aept_query_t *q, const char *name, int flags,
+                           char ***names_out, int *count_out);
+int aept_query_autoremovable(aept_query_t *q, char ***names_out,
+                             int *count_out);
+
+/* --- Query: verify ------------------------------------------------------- */
+
+enum {
+    AEPT_VERIFY_MISSING    = 1,
+    AEPT_VERIFY_MODIFIED   = 2,
+    AEPT_VERIFY_UNREADABLE = 3
+};
+
+enum {
+    AEPT_VERIFY_QUICK      = 1
+};
+
+typedef struct {
+    char *package;
+    char *path;
+    int   problem;
+} aept_verify_problem_t;
+
+int  aept_verify(aept_ctx_t *ctx, const char **names, int count, int flags,
+                 aept_verify_problem_t **problems_out, int *count_out);
+void aept_verify_problems_free(aept_verify_problem_t *problems, int count);
 """
 
 LIBC_CDEF = """\
@@ -3,7 +3,7 @@
 import sys
 from dataclasses import dataclass
 from enum import IntEnum
-from typing import Callable, List, Optional
+from typing import Callable, Dict, List, Optional
 
 from ._ffi import ffi, lib
 from ._marshalling import c_str_array_to_list, c_to_str, str_list_to_c, str_to_c
@@ -28,6 +28,15 @@ class Flag(IntEnum):
     NON_INTERACTIVE = lib.AEPT_FLAG_NON_INTERACTIVE
     CHECK_SIGNATURE = lib.AEPT_FLAG_CHECK_SIGNATURE
     IGNORE_UID      = lib.AEPT_FLAG_IGNORE_UID
+    KEEP_GOING      = lib.AEPT_FLAG_KEEP_GOING
+    PIPELINE_DOWNLOADS = lib.AEPT_FLAG_PIPELINE_DOWNLOADS
+    PREFETCH        = lib.AEPT_FLAG_PREFETCH
+
+
+class VerifyProblem(IntEnum):
+    MISSING    = lib.AEPT_VERIFY_MISSING
+    MODIFIED   = lib.AEPT_VERIFY_MODIFIED
+    UNREADABLE = lib.AEPT_VERIFY_UNREADABLE
 
 
 class LogLevel(IntEnum):
@@ -76,6 +85,53 @@ class Transaction:
     remove: List[str]
 
 
+@dataclass
+class VerifyResult:
+    package: str
+    path: str
+    problem: VerifyProblem
+
+
+@dataclass
+class Progress:
+    phase: str          # "download", "unpack" or "scripts"
+    package: str
+    done: int           # bytes
+    total: int          # bytes, 0 if unknown
+
+
+@dataclass
+class PhaseStats:
+    wall: float
+    cpu: float
+    count: int
+
+
+@dataclass
+class Stats:
+    phases: Dict[str, PhaseStats]
+    bytes_downloaded: int
+    files_downloaded: int
+    bytes_extracted: int
+    files_extracted: int
+    files_unchanged: int
+    files_removed: int
+    scripts_run: int
+    peak_rss: int
+
+
+@dataclass
+class MirrorStats:
+    source: str
+    url: str
+    latency: Optional[float]
+    throughput: float
+    bytes_downloaded: int
+    requests: int
+    failures: int
+    down: bool
+
+
 # --- Helpers --------------------------------------------------------------
 
 def _txn_to_python(txn):
@@ -91,6 +147,38 @@ def _txn_to_python(txn):
     )
 
 
+def _info_to_python(info):
+    """Convert a C aept_pkg_info_t* to a Python PkgInfo."""
+    return PkgInfo(
+        name=c_to_str(info.name),
+        version=c_to_str(info.version),
+        architecture=c_to_str(info.architecture),
+        installed_size=info.installed_size,
+        depends=c_to_str(info.depends),
+        pre_depends=c_to_str(info.pre_depends),
+        recommends=c_to_str(info.recommends),
+        suggests=c_to_str(info.suggests),
+        provides=c_to_str(info.provides),
+        conflicts=c_to_str(info.conflicts),
+        replaces=c_to_str(info.replaces),
+        homepage=c_to_str(info.homepage),
+        filename=c_to_str(info.filename),
+        summary=c_to_str(info.summary),
+        description=c_to_str(info.description),
+        is_installed=bool(info.is_installed),
+    )
+
+
+def _owns_results_to_python(results, count):
+    """Convert and free a C aept_owns_result_t array."""
+    try:
+        return [[c_to_str(results[i].owners[j])
+                 for j in range(results[i].count)]
+                for i in range(count)]
+    finally:
+        lib.aept_owns_results_free(results, count)
+
+
 # --- Main class -----------------------------------------------------------
 
 class Aept:
@@ -109,6 +197,7 @@ class Aept:
         self._log_cb_handle = None
         self._display_cb_handle = None
         self._confirm_cb_handle = None
+        self._progress_cb_handle = None
         self._pending_exc = None
         self._ctx = lib.aept_init()
         if self._ctx == ffi.NULL:
@@ -134,6 +223,7 @@ class Aept:
         self._log_cb_handle = None
         self._display_cb_handle = None
         self._confirm_cb_handle = None
+        self._progress_cb_handle = None
         self._pending_exc = None
 
     def _call(self, rc, msg="libaept error"):
@@ -158,6 +248,12 @@ class Aept:
     def set_verbosity(self, level: int):
         lib.aept_set_verbosity(self._ctx, int(level))
 
+    def set_download_jobs(self, jobs: int):
+        lib.aept_set_download_jobs(self._ctx, int(jobs))
+
+    def set_download_rate(self, kib: int):
+        lib.aept_set_download_rate(self._ctx, int(kib))
+
     # --- Flags ------------------------------------------------------------
 
     def set_flag(self, flag: int, value: bool):
@@ -232,12 +328,86 @@ class Aept:
         self._confirm_cb_handle = _cb
         lib.aept_set_confirm_fn(self._ctx, _cb, ffi.NULL)
 
+    def set_progress_callback(self, fn: Optional[Callable[[Progress], None]]):
+        """Set a Python progress callback, or None to clear.
+
+        fn signature: fn(progress: Progress)
+
+        Called when a download, unpack or script starts, at most every
+        100 ms while it runs, and when it ends.  Concurrent downloads
+        call it from their worker threads, one at a time.
+        """
+        if fn is None:
+            lib.aept_set_progress_fn(self._ctx, ffi.NULL, ffi.NULL)
+            self._progress_cb_handle = None
+            return
+
+        @ffi.callback("void(int, const char *, unsigned long long, "
+                      "unsigned long long, void *)")
+        def _cb(phase, package, done, total, _userdata):
+            try:
+                fn(Progress(phase=c_to_str(lib.aept_phase_name(phase)),
+                            package=c_to_str(package) or "",
+                            done=done, total=total))
+            except Exception:
+                if self._pending_exc is None:
+                    self._pending_exc = sys.exc_info()
+
+        self._progress_cb_handle = _cb
+        lib.aept_set_progress_fn(self._ctx, _cb, ffi.NULL)
+
     # --- Cancellation -----------------------------------------------------
 
     def cancel(self):
         """Signal cancellation (async-signal-safe)."""
         lib.aept_cancel(self._ctx)
 
+    # --- Statistics -------------------------------------------------------
+
+    def get_stats(self) -> Stats:
+        """Per-phase timings and counters since init or reset_stats()."""
+        st = ffi.new("aept_stats_t *")
+        lib.aept_get_stats(self._ctx, st)
+        phases = {}
+        for i in range(lib.AEPT_PHASE_COUNT):
+            ph = st.phase[i]
+            phases[c_to_str(lib.aept_phase_name(i))] = PhaseStats(
+                wall=ph.wall, cpu=ph.cpu, count=ph.count)
+        return Stats(
+            phases=phases,
+            bytes_downloaded=st.bytes_downloaded,
+            files_downloaded=st.files_downloaded,
+            bytes_extracted=st.bytes_extracted,
+            files_extracted=st.files_extracted,
+            files_unchanged=st.files_unchanged,
+            files_removed=st.files_removed,
+            scripts_run=st.scripts_run,
+            peak_rss=st.peak_rss,
+        )
+
+    def reset_stats(self):
+        lib.aept_reset_stats(self._ctx)
+
+    def get_mirror_stats(self) -> List[MirrorStats]:
+        """What was measured of each mirror of each source.
+
+        Kept by reset_stats(), since it decides which mirror is tried
+        first.
+        """
+        n = lib.aept_get_mirror_stats(self._ctx, ffi.NULL, 0)
+        out = ffi.new("aept_mirror_stats_t[]", max(n, 1))
+        n = lib.aept_get_mirror_stats(self._ctx, out, n)
+        return [MirrorStats(source=c_to_str(out[i].source),
+                            url=c_to_str(out[i].url),
+                            latency=(out[i].latency
+                                     if out[i].latency >= 0 else None),
+                            throughput=out[i].throughput,
+                            bytes_downloaded=out[i].bytes_downloaded,
+                            requests=out[i].requests,
+                            failures=out[i].failures,
+                            down=bool(out[i].down))
+                for i in range(n)]
+
     # --- Mutating operations ----------------------------------------------
 
     def update(self):
@@ -254,6 +424,20 @@ class Aept:
     def upgrade(self):
         self._call(lib.aept_upgrade(self._ctx), "aept_upgrade() failed")
 
+    def install_roots(self, roots: List[str],
+                      names: Optional[List[str]] = None,
+                      local_paths: Optional[List[str]] = None):
+        c_roots, ka1, n_roots = str_list_to_c(roots)
+        c_names, ka2, n_names = str_list_to_c(names or [])
+        c_paths, ka3, n_paths = str_list_to_c(local_paths or [])
+        results = ffi.new("int[]", max(n_roots, 1))
+        rc = lib.aept_install_roots(self._ctx, c_roots, n_roots,
+                                    c_names, n_names, c_paths, n_paths,
+                                    results)
+        failed = [roots[i] for i in range(n_roots) if results[i] != 0]
+        self._call(rc, "aept_install_roots() failed for " +
+                   ", ".join(failed))
+
     def remove(self, names: List[str]):
         c_names, ka, count = str_list_to_c(names)
         self._call(lib.aept_remove(self._ctx, c_names, count),
@@ -289,27 +473,75 @@ class Aept:
         self._call(lib.aept_mark_manual_all(self._ctx),
                    "aept_mark_manual_all() failed")
 
+    def db_import(self):
+        self._call(lib.aept_db_import(self._ctx), "aept_db_import() failed")
+
+    def db_export(self, dir: str):
+        self._call(lib.aept_db_export(self._ctx, str_to_c(dir)),
+                   "aept_db_export() failed")
+
+    def db_compact(self):
+        self._call(lib.aept_db_compact(self._ctx), "aept_db_compact() failed")
+
     # --- Query: list ------------------------------------------------------
 
-    def list_packages(self, pattern: Optional[str] = None, *,
-                      installed: bool = False,
-                      upgradable: bool = False) -> List[PkgEntry]:
-        out = ffi.new("aept_pkg_list_t *")
-        try:
-            self._call(lib.aept_list(self._ctx, str_to_c(pattern),
-                                     int(installed), int(upgradable), out),
-                   "aept_list() failed")
-            result = []
-            for i in range(out.count):
-                e = out.entries[i]
-                result.append(PkgEntry(
+    def _list_callback(self, fn):
+        @ffi.callback("int(const aept_pkg_entry_t *, void *)")
+        def _cb(e, _userdata):
+            try:
+                keep_going = fn(PkgEntry(
                     name=c_to_str(e.name),
                     version=c_to_str(e.version),
                     summary=c_to_str(e.summary),
                     installed=bool(e.installed),
                     upgradable=bool(e.upgradable),
                 ))
-            return result
+                return 1 if keep_going is False else 0
+            except Exception:
+                if self._pending_exc is None:
+                    self._pending_exc = sys.exc_info()
+                return 1
+        return _cb
+
+    def list_packages(self, pattern: Optional[str] = None, *,
+                      installed: bool = False,
+                      upgradable: bool = False) -> List[PkgEntry]:
+        result: List[PkgEntry] = []
+        self.for_each_package(result.append, pattern,
+                              installed=installed, upgradable=upgradable)
+        return result
+
+    def for_each_package(self, fn: Callable[[PkgEntry], Optional[bool]],
+                         pattern: Optional[str] = None, *,
+                         installed: bool = False,
+                         upgradable: bool = False):
+        """Call fn for each matching package as it is produced.
+
+        fn signature: fn(entry: PkgEntry) -> Optional[bool]
+        (return False to stop early)
+        """
+        _cb = self._list_callback(fn)
+        self._call(lib.aept_list_foreach(self._ctx, str_to_c(pattern),
+                                         int(installed), int(upgradable),
+                                         _cb, ffi.NULL),
+                   "aept_list_foreach() failed")
+
+    def list_upgradable_cached(self, pattern: Optional[str] = None
+                               ) -> List[PkgEntry]:
+        """Like list_packages(pattern, upgradable=True), but answered
+        from the summary in upgradable_file while the package lists and
+        the installed packages are unchanged."""
+        out = ffi.new("aept_pkg_list_t *")
+        self._call(lib.aept_list_upgradable_cached(self._ctx,
+                                                   str_to_c(pattern), out),
+                   "aept_list_upgradable_cached() failed")
+        try:
+            return [PkgEntry(name=c_to_str(e.name),
+                             version=c_to_str(e.version),
+                             summary=c_to_str(e.summary),
+                             installed=bool(e.installed),
+                             upgradable=bool(e.upgradable))
+                    for e in (out.entries[i] for i in range(out.count))]
         finally:
             lib.aept_pkg_list_free(out)
 
@@ -322,24 +554,7 @@ class Aept:
                         "aept_show() failed")
             if rc == 1:
                 return None
-            return PkgInfo(
-                name=c_to_str(out.name),
-                version=c_to_str(out.version),
-                architecture=c_to_str(out.architecture),
-                installed_size=out.installed_size,
-                depends=c_to_str(out.depends),
-                pre_depends=c_to_str(out.pre_depends),
-                recommends=c_to_str(out.recommends),
-                suggests=c_to_str(out.suggests),
-                provides=c_to_str(out.provides),
-                conflicts=c_to_str(out.conflicts),
-                replaces=c_to_str(out.replaces),
-                homepage=c_to_str(out.homepage),
-                filename=c_to_str(out.filename),
-                summary=c_to_str(out.summary),
-                description=c_to_str(out.description),
-                is_installed=bool(out.is_installed),
-            )
+            return _info_to_python(out)
         finally:
             lib.aept_pkg_info_free(out)
 
@@ -365,9 +580,222 @@ class Aept:
             return None
         return c_str_array_to_list(owners_out[0], count_out[0])
 
+    def owns_many(self, paths: List[str]) -> List[List[str]]:
+        """Look up the owners of many paths at once.
+
+        Returns one list of owners per path, in order, empty if no
+        installed package owns it.
+        """
+        if not paths:
+            return []
+        c_paths, keepalive, n = str_list_to_c(paths)
+        results_out = ffi.new("aept_owns_result_t **")
+        self._call(lib.aept_owns_many(self._ctx, c_paths, n, results_out),
+                   "aept_owns_many() failed")
+        return _owns_results_to_python(results_out[0], n)
+
+    # --- Query: reverse dependencies --------------------------------------
+
+    def whatdepends(self, name: str, *,
+                    recursive: bool = False) -> Optional[List[str]]:
+        """Installed packages that depend on the installed package name.
+
+        With recursive, also those that depend on it through others.
+        Returns None if name is not installed.
+        """
+        names_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        flags = lib.AEPT_WHATDEPENDS_RECURSIVE if recursive else 0
+        rc = self._call(lib.aept_whatdepends(self._ctx, str_to_c(name), flags,
+                                             names_out, count_out),
+                        "aept_whatdepends() failed")
+        if rc == 1:
+            return None
+        return c_str_array_to_list(names_out[0], count_out[0])
+
+    def autoremovable(self) -> List[str]:
+        """Packages that autoremove() would remove, without removing them."""
+        names_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        self._call(lib.aept_autoremovable(self._ctx, names_out, count_out),
+                   "aept_autoremovable() failed")
+        return c_str_array_to_list(names_out[0], count_out[0])
+
     def architectures(self) -> List[str]:
         archs_out = ffi.new("char ***")
         count_out = ffi.new("int *")
         self._call(lib.aept_architectures(self._ctx, archs_out, count_out),
                "aept_architectures() failed")
         return c_str_array_to_list(archs_out[0], count_out[0])
+
+    # --- Query: sessions --------------------------------------------------
+
+    def query(self) -> "Query":
+        """Open a query session that keeps the package pool loaded.
+
+        Usage::
+
+            with a.query() as q:
+                infos = q.show_many(names)
+        """
+        return Query(self)
+
+    # --- Query: verify ----------------------------------------------------
+
+    def verify(self, names: Optional[List[str]] = None, *,
+               quick: bool = False) -> List[VerifyResult]:
+        """Check installed files against their recorded digests.
+
+        Checks the given packages, or all installed ones if names is
+        empty, and returns the files that do not match.
+        """
+        c_names, keepalive, n = str_list_to_c(names or [])
+        problems_out = ffi.new("aept_verify_problem_t **")
+        count_out = ffi.new("int *")
+        flags = lib.AEPT_VERIFY_QUICK if quick else 0
+        self._call(lib.aept_verify(self._ctx, c_names, n, flags,
+                                   problems_out, count_out),
+                   "aept_verify() failed")
+        problems, count = problems_out[0], count_out[0]
+        try:
+            return [VerifyResult(package=c_to_str(problems[i].package),
+                                 path=c_to_str(problems[i].path),
+                                 problem=VerifyProblem(problems[i].problem))
+                    for i in range(count)]
+        finally:
+            lib.aept_verify_problems_free(problems, count)
+
+
+class Query:
+    """Query session that loads the package pool once for many calls.
+
+    Reloads by itself when the package lists or the installed packages
+    change.  Close it, or use it as a context manager, before closing
+    the Aept object it came from.
+    """
+
+    def __init__(self, aept: Aept):
+        self._aept = aept
+        self._q = lib.aept_query_open(aept._ctx)
+
+    def __enter__(self):
+        return self
+
+    def __del__(self):
+        self.close()
+
+    def __exit__(self, *exc):
+        self.close()
+        return False
+
+    def close(self):
+        """Release the session.  Idempotent."""
+        if self._q != ffi.NULL:
+            lib.aept_query_close(self._q)
+            self._q = ffi.NULL
+
+    def list_packages(self, pattern: Optional[str] = None, *,
+                      installed: bool = False,
+                      upgradable: bool = False) -> List[PkgEntry]:
+        result: List[PkgEntry] = []
+        self.for_each_package(result.append, pattern,
+                              installed=installed, upgradable=upgradable)
+        return result
+
+    def for_each_package(self, fn: Callable[[PkgEntry], Optional[bool]],
+                         pattern: Optional[str] = None, *,
+                         installed: bool = False,
+                         upgradable: bool = False):
+        """Like Aept.for_each_package()."""
+        _cb = self._aept._list_callback(fn)
+        self._aept._call(lib.aept_query_list_foreach(
+                             self._q, str_to_c(pattern), int(installed),
+                             int(upgradable), _cb, ffi.NULL),
+                         "aept_query_list_foreach() failed")
+
+    def show(self, name: str) -> Optional[PkgInfo]:
+        out = ffi.new("aept_pkg_info_t *")
+        try:
+            rc = self._aept._call(lib.aept_query_show(self._q,
+                                                      str_to_c(name), out),
+                                  "aept_query_show() failed")
+            if rc == 1:
+                return None
+            return _info_to_python(out)
+        finally:
+            lib.aept_pkg_info_free(out)
+
+    def show_many(self, names: List[str]) -> List[Optional[PkgInfo]]:
+        """Describe many packages at once.
+
+        Returns one PkgInfo per name, in order, None if there is no
+        such package.
+        """
+        if not names:
+            return []
+        c_names, keepalive, n = str_list_to_c(names)
+        infos_out = ffi.new("aept_pkg_info_t **")
+        self._aept._call(lib.aept_query_show_many(self._q, c_names, n,
+                                                  infos_out),
+                         "aept_query_show_many() failed")
+        infos = infos_out[0]
+        try:
+            return [_info_to_python(infos[i])
+                    if infos[i].name != ffi.NULL else None
+                    for i in range(n)]
+        finally:
+            lib.aept_pkg_infos_free(infos, n)
+
+    def files(self, name: str) -> Optional[List[str]]:
+        paths_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        rc = self._aept._call(lib.aept_query_files(self._q, str_to_c(name),
+                                                   paths_out, count_out),
+                              "aept_query_files() failed")
+        if rc == 1:
+            return None
+        return c_str_array_to_list(paths_out[0], count_out[0])
+
+    def owns(self, path: str) -> Optional[List[str]]:
+        owners_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        rc = self._aept._call(lib.aept_query_owns(self._q, str_to_c(path),
+                                                  owners_out, count_out),
+                              "aept_query_owns() failed")
+        if rc == 1:
+            return None
+        return c_str_array_to_list(owners_out[0], count_out[0])
+
+    def owns_many(self, paths: List[str]) -> List[List[str]]:
+        """Like Aept.owns_many()."""
+        if not paths:
+            return []
+        c_paths, keepalive, n = str_list_to_c(paths)
+        results_out = ffi.new("aept_owns_result_t **")
+        self._aept._call(lib.aept_query_owns_many(self._q, c_paths, n,
+                                                  results_out),
+                         "aept_query_owns_many() failed")
+        return _owns_results_to_python(results_out[0], n)
+
+    def whatdepends(self, name: str, *,
+                    recursive: bool = False) -> Optional[List[str]]:
+        """Like Aept.whatdepends()."""
+        names_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        flags = lib.AEPT_WHATDEPENDS_RECURSIVE if recursive else 0
+        rc = self._aept._call(lib.aept_query_whatdepends(
+                                  self._q, str_to_c(name), flags,
+                                  names_out, count_out),
+                              "aept_query_whatdepends() failed")
+        if rc == 1:
+            return None
+        return c_str_array_to_list(names_out[0], count_out[0])
+
+    def autoremovable(self) -> List[str]:
+        """Like Aept.autoremovable()."""
+        names_out = ffi.new("char ***")
+        count_out = ffi.new("int *")
+        self._aept._call(lib.aept_query_autoremovable(self._q, names_out,
+                                                      count_out),
+                         "aept_query_autoremovable() failed")
+        return c_str_array_to_list(names_out[0], count_out[0])
@@ -0,0 +1,187 @@
+"""asyncio wrapper around the libaept bindings."""
+
+import asyncio
+import functools
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass
+from typing import AsyncIterator, Callable, List, Optional, TypeVar, Union
+
+from ._ffi import ffi, lib
+from ._marshalling import c_to_str
+from .aept import Aept, AeptError, LogLevel, Progress
+
+T = TypeVar("T")
+
+# Events collected per aept_events_take() call
+_BATCH = 256
+
+
+@dataclass
+class LogEvent:
+    level: LogLevel
+    message: str
+
+
+class AsyncAept:
+    """Aept for asyncio programs.
+
+    Every libaept call runs on a worker thread owned by this object, one
+    call at a time, and cffi releases the GIL for as long as it is in C,
+    so a long transaction does not hold up the event loop.  Log messages
+    are queued by libaept and collected by the event loop in batches
+    when the queue's file descriptor becomes readable, instead of
+    entering Python once per line; read them with events().  They no
+    longer reach a callback set with set_log_callback().
+
+    Cancelling the task awaiting an operation cancels the operation with
+    aept_cancel() and waits for it to wind down.  A cancelled context
+    stays cancelled, so open a new one for further operations.
+
+    Usage::
+
+        async with AsyncAept() as a:
+            await a.load_config()
+
+            async def show_log():
+                async for ev in a.events():
+                    if isinstance(ev, LogEvent):
+                        print(ev.level.name, ev.message)
+
+            log = asyncio.create_task(show_log())
+            await a.install(names=["hello"])
+    """
+
+    def __init__(self):
+        self._executor = ThreadPoolExecutor(max_workers=1,
+                                            thread_name_prefix="aept")
+        self._aept: Optional[Aept] = None
+        self._loop: Optional[asyncio.AbstractEventLoop] = None
+        self._queue: Optional[asyncio.Queue] = None
+        self._fd = -1
+        self._buf = ffi.new("aept_event_t[]", _BATCH)
+
+    async def __aenter__(self):
+        await self.open()
+        return self
+
+    async def __aexit__(self, *exc):
+        await self.close()
+        return False
+
+    async def open(self):
+        """Create the context on the worker thread, which libaept's
+        per-thread state then belongs to."""
+        if self._aept is not None:
+            return
+        self._loop = asyncio.get_running_loop()
+        self._queue = asyncio.Queue()
+        self._aept = await self._loop.run_in_executor(self._executor, Aept)
+        self._fd = lib.aept_events_open(self._aept._ctx)
+        if self._fd < 0:
+            raise AeptError("aept_events_open() failed")
+        self._loop.add_reader(self._fd, self._drain)
+
+    async def close(self):
+        """Release the context and end events().  Idempotent."""
+        if self._aept is None:
+            return
+        self._loop.remove_reader(self._fd)
+        self._drain()
+        await self._loop.run_in_executor(self._executor, self._aept.close)
+        self._aept = None
+        self._fd = -1
+        self._executor.shutdown(wait=False)
+        self._queue.put_nowait(None)
+
+    def _drain(self):
+        ctx = self._aept._ctx
+        while True:
+            n = lib.aept_events_take(ctx, self._buf, _BATCH)
+            for i in range(n):
+                ev = self._buf[i]
+                if ev.type == lib.AEPT_EVENT_PROGRESS:
+                    self._queue.put_nowait(Progress(
+                        phase=c_to_str(lib.aept_phase_name(ev.phase)),
+                        package=ffi.string(ev.text).decode("utf-8",
+                                                           "replace"),
+                        done=ev.done, total=ev.total))
+                    continue
+                self._queue.put_nowait(LogEvent(
+                    level=LogLevel(ev.level),
+                    message=ffi.string(ev.text).decode("utf-8", "replace")))
+            lib.aept_events_free(self._buf, n)
+            if n < _BATCH:
+                return
+
+    async def events(self) -> AsyncIterator[Union[LogEvent, Progress]]:
+        """Yield log events and progress reports as they arrive, until
+        close()."""
+        while True:
+            ev = await self._queue.get()
+            if ev is None:
+                return
+            yield ev
+
+    def cancel(self):
+        """Cancel the running operation, if any (thread-safe)."""
+        if self._aept is not None:
+            self._aept.cancel()
+
+    async def run(self, fn: Callable[..., T], *args, **kwargs) -> T:
+        """Call fn(aept, *args, **kwargs) on the worker thread.
+
+        Works with any Aept method, e.g. ``await a.run(Aept.show, "hello")``.
+        """
+        if self._aept is None:
+            raise AeptError("AsyncAept is not open")
+        fut = self._loop.run_in_executor(
+            self._executor, functools.partial(fn, self._aept, *args, **kwargs))
+        try:
+            return await asyncio.shield(fut)
+        except asyncio.CancelledError:
+            self._aept.cancel()
+            try:
+                await fut
+            except Exception:
+                pass
+            raise
+        finally:
+            self._drain()
+
+    # --- Operations -------------------------------------------------------
+
+    async def load_config(self, path: Optional[str] = None):
+        await self.run(Aept.load_config, path)
+
+    async def update(self):
+        await self.run(Aept.update)
+
+    async def install(self, names: Optional[List[str]] = None,
+                      local_paths: Optional[List[str]] = None):
+        await self.run(Aept.install, names, local_paths)
+
+    async def upgrade(self):
+        await self.run(Aept.upgrade)
+
+    async def install_roots(self, roots: List[str],
+                            names: Optional[List[str]] = None,
+                            local_paths: Optional[List[str]] = None):
+        await self.run(Aept.install_roots, roots, names, local_paths)
+
+    async def remove(self, names: List[str]):
+        await self.run(Aept.remove, names)
+
+    async def autoremove(self):
+        await self.run(Aept.autoremove)
+
+    async def clean(self):
+        await self.run(Aept.clean)
+
+    async def db_import(self):
+        await self.run(Aept.db_import)
+
+    async def db_export(self, dir: str):
+        await self.run(Aept.db_export, dir)
+
+    async def db_compact(self):
+        await self.run(Aept.db_compact)
@@ -4,12 +4,13 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include <dirent.h>
 #include <errno.h>
 #include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <solv/evr.h>
@@ -25,12 +26,19 @@
 #include "aept/autoremove.h"
 #include "aept/clean.h"
 #include "aept/config.h"
+#include "aept/depgraph.h"
+#include "aept/download.h"
+#include "aept/infodb.h"
 #include "aept/install.h"
+#include "aept/event.h"
+#include "aept/integrity.h"
 #include "aept/msg.h"
+#include "aept/owner_index.h"
 #include "aept/pin.h"
 #include "aept/remove.h"
 #include "aept/solver.h"
 #include "aept/status.h"
+#include "aept/trace.h"
 #include "aept/update.h"
 #include "aept/util.h"
 
@@ -41,9 +49,11 @@ aept_ctx_t *aept_init(void)
     aept_ctx_t *ctx = aept_malloc(sizeof(*ctx));
     memset(ctx, 0, sizeof(*ctx));
     ctx->lock_fd = -1;
+    ctx->root_helper_fd = -1;
     ctx->use_color = isatty(STDOUT_FILENO) && isatty(STDERR_FILENO);
     aept_log_set_ctx(ctx);
-    fetchConnectionCacheInit(4, 2);
+    fetchConnectionCacheInit(AEPT_CONNECTION_CACHE_DEFAULT,
+                             AEPT_CONNECTION_CACHE_DEFAULT);
     fetchRestartCalls = 0;
     return ctx;
 }
@@ -54,6 +64,9 @@ void aept_cleanup(aept_ctx_t *ctx)
         return;
 
     fetchConnectionCacheClose();
+    aept_root_helper_stop(ctx);
+    aept_event_queue_free(ctx);
+    aept_trace_close(ctx);
 
     if (ctx->config_loaded) {
         aept_config_free(&ctx->config);
@@ -99,7 +112,13 @@ int aept_load_config(aept_ctx_t *ctx, const char *path)
     aept_config_apply_offline_root(&ctx->config);
     ctx->config_loaded = 1;
 
-    return 0;
+    /* Keep-alive connections are reused for the life of the context and
+     * dropped in aept_cleanup().  All of them may point at the same
+     * mirror, so the per-host limit equals the global one. */
+    fetchConnectionCacheInit(ctx->config.connection_cache,
+                             ctx->config.connection_cache);
+
+    return aept_trace_open(ctx);
 }
 
 void aept_set_offline_root(aept_ctx_t *ctx, const char *path)
@@ -113,6 +132,20 @@ void aept_set_verbosity(aept_ctx_t *ctx, int level)
     ctx->config.verbosity = level;
 }
 
+void aept_set_download_jobs(aept_ctx_t *ctx, int jobs)
+{
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > AEPT_MAX_DOWNLOAD_JOBS)
+        jobs = AEPT_MAX_DOWNLOAD_JOBS;
+    ctx->config.download_jobs = jobs;
+}
+
+void aept_set_download_rate(aept_ctx_t *ctx, int kib)
+{
+    ctx->config.download_rate = kib > 0 ? kib : 0;
+}
+
 /* ── Flags ───────────────────────────────────────────────────────── */
 
 static int *flag_ptr(aept_config_t *cfg, int flag)
@@ -131,6 +164,8 @@ static int *flag_ptr(aept_config_t *cfg, int flag)
     case AEPT_FLAG_CHECK_SIGNATURE:  return &cfg->check_signature;
     case AEPT_FLAG_IGNORE_UID:       return &cfg->ignore_uid;
     case AEPT_FLAG_KEEP_GOING:       return &cfg->keep_going;
+    case AEPT_FLAG_PIPELINE_DOWNLOADS: return &cfg->pipeline_downloads;
+    case AEPT_FLAG_PREFETCH:         return &cfg->prefetch;
     default:                         return NULL;
     }
 }
@@ -152,8 +187,7 @@ int aept_get_flag(aept_ctx_t *ctx, int flag)
 
 void aept_set_log_fn(aept_ctx_t *ctx, aept_log_fn fn, void *userdata)
 {
-    ctx->log_fn = fn;
-    ctx->log_userdata = userdata;
+    aept_log_set_fn(ctx, fn, userdata);
 }
 
 void aept_set_display_fn(aept_ctx_t *ctx, aept_display_fn fn, void *userdata)
@@ -168,6 +202,105 @@ void aept_set_confirm_fn(aept_ctx_t *ctx, aept_confirm_fn fn, void *userdata)
     ctx->confirm_userdata = userdata;
 }
 
+void aept_set_progress_fn(aept_ctx_t *ctx, aept_progress_fn fn,
+                          void *userdata)
+{
+    ctx->progress_fn = fn;
+    ctx->progress_userdata = userdata;
+}
+
+/* ── Statistics ──────────────────────────────────────────────────── */
+
+static const char *phase_names[AEPT_PHASE_COUNT] = {
+    [AEPT_PHASE_LOAD]     = "load",
+    [AEPT_PHASE_SOLVE]    = "solve",
+    [AEPT_PHASE_DOWNLOAD] = "download",
+    [AEPT_PHASE_VERIFY]   = "verify",
+    [AEPT_PHASE_CLASH]    = "clash",
+    [AEPT_PHASE_UNPACK]   = "unpack",
+    [AEPT_PHASE_REMOVE]   = "remove",
+    [AEPT_PHASE_SCRIPTS]  = "scripts",
+    [AEPT_PHASE_TRIGGERS] = "triggers",
+};
+
+void aept_get_stats(aept_ctx_t *ctx, aept_stats_t *out)
+{
+    struct aept_stats *st = &ctx->stats;
+    int i;
+
+    memset(out, 0, sizeof(*out));
+
+    for (i = 0; i < AEPT_PHASE_COUNT; i++) {
+        out->phase[i].wall = st->wall_ns[i] / 1e9;
+        out->phase[i].cpu = st->cpu_ns[i] / 1e9;
+        out->phase[i].count = st->count[i];
+    }
+
+    out->bytes_downloaded = st->counter[AEPT_STAT_BYTES_DOWNLOADED];
+    out->files_downloaded = st->counter[AEPT_STAT_FILES_DOWNLOADED];
+    out->bytes_extracted = st->counter[AEPT_STAT_BYTES_EXTRACTED];
+    out->files_extracted = st->counter[AEPT_STAT_FILES_EXTRACTED];
+    out->files_unchanged = st->counter[AEPT_STAT_FILES_UNCHANGED];
+    out->files_removed = st->counter[AEPT_STAT_FILES_REMOVED];
+    out->scripts_run = st->counter[AEPT_STAT_SCRIPTS_RUN];
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        out->peak_rss = (unsigned long long)ru.ru_maxrss * 1024;
+}
+
+void aept_reset_stats(aept_ctx_t *ctx)
+{
+    struct aept_stats *st = &ctx->stats;
+    int i;
+
+    for (i = 0; i < AEPT_PHASE_COUNT; i++) {
+        st->wall_ns[i] = 0;
+        st->cpu_ns[i] = 0;
+        st->count[i] = 0;
+    }
+
+    for (i = 0; i < AEPT_STAT_COUNT; i++)
+        st->counter[i] = 0;
+}
+
+int aept_get_mirror_stats(aept_ctx_t *ctx, aept_mirror_stats_t *out,
+                          int max)
+{
+    int n = 0;
+
+    for (int i = 0; i < ctx->config.nsources; i++) {
+        aept_source_t *src = &ctx->config.sources[i];
+
+        for (int j = 0; j < src->nmirrors; j++, n++) {
+            aept_mirror_t *m = &src->mirrors[j];
+            unsigned long long bytes = m->bytes, ns = m->ns;
+            long long latency = m->latency_ns;
+
+            if (n >= max)
+                continue;
+
+            out[n].source = src->name;
+            out[n].url = m->url;
+            out[n].latency = latency >= 0 ? latency / 1e9 : -1.0;
+            out[n].throughput = ns > 0 ? bytes * 1e9 / ns : 0.0;
+            out[n].bytes_downloaded = bytes;
+            out[n].requests = m->requests;
+            out[n].failures = m->failures;
+            out[n].down = m->down;
+        }
+    }
+
+    return n;
+}
+
+const char *aept_phase_name(int phase)
+{
+    if (phase < 0 || phase >= AEPT_PHASE_COUNT)
+        return NULL;
+    return phase_names[phase];
+}
+
 /* ── Cancellation ────────────────────────────────────────────────── */
 
 void aept_cancel(aept_ctx_t *ctx)
@@ -175,8 +308,28 @@ void aept_cancel(aept_ctx_t *ctx)
     ctx->cancelled = 1;
 }
 
+/* ── Event queue ─────────────────────────────────────────────────── */
+
+int aept_events_open(aept_ctx_t *ctx)
+{
+    return aept_event_queue_open(ctx);
+}
+
+int aept_events_take(aept_ctx_t *ctx, aept_event_t *out, int max)
+{
+    return aept_event_take(ctx, out, max);
+}
+
+void aept_events_free(aept_event_t *events, int count)
+{
+    for (int i = 0; i < count; i++)
+        free(events[i].text);
+}
+
 /* ── Mutating operations ─────────────────────────────────────────── */
 
+static void upgradable_refresh(aept_ctx_t *ctx);
+
 int aept_update(aept_ctx_t *ctx)
 {
     int r;
@@ -185,6 +338,7 @@ int aept_update(aept_ctx_t *ctx)
     if (aept_config_lock(ctx) < 0)               return -1;
 
     r = aept_op_update(ctx);
+    upgradable_refresh(ctx);
 
     aept_config_unlock(ctx);
     return r;
@@ -199,6 +353,8 @@ int aept_install(aept_ctx_t *ctx, const char **names, int name_count,
     if (aept_config_lock(ctx) < 0)               return -1;
 
     r = aept_op_install(ctx, names, name_count, local_paths, local_count);
+    aept_status_publish(ctx);
+    upgradable_refresh(ctx);
 
     aept_config_unlock(ctx);
     return r;
@@ -212,7 +368,205 @@ int aept_upgrade(aept_ctx_t *ctx)
     if (aept_config_lock(ctx) < 0)               return -1;
 
     r = aept_op_install(ctx, NULL, 0, NULL, 0);
+    aept_status_publish(ctx);
+    upgradable_refresh(ctx);
+
+    aept_config_unlock(ctx);
+    return r;
+}
+
+/* ── Installing into several roots ───────────────────────────────── */
+
+typedef struct {
+    aept_ctx_t *ctx;
+    const char *const *roots;
+    const char **names;
+    int name_count;
+    const char **local_paths;
+    int local_count;
+    aept_plan_t *plan;
+} roots_run_t;
+
+/* path, which is below the offline root of ctx, moved below root */
+static char *reroot_path(aept_ctx_t *ctx, const char *root, const char *path)
+{
+    const char *old = ctx->config.offline_root;
+    size_t n = old ? strlen(old) : 0;
+    char *out;
+
+    if (n && strncmp(path, old, n) == 0)
+        path += n;
+    aept_asprintf(&out, "%s%s", root, path);
+    return out;
+}
 
+/* A context for installing into root with the settings and callbacks of
+ * ctx.  The package lists and the download cache stay those of ctx, the
+ * package database, lock, marks and pins are root's own.  Everything
+ * else in the configuration is borrowed from ctx, so it is never freed
+ * through the new context. */
+static aept_ctx_t *root_ctx_new(aept_ctx_t *ctx, const char *root)
+{
+    aept_ctx_t *rc = aept_malloc(sizeof(*rc));
+
+    memset(rc, 0, sizeof(*rc));
+    rc->config = ctx->config;
+    rc->config.offline_root = aept_strdup(root);
+    rc->config.info_dir = reroot_path(ctx, root, ctx->config.info_dir);
+    rc->config.lock_file = reroot_path(ctx, root, ctx->config.lock_file);
+    rc->config.auto_file = reroot_path(ctx, root, ctx->config.auto_file);
+    rc->config.pin_file = reroot_path(ctx, root, ctx->config.pin_file);
+    rc->config.upgradable_file = reroot_path(ctx, root,
+                                             ctx->config.upgradable_file);
+
+    rc->log_fn = ctx->log_fn;
+    rc->log_userdata = ctx->log_userdata;
+    rc->display_fn = ctx->display_fn;
+    rc->display_userdata = ctx->display_userdata;
+    rc->confirm_fn = ctx->confirm_fn;
+    rc->confirm_userdata = ctx->confirm_userdata;
+    rc->progress_fn = ctx->progress_fn;
+    rc->progress_userdata = ctx->progress_userdata;
+    rc->events = ctx->events;
+    rc->trace = ctx->trace;
+
+    rc->lock_fd = -1;
+    rc->root_helper_fd = -1;
+    rc->use_color = ctx->use_color;
+    rc->parent = ctx;
+    return rc;
+}
+
+/* Free rc, adding what it counted to the statistics of ctx */
+static void root_ctx_free(aept_ctx_t *ctx, aept_ctx_t *rc)
+{
+    int i;
+
+    aept_root_helper_stop(rc);
+
+    for (i = 0; i < AEPT_PHASE_COUNT; i++) {
+        ctx->stats.wall_ns[i] += rc->stats.wall_ns[i];
+        ctx->stats.cpu_ns[i] += rc->stats.cpu_ns[i];
+        ctx->stats.count[i] += rc->stats.count[i];
+    }
+    for (i = 0; i < AEPT_STAT_COUNT; i++)
+        ctx->stats.counter[i] += rc->stats.counter[i];
+
+    free(rc->config.offline_root);
+    free(rc->config.info_dir);
+    free(rc->config.lock_file);
+    free(rc->config.auto_file);
+    free(rc->config.pin_file);
+    free(rc->config.upgradable_file);
+    free(rc);
+}
+
+static int root_task(aept_ctx_t *ctx, int i, void *arg)
+{
+    roots_run_t *rr = arg;
+    aept_ctx_t *rc = root_ctx_new(ctx, rr->roots[i]);
+    int lock = strcmp(rc->config.lock_file, ctx->config.lock_file) != 0;
+    int r;
+
+    aept_log_set_ctx(rc);
+
+    /* Only the reference run asks and trims the cache; the others apply
+     * what it showed and leave the shared downloads alone. */
+    rc->config.no_cache = 0;
+    if (rr->plan && rr->plan->capture) {
+        rc->config.download_only = 1;
+    } else {
+        rc->config.non_interactive = 1;
+        if (!rc->config.force_confnew)
+            rc->config.force_confold = 1;
+        rc->config.cache_limit = 0;
+    }
+
+    r = aept_config_validate(&rc->config);
+    if (r == 0 && lock)
+        r = aept_config_lock(rc);
+    if (r == 0) {
+        r = aept_op_install_plan(rc, rr->names, rr->name_count,
+                                 rr->local_paths, rr->local_count, rr->plan);
+        if (!rc->config.download_only) {
+            aept_status_publish(rc);
+            upgradable_refresh(rc);
+        }
+        if (lock)
+            aept_config_unlock(rc);
+    }
+    if (r < 0)
+        aept_log_error("installing into '%s' failed", rr->roots[i]);
+
+    aept_log_set_ctx(ctx);
+    root_ctx_free(ctx, rc);
+    return r;
+}
+
+int aept_install_roots(aept_ctx_t *ctx, const char *const *roots, int nroots,
+                       const char **names, int name_count,
+                       const char **local_paths, int local_count,
+                       int *results)
+{
+    aept_plan_t plan;
+    roots_run_t rr;
+    int jobs = ctx->config.root_jobs;
+    int i, r;
+
+    for (i = 0; i < nroots; i++)
+        results[i] = -1;
+    if (nroots <= 0)
+        return 0;
+
+    if (aept_config_validate(&ctx->config) < 0) return -1;
+    if (aept_config_lock(ctx) < 0)               return -1;
+
+    memset(&plan, 0, sizeof(plan));
+    rr.ctx = ctx;
+    rr.roots = roots;
+    rr.names = names;
+    rr.name_count = name_count;
+    rr.local_paths = local_paths;
+    rr.local_count = local_count;
+    rr.plan = &plan;
+
+    /* Resolve against the first root and download what it needs, once
+     * for all of them.  The package lists and the cache are under the
+     * lock of ctx for as long as the roots use them. */
+    plan.capture = 1;
+    r = root_task(ctx, 0, &rr);
+    plan.capture = 0;
+
+    if (r < 0 || !plan.ready || ctx->config.noaction ||
+            ctx->config.download_only || ctx->config.prefetch) {
+        for (i = 0; i < nroots; i++)
+            results[i] = r;
+        goto out;
+    }
+
+    /* Reinstalls are fetched by each run itself, past the plan */
+    if (ctx->config.reinstall && names)
+        rr.plan = NULL;
+
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (int)n : 1;
+    }
+
+    aept_parallel_run(ctx, nroots, jobs, root_task, &rr, results);
+
+    for (i = 0; i < nroots; i++) {
+        if (results[i] < 0)
+            r = -1;
+    }
+
+    if (ctx->config.no_cache) {
+        for (i = 0; i < plan.npaths; i++)
+            aept_download_discard(ctx, plan.paths[i]);
+    }
+
+out:
+    aept_plan_free(&plan);
     aept_config_unlock(ctx);
     return r;
 }
@@ -225,6 +579,8 @@ int aept_remove(aept_ctx_t *ctx, const char **names, int count)
     if (aept_config_lock(ctx) < 0)               return -1;
 
     r = aept_op_remove(ctx, names, count);
+    aept_status_publish(ctx);
+    upgradable_refresh(ctx);
 
     aept_config_unlock(ctx);
     return r;
@@ -238,6 +594,8 @@ int aept_autoremove(aept_ctx_t *ctx)
     if (aept_config_lock(ctx) < 0)               return -1;
 
     r = aept_op_autoremove(ctx);
+    aept_status_publish(ctx);
+    upgradable_refresh(ctx);
 
     aept_config_unlock(ctx);
     return r;
@@ -319,6 +677,8 @@ int aept_mark_auto(aept_ctx_t *ctx, const char **names, int count)
 {
     int i, r = 0;
 
+    aept_status_auto_begin(ctx);
+
     for (i = 0; i < count; i++) {
         char *list_path = NULL;
         aept_asprintf(&list_path, "%s/%s.list",
@@ -332,6 +692,9 @@ int aept_mark_auto(aept_ctx_t *ctx, const char **names, int count)
             r = -1;
     }
 
+    if (aept_status_auto_commit(ctx) < 0)
+        r = -1;
+
     return r;
 }
 
@@ -339,6 +702,8 @@ int aept_mark_manual(aept_ctx_t *ctx, const char **names, int count)
 {
     int i, r = 0;
 
+    aept_status_auto_begin(ctx);
+
     for (i = 0; i < count; i++) {
         char *list_path = NULL;
         aept_asprintf(&list_path, "%s/%s.list",
@@ -352,6 +717,9 @@ int aept_mark_manual(aept_ctx_t *ctx, const char **names, int count)
             r = -1;
     }
 
+    if (aept_status_auto_commit(ctx) < 0)
+        r = -1;
+
     return r;
 }
 
@@ -360,6 +728,49 @@ int aept_mark_manual_all(aept_ctx_t *ctx)
     return aept_status_clear_auto(ctx);
 }
 
+/* ── Consolidated package database ───────────────────────────────── */
+
+int aept_db_import(aept_ctx_t *ctx)
+{
+    int r;
+
+    if (aept_config_lock(ctx) < 0)
+        return -1;
+
+    r = aept_infodb_sync(ctx);
+
+    aept_config_unlock(ctx);
+    return r;
+}
+
+int aept_db_export(aept_ctx_t *ctx, const char *dir)
+{
+    int r;
+
+    if (aept_config_lock(ctx) < 0)
+        return -1;
+
+    r = aept_infodb_export(ctx, dir);
+
+    aept_config_unlock(ctx);
+    return r;
+}
+
+int aept_db_compact(aept_ctx_t *ctx)
+{
+    int r;
+
+    if (aept_config_lock(ctx) < 0)
+        return -1;
+
+    r = aept_infodb_sync(ctx);
+    if (r == 0)
+        r = aept_infodb_compact(ctx);
+
+    aept_config_unlock(ctx);
+    return r;
+}
+
 /* ── Query helpers ───────────────────────────────────────────────── */
 
 static int query_load_repos(aept_ctx_t *ctx)
@@ -368,6 +779,7 @@ static int query_load_repos(aept_ctx_t *ctx)
 
     for (i = 0; i < ctx->config.nsources; i++) {
         char *list_path = NULL;
+        char *cache_path = NULL;
         FILE *fp;
 
         aept_asprintf(&list_path, "%s/%s",
@@ -379,8 +791,11 @@ static int query_load_repos(aept_ctx_t *ctx)
             continue;
         }
 
-        aept_solver_load_repo(ctx, ctx->config.sources[i].name, fp, i);
+        aept_asprintf(&cache_path, "%s.solv", list_path);
+        aept_solver_load_repo(ctx, ctx->config.sources[i].name, fp,
+                              cache_path, i);
         fclose(fp);
+        free(cache_path);
         free(list_path);
     }
 
@@ -431,25 +846,12 @@ static char *deparray_to_str(Pool *pool, Solvable *s, Id keyname, Id marker)
     return result;
 }
 
-/* ── Query: list ─────────────────────────────────────────────────── */
-
 struct api_list_entry {
     Id name_id;
     Solvable *avail;
     Solvable *installed;
 };
 
-static struct api_list_entry *find_list_entry(struct api_list_entry *entries,
-                                              int n, Id name_id)
-{
-    int i;
-    for (i = 0; i < n; i++) {
-        if (entries[i].name_id == name_id)
-            return &entries[i];
-    }
-    return NULL;
-}
-
 static Pool *api_sort_pool;
 
 static int cmp_api_list_entry(const void *a, const void *b)
@@ -460,34 +862,28 @@ static int cmp_api_list_entry(const void *a, const void *b)
                  pool_id2str(api_sort_pool, eb->name_id));
 }
 
-int aept_list(aept_ctx_t *ctx, const char *pattern,
-              int filter_installed, int filter_upgradable,
-              aept_pkg_list_t *out)
+/* Fold every solvable into one entry per name.  Solvable names are
+ * string Ids, so a table indexed by Id (holding entry index + 1) finds
+ * the entry for a name in constant time. */
+static struct api_list_entry *collect_list_entries(Pool *pool, int *count)
 {
-    Pool *pool;
-    Id p;
-    Solvable *s;
     struct api_list_entry *entries = NULL;
+    int *slot;
     int nentries = 0, alloc = 0;
-    int i, r = -1;
-
-    memset(out, 0, sizeof(*out));
-
-    if (aept_solver_init(ctx) < 0)
-        return -1;
-
-    aept_status_load(ctx);
-    query_load_repos(ctx);
+    Id p;
+    Solvable *s;
 
-    pool = aept_solver_pool(ctx->solver);
+    slot = aept_malloc(pool->ss.nstrings * sizeof(*slot));
+    memset(slot, 0, pool->ss.nstrings * sizeof(*slot));
 
     FOR_POOL_SOLVABLES(p) {
         struct api_list_entry *e;
 
         s = pool_id2solvable(pool, p);
-        e = find_list_entry(entries, nentries, s->name);
 
-        if (!e) {
+        if (slot[s->name]) {
+            e = &entries[slot[s->name] - 1];
+        } else {
             if (nentries >= alloc) {
                 alloc = alloc ? alloc * 2 : 256;
                 entries = aept_realloc(entries, alloc * sizeof(*entries));
@@ -496,6 +892,7 @@ int aept_list(aept_ctx_t *ctx, const char *pattern,
             e->name_id = s->name;
             e->avail = NULL;
             e->installed = NULL;
+            slot[s->name] = nentries;
         }
 
         if (s->repo == pool->installed) {
@@ -508,121 +905,626 @@ int aept_list(aept_ctx_t *ctx, const char *pattern,
         }
     }
 
-    api_sort_pool = pool;
-    qsort(entries, nentries, sizeof(*entries), cmp_api_list_entry);
+    free(slot);
+    *count = nentries;
+    return entries;
+}
 
-    out->entries = calloc(nentries, sizeof(aept_pkg_entry_t));
-    if (!out->entries && nentries > 0)
-        goto cleanup;
+/* ── Query sessions ──────────────────────────────────────────────── */
+
+/*
+ * A session keeps the solver pool, the per-name entries sorted for
+ * listing, the dependency graph of the installed packages and the
+ * owner index loaded between calls.  Each is loaded on first use.
+ * Every call first stat()s lists_dir, info_dir, the auto-installed
+ * marks and the list of each source again, and drops whatever was loaded if one of
+ * them changed, so that an update or install in between is seen.
+ * Lists and control files are replaced by renaming, which changes
+ * their directory too.
+ *
+ * The package database is read from the generation last published by
+ * a transaction, see aept_status_publish(), so queries need no lock and
+ * never see a transaction half done.  A new generation is a new
+ * directory, which changes the info_dir stamp.
+ */
 
-    for (i = 0; i < nentries; i++) {
-        struct api_list_entry *e = &entries[i];
-        const char *name = pool_id2str(pool, e->name_id);
-        const char *summary;
-        Solvable *show;
-        int upgradable;
+typedef struct {
+    int present;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} query_stamp_t;
+
+struct aept_query {
+    aept_ctx_t *ctx;
+
+    /* lists_dir, info_dir, auto_file, then the list of each source */
+    query_stamp_t *stamps;
+    int nstamps;
+
+    struct aept_solver *solver;      /* NULL until loaded */
+    struct api_list_entry *entries;  /* sorted by name */
+    int nentries;
+    int *slot;                       /* name Id -> entry index + 1 */
+    int nslots;
+
+    aept_depgraph_t graph;
+    int graph_built;
+
+    aept_owner_index_t owners;
+    int owners_state;                /* 0 not loaded, 1 loaded,
+                                      * 2 nothing installed */
+};
 
-        if (pattern && fnmatch(pattern, name, 0) != 0)
-            continue;
+/* Point ctx at the published package database for reading.  Returns
+ * the info_dir to hand back to read_view_leave(). */
+static char *read_view_enter(aept_ctx_t *ctx)
+{
+    char *live = ctx->config.info_dir;
 
-        if (filter_installed && !e->installed)
-            continue;
+    ctx->config.info_dir = aept_status_read_dir(ctx);
+    return live;
+}
 
-        upgradable = e->installed && e->avail &&
-            pool_evrcmp_str(pool,
-                pool_id2str(pool, e->avail->evr),
-                pool_id2str(pool, e->installed->evr), EVRCMP_COMPARE) > 0;
+static void read_view_leave(aept_ctx_t *ctx, char *live)
+{
+    free(ctx->config.info_dir);
+    ctx->config.info_dir = live;
+}
 
-        if (filter_upgradable && !upgradable)
-            continue;
+static void stamp_path(const char *path, query_stamp_t *st)
+{
+    struct stat sb;
 
-        show = filter_installed ? e->installed :
-               (e->avail ? e->avail : e->installed);
+    memset(st, 0, sizeof(*st));
+    if (stat(path, &sb) != 0)
+        return;
 
-        aept_pkg_entry_t *pe = &out->entries[out->count++];
-        pe->name = strdup(pool_id2str(pool, e->name_id));
-        pe->version = strdup(pool_id2str(pool, show->evr));
-        summary = solvable_lookup_str(show, SOLVABLE_SUMMARY);
-        pe->summary = summary ? strdup(summary) : NULL;
-        pe->installed = e->installed != NULL;
-        pe->upgradable = upgradable;
-    }
+    st->present = 1;
+    st->dev = sb.st_dev;
+    st->ino = sb.st_ino;
+    st->size = sb.st_size;
+    st->mtime = sb.st_mtim;
+}
 
-    r = 0;
+static int stamp_equal(const query_stamp_t *a, const query_stamp_t *b)
+{
+    return a->present == b->present && a->dev == b->dev &&
+           a->ino == b->ino && a->size == b->size &&
+           a->mtime.tv_sec == b->mtime.tv_sec &&
+           a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
 
-cleanup:
-    free(entries);
-    aept_solver_fini(ctx);
-    return r;
+static query_stamp_t *query_stamps(aept_ctx_t *ctx, int *count)
+{
+    int n = ctx->config.nsources + 3;
+    query_stamp_t *stamps = aept_malloc(n * sizeof(*stamps));
+    char *live;
+
+    stamp_path(ctx->config.lists_dir, &stamps[0]);
+    live = read_view_enter(ctx);
+    stamp_path(ctx->config.info_dir, &stamps[1]);
+    read_view_leave(ctx, live);
+    stamp_path(ctx->config.auto_file, &stamps[2]);
+
+    for (int i = 0; i < ctx->config.nsources; i++) {
+        char *list_path = NULL;
+
+        aept_asprintf(&list_path, "%s/%s",
+                      ctx->config.lists_dir, ctx->config.sources[i].name);
+        stamp_path(list_path, &stamps[i + 3]);
+        free(list_path);
+    }
+
+    *count = n;
+    return stamps;
 }
 
-void aept_pkg_list_free(aept_pkg_list_t *list)
+static void query_unload(aept_query_t *q)
 {
-    int i;
+    if (q->graph_built)
+        aept_depgraph_free(&q->graph);
+    q->graph_built = 0;
 
-    if (!list)
-        return;
+    if (q->solver) {
+        struct aept_solver *saved = q->ctx->solver;
 
-    for (i = 0; i < list->count; i++) {
-        free(list->entries[i].name);
-        free(list->entries[i].version);
-        free(list->entries[i].summary);
+        q->ctx->solver = q->solver;
+        aept_solver_fini(q->ctx);
+        q->ctx->solver = saved;
+        q->solver = NULL;
     }
-    free(list->entries);
-    memset(list, 0, sizeof(*list));
+
+    free(q->entries);
+    free(q->slot);
+    q->entries = NULL;
+    q->slot = NULL;
+    q->nentries = 0;
+    q->nslots = 0;
+
+    if (q->owners_state == 1)
+        aept_owner_index_free(&q->owners);
+    q->owners_state = 0;
+
+    free(q->stamps);
+    q->stamps = NULL;
+    q->nstamps = 0;
 }
 
-/* ── Query: show ─────────────────────────────────────────────────── */
+/* Drop what was loaded if its sources have changed.  The stamps are
+ * taken before anything is loaded, so a change while loading is
+ * caught by the next call. */
+static void query_refresh(aept_query_t *q)
+{
+    query_stamp_t *now;
+    int n, i;
 
-int aept_show(aept_ctx_t *ctx, const char *name, aept_pkg_info_t *out)
+    now = query_stamps(q->ctx, &n);
+
+    if (q->stamps) {
+        for (i = 0; i < n && i < q->nstamps; i++) {
+            if (!stamp_equal(&now[i], &q->stamps[i]))
+                break;
+        }
+
+        if (i == n && n == q->nstamps) {
+            free(now);
+            return;
+        }
+
+        aept_log_debug("package lists or status changed, reloading");
+        query_unload(q);
+    }
+
+    q->stamps = now;
+    q->nstamps = n;
+}
+
+/* The session's pool, loading it on first use.  The session solver is
+ * swapped in for loading only, so sessions and operations on the same
+ * context don't disturb each other. */
+static Pool *query_pool(aept_query_t *q)
 {
+    aept_ctx_t *ctx = q->ctx;
+    struct aept_solver *saved = ctx->solver;
     Pool *pool;
-    Id name_id, p;
-    Solvable *s, *best = NULL, *installed = NULL;
-    const char *str;
-    unsigned int medianr;
-    int r = -1;
+    char *live;
+    int i;
 
-    memset(out, 0, sizeof(*out));
+    if (q->solver)
+        return aept_solver_pool(q->solver);
 
-    if (aept_solver_init(ctx) < 0)
-        return -1;
+    ctx->solver = NULL;
+    if (aept_solver_init(ctx) < 0) {
+        ctx->solver = saved;
+        return NULL;
+    }
 
+    live = read_view_enter(ctx);
     aept_status_load(ctx);
+    read_view_leave(ctx, live);
     query_load_repos(ctx);
 
-    pool = aept_solver_pool(ctx->solver);
+    q->solver = ctx->solver;
+    ctx->solver = saved;
 
-    name_id = pool_str2id(pool, name, 0);
-    if (!name_id)
-        goto not_found;
+    pool = aept_solver_pool(q->solver);
+    q->entries = collect_list_entries(pool, &q->nentries);
 
-    FOR_POOL_SOLVABLES(p) {
-        s = pool_id2solvable(pool, p);
-        if (s->name != name_id)
-            continue;
+    api_sort_pool = pool;
+    qsort(q->entries, q->nentries, sizeof(*q->entries), cmp_api_list_entry);
 
-        if (s->repo == pool->installed) {
-            installed = s;
-        } else {
-            if (!best || pool_evrcmp_str(pool,
-                    pool_id2str(pool, s->evr),
-                    pool_id2str(pool, best->evr), EVRCMP_COMPARE) > 0)
-                best = s;
-        }
-    }
+    q->nslots = pool->ss.nstrings;
+    q->slot = aept_malloc(q->nslots * sizeof(*q->slot));
+    memset(q->slot, 0, q->nslots * sizeof(*q->slot));
+    for (i = 0; i < q->nentries; i++)
+        q->slot[q->entries[i].name_id] = i + 1;
 
-    s = best ? best : installed;
-    if (!s)
-        goto not_found;
+    return pool;
+}
 
-    out->name = strdup(pool_id2str(pool, s->name));
-    out->version = strdup(pool_id2str(pool, s->evr));
-    out->architecture = strdup(pool_id2str(pool, s->arch));
-    out->installed_size = solvable_lookup_num(s, SOLVABLE_INSTALLSIZE, 0);
+static const struct api_list_entry *query_find(aept_query_t *q, Pool *pool,
+                                               const char *name)
+{
+    Id name_id = pool_str2id(pool, name, 0);
 
-    out->depends = deparray_to_str(pool, s, SOLVABLE_REQUIRES,
-                                   -SOLVABLE_PREREQMARKER);
+    if (!name_id || name_id >= q->nslots || !q->slot[name_id])
+        return NULL;
+    return &q->entries[q->slot[name_id] - 1];
+}
+
+aept_query_t *aept_query_open(aept_ctx_t *ctx)
+{
+    aept_query_t *q = aept_malloc(sizeof(*q));
+
+    memset(q, 0, sizeof(*q));
+    q->ctx = ctx;
+    aept_owner_index_init(&q->owners);
+    return q;
+}
+
+void aept_query_close(aept_query_t *q)
+{
+    if (!q)
+        return;
+
+    query_unload(q);
+    free(q);
+}
+
+/* ── Query: list ─────────────────────────────────────────────────── */
+
+int aept_query_list_foreach(aept_query_t *q, const char *pattern,
+                            int filter_installed, int filter_upgradable,
+                            aept_list_fn fn, void *userdata)
+{
+    Pool *pool;
+    int i;
+
+    query_refresh(q);
+
+    pool = query_pool(q);
+    if (!pool)
+        return -1;
+
+    for (i = 0; i < q->nentries; i++) {
+        struct api_list_entry *e = &q->entries[i];
+        const char *name = pool_id2str(pool, e->name_id);
+        aept_pkg_entry_t pe;
+        Solvable *show;
+        int upgradable;
+
+        if (pattern && fnmatch(pattern, name, 0) != 0)
+            continue;
+
+        if (filter_installed && !e->installed)
+            continue;
+
+        upgradable = e->installed && e->avail &&
+            pool_evrcmp_str(pool,
+                pool_id2str(pool, e->avail->evr),
+                pool_id2str(pool, e->installed->evr), EVRCMP_COMPARE) > 0;
+
+        if (filter_upgradable && !upgradable)
+            continue;
+
+        show = filter_installed ? e->installed :
+               (e->avail ? e->avail : e->installed);
+
+        /* Borrowed from the pool: valid only for the duration of fn(). */
+        pe.name = (char *)name;
+        pe.version = (char *)pool_id2str(pool, show->evr);
+        pe.summary = (char *)solvable_lookup_str(show, SOLVABLE_SUMMARY);
+        pe.installed = e->installed != NULL;
+        pe.upgradable = upgradable;
+
+        if (fn(&pe, userdata) != 0)
+            break;
+    }
+
+    return 0;
+}
+
+int aept_list_foreach(aept_ctx_t *ctx, const char *pattern,
+                      int filter_installed, int filter_upgradable,
+                      aept_list_fn fn, void *userdata)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_list_foreach(q, pattern, filter_installed,
+                                filter_upgradable, fn, userdata);
+    aept_query_close(q);
+    return r;
+}
+
+struct list_collect {
+    aept_pkg_list_t *out;
+    int alloc;
+};
+
+static int list_append(const aept_pkg_entry_t *entry, void *userdata)
+{
+    struct list_collect *lc = userdata;
+    aept_pkg_list_t *out = lc->out;
+    aept_pkg_entry_t *pe;
+
+    if (out->count >= lc->alloc) {
+        lc->alloc = lc->alloc ? lc->alloc * 2 : 256;
+        out->entries = aept_realloc(out->entries,
+                                    lc->alloc * sizeof(*out->entries));
+    }
+
+    pe = &out->entries[out->count++];
+    pe->name = aept_strdup(entry->name);
+    pe->version = aept_strdup(entry->version);
+    pe->summary = entry->summary ? aept_strdup(entry->summary) : NULL;
+    pe->installed = entry->installed;
+    pe->upgradable = entry->upgradable;
+    return 0;
+}
+
+int aept_query_list(aept_query_t *q, const char *pattern,
+                    int filter_installed, int filter_upgradable,
+                    aept_pkg_list_t *out)
+{
+    struct list_collect lc = { out, 0 };
+
+    memset(out, 0, sizeof(*out));
+
+    if (aept_query_list_foreach(q, pattern, filter_installed,
+                                filter_upgradable, list_append, &lc) < 0) {
+        aept_pkg_list_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+int aept_list(aept_ctx_t *ctx, const char *pattern,
+              int filter_installed, int filter_upgradable,
+              aept_pkg_list_t *out)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_list(q, pattern, filter_installed, filter_upgradable,
+                        out);
+    aept_query_close(q);
+    return r;
+}
+
+void aept_pkg_list_free(aept_pkg_list_t *list)
+{
+    int i;
+
+    if (!list)
+        return;
+
+    for (i = 0; i < list->count; i++) {
+        free(list->entries[i].name);
+        free(list->entries[i].version);
+        free(list->entries[i].summary);
+    }
+    free(list->entries);
+    memset(list, 0, sizeof(*list));
+}
+
+/* ── Query: cached upgradable summary ────────────────────────────── */
+
+/*
+ * upgradable_file holds the result of aept_list(ctx, NULL, 0, 1, ...)
+ * together with the stamps of lists_dir, info_dir, the auto-installed
+ * marks and the source lists it was computed from:
+ *
+ *   aept-upgradable 1
+ *   <number of stamps>
+ *   <present> <dev> <ino> <size> <mtime sec> <mtime nsec>   per stamp
+ *   <name>\t<version>\t<summary>                            per package
+ *
+ * It is valid while every stamp still matches, which is checked without
+ * loading any package list.
+ */
+
+#define UPGRADABLE_MAGIC "aept-upgradable 1"
+
+static void upgradable_put(FILE *fp, const char *s)
+{
+    for (; s && *s; s++)
+        fputc(*s == '\t' || *s == '\n' ? ' ' : *s, fp);
+}
+
+static int upgradable_write(aept_ctx_t *ctx, const query_stamp_t *stamps,
+                            int n, const aept_pkg_list_t *list)
+{
+    const char *path = ctx->config.upgradable_file;
+    char *tmp = NULL;
+    FILE *fp;
+    int i, r = -1;
+
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "w");
+    if (!fp)
+        goto cleanup;
+
+    fprintf(fp, "%s\n%d\n", UPGRADABLE_MAGIC, n);
+    for (i = 0; i < n; i++)
+        fprintf(fp, "%d %llu %llu %lld %lld %ld\n", stamps[i].present,
+                (unsigned long long)stamps[i].dev,
+                (unsigned long long)stamps[i].ino,
+                (long long)stamps[i].size,
+                (long long)stamps[i].mtime.tv_sec,
+                (long)stamps[i].mtime.tv_nsec);
+
+    for (i = 0; i < list->count; i++) {
+        upgradable_put(fp, list->entries[i].name);
+        fputc('\t', fp);
+        upgradable_put(fp, list->entries[i].version);
+        fputc('\t', fp);
+        upgradable_put(fp, list->entries[i].summary);
+        fputc('\n', fp);
+    }
+
+    if (ferror(fp)) {
+        fclose(fp);
+        goto cleanup;
+    }
+    if (fclose(fp) != 0)
+        goto cleanup;
+    if (rename(tmp, path) != 0)
+        goto cleanup;
+    r = 0;
+
+cleanup:
+    if (r < 0) {
+        aept_log_debug("cannot write '%s': %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return r;
+}
+
+/* Read the summary into out, keeping the packages matching pattern, if
+ * it is still valid.  With out NULL, only check that it is.  Returns 0
+ * if it is valid, -1 if not. */
+static int upgradable_read(aept_ctx_t *ctx, const char *pattern,
+                           aept_pkg_list_t *out)
+{
+    struct list_collect lc = { out, 0 };
+    query_stamp_t *now = NULL;
+    char *line = NULL;
+    size_t cap = 0;
+    FILE *fp;
+    int i, n, r = -1;
+
+    fp = fopen(ctx->config.upgradable_file, "r");
+    if (!fp)
+        return -1;
+
+    if (getline(&line, &cap, fp) < 0 ||
+            strcmp(line, UPGRADABLE_MAGIC "\n") != 0)
+        goto cleanup;
+
+    now = query_stamps(ctx, &n);
+    if (fscanf(fp, "%d\n", &i) != 1 || i != n)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        query_stamp_t st;
+        unsigned long long dev, ino;
+        long long size, sec;
+        long nsec;
+
+        memset(&st, 0, sizeof(st));
+        if (fscanf(fp, "%d %llu %llu %lld %lld %ld\n", &st.present, &dev,
+                   &ino, &size, &sec, &nsec) != 6)
+            goto cleanup;
+        st.dev = (dev_t)dev;
+        st.ino = (ino_t)ino;
+        st.size = (off_t)size;
+        st.mtime.tv_sec = (time_t)sec;
+        st.mtime.tv_nsec = nsec;
+        if (!stamp_equal(&st, &now[i]))
+            goto cleanup;
+    }
+
+    if (!out) {
+        r = 0;
+        goto cleanup;
+    }
+
+    while (getline(&line, &cap, fp) > 0) {
+        char *version, *summary;
+        aept_pkg_entry_t pe;
+
+        line[strcspn(line, "\n")] = '\0';
+        version = strchr(line, '\t');
+        if (!version)
+            goto cleanup;
+        *version++ = '\0';
+        summary = strchr(version, '\t');
+        if (!summary)
+            goto cleanup;
+        *summary++ = '\0';
+
+        if (pattern && fnmatch(pattern, line, 0) != 0)
+            continue;
+
+        pe.name = line;
+        pe.version = version;
+        pe.summary = *summary ? summary : NULL;
+        pe.installed = 1;
+        pe.upgradable = 1;
+        list_append(&pe, &lc);
+    }
+    r = 0;
+
+cleanup:
+    if (r < 0 && out)
+        aept_pkg_list_free(out);
+    free(now);
+    free(line);
+    fclose(fp);
+    return r;
+}
+
+/* Compute the upgradable packages into list and save them.  The stamps
+ * are those taken before the pool was loaded. */
+static int upgradable_compute(aept_ctx_t *ctx, aept_pkg_list_t *list)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_list(q, NULL, 0, 1, list);
+    if (r == 0)
+        upgradable_write(ctx, q->stamps, q->nstamps, list);
+    aept_query_close(q);
+    return r;
+}
+
+/* Bring an existing summary up to date after an operation. */
+static void upgradable_refresh(aept_ctx_t *ctx)
+{
+    aept_pkg_list_t list;
+
+    if (access(ctx->config.upgradable_file, F_OK) != 0 ||
+            upgradable_read(ctx, NULL, NULL) == 0)
+        return;
+
+    if (upgradable_compute(ctx, &list) == 0)
+        aept_pkg_list_free(&list);
+}
+
+int aept_list_upgradable_cached(aept_ctx_t *ctx, const char *pattern,
+                                aept_pkg_list_t *out)
+{
+    aept_pkg_list_t all;
+    int i, n = 0;
+
+    memset(out, 0, sizeof(*out));
+
+    if (upgradable_read(ctx, pattern, out) == 0)
+        return 0;
+
+    if (upgradable_compute(ctx, &all) < 0)
+        return -1;
+
+    /* Keep the entries matching pattern */
+    for (i = 0; i < all.count; i++) {
+        aept_pkg_entry_t *pe = &all.entries[i];
+
+        if (pattern && fnmatch(pattern, pe->name, 0) != 0) {
+            free(pe->name);
+            free(pe->version);
+            free(pe->summary);
+            continue;
+        }
+        all.entries[n++] = *pe;
+    }
+    all.count = n;
+
+    *out = all;
+    return 0;
+}
+
+/* ── Query: show ─────────────────────────────────────────────────── */
+
+/* Describe the newest available version of e, or the installed one if
+ * none is available. */
+static void fill_pkg_info(Pool *pool, const struct api_list_entry *e,
+                          aept_pkg_info_t *out)
+{
+    Solvable *s = e->avail ? e->avail : e->installed;
+    const char *str;
+    unsigned int medianr;
+
+    out->name = strdup(pool_id2str(pool, s->name));
+    out->version = strdup(pool_id2str(pool, s->evr));
+    out->architecture = strdup(pool_id2str(pool, s->arch));
+    out->installed_size = solvable_lookup_num(s, SOLVABLE_INSTALLSIZE, 0);
+
+    out->depends = deparray_to_str(pool, s, SOLVABLE_REQUIRES,
+                                   -SOLVABLE_PREREQMARKER);
     out->pre_depends = deparray_to_str(pool, s, SOLVABLE_REQUIRES,
                                        SOLVABLE_PREREQMARKER);
     out->recommends = deparray_to_str(pool, s, SOLVABLE_RECOMMENDS, 0);
@@ -644,15 +1546,70 @@ int aept_show(aept_ctx_t *ctx, const char *name, aept_pkg_info_t *out)
     str = solvable_lookup_str(s, SOLVABLE_DESCRIPTION);
     out->description = str ? strdup(str) : NULL;
 
-    out->is_installed = installed != NULL;
+    out->is_installed = e->installed != NULL;
+}
 
-    r = 0;
-    goto cleanup;
+int aept_query_show(aept_query_t *q, const char *name, aept_pkg_info_t *out)
+{
+    const struct api_list_entry *e;
+    Pool *pool;
 
-not_found:
-    r = 1;
-cleanup:
-    aept_solver_fini(ctx);
+    memset(out, 0, sizeof(*out));
+
+    query_refresh(q);
+
+    pool = query_pool(q);
+    if (!pool)
+        return -1;
+
+    e = query_find(q, pool, name);
+    if (!e)
+        return 1;
+
+    fill_pkg_info(pool, e, out);
+    return 0;
+}
+
+int aept_query_show_many(aept_query_t *q, const char *const *names,
+                         int count, aept_pkg_info_t **infos_out)
+{
+    aept_pkg_info_t *infos;
+    Pool *pool;
+    int i;
+
+    *infos_out = NULL;
+
+    for (i = 0; i < count; i++) {
+        if (!names[i])
+            return -1;
+    }
+
+    query_refresh(q);
+
+    pool = query_pool(q);
+    if (!pool)
+        return -1;
+
+    infos = aept_malloc((count > 0 ? count : 1) * sizeof(*infos));
+    memset(infos, 0, (count > 0 ? count : 1) * sizeof(*infos));
+
+    for (i = 0; i < count; i++) {
+        const struct api_list_entry *e = query_find(q, pool, names[i]);
+        if (e)
+            fill_pkg_info(pool, e, &infos[i]);
+    }
+
+    *infos_out = infos;
+    return 0;
+}
+
+int aept_show(aept_ctx_t *ctx, const char *name, aept_pkg_info_t *out)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_show(q, name, out);
+    aept_query_close(q);
     return r;
 }
 
@@ -678,12 +1635,22 @@ void aept_pkg_info_free(aept_pkg_info_t *info)
     memset(info, 0, sizeof(*info));
 }
 
+void aept_pkg_infos_free(aept_pkg_info_t *infos, int count)
+{
+    if (!infos)
+        return;
+
+    for (int i = 0; i < count; i++)
+        aept_pkg_info_free(&infos[i]);
+    free(infos);
+}
+
 /* ── Query: files ────────────────────────────────────────────────── */
 
 int aept_files(aept_ctx_t *ctx, const char *name,
                char ***paths_out, int *count_out)
 {
-    char *list_path = NULL;
+    char *list_path = NULL, *dir;
     FILE *fp;
     char buf[4096];
     char **paths = NULL;
@@ -695,7 +1662,9 @@ int aept_files(aept_ctx_t *ctx, const char *name,
     if (!aept_pkg_name_is_safe(name))
         return -1;
 
-    aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, name);
+    dir = aept_status_read_dir(ctx);
+    aept_asprintf(&list_path, "%s/%s.list", dir, name);
+    free(dir);
 
     fp = fopen(list_path, "r");
     free(list_path);
@@ -737,6 +1706,14 @@ int aept_files(aept_ctx_t *ctx, const char *name,
     return 0;
 }
 
+/* .list files are read afresh on every call, so there is nothing for
+ * the session to keep. */
+int aept_query_files(aept_query_t *q, const char *name,
+                     char ***paths_out, int *count_out)
+{
+    return aept_files(q->ctx, name, paths_out, count_out);
+}
+
 /* ── Query: owns ─────────────────────────────────────────────────── */
 
 static const char *strip_leading(const char *p)
@@ -756,15 +1733,129 @@ static size_t owns_path_len(const char *p)
     return len;
 }
 
+/* Owners collected for one query path, without duplicates */
+typedef struct {
+    char **owners;
+    int count;
+    int alloc;
+} owns_acc_t;
+
+static void owns_collect(const char *owner, void *userdata)
+{
+    owns_acc_t *acc = userdata;
+
+    for (int i = 0; i < acc->count; i++) {
+        if (strcmp(acc->owners[i], owner) == 0)
+            return;
+    }
+
+    if (acc->count >= acc->alloc) {
+        acc->alloc = acc->alloc ? acc->alloc * 2 : 4;
+        acc->owners = aept_realloc(acc->owners, acc->alloc * sizeof(char *));
+    }
+    acc->owners[acc->count++] = aept_strdup(owner);
+}
+
+static int owner_name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* List entries are matched ignoring trailing slashes, and are recorded
+ * with at most one, so both forms of the needle are looked up. */
+static void owns_lookup(aept_owner_index_t *idx, const char *path,
+                        owns_acc_t *acc)
+{
+    const char *needle = strip_leading(path);
+    size_t len;
+    char *key;
+
+    if (*needle == '\0')
+        needle = ".";
+    len = owns_path_len(needle);
+
+    key = aept_malloc(len + 2);
+    memcpy(key, needle, len);
+    key[len] = '\0';
+    aept_owner_index_foreach_owner(idx, key, owns_collect, acc);
+
+    if (strcmp(key, ".") != 0) {
+        key[len] = '/';
+        key[len + 1] = '\0';
+        aept_owner_index_foreach_owner(idx, key, owns_collect, acc);
+    }
+    free(key);
+
+    if (acc->count > 1)
+        qsort(acc->owners, acc->count, sizeof(char *), owner_name_cmp);
+}
+
+/* Returns 1 if there is no info_dir, i.e. nothing is installed. */
+static int open_owner_index(aept_ctx_t *ctx, aept_owner_index_t *idx)
+{
+    struct stat st;
+    char *live;
+    int r = 0;
+
+    aept_owner_index_init(idx);
+    live = read_view_enter(ctx);
+
+    /* Queries don't hold the lock, so a rebuilt index is not saved:
+     * without a published generation, an install could change
+     * info_dir while it is being read. */
+    if (stat(ctx->config.info_dir, &st) != 0)
+        r = 1;
+    else if (aept_owner_index_load(ctx, idx) < 0)
+        aept_owner_index_build(ctx, idx);
+
+    read_view_leave(ctx, live);
+    return r;
+}
+
+static int owns_one(aept_owner_index_t *idx, const char *path,
+                    char ***owners_out, int *count_out)
+{
+    owns_acc_t acc = { NULL, 0, 0 };
+
+    owns_lookup(idx, path, &acc);
+
+    *owners_out = acc.owners;
+    *count_out = acc.count;
+    return acc.count > 0 ? 0 : 1;
+}
+
+static int owns_paths_valid(const char *const *paths, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (!paths[i] || *paths[i] == '\0')
+            return 0;
+    }
+    return 1;
+}
+
+/* idx is NULL if nothing is installed. */
+static aept_owns_result_t *owns_batch(aept_owner_index_t *idx,
+                                      const char *const *paths, int count)
+{
+    aept_owns_result_t *results;
+
+    results = aept_malloc((count > 0 ? count : 1) * sizeof(*results));
+    memset(results, 0, (count > 0 ? count : 1) * sizeof(*results));
+
+    for (int i = 0; idx && i < count; i++) {
+        owns_acc_t acc = { NULL, 0, 0 };
+        owns_lookup(idx, paths[i], &acc);
+        results[i].owners = acc.owners;
+        results[i].count = acc.count;
+    }
+    return results;
+}
+
 int aept_owns(aept_ctx_t *ctx, const char *path,
               char ***owners_out, int *count_out)
 {
-    DIR *dir;
-    struct dirent *ent;
-    const char *needle;
-    size_t needle_len;
-    char **owners = NULL;
-    int count = 0, alloc = 0;
+    aept_owner_index_t idx;
+    int r;
 
     *owners_out = NULL;
     *count_out = 0;
@@ -772,79 +1863,224 @@ int aept_owns(aept_ctx_t *ctx, const char *path,
     if (!path || *path == '\0')
         return -1;
 
-    needle = strip_leading(path);
-    if (*needle == '\0')
-        needle = ".";
-    needle_len = owns_path_len(needle);
+    if (open_owner_index(ctx, &idx) != 0)
+        return 1;
 
-    dir = opendir(ctx->config.info_dir);
-    if (!dir)
+    r = owns_one(&idx, path, owners_out, count_out);
+    aept_owner_index_free(&idx);
+    return r;
+}
+
+int aept_owns_many(aept_ctx_t *ctx, const char *const *paths, int count,
+                   aept_owns_result_t **results_out)
+{
+    aept_owner_index_t idx;
+
+    *results_out = NULL;
+
+    if (!owns_paths_valid(paths, count))
+        return -1;
+
+    if (open_owner_index(ctx, &idx) == 0) {
+        *results_out = owns_batch(&idx, paths, count);
+        aept_owner_index_free(&idx);
+    } else {
+        *results_out = owns_batch(NULL, paths, count);
+    }
+    return 0;
+}
+
+/* The session's owner index, or NULL if nothing is installed. */
+static aept_owner_index_t *query_owners(aept_query_t *q)
+{
+    if (q->owners_state == 0)
+        q->owners_state = open_owner_index(q->ctx, &q->owners) == 0 ? 1 : 2;
+    return q->owners_state == 1 ? &q->owners : NULL;
+}
+
+int aept_query_owns(aept_query_t *q, const char *path,
+                    char ***owners_out, int *count_out)
+{
+    aept_owner_index_t *idx;
+
+    *owners_out = NULL;
+    *count_out = 0;
+
+    if (!path || *path == '\0')
+        return -1;
+
+    query_refresh(q);
+
+    idx = query_owners(q);
+    if (!idx)
         return 1;
 
-    while ((ent = readdir(dir)) != NULL) {
-        const char *dot;
-        char *list_path = NULL;
-        FILE *fp;
-        char buf[4096];
+    return owns_one(idx, path, owners_out, count_out);
+}
 
-        dot = strrchr(ent->d_name, '.');
-        if (!dot || strcmp(dot, ".list") != 0)
-            continue;
+int aept_query_owns_many(aept_query_t *q, const char *const *paths,
+                         int count, aept_owns_result_t **results_out)
+{
+    *results_out = NULL;
 
-        aept_asprintf(&list_path, "%s/%s", ctx->config.info_dir, ent->d_name);
-        fp = fopen(list_path, "r");
-        free(list_path);
+    if (!owns_paths_valid(paths, count))
+        return -1;
 
-        if (!fp)
-            continue;
+    query_refresh(q);
 
-        while (fgets(buf, sizeof(buf), fp)) {
-            const char *entry;
-            char *tab;
+    *results_out = owns_batch(query_owners(q), paths, count);
+    return 0;
+}
 
-            if (aept_fgets_is_truncated(buf, sizeof(buf))) {
-                aept_fgets_drain_line(fp);
-                continue;
-            }
-            buf[strcspn(buf, "\n")] = '\0';
+void aept_owns_results_free(aept_owns_result_t *results, int count)
+{
+    if (!results)
+        return;
 
-            tab = strchr(buf, '\t');
-            if (tab)
-                *tab = '\0';
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < results[i].count; j++)
+            free(results[i].owners[j]);
+        free(results[i].owners);
+    }
+    free(results);
+}
 
-            if (*buf == '\0')
-                continue;
+/* ── Query: reverse dependencies ─────────────────────────────────── */
 
-            entry = strip_leading(buf);
-            if (*entry == '\0')
-                entry = ".";
+/* The session's graph of the installed packages, built on first use. */
+static const aept_depgraph_t *query_graph(aept_query_t *q, Pool *pool)
+{
+    if (!q->graph_built) {
+        aept_depgraph_build(&q->graph, pool);
+        q->graph_built = 1;
+    }
+    return &q->graph;
+}
 
-            if (owns_path_len(entry) == needle_len &&
-                strncmp(entry, needle, needle_len) == 0) {
-                size_t name_len = (size_t)(dot - ent->d_name);
+/* Names of the nodes marked in mark, sorted. */
+static void marked_names(Pool *pool, const aept_depgraph_t *g,
+                         const uint64_t *mark, char ***names_out,
+                         int *count_out)
+{
+    char **names = NULL;
+    int count = 0, alloc = 0;
 
-                if (count >= alloc) {
-                    alloc = alloc ? alloc * 2 : 4;
-                    owners = aept_realloc(owners, alloc * sizeof(char *));
-                }
-                char *owner = malloc(name_len + 1);
-                if (owner) {
-                    memcpy(owner, ent->d_name, name_len);
-                    owner[name_len] = '\0';
-                    owners[count++] = owner;
-                }
-                break;
-            }
-        }
+    for (int i = 0; i < g->n; i++) {
+        Solvable *s;
 
-        fclose(fp);
+        if (!aept_depgraph_test(mark, i))
+            continue;
+
+        if (count >= alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            names = aept_realloc(names, alloc * sizeof(char *));
+        }
+        s = pool_id2solvable(pool, g->start + i);
+        names[count++] = aept_strdup(pool_id2str(pool, s->name));
     }
 
-    closedir(dir);
+    if (count > 1)
+        qsort(names, count, sizeof(char *), owner_name_cmp);
 
-    *owners_out = owners;
+    *names_out = names;
     *count_out = count;
-    return count > 0 ? 0 : 1;
+}
+
+int aept_query_whatdepends(aept_query_t *q, const char *name, int flags,
+                           char ***names_out, int *count_out)
+{
+    const struct api_list_entry *e;
+    const aept_depgraph_t *g;
+    uint64_t *mark;
+    Pool *pool;
+    int node;
+
+    *names_out = NULL;
+    *count_out = 0;
+
+    if (!name)
+        return -1;
+
+    query_refresh(q);
+
+    pool = query_pool(q);
+    if (!pool)
+        return -1;
+
+    e = query_find(q, pool, name);
+    if (!e || !e->installed)
+        return 1;
+
+    g = query_graph(q, pool);
+    node = aept_depgraph_node(g, pool_solvable2id(pool, e->installed));
+    if (node < 0)
+        return 1;
+
+    mark = aept_malloc(aept_depgraph_words(g) * sizeof(uint64_t));
+    memset(mark, 0, aept_depgraph_words(g) * sizeof(uint64_t));
+
+    if (flags & AEPT_WHATDEPENDS_RECURSIVE) {
+        aept_depgraph_set(mark, node);
+        aept_depgraph_reach(g, mark, 1);
+        mark[node >> 6] &= ~((uint64_t)1 << (node & 63));
+    } else {
+        for (int j = g->rev_off[node]; j < g->rev_off[node + 1]; j++)
+            aept_depgraph_set(mark, g->rev[j]);
+    }
+
+    marked_names(pool, g, mark, names_out, count_out);
+    free(mark);
+    return 0;
+}
+
+int aept_whatdepends(aept_ctx_t *ctx, const char *name, int flags,
+                     char ***names_out, int *count_out)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_whatdepends(q, name, flags, names_out, count_out);
+    aept_query_close(q);
+    return r;
+}
+
+int aept_query_autoremovable(aept_query_t *q, char ***names_out,
+                             int *count_out)
+{
+    const aept_depgraph_t *g;
+    uint64_t *mark;
+    Pool *pool;
+    int r;
+
+    *names_out = NULL;
+    *count_out = 0;
+
+    query_refresh(q);
+
+    pool = query_pool(q);
+    if (!pool)
+        return -1;
+
+    g = query_graph(q, pool);
+    mark = aept_malloc((g->n > 0 ? aept_depgraph_words(g) : 1) *
+                       sizeof(uint64_t));
+
+    r = aept_autoremove_unneeded(q->ctx, pool, g, mark);
+    if (r > 0)
+        marked_names(pool, g, mark, names_out, count_out);
+
+    free(mark);
+    return r < 0 ? -1 : 0;
+}
+
+int aept_autoremovable(aept_ctx_t *ctx, char ***names_out, int *count_out)
+{
+    aept_query_t *q = aept_query_open(ctx);
+    int r;
+
+    r = aept_query_autoremovable(q, names_out, count_out);
+    aept_query_close(q);
+    return r;
 }
 
 /* ── Query: architectures ────────────────────────────────────────── */
@@ -870,3 +2106,28 @@ int aept_architectures(aept_ctx_t *ctx, char ***archs_out, int *count_out)
 
     return 0;
 }
+
+/* ── Query: verify ───────────────────────────────────────────────── */
+
+int aept_verify(aept_ctx_t *ctx, const char **names, int count, int flags,
+                aept_verify_problem_t **problems_out, int *count_out)
+{
+    char *live = read_view_enter(ctx);
+    int r;
+
+    r = aept_op_verify(ctx, names, count, flags, problems_out, count_out);
+    read_view_leave(ctx, live);
+    return r;
+}
+
+void aept_verify_problems_free(aept_verify_problem_t *problems, int count)
+{
+    if (!problems)
+        return;
+
+    for (int i = 0; i < count; i++) {
+        free(problems[i].package);
+        free(problems[i].path);
+    }
+    free(problems);
+}
@@ -13,13 +13,28 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include <solv/chksum.h>
+#include <solv/knownid.h>
+#include <solv/util.h>
+
+#ifdef HAVE_LZMA_MT
+#include <lzma.h>
+#endif
 
 #include "aept/archive.h"
+#include "aept/extract.h"
 #include "aept/msg.h"
+#include "aept/progress.h"
 #include "aept/util.h"
 
 #define BLOCK_SIZE 0x8000
 
+/* Largest file hashed in memory to find out whether it changed since
+ * the installed version, before it is written or left alone */
+#define KEEP_HASH_MAX (8 << 20)
+
 /*
  * Pipe callbacks: feed data from one libarchive reader (the outer AR member)
  * into a second reader (the inner compressed tar).
@@ -48,6 +63,167 @@ static int pipe_close_cb(struct archive *a, void *opaque)
     return ARCHIVE_OK;
 }
 
+/*
+ * Multi-threaded xz decoding.  libarchive's xz filter only uses one
+ * core, so for xz input and more than one thread the data is decoded
+ * here with liblzma's threaded decoder and handed to libarchive already
+ * decompressed.  liblzma only runs blocks in parallel for files written
+ * in multiple blocks (xz -T), and falls back to one thread otherwise.
+ */
+
+/* Number of decoder threads for the decompress_threads option value. */
+static int resolve_threads(int threads)
+{
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+    return threads;
+}
+
+#ifdef HAVE_LZMA_MT
+
+static const unsigned char xz_magic[6] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+
+struct xz_mt_ctx {
+    lzma_stream strm;
+    aept_ar_read_fn read;           /* compressed input */
+    void *userdata;
+    void (*close)(void *userdata);
+    int in_eof;
+    int done;
+    uint8_t in[BLOCK_SIZE];
+    uint8_t out[BLOCK_SIZE];
+};
+
+static ssize_t xz_mt_read_cb(struct archive *a, void *opaque,
+                             const void **out)
+{
+    struct xz_mt_ctx *ctx = opaque;
+
+    *out = ctx->out;
+    if (ctx->done)
+        return 0;
+
+    ctx->strm.next_out = ctx->out;
+    ctx->strm.avail_out = sizeof(ctx->out);
+
+    while (ctx->strm.avail_out == sizeof(ctx->out)) {
+        if (ctx->strm.avail_in == 0 && !ctx->in_eof) {
+            ssize_t n = ctx->read(ctx->userdata, ctx->in, sizeof(ctx->in));
+            if (n < 0) {
+                archive_set_error(a, EIO, "read error");
+                return -1;
+            }
+            ctx->strm.next_in = ctx->in;
+            ctx->strm.avail_in = (size_t)n;
+            ctx->in_eof = n == 0;
+        }
+
+        lzma_ret ret = lzma_code(&ctx->strm,
+                                 ctx->in_eof ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_STREAM_END) {
+            ctx->done = 1;
+            break;
+        }
+        if (ret != LZMA_OK) {
+            archive_set_error(a, EIO,
+                              "xz decompression failed (error %d)", ret);
+            return -1;
+        }
+    }
+
+    return (ssize_t)(sizeof(ctx->out) - ctx->strm.avail_out);
+}
+
+static int xz_mt_close_cb(struct archive *a, void *opaque)
+{
+    (void)a;
+    struct xz_mt_ctx *ctx = opaque;
+
+    lzma_end(&ctx->strm);
+    if (ctx->close)
+        ctx->close(ctx->userdata);
+    free(ctx);
+    return ARCHIVE_OK;
+}
+
+/*
+ * Set up a threaded decoder over read().  The first `len` bytes of input
+ * were already consumed by the caller and are passed in `head`.  Returns
+ * NULL if liblzma cannot set up the decoder.
+ */
+static struct xz_mt_ctx *xz_mt_new(int threads, const void *head, size_t len,
+                                   aept_ar_read_fn read, void *userdata,
+                                   void (*close)(void *userdata))
+{
+    struct xz_mt_ctx *ctx = aept_malloc(sizeof(*ctx));
+    lzma_stream init = LZMA_STREAM_INIT;
+    lzma_mt mt;
+    uint64_t physmem = lzma_physmem();
+
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = (uint32_t)threads;
+    /* Above this, liblzma decodes in a single thread rather than fail */
+    mt.memlimit_threading = physmem ? physmem / 4 : UINT64_MAX;
+    mt.memlimit_stop = UINT64_MAX;
+
+    ctx->strm = init;
+    if (lzma_stream_decoder_mt(&ctx->strm, &mt) != LZMA_OK) {
+        aept_log_debug("cannot set up threaded xz decoder");
+        free(ctx);
+        return NULL;
+    }
+
+    if (len)
+        memcpy(ctx->in, head, len);
+    ctx->strm.next_in = ctx->in;
+    ctx->strm.avail_in = len;
+    ctx->read = read;
+    ctx->userdata = userdata;
+    ctx->close = close;
+    ctx->in_eof = 0;
+    ctx->done = 0;
+    return ctx;
+}
+
+static ssize_t member_read(void *userdata, void *buf, size_t size)
+{
+    return archive_read_data(userdata, buf, size);
+}
+
+static void member_close(void *userdata)
+{
+    archive_read_free(userdata);
+}
+
+static ssize_t file_read(void *userdata, void *buf, size_t size)
+{
+    size_t n = fread(buf, 1, size, userdata);
+    return ferror((FILE *)userdata) ? -1 : (ssize_t)n;
+}
+
+static void file_close(void *userdata)
+{
+    fclose(userdata);
+}
+
+/* Open `reader` on the decoder output.  Takes ownership of ctx. */
+static int open_xz_mt(struct archive *reader, struct xz_mt_ctx *ctx)
+{
+    /* libarchive calls xz_mt_close_cb even if the open fails */
+    if (archive_read_open(reader, ctx, NULL, xz_mt_read_cb,
+                          xz_mt_close_cb) != ARCHIVE_OK) {
+        aept_log_error("failed to open xz stream: %s",
+                  archive_error_string(reader));
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* HAVE_LZMA_MT */
+
 /*
  * Normalize a path in-place by stripping leading "./", collapsing "//",
  * and resolving "." and ".." components.  Returns a newly allocated string.
@@ -150,17 +326,48 @@ static char *safe_join(const char *prefix, const char *entry_path)
     return resolved;
 }
 
+/* Whether path, past any leading "./" and "/", has no empty, "." or
+ * ".." components, which normalize_path() would change. */
+static int path_is_normal(const char *path)
+{
+    while (path[0] == '.' && path[1] == '/')
+        path += 2;
+    while (path[0] == '/')
+        path++;
+    if (path[0] == '\0')
+        return 1;
+
+    for (;;) {
+        const char *end = strchrnul(path, '/');
+        size_t len = end - path;
+
+        if (len == 0 || (len == 1 && path[0] == '.') ||
+                (len == 2 && path[0] == '.' && path[1] == '.'))
+            return 0;
+        if (*end == '\0')
+            return 1;
+        path = end + 1;
+    }
+}
+
 /*
  * Look up an archive entry path in a fileset, normalizing the entry
  * path with full ".." resolution first.  Without this, a crafted entry
  * named "etc/../etc/foo.conf" would not match the canonical
  * "etc/foo.conf" stored in the set, because aept_fileset_contains()
- * does not resolve ".." components.
+ * does not resolve ".." components.  Paths that are normal already,
+ * which is nearly all of them, are looked up as they are.
  */
 static int fileset_contains_entry(aept_fileset_t *fs, const char *entry_path)
 {
-    char *norm = normalize_path(entry_path);
-    int r = aept_fileset_contains(fs, norm);
+    char *norm;
+    int r;
+
+    if (path_is_normal(entry_path))
+        return aept_fileset_contains(fs, entry_path);
+
+    norm = normalize_path(entry_path);
+    r = aept_fileset_contains(fs, norm);
     free(norm);
     return r;
 }
@@ -289,16 +496,17 @@ static struct archive *open_outer(const char *path)
 /*
  * Scan AR members for an entry whose name starts with the given prefix
  * (e.g. "control.tar" or "data.tar").  Positions the reader on that
- * member so its data can be piped into an inner reader.
+ * member so its data can be piped into an inner reader, and returns
+ * the member name without any leading "./" (NULL if there is none).
  */
-static int seek_member(struct archive *ar, const char *prefix)
+static const char *seek_member(struct archive *ar, const char *prefix)
 {
     size_t pfxlen = strlen(prefix);
 
     for (;;) {
         struct archive_entry *entry = next_header(ar, NULL);
         if (!entry)
-            return -1;
+            return NULL;
 
         const char *name = archive_entry_pathname(entry);
 
@@ -307,36 +515,66 @@ static int seek_member(struct archive *ar, const char *prefix)
             name += 2;
 
         if (strncmp(name, prefix, pfxlen) == 0)
-            return 0;
+            return name;
     }
 }
 
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), slen = strlen(suffix);
+    return len >= slen && strcmp(s + len - slen, suffix) == 0;
+}
+
 /*
  * Open the inner compressed tar that is embedded in an AR member.
- * Takes ownership of `outer` (freed on close of the returned reader).
+ * Takes ownership of `outer`, which is freed on close of the returned
+ * reader or right away on failure.  With `raw` set, the member is only
+ * decompressed, not parsed as tar.  An xz member is decoded on up to
+ * `xz_threads` threads.
  */
-static struct archive *open_inner(struct archive *outer)
+static struct archive *open_inner(struct archive *outer, int raw,
+                                  int xz_threads)
 {
-    struct pipe_ctx *ctx = aept_malloc(sizeof(*ctx));
-    ctx->source = outer;
-
     struct archive *inner = archive_read_new();
     if (!inner) {
         aept_log_error("failed to create inner archive reader");
-        free(ctx);
+        archive_read_free(outer);
         return NULL;
     }
 
-    archive_read_support_filter_all(inner);
-    archive_read_support_format_tar(inner);
+    if (raw)
+        archive_read_support_format_raw(inner);
+    else
+        archive_read_support_format_tar(inner);
     archive_read_support_format_empty(inner);
 
+#ifdef HAVE_LZMA_MT
+    if (xz_threads > 1) {
+        struct xz_mt_ctx *xz = xz_mt_new(xz_threads, NULL, 0, member_read,
+                                         outer, member_close);
+        if (xz) {
+            if (open_xz_mt(inner, xz) < 0) {
+                archive_read_free(inner);
+                return NULL;
+            }
+            return inner;
+        }
+    }
+#else
+    (void)xz_threads;
+#endif
+
+    struct pipe_ctx *ctx = aept_malloc(sizeof(*ctx));
+    ctx->source = outer;
+
+    archive_read_support_filter_all(inner);
+
+    /* libarchive calls pipe_close_cb even if the open fails */
     if (archive_read_open(inner, ctx, NULL, pipe_read_cb,
                           pipe_close_cb) != ARCHIVE_OK) {
         aept_log_error("failed to open inner archive: %s",
                   archive_error_string(inner));
         archive_read_free(inner);
-        free(ctx);
         return NULL;
     }
 
@@ -345,26 +583,25 @@ static struct archive *open_inner(struct archive *outer)
 
 /*
  * Open an inner tar from an IPK, seeking to the AR member whose name
- * starts with `prefix` (e.g. "control.tar" or "data.tar").
+ * starts with `prefix` (e.g. "control.tar" or "data.tar").  `threads`
+ * is the decompress_threads setting for an xz-compressed member.
  */
-static struct archive *open_ipk_tar(const char *ipk_path, const char *prefix)
+static struct archive *open_ipk_tar(const char *ipk_path, const char *prefix,
+                                    int raw, int threads)
 {
     struct archive *outer = open_outer(ipk_path);
     if (!outer)
         return NULL;
 
-    if (seek_member(outer, prefix) < 0) {
+    const char *member = seek_member(outer, prefix);
+    if (!member) {
         archive_read_free(outer);
         return NULL;
     }
 
-    struct archive *inner = open_inner(outer);
-    if (!inner) {
-        archive_read_free(outer);
-        return NULL;
-    }
+    int xz_threads = has_suffix(member, ".xz") ? resolve_threads(threads) : 1;
 
-    return inner;
+    return open_inner(outer, raw, xz_threads);
 }
 
 /*
@@ -390,20 +627,231 @@ static struct archive *new_disk_writer(int flags)
     return disk;
 }
 
+/* Feed len zero bytes to chk, for the holes of a sparse file. */
+static void chksum_add_zeros(Chksum *chk, int64_t len)
+{
+    static const char zeros[BLOCK_SIZE];
+
+    while (len > 0) {
+        int n = len > BLOCK_SIZE ? BLOCK_SIZE : (int)len;
+        solv_chksum_add(chk, zeros, n);
+        len -= n;
+    }
+}
+
+/*
+ * Write entry and its data to disk, like archive_read_extract2().  If
+ * chk is non-NULL the content is fed to it on the way, so the digest
+ * costs no second read.  On failure *err is set to whichever of ar and
+ * disk holds the error message.
+ */
+static int extract_entry(struct archive *ar, struct archive_entry *entry,
+                         struct archive *disk, Chksum *chk,
+                         struct archive **err)
+{
+    int64_t hashed = 0;
+    int r, r2;
+
+    *err = disk;
+    r = archive_write_header(disk, entry);
+    if (r < ARCHIVE_WARN)
+        return r;
+
+    if (archive_entry_size(entry) > 0) {
+        for (;;) {
+            const void *buf;
+            size_t len;
+            int64_t offset;
+
+            r2 = archive_read_data_block(ar, &buf, &len, &offset);
+            if (r2 == ARCHIVE_EOF)
+                break;
+            if (r2 < ARCHIVE_WARN) {
+                *err = ar;
+                return r2;
+            }
+
+            if (archive_write_data_block(disk, buf, len, offset) < 0)
+                return ARCHIVE_FAILED;
+
+            if (chk) {
+                if (offset > hashed)
+                    chksum_add_zeros(chk, offset - hashed);
+                solv_chksum_add(chk, buf, (int)len);
+                hashed = offset + (int64_t)len;
+            }
+        }
+    }
+
+    if (chk && archive_entry_size(entry) > hashed)
+        chksum_add_zeros(chk, archive_entry_size(entry) - hashed);
+
+    r2 = archive_write_finish_entry(disk);
+    return r2 < r ? r2 : r;
+}
+
+static void entry_header(struct archive_entry *entry, aept_ar_header_t *hdr)
+{
+    hdr->path = archive_entry_pathname(entry);
+    hdr->link_target = archive_entry_filetype(entry) == AE_IFLNK ?
+        archive_entry_symlink(entry) : NULL;
+    hdr->hardlink = archive_entry_hardlink(entry);
+    hdr->uname = archive_entry_uname(entry);
+    hdr->gname = archive_entry_gname(entry);
+    hdr->mode = (unsigned int)archive_entry_mode(entry);
+    hdr->uid = (unsigned int)archive_entry_uid(entry);
+    hdr->gid = (unsigned int)archive_entry_gid(entry);
+    hdr->size = (long long)archive_entry_size(entry);
+    hdr->mtime = (long long)archive_entry_mtime(entry);
+    hdr->mtime_nsec = archive_entry_mtime_nsec(entry);
+}
+
+static int copy_data(struct archive *ar, int fd, long long size,
+                     char digest[65])
+{
+    Chksum *chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    int64_t hashed = 0;
+    int ret = -1;
+
+    for (;;) {
+        const void *buf;
+        size_t len;
+        int64_t offset;
+
+        int r = archive_read_data_block(ar, &buf, &len, &offset);
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r < ARCHIVE_WARN) {
+            aept_log_error("failed to read archive data: %s",
+                           archive_error_string(ar));
+            goto cleanup;
+        }
+
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pwrite(fd, (const char *)buf + done, len - done,
+                               (off_t)(offset + (int64_t)done));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                goto cleanup;
+            done += (size_t)n;
+        }
+
+        if (offset > hashed)
+            chksum_add_zeros(chk, offset - hashed);
+        solv_chksum_add(chk, buf, (int)len);
+        hashed = offset + (int64_t)len;
+    }
+
+    if (size > hashed)
+        chksum_add_zeros(chk, size - hashed);
+    if (ftruncate(fd, (off_t)size) < 0)
+        goto cleanup;
+
+    int len;
+    const unsigned char *raw = solv_chksum_get(chk, &len);
+    solv_bin2hex(raw, len, digest);
+    ret = 0;
+
+cleanup:
+    solv_chksum_free(chk, NULL);
+    return ret;
+}
+
+/* Read the content of the current regular file of size bytes into
+ * *out, with holes as zeros, and store its SHA-256 in hex in digest. */
+static int read_data(struct archive *ar, long long size, char **out,
+                     char digest[65])
+{
+    char *buf = aept_malloc(size > 0 ? (size_t)size : 1);
+    Chksum *chk;
+
+    memset(buf, 0, size > 0 ? (size_t)size : 1);
+
+    for (;;) {
+        const void *block;
+        size_t len;
+        int64_t offset;
+
+        int r = archive_read_data_block(ar, &block, &len, &offset);
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r < ARCHIVE_WARN || offset < 0 ||
+                offset + (int64_t)len > size) {
+            aept_log_error("failed to read archive data: %s",
+                           archive_error_string(ar));
+            free(buf);
+            return -1;
+        }
+        memcpy(buf + offset, block, len);
+    }
+
+    chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    solv_chksum_add(chk, buf, (int)size);
+
+    int len;
+    const unsigned char *raw = solv_chksum_get(chk, &len);
+    solv_bin2hex(raw, len, digest);
+    solv_chksum_free(chk, NULL);
+
+    *out = buf;
+    return 0;
+}
+
+/* Fill callback for aept_extract_entry() from the current entry, or
+ * from buf if it was read already */
+typedef struct {
+    struct archive *ar;
+    long long size;
+    int copied;
+    char digest[65];
+    char *buf;
+} fill_arg_t;
+
+static int fill_from_archive(void *userdata, int fd)
+{
+    fill_arg_t *f = userdata;
+
+    if (f->buf) {
+        for (long long done = 0; done < f->size; ) {
+            ssize_t n = pwrite(fd, f->buf + done, (size_t)(f->size - done),
+                               (off_t)done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            done += n;
+        }
+    } else if (copy_data(f->ar, fd, f->size, f->digest) < 0) {
+        return -1;
+    }
+    f->copied = 1;
+    return 0;
+}
+
 /*
  * Extract every entry from `ar` into `dest`, using the given flags.
  * If `conffiles` is non-empty, matching entries are extracted with
  * `cf_suffix` appended to the destination (e.g. ".aept-new") and
  * without the NO_OVERWRITE flag.
+ *
+ * Data archives, which are extracted with their modes and times, are
+ * written through extract.c relative to directory handles.  Control
+ * archives and entries extract.c cannot create, such as device nodes,
+ * go through libarchive's disk writer by absolute path.
  */
 static int do_extract_all(struct archive *ar, const char *dest, int flags,
                           unsigned long *size, aept_fileset_t *conffiles,
                           const char *cf_suffix,
-                          aept_ar_file_list_t *recorded)
+                          aept_ar_file_list_t *recorded,
+                          aept_ar_installed_t *installed)
 {
     int ret = -1;
     char *keep_path = NULL;
     char *keep_link = NULL;
+    char *keep_digest = NULL;
+    Chksum *chk = NULL;
+    aept_extract_t *x = NULL;
 
     struct archive *disk = new_disk_writer(flags);
     if (!disk)
@@ -413,10 +861,14 @@ static int do_extract_all(struct archive *ar, const char *dest, int flags,
     struct archive *cf_disk = NULL;
     if (have_cf) {
         cf_disk = new_disk_writer(flags & ~ARCHIVE_EXTRACT_NO_OVERWRITE);
-        if (!cf_disk) {
-            archive_write_free(disk);
-            return -1;
-        }
+        if (!cf_disk)
+            goto cleanup;
+    }
+
+    if (flags & ARCHIVE_EXTRACT_PERM) {
+        x = aept_extract_begin(dest, (flags & ARCHIVE_EXTRACT_OWNER) != 0);
+        if (!x)
+            goto cleanup;
     }
 
     for (;;) {
@@ -442,6 +894,11 @@ static int do_extract_all(struct archive *ar, const char *dest, int flags,
             goto cleanup;
         }
 
+        aept_ar_header_t hdr;
+        entry_header(entry, &hdr);
+        int direct = x && aept_extract_supported(&hdr);
+        int kept = 0;
+
         /*
          * Capture the archive-relative metadata before rewrite_all_paths
          * overwrites the entry pathname — so the caller can build a
@@ -458,46 +915,101 @@ static int do_extract_all(struct archive *ar, const char *dest, int flags,
                     tgt = "<redacted>";
                 keep_link = aept_strdup(tgt);
             }
+            /* Hard links carry no data of their own */
+            if (S_ISREG(st->st_mode) && !archive_entry_hardlink(entry) &&
+                    !direct)
+                chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
         }
 
         int is_cf = have_cf &&
             fileset_contains_entry(conffiles, raw_path);
 
-        int skip = rewrite_all_paths(entry, dest);
-        if (skip != 0) {
-            free(keep_path);
-            free(keep_link);
-            keep_path = NULL;
-            keep_link = NULL;
-            if (skip == 1)
+        if (direct) {
+            fill_arg_t fill = { ar, hdr.size, 0, "", NULL };
+            const aept_ar_file_entry_t *old = NULL;
+            int r = 0;
+
+            if (installed && !is_cf)
+                old = aept_ar_installed_find(installed, raw_path);
+
+            /* Hash an apparently unchanged file before writing it */
+            if (old && hdr.size <= KEEP_HASH_MAX &&
+                    aept_extract_keep(x, &hdr, old, NULL) == 0) {
+                if (read_data(ar, hdr.size, &fill.buf, fill.digest) < 0)
+                    goto cleanup;
+                kept = aept_extract_keep(x, &hdr, old, fill.digest) == 0;
+            }
+
+            if (kept) {
+                fill.copied = 1;
+                installed->unchanged++;
+            } else {
+                r = aept_extract_entry(x, &hdr, is_cf ? cf_suffix : NULL,
+                                       fill_from_archive, &fill);
+            }
+            free(fill.buf);
+            if (r < 0)
+                goto cleanup;
+            if (r == 1) {
+                free(keep_path);
+                free(keep_link);
+                keep_path = NULL;
+                keep_link = NULL;
                 continue;
-            goto cleanup;
-        }
+            }
+            if (recorded && fill.copied)
+                keep_digest = aept_strdup(fill.digest);
+        } else {
+            int skip = rewrite_all_paths(entry, dest);
+            if (skip != 0) {
+                free(keep_path);
+                free(keep_link);
+                keep_path = NULL;
+                keep_link = NULL;
+                solv_chksum_free(chk, NULL);
+                chk = NULL;
+                if (skip == 1)
+                    continue;
+                goto cleanup;
+            }
 
-        if (is_cf && cf_suffix) {
-            const char *pathname = archive_entry_pathname(entry);
-            char *suffixed;
-            aept_asprintf(&suffixed, "%s%s", pathname, cf_suffix);
-            archive_entry_set_pathname(entry, suffixed);
-            free(suffixed);
-        }
+            if (is_cf && cf_suffix) {
+                const char *pathname = archive_entry_pathname(entry);
+                char *suffixed;
+                aept_asprintf(&suffixed, "%s%s", pathname, cf_suffix);
+                archive_entry_set_pathname(entry, suffixed);
+                free(suffixed);
+            }
 
-        aept_log_debug("extracting '%s'", archive_entry_pathname(entry));
+            aept_log_debug("extracting '%s'", archive_entry_pathname(entry));
 
-        int r = archive_read_extract2(ar, entry, is_cf ? cf_disk : disk);
-        if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
-            aept_log_error("failed to extract '%s': %s",
-                      archive_entry_pathname(entry),
-                      archive_error_string(ar));
-            goto cleanup;
+            struct archive *err;
+            int r = extract_entry(ar, entry, is_cf ? cf_disk : disk, chk,
+                                  &err);
+            if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+                aept_log_error("failed to extract '%s': %s",
+                          archive_entry_pathname(entry),
+                          archive_error_string(err));
+                goto cleanup;
+            }
+            if (r == ARCHIVE_WARN)
+                aept_log_debug("warning extracting '%s': %s",
+                          archive_entry_pathname(entry),
+                          archive_error_string(err));
+
+            if (chk) {
+                int len;
+                const unsigned char *raw = solv_chksum_get(chk, &len);
+                keep_digest = aept_malloc(len * 2 + 1);
+                solv_bin2hex(raw, len, keep_digest);
+                solv_chksum_free(chk, NULL);
+                chk = NULL;
+            }
         }
-        if (r == ARCHIVE_WARN)
-            aept_log_debug("warning extracting '%s': %s",
-                      archive_entry_pathname(entry),
-                      archive_error_string(ar));
 
-        if (size)
+        if (size && !kept)
             *size += archive_entry_size(entry);
+        aept_progress_add(archive_entry_size(entry));
 
         if (recorded && keep_path) {
             if (recorded->count >= recorded->alloc) {
@@ -505,12 +1017,25 @@ static int do_extract_all(struct archive *ar, const char *dest, int flags,
                 recorded->entries = aept_realloc(recorded->entries,
                         recorded->alloc * sizeof(*recorded->entries));
             }
-            recorded->entries[recorded->count].path = keep_path;
-            recorded->entries[recorded->count].link_target = keep_link;
-            recorded->entries[recorded->count].mode = keep_mode;
+            aept_ar_file_entry_t *e = &recorded->entries[recorded->count];
+            aept_arena_t *strings = &recorded->strings;
+            e->path = aept_arena_strdup(strings, keep_path);
+            e->link_target = keep_link ?
+                aept_arena_strdup(strings, keep_link) : NULL;
+            e->mode = keep_mode;
+            e->digest = keep_digest ?
+                aept_arena_strdup(strings, keep_digest) : NULL;
+            e->size = keep_digest ? (unsigned long long)
+                                    archive_entry_size(entry) : 0;
+            e->mtime = keep_digest ? (long long)archive_entry_mtime(entry)
+                                   : 0;
             recorded->count++;
+            free(keep_path);
+            free(keep_link);
+            free(keep_digest);
             keep_path = NULL;
             keep_link = NULL;
+            keep_digest = NULL;
         }
     }
 
@@ -518,6 +1043,9 @@ static int do_extract_all(struct archive *ar, const char *dest, int flags,
 cleanup:
     free(keep_path);
     free(keep_link);
+    free(keep_digest);
+    solv_chksum_free(chk, NULL);
+    aept_extract_end(x);
     if (cf_disk)
         archive_write_free(cf_disk);
     archive_write_free(disk);
@@ -530,7 +1058,7 @@ cleanup:
 
 struct aept_ar *aept_ar_open_pkg_control_archive(const char *filename)
 {
-    struct archive *inner = open_ipk_tar(filename, "control.tar");
+    struct archive *inner = open_ipk_tar(filename, "control.tar", 0, 1);
     if (!inner)
         return NULL;
 
@@ -542,13 +1070,8 @@ struct aept_ar *aept_ar_open_pkg_control_archive(const char *filename)
     return ar;
 }
 
-struct aept_ar *aept_ar_open_pkg_data_archive(const char *filename,
-                                              int ignore_uid)
+static struct aept_ar *new_data_ar(struct archive *inner, int ignore_uid)
 {
-    struct archive *inner = open_ipk_tar(filename, "data.tar");
-    if (!inner)
-        return NULL;
-
     struct aept_ar *ar = aept_malloc(sizeof(*ar));
     ar->ar = inner;
     ar->extract_flags = ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM |
@@ -562,26 +1085,125 @@ struct aept_ar *aept_ar_open_pkg_data_archive(const char *filename,
     return ar;
 }
 
-struct aept_ar *aept_ar_open_compressed_file(const char *filename)
+struct aept_ar *aept_ar_open_pkg_data_archive(const char *filename,
+                                              int ignore_uid, int threads)
+{
+    struct archive *inner = open_ipk_tar(filename, "data.tar", 0, threads);
+    if (!inner)
+        return NULL;
+
+    return new_data_ar(inner, ignore_uid);
+}
+
+int aept_ar_spool_pkg_data_archive(const char *filename,
+                                   const char *spool_path, int threads)
+{
+    FILE *fp = NULL;
+    int ret = -1;
+
+    struct archive *inner = open_ipk_tar(filename, "data.tar", 1, threads);
+    if (!inner)
+        return -1;
+
+    int eof;
+    if (!next_header(inner, &eof) && !eof)
+        goto cleanup;
+
+    fp = fopen(spool_path, "wb");
+    if (!fp) {
+        aept_log_error("cannot create '%s': %s", spool_path, strerror(errno));
+        goto cleanup;
+    }
+
+    if (!eof && stream_entry(inner, fp) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (fp && fclose(fp) != 0 && ret == 0) {
+        aept_log_error("failed to write '%s': %s", spool_path,
+                  strerror(errno));
+        ret = -1;
+    }
+    if (ret != 0)
+        unlink(spool_path);
+    archive_read_free(inner);
+    return ret;
+}
+
+struct aept_ar *aept_ar_open_spooled_data_archive(const char *spool_path,
+                                                  int ignore_uid)
 {
     struct archive *reader = archive_read_new();
     if (!reader) {
-        aept_log_error("failed to create archive reader for compressed file");
+        aept_log_error("failed to create archive reader");
         return NULL;
     }
 
-    archive_read_support_filter_gzip(reader);
-    archive_read_support_format_raw(reader);
+    archive_read_support_format_tar(reader);
     archive_read_support_format_empty(reader);
 
-    if (archive_read_open_filename(reader, filename,
+    if (archive_read_open_filename(reader, spool_path,
                                    BLOCK_SIZE) != ARCHIVE_OK) {
         aept_log_error("failed to open '%s': %s",
-                  filename, archive_error_string(reader));
+                  spool_path, archive_error_string(reader));
         archive_read_free(reader);
         return NULL;
     }
 
+    return new_data_ar(reader, ignore_uid);
+}
+
+/*
+ * Stream callbacks: feed a gzip decoder from a caller-supplied reader, e.g.
+ * a network transfer, so the compressed data never touches the disk.
+ */
+
+struct stream_ctx {
+    aept_ar_read_fn read;
+    void *userdata;
+    char buf[BLOCK_SIZE];
+};
+
+static ssize_t stream_read_cb(struct archive *a, void *opaque,
+                              const void **out)
+{
+    struct stream_ctx *ctx = opaque;
+    ssize_t n = ctx->read(ctx->userdata, ctx->buf, sizeof(ctx->buf));
+
+    if (n < 0) {
+        archive_set_error(a, EIO, "read error");
+        return -1;
+    }
+    *out = ctx->buf;
+    return n;
+}
+
+static int stream_close_cb(struct archive *a, void *opaque)
+{
+    (void)a;
+    free(opaque);
+    return ARCHIVE_OK;
+}
+
+static struct archive *new_compressed_reader(void)
+{
+    struct archive *reader = archive_read_new();
+    if (!reader) {
+        aept_log_error("failed to create archive reader for compressed file");
+        return NULL;
+    }
+
+    archive_read_support_filter_gzip(reader);
+    archive_read_support_filter_xz(reader);
+    archive_read_support_format_raw(reader);
+    archive_read_support_format_empty(reader);
+    return reader;
+}
+
+static struct aept_ar *finish_open_compressed(struct archive *reader)
+{
     /* Advance past the synthetic header for raw format */
     int eof;
     struct archive_entry *entry = next_header(reader, &eof);
@@ -596,6 +1218,105 @@ struct aept_ar *aept_ar_open_compressed_file(const char *filename)
     return ar;
 }
 
+#ifdef HAVE_LZMA_MT
+/*
+ * Open reader on filename through the threaded xz decoder if the file
+ * is xz-compressed.  Returns 1 if it did, 0 to fall back to libarchive's
+ * own filters, or -1 on error.
+ */
+static int open_compressed_file_mt(struct archive *reader,
+                                   const char *filename, int threads)
+{
+    unsigned char head[sizeof(xz_magic)];
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return 0;
+
+    size_t n = fread(head, 1, sizeof(head), fp);
+    struct xz_mt_ctx *xz = NULL;
+    if (n == sizeof(head) && memcmp(head, xz_magic, n) == 0)
+        xz = xz_mt_new(threads, head, n, file_read, fp, file_close);
+    if (!xz) {
+        fclose(fp);
+        return 0;
+    }
+
+    return open_xz_mt(reader, xz) < 0 ? -1 : 1;
+}
+#endif
+
+struct aept_ar *aept_ar_open_compressed_file(const char *filename,
+                                             int threads)
+{
+    struct archive *reader = new_compressed_reader();
+    if (!reader)
+        return NULL;
+
+#ifdef HAVE_LZMA_MT
+    threads = resolve_threads(threads);
+    if (threads > 1) {
+        int r = open_compressed_file_mt(reader, filename, threads);
+        if (r < 0) {
+            archive_read_free(reader);
+            return NULL;
+        }
+        if (r > 0)
+            return finish_open_compressed(reader);
+    }
+#else
+    (void)threads;
+#endif
+
+    if (archive_read_open_filename(reader, filename,
+                                   BLOCK_SIZE) != ARCHIVE_OK) {
+        aept_log_error("failed to open '%s': %s",
+                  filename, archive_error_string(reader));
+        archive_read_free(reader);
+        return NULL;
+    }
+
+    return finish_open_compressed(reader);
+}
+
+struct aept_ar *aept_ar_open_compressed_stream(aept_ar_read_fn read,
+                                               void *userdata)
+{
+    struct archive *reader = new_compressed_reader();
+    if (!reader)
+        return NULL;
+
+    struct stream_ctx *ctx = aept_malloc(sizeof(*ctx));
+    ctx->read = read;
+    ctx->userdata = userdata;
+
+    /* libarchive calls stream_close_cb even if the open fails */
+    if (archive_read_open(reader, ctx, NULL, stream_read_cb,
+                          stream_close_cb) != ARCHIVE_OK) {
+        aept_log_error("failed to open compressed stream: %s",
+                  archive_error_string(reader));
+        archive_read_free(reader);
+        return NULL;
+    }
+
+    return finish_open_compressed(reader);
+}
+
+ssize_t aept_ar_read(struct aept_ar *ar, void *buf, size_t size)
+{
+    ssize_t n;
+
+    if (archive_format(ar->ar) == ARCHIVE_FORMAT_EMPTY)
+        return 0;
+
+    n = archive_read_data(ar->ar, buf, size);
+    if (n < 0) {
+        aept_log_error("failed to read archive data: %s",
+                       archive_error_string(ar->ar));
+        return -1;
+    }
+    return n;
+}
+
 int aept_ar_copy_to_stream(struct aept_ar *ar, FILE *stream)
 {
     return stream_entry(ar->ar, stream);
@@ -621,34 +1342,104 @@ void aept_ar_file_list_init(aept_ar_file_list_t *fl)
     fl->entries = NULL;
     fl->count = 0;
     fl->alloc = 0;
+    memset(&fl->strings, 0, sizeof(fl->strings));
 }
 
 void aept_ar_file_list_free(aept_ar_file_list_t *fl)
 {
-    for (int i = 0; i < fl->count; i++) {
-        free(fl->entries[i].path);
-        free(fl->entries[i].link_target);
-    }
     free(fl->entries);
+    aept_arena_free(&fl->strings);
     aept_ar_file_list_init(fl);
 }
 
-int aept_ar_list_data_paths(const char *ipk_path, int ignore_uid,
-                            aept_ar_file_list_t *out)
+void aept_ar_installed_init(aept_ar_installed_t *in)
 {
-    struct aept_ar *ar = aept_ar_open_pkg_data_archive(ipk_path, ignore_uid);
-    if (!ar)
+    aept_ar_file_list_init(&in->files);
+    aept_pathmap_init(&in->index);
+    in->unchanged = 0;
+}
+
+void aept_ar_installed_free(aept_ar_installed_t *in)
+{
+    aept_pathmap_free(&in->index);
+    aept_ar_file_list_free(&in->files);
+    aept_ar_installed_init(in);
+}
+
+int aept_ar_installed_load(aept_ar_installed_t *in, const char *path)
+{
+    aept_ar_file_list_t *fl = &in->files;
+    char buf[4096];
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp)
         return -1;
 
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *fields[5], *p = buf;
+        aept_ar_file_entry_t *e;
+        int n = 0;
+
+        if (aept_fgets_is_truncated(buf, sizeof(buf))) {
+            aept_fgets_drain_line(fp);
+            continue;
+        }
+        buf[strcspn(buf, "\n")] = '\0';
+
+        while (n < 5) {
+            fields[n++] = p;
+            p = strchr(p, '\t');
+            if (!p)
+                break;
+            *p++ = '\0';
+        }
+        if (fields[0][0] == '\0')
+            continue;
+
+        if (fl->count >= fl->alloc) {
+            fl->alloc = fl->alloc ? fl->alloc * 2 : 256;
+            fl->entries = aept_realloc(fl->entries,
+                                       fl->alloc * sizeof(*fl->entries));
+        }
+
+        e = &fl->entries[fl->count];
+        memset(e, 0, sizeof(*e));
+        e->path = aept_arena_strdup(&fl->strings, fields[0]);
+        if (n >= 2)
+            e->mode = (unsigned int)strtoul(fields[1], NULL, 8);
+        if (n == 3)
+            e->link_target = aept_arena_strdup(&fl->strings, fields[2]);
+        if (n == 5) {
+            e->size = strtoull(fields[2], NULL, 10);
+            e->mtime = strtoll(fields[3], NULL, 10);
+            e->digest = aept_arena_strdup(&fl->strings, fields[4]);
+        }
+
+        aept_pathmap_put(&in->index, e->path, fl->count++);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+const aept_ar_file_entry_t *aept_ar_installed_find(
+        const aept_ar_installed_t *in, const char *path)
+{
+    int i = aept_pathmap_get(&in->index, path);
+
+    return i < 0 ? NULL : &in->files.entries[i];
+}
+
+int aept_ar_list_paths(struct aept_ar *ar, aept_ar_file_list_t *out)
+{
     for (;;) {
         int eof;
         struct archive_entry *entry = next_header(ar->ar, &eof);
         if (eof)
             break;
-        if (!entry) {
-            aept_ar_close(ar);
+        if (!entry)
             return -1;
-        }
 
         const char *path = archive_entry_pathname(entry);
         const struct stat *st = archive_entry_stat(entry);
@@ -658,7 +1449,6 @@ int aept_ar_list_data_paths(const char *ipk_path, int ignore_uid,
 
         if (!aept_archive_path_is_safe(path)) {
             aept_log_error("refusing unsafe archive path '%s'", path);
-            aept_ar_close(ar);
             return -1;
         }
 
@@ -673,17 +1463,33 @@ int aept_ar_list_data_paths(const char *ipk_path, int ignore_uid,
                                     out->alloc * sizeof(aept_ar_file_entry_t));
         }
 
-        out->entries[out->count].path = aept_strdup(path);
+        out->entries[out->count].path = aept_arena_strdup(&out->strings,
+                                                          path);
         out->entries[out->count].link_target =
-            target ? aept_strdup(target) : NULL;
+            target ? aept_arena_strdup(&out->strings, target) : NULL;
         out->entries[out->count].mode = (unsigned int)st->st_mode;
+        out->entries[out->count].digest = NULL;
+        out->entries[out->count].size = 0;
+        out->entries[out->count].mtime = 0;
         out->count++;
     }
 
-    aept_ar_close(ar);
     return 0;
 }
 
+int aept_ar_list_data_paths(const char *ipk_path, int ignore_uid,
+                            int threads, aept_ar_file_list_t *out)
+{
+    struct aept_ar *ar = aept_ar_open_pkg_data_archive(ipk_path, ignore_uid,
+                                                       threads);
+    if (!ar)
+        return -1;
+
+    int r = aept_ar_list_paths(ar, out);
+    aept_ar_close(ar);
+    return r;
+}
+
 int aept_ar_file_list_write(const aept_ar_file_list_t *fl, FILE *stream)
 {
     for (int i = 0; i < fl->count; i++) {
@@ -693,6 +1499,9 @@ int aept_ar_file_list_write(const aept_ar_file_list_t *fl, FILE *stream)
         if (e->link_target)
             r = fprintf(stream, "%s\t%#03o\t%s\n", e->path, e->mode,
                         e->link_target);
+        else if (e->digest)
+            r = fprintf(stream, "%s\t%#03o\t%llu\t%lld\t%s\n", e->path,
+                        e->mode, e->size, e->mtime, e->digest);
         else
             r = fprintf(stream, "%s\t%#03o\n", e->path, e->mode);
 
@@ -704,10 +1513,11 @@ int aept_ar_file_list_write(const aept_ar_file_list_t *fl, FILE *stream)
 
 int aept_ar_extract_all(struct aept_ar *ar, const char *prefix,
                    unsigned long *size, aept_fileset_t *conffiles,
-                   const char *cf_suffix, aept_ar_file_list_t *recorded)
+                   const char *cf_suffix, aept_ar_file_list_t *recorded,
+                   aept_ar_installed_t *installed)
 {
     return do_extract_all(ar->ar, prefix, ar->extract_flags, size,
-                          conffiles, cf_suffix, recorded);
+                          conffiles, cf_suffix, recorded, installed);
 }
 
 int aept_ar_extract_selected(struct aept_ar *ar, aept_fileset_t *selected,
@@ -759,6 +1569,38 @@ cleanup:
     return ret;
 }
 
+int aept_ar_walk(struct aept_ar *ar, aept_ar_walk_fn fn, void *userdata)
+{
+    for (;;) {
+        int eof;
+        struct archive_entry *entry = next_header(ar->ar, &eof);
+        if (eof)
+            return 0;
+        if (!entry)
+            return -1;
+
+        aept_ar_header_t hdr;
+        const char *path = archive_entry_pathname(entry);
+
+        if (!aept_archive_path_is_safe(path)) {
+            aept_log_error("refusing unsafe archive path '%s'", path);
+            return -1;
+        }
+
+        entry_header(entry, &hdr);
+
+        int r = fn(userdata, ar, &hdr);
+        if (r != 0)
+            return r;
+    }
+}
+
+int aept_ar_copy_data(struct aept_ar *ar, int fd, long long size,
+                      char digest[65])
+{
+    return copy_data(ar->ar, fd, size, digest);
+}
+
 void aept_ar_close(struct aept_ar *ar)
 {
     archive_read_free(ar->ar);
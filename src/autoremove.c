@@ -16,59 +16,75 @@
 #include "aept/aept.h"
 #include "aept/internal.h"
 #include "aept/autoremove.h"
+#include "aept/depgraph.h"
 #include "aept/msg.h"
+#include "aept/owner_index.h"
 #include "aept/remove.h"
 #include "aept/solver.h"
 #include "aept/status.h"
 #include "aept/trigger.h"
 #include "aept/util.h"
 
-/* Mark solvable p as needed and recursively mark its dependencies. */
-static void mark_needed(Pool *pool, Id p, char *needed, int ninstalled)
+int aept_autoremove_unneeded(struct aept_ctx *ctx, Pool *pool,
+                             const aept_depgraph_t *g, uint64_t *unneeded)
 {
-    Solvable *s = pool_id2solvable(pool, p);
-    Id *reqp, req;
-    Id p2, pp2;
+    Repo *installed = pool->installed;
+    aept_fileset_t auto_set;
+    size_t nwords = aept_depgraph_words(g);
+    uint64_t *needed;
+    int count = 0, i;
 
-    if (p < pool->installed->start || p >= pool->installed->end)
-        return;
+    memset(unneeded, 0, nwords * sizeof(uint64_t));
+    if (g->n == 0)
+        return 0;
 
-    int idx = p - pool->installed->start;
-    if (idx < 0 || idx >= ninstalled)
-        return;
+    aept_fileset_init(&auto_set);
+    if (aept_status_load_auto_set(ctx, &auto_set) < 0) {
+        aept_fileset_free(&auto_set);
+        return -1;
+    }
 
-    if (needed[idx])
-        return;
+    if (auto_set.count == 0) {
+        aept_fileset_free(&auto_set);
+        return 0;
+    }
 
-    needed[idx] = 1;
+    needed = aept_malloc(nwords * sizeof(uint64_t));
+    memset(needed, 0, nwords * sizeof(uint64_t));
 
-    if (!s->requires)
-        return;
+    /* Everything reachable from a manually installed package is needed. */
+    for (i = 0; i < g->n; i++) {
+        Solvable *s = pool_id2solvable(pool, g->start + i);
 
-    reqp = s->repo->idarraydata + s->requires;
-    while ((req = *reqp++) != 0) {
-        if (req == SOLVABLE_PREREQMARKER)
+        if (s->repo != installed)
             continue;
+        if (aept_fileset_contains(&auto_set, pool_id2str(pool, s->name)))
+            aept_depgraph_set(unneeded, i);
+        else
+            aept_depgraph_set(needed, i);
+    }
 
-        FOR_PROVIDES(p2, pp2, req) {
-            Solvable *s2 = pool_id2solvable(pool, p2);
-            if (s2->repo == pool->installed)
-                mark_needed(pool, p2, needed, ninstalled);
-        }
+    aept_depgraph_reach(g, needed, 0);
+
+    for (size_t w = 0; w < nwords; w++) {
+        unneeded[w] &= ~needed[w];
+        count += __builtin_popcountll(unneeded[w]);
     }
+
+    free(needed);
+    aept_fileset_free(&auto_set);
+    return count;
 }
 
 int aept_op_autoremove(struct aept_ctx *ctx)
 {
     Pool *pool;
     Repo *installed;
-    aept_fileset_t auto_set;
-    char *needed = NULL;
+    aept_depgraph_t graph;
+    uint64_t *unneeded = NULL;
     const char **candidates = NULL;
-    const char **candidates_evr = NULL;
-    int ncandidates = 0;
-    int ninstalled;
-    Id p;
+    int ncandidates;
+    int applied = 0;
     Solvable *s;
     int i, r;
 
@@ -76,6 +92,8 @@ int aept_op_autoremove(struct aept_ctx *ctx)
     if (r < 0)
         return -1;
 
+    aept_status_auto_begin(ctx);
+
     r = aept_status_load(ctx);
     if (r < 0)
         goto out;
@@ -89,55 +107,29 @@ int aept_op_autoremove(struct aept_ctx *ctx)
         goto out;
     }
 
-    pool_createwhatprovides(pool);
-
-    aept_fileset_init(&auto_set);
-    r = aept_status_load_auto_set(ctx, &auto_set);
-    if (r < 0)
-        goto out_fileset;
+    aept_depgraph_build(&graph, pool);
+    unneeded = aept_malloc(aept_depgraph_words(&graph) * sizeof(uint64_t));
 
-    if (auto_set.count == 0) {
-        aept_log_info("nothing to do");
-        r = 0;
-        goto out_fileset;
-    }
-
-    /* BFS: mark all packages reachable from manually-installed ones. */
-    ninstalled = installed->end - installed->start;
-    needed = aept_malloc(ninstalled);
-    memset(needed, 0, ninstalled);
-
-    FOR_REPO_SOLVABLES(installed, p, s) {
-        const char *name = pool_id2str(pool, s->name);
-        if (!aept_fileset_contains(&auto_set, name))
-            mark_needed(pool, p, needed, ninstalled);
+    ncandidates = aept_autoremove_unneeded(ctx, pool, &graph, unneeded);
+    if (ncandidates < 0) {
+        r = -1;
+        goto out_graph;
     }
 
-    /* Collect auto-installed packages that are not needed. */
-    FOR_REPO_SOLVABLES(installed, p, s) {
-        int idx = p - installed->start;
-        if (idx < 0 || idx >= ninstalled)
-            continue;
-        if (needed[idx])
-            continue;
-
-        const char *name = pool_id2str(pool, s->name);
-        if (!aept_fileset_contains(&auto_set, name))
-            continue;
-
-        ncandidates++;
-        candidates = aept_realloc(candidates,
-                              ncandidates * sizeof(const char *));
-        candidates_evr = aept_realloc(candidates_evr,
-                                  ncandidates * sizeof(const char *));
-        candidates[ncandidates - 1] = name;
-        candidates_evr[ncandidates - 1] = pool_id2str(pool, s->evr);
+    candidates = aept_malloc((ncandidates > 0 ? ncandidates : 1) *
+                             sizeof(const char *));
+    ncandidates = 0;
+    for (i = 0; i < graph.n; i++) {
+        if (aept_depgraph_test(unneeded, i)) {
+            s = pool_id2solvable(pool, graph.start + i);
+            candidates[ncandidates++] = pool_id2str(pool, s->name);
+        }
     }
 
     if (ncandidates == 0) {
         aept_log_info("nothing to do");
         r = 0;
-        goto out_needed;
+        goto out_graph;
     }
 
     aept_transaction_t txn = {0};
@@ -148,19 +140,28 @@ int aept_op_autoremove(struct aept_ctx *ctx)
 
     if (!aept_confirm_continue()) {
         r = 0;
-        goto out_needed;
+        goto out_graph;
     }
 
     if (ctx->config.noaction) {
         aept_log_info("dry run, not removing");
         r = 0;
-        goto out_needed;
+        goto out_graph;
     }
 
     aept_trigger_ctx_t tctx;
     aept_trigger_ctx_init(&tctx);
 
+    /* Keep the saved owner index current if there is one.  A stale
+     * index is left for the next install to rebuild. */
+    aept_owner_index_t owner_idx;
+    aept_owner_index_t *owners = NULL;
+    aept_owner_index_init(&owner_idx);
+    if (aept_owner_index_load(ctx, &owner_idx) == 0)
+        owners = &owner_idx;
+
     int had_error = 0;
+    applied = 1;
 
     for (i = 0; i < ncandidates; i++) {
         if (aept_cancelled()) {
@@ -170,7 +171,7 @@ int aept_op_autoremove(struct aept_ctx *ctx)
         }
 
         aept_trigger_ctx_collect_dirs(ctx, &tctx, candidates[i]);
-        r = aept_do_remove(ctx, candidates[i], NULL, NULL, NULL);
+        r = aept_do_remove(ctx, candidates[i], NULL, NULL, owners);
         if (r < 0) {
             had_error = 1;
             if (!ctx->config.force_depends && !ctx->config.keep_going)
@@ -183,14 +184,23 @@ int aept_op_autoremove(struct aept_ctx *ctx)
 
 out_trigger:
     aept_trigger_ctx_free(&tctx);
+    if (owners) {
+        if (r == 0)
+            aept_owner_index_save(ctx, owners);
+        else
+            aept_owner_index_discard(ctx);
+    }
+    aept_owner_index_free(&owner_idx);
 
-out_needed:
-    free(candidates_evr);
+out_graph:
     free(candidates);
-    free(needed);
-out_fileset:
-    aept_fileset_free(&auto_set);
+    free(unneeded);
+    aept_depgraph_free(&graph);
 out:
+    if (aept_status_auto_commit(ctx) < 0)
+        r = -1;
+    if (applied)
+        aept_durability_barrier(ctx, AEPT_DURABILITY_TRANSACTION);
     aept_solver_fini(ctx);
     return r;
 }
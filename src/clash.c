@@ -18,6 +18,8 @@
 #include "aept/clash.h"
 #include "aept/msg.h"
 #include "aept/owner_index.h"
+#include "aept/stats.h"
+#include "aept/trace.h"
 #include "aept/util.h"
 
 /* Check whether solvable s declares Replaces for owner_name. */
@@ -86,27 +88,25 @@ static int same_dir_symlink(const char *disk_path, const char *archive_target)
     return is_dir;
 }
 
-int aept_clash_check(struct aept_ctx *ctx, const char *ipk_path,
+int aept_clash_check(struct aept_ctx *ctx,
+                     const aept_ar_file_list_t *new_files,
                      Pool *pool, Id p,
                      aept_fileset_t *old_files,
                      aept_owner_index_t *owners)
 {
     Solvable *s = pool_id2solvable(pool, p);
     const char *pkg_name = pool_id2str(pool, s->name);
-    aept_ar_file_list_t new_files;
+    aept_stats_timer_t timer;
+    aept_trace_span_t span;
     int clashes = 0;
     int i;
 
-    aept_ar_file_list_init(&new_files);
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_CLASH);
+    aept_trace_begin(ctx, &span, "clash", pkg_name);
 
-    if (aept_ar_list_data_paths(ipk_path, ctx->config.ignore_uid, &new_files) < 0) {
-        aept_ar_file_list_free(&new_files);
-        return -1;
-    }
-
-    for (i = 0; i < new_files.count; i++) {
-        const char *path = new_files.entries[i].path;
-        const char *link_target = new_files.entries[i].link_target;
+    for (i = 0; i < new_files->count; i++) {
+        const char *path = new_files->entries[i].path;
+        const char *link_target = new_files->entries[i].link_target;
         const char *stripped = path;
         char *disk_path = NULL;
         struct stat st;
@@ -158,6 +158,7 @@ int aept_clash_check(struct aept_ctx *ctx, const char *ipk_path,
         clashes++;
     }
 
-    aept_ar_file_list_free(&new_files);
+    aept_trace_end(&span);
+    aept_stats_end(&timer);
     return clashes;
 }
@@ -4,13 +4,17 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <solv/repo.h>
+
 #include "aept/internal.h"
 #include "aept/clean.h"
 #include "aept/msg.h"
@@ -51,3 +55,211 @@ int aept_op_clean(struct aept_ctx *ctx)
 
     return errors ? -1 : 0;
 }
+
+/* ── Size limit ── */
+
+/* A cached package together with its .verified record and .part
+ * download remainder, which are evicted with it. */
+typedef struct {
+    char *base;
+    unsigned long long bytes;
+    struct timespec used;
+} cache_entry_t;
+
+static int entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const cache_entry_t *)a)->base,
+                  ((const cache_entry_t *)b)->base);
+}
+
+static int entry_age_cmp(const void *a, const void *b)
+{
+    const struct timespec *x = &((const cache_entry_t *)a)->used;
+    const struct timespec *y = &((const cache_entry_t *)b)->used;
+
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    if (x->tv_nsec != y->tv_nsec)
+        return x->tv_nsec < y->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Temporary files end in .<pid> and belong to whoever writes them. */
+static int is_temp_name(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    const char *c;
+
+    if (!dot || !dot[1])
+        return 0;
+    for (c = dot + 1; *c; c++)
+        if (!isdigit((unsigned char)*c))
+            return 0;
+    return 1;
+}
+
+static char *strip_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name), m = strlen(suffix);
+
+    if (n > m && strcmp(name + n - m, suffix) == 0)
+        return aept_strndup(name, n - m);
+    return NULL;
+}
+
+static void keep_solvable(aept_fileset_t *keep, Solvable *s)
+{
+    const char *loc, *base;
+    unsigned int medianr;
+
+    loc = solvable_get_location(s, &medianr);
+    if (!loc)
+        return;
+    base = strrchr(loc, '/');
+    aept_fileset_add(keep, base ? base + 1 : loc);
+}
+
+/* The cache files of the installed versions and of trans. */
+static void collect_kept(Pool *pool, Transaction *trans, aept_fileset_t *keep)
+{
+    Repo *installed = pool->installed;
+    Solvable *s;
+    Id p, pp, q;
+    int i;
+
+    if (!pool->whatprovides)
+        pool_createwhatprovides(pool);
+
+    if (installed) {
+        FOR_REPO_SOLVABLES(installed, p, s) {
+            FOR_PROVIDES(q, pp, s->name) {
+                Solvable *a = pool->solvables + q;
+
+                if (a->repo != installed && a->name == s->name &&
+                    a->evr == s->evr && a->arch == s->arch)
+                    keep_solvable(keep, a);
+            }
+        }
+    }
+
+    for (i = 0; trans && i < trans->steps.count; i++) {
+        s = pool->solvables + trans->steps.elements[i];
+        if (s->repo != installed)
+            keep_solvable(keep, s);
+    }
+}
+
+void aept_cache_trim(struct aept_ctx *ctx, Pool *pool, Transaction *trans)
+{
+    const char *dir = ctx->config.cache_dir;
+    unsigned long long limit, total = 0, freed = 0;
+    cache_entry_t *ents = NULL, *groups;
+    int n = 0, alloc = 0, ngroups = 0, evicted = 0;
+    aept_fileset_t keep;
+    struct dirent *ent;
+    DIR *d;
+    int i;
+
+    if (ctx->config.cache_limit <= 0)
+        return;
+    limit = (unsigned long long)ctx->config.cache_limit << 20;
+
+    d = opendir(dir);
+    if (!d)
+        return;
+
+    while ((ent = readdir(d)) != NULL) {
+        struct stat st;
+        char *path = NULL, *base;
+
+        if (ent->d_name[0] == '.' || is_temp_name(ent->d_name))
+            continue;
+
+        aept_asprintf(&path, "%s/%s", dir, ent->d_name);
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        free(path);
+
+        base = strip_suffix(ent->d_name, ".verified");
+        if (!base)
+            base = strip_suffix(ent->d_name, ".part");
+        if (!base)
+            base = aept_strdup(ent->d_name);
+
+        if (n >= alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            ents = aept_realloc(ents, alloc * sizeof(*ents));
+        }
+        ents[n].base = base;
+        ents[n].bytes = (unsigned long long)st.st_blocks * 512;
+        ents[n].used = st.st_mtim;
+        n++;
+        total += ents[n - 1].bytes;
+    }
+    closedir(d);
+
+    if (total <= limit)
+        goto cleanup;
+
+    /* Merge each package with its companions.  Their latest mtime is the
+     * last use: the package's is its download, the record's its last
+     * reuse from the cache. */
+    qsort(ents, n, sizeof(*ents), entry_cmp);
+    groups = ents;
+    for (i = 0; i < n; i++) {
+        cache_entry_t *g = ngroups ? &groups[ngroups - 1] : NULL;
+
+        if (g && strcmp(g->base, ents[i].base) == 0) {
+            g->bytes += ents[i].bytes;
+            if (entry_age_cmp(&ents[i], g) > 0)
+                g->used = ents[i].used;
+            free(ents[i].base);
+            continue;
+        }
+        groups[ngroups++] = ents[i];
+    }
+    n = ngroups;
+
+    aept_fileset_init(&keep);
+    collect_kept(pool, trans, &keep);
+
+    qsort(groups, n, sizeof(*groups), entry_age_cmp);
+    for (i = 0; i < n && total > limit; i++) {
+        static const char *const suffix[] = { "", ".verified", ".part" };
+        size_t k;
+
+        if (aept_fileset_contains(&keep, groups[i].base))
+            continue;
+
+        for (k = 0; k < sizeof(suffix) / sizeof(suffix[0]); k++) {
+            char *path = NULL;
+
+            aept_asprintf(&path, "%s/%s%s", dir, groups[i].base, suffix[k]);
+            if (unlink(path) < 0 && errno != ENOENT)
+                aept_log_warning("cannot remove '%s': %s", path,
+                                 strerror(errno));
+            free(path);
+        }
+
+        aept_log_debug("evicted %s from the cache", groups[i].base);
+        total -= groups[i].bytes;
+        freed += groups[i].bytes;
+        evicted++;
+    }
+
+    aept_fileset_free(&keep);
+
+    if (evicted)
+        aept_log_info("evicted %d package%s (%llu KiB) from the cache",
+                      evicted, evicted == 1 ? "" : "s", freed >> 10);
+    if (total > limit)
+        aept_log_info("cache holds %llu MiB, over cache_limit, in packages "
+                      "still needed", total >> 20);
+
+cleanup:
+    for (i = 0; i < n; i++)
+        free(ents[i].base);
+    free(ents);
+}
@@ -25,31 +25,36 @@ void aept_conffile_set_init(aept_conffile_set_t *cs)
     cs->entries = NULL;
     cs->count = 0;
     cs->alloc = 0;
+    aept_pathmap_init(&cs->index);
 }
 
 void aept_conffile_set_add(aept_conffile_set_t *cs, const char *path,
                       const char *md5)
 {
+    char *copy;
+
     if (cs->count >= cs->alloc) {
         cs->alloc = cs->alloc ? cs->alloc * 2 : 8;
         cs->entries = aept_realloc(cs->entries,
                                cs->alloc * sizeof(aept_conffile_t));
     }
 
-    cs->entries[cs->count].path = aept_strdup(path);
+    copy = aept_strdup(path);
+    cs->entries[cs->count].path = copy;
     cs->entries[cs->count].md5 = md5 ? aept_strdup(md5) : NULL;
+
+    /* The first entry for a path is the one looked up */
+    if (aept_pathmap_get(&cs->index, copy) < 0)
+        aept_pathmap_put(&cs->index, copy, cs->count);
     cs->count++;
 }
 
 const char *aept_conffile_set_lookup(const aept_conffile_set_t *cs,
                                 const char *path)
 {
-    for (int i = 0; i < cs->count; i++) {
-        if (strcmp(cs->entries[i].path, path) == 0)
-            return cs->entries[i].md5;
-    }
+    int i = aept_pathmap_get(&cs->index, path);
 
-    return NULL;
+    return i >= 0 ? cs->entries[i].md5 : NULL;
 }
 
 void aept_conffile_set_free(aept_conffile_set_t *cs)
@@ -59,6 +64,7 @@ void aept_conffile_set_free(aept_conffile_set_t *cs)
         free(cs->entries[i].md5);
     }
     free(cs->entries);
+    aept_pathmap_free(&cs->index);
     aept_conffile_set_init(cs);
 }
 
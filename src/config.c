@@ -7,6 +7,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <libgen.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,14 +32,25 @@ void aept_config_set_defaults(struct aept_config *cfg)
     cfg->usign_keydir = aept_strdup("/etc/aept/usign/trustdb");
     cfg->auto_file = aept_strdup("/var/lib/aept/auto-installed");
     cfg->pin_file = aept_strdup("/var/lib/aept/pinned-packages");
+    cfg->upgradable_file = aept_strdup("/var/lib/aept/upgradable");
 
     cfg->check_signature = 1;
     cfg->verbosity = AEPT_INFO;
+    cfg->download_jobs = 4;
+    cfg->install_jobs = 1;
+    cfg->remove_jobs = 1;
+    cfg->connection_cache = AEPT_CONNECTION_CACHE_DEFAULT;
+    cfg->spool_data = 1;
+    cfg->delta_downloads = 1;
+    cfg->durability = AEPT_DURABILITY_TRANSACTION;
 }
 
+/* urls is the rest of the directive line: one or more mirror URLs */
 static void add_source(struct aept_config *cfg, const char *name,
-                        const char *url, int gzip)
+                        char *urls, int gzip)
 {
+    char *url;
+
     if (!aept_pkg_name_is_safe(name)) {
         aept_log_warning("ignoring source with unsafe name '%s'", name);
         return;
@@ -49,9 +61,24 @@ static void add_source(struct aept_config *cfg, const char *name,
                             cfg->nsources * sizeof(aept_source_t));
 
     aept_source_t *src = &cfg->sources[cfg->nsources - 1];
+    memset(src, 0, sizeof(*src));
     src->name = aept_strdup(name);
-    src->url = aept_strdup(url);
     src->gzip = gzip;
+
+    while ((url = strsep(&urls, " \t")) != NULL) {
+        aept_mirror_t *m;
+
+        if (*url == '\0')
+            continue;
+
+        src->mirrors = aept_realloc(src->mirrors,
+                                    (src->nmirrors + 1) * sizeof(*m));
+        m = &src->mirrors[src->nmirrors++];
+        memset(m, 0, sizeof(*m));
+        m->url = aept_strdup(url);
+        m->latency_ns = -1;
+    }
+    src->url = src->mirrors[0].url;
 }
 
 static void add_arch(struct aept_config *cfg, const char *arch)
@@ -82,6 +109,40 @@ static int parse_bool(const char *key, const char *value, int safe_default)
     return safe_default;
 }
 
+/*
+ * Parse a numeric option value in the range [min, max].  On malformed
+ * or out-of-range input, logs a warning and returns `fallback`.
+ */
+static int parse_int(const char *key, const char *value, int min, int max,
+                     int fallback)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(value, &end, 10);
+    if (errno == 0 && end != value && *end == '\0' && v >= min && v <= max)
+        return (int)v;
+
+    aept_log_warning("invalid value '%s' for option '%s', "
+                "using default '%d'", value, key, fallback);
+    return fallback;
+}
+
+static int parse_durability(const char *key, const char *value, int fallback)
+{
+    if (strcmp(value, "none") == 0)
+        return AEPT_DURABILITY_NONE;
+    if (strcmp(value, "package") == 0)
+        return AEPT_DURABILITY_PACKAGE;
+    if (strcmp(value, "transaction") == 0)
+        return AEPT_DURABILITY_TRANSACTION;
+
+    aept_log_warning("invalid value '%s' for option '%s', "
+                "using default", value, key);
+    return fallback;
+}
+
 static void set_option(struct aept_config *cfg, const char *key,
                         const char *value)
 {
@@ -97,6 +158,10 @@ static void set_option(struct aept_config *cfg, const char *key,
         strp = &cfg->cache_dir;
     else if (strcmp(key, "tmp_dir") == 0)
         strp = &cfg->tmp_dir;
+    else if (strcmp(key, "shared_cache_dir") == 0)
+        strp = &cfg->shared_cache_dir;
+    else if (strcmp(key, "unpacked_store") == 0)
+        strp = &cfg->unpacked_store;
     else if (strcmp(key, "lock_file") == 0)
         strp = &cfg->lock_file;
     else if (strcmp(key, "usign_keydir") == 0)
@@ -105,10 +170,14 @@ static void set_option(struct aept_config *cfg, const char *key,
         strp = &cfg->auto_file;
     else if (strcmp(key, "pin_file") == 0)
         strp = &cfg->pin_file;
+    else if (strcmp(key, "upgradable_file") == 0)
+        strp = &cfg->upgradable_file;
     else if (strcmp(key, "ssl_client_cert") == 0)
         strp = &cfg->ssl_client_cert;
     else if (strcmp(key, "ssl_client_key") == 0)
         strp = &cfg->ssl_client_key;
+    else if (strcmp(key, "trace_file") == 0)
+        strp = &cfg->trace_file;
     else if (strcmp(key, "check_signature") == 0) {
         cfg->check_signature = parse_bool(key, value, 1);
         return;
@@ -118,6 +187,63 @@ static void set_option(struct aept_config *cfg, const char *key,
     } else if (strcmp(key, "allow_downgrade") == 0) {
         cfg->allow_downgrade = parse_bool(key, value, 0);
         return;
+    } else if (strcmp(key, "pipeline_downloads") == 0) {
+        cfg->pipeline_downloads = parse_bool(key, value, 0);
+        return;
+    } else if (strcmp(key, "spool_data") == 0) {
+        cfg->spool_data = parse_bool(key, value, 1);
+        return;
+    } else if (strcmp(key, "store_hardlinks") == 0) {
+        cfg->store_hardlinks = parse_bool(key, value, 0);
+        return;
+    } else if (strcmp(key, "mirror_split") == 0) {
+        cfg->mirror_split = parse_bool(key, value, 0);
+        return;
+    } else if (strcmp(key, "delta_downloads") == 0) {
+        cfg->delta_downloads = parse_bool(key, value, 1);
+        return;
+    } else if (strcmp(key, "info_db") == 0) {
+        cfg->info_db = parse_bool(key, value, 0);
+        return;
+    } else if (strcmp(key, "low_memory") == 0) {
+        cfg->low_memory = parse_bool(key, value, 0);
+        return;
+    } else if (strcmp(key, "decompress_threads") == 0) {
+        cfg->decompress_threads = parse_int(key, value, 0, 256,
+                                            cfg->decompress_threads);
+        return;
+    } else if (strcmp(key, "install_jobs") == 0) {
+        cfg->install_jobs = parse_int(key, value, 1, AEPT_MAX_INSTALL_JOBS,
+                                      cfg->install_jobs);
+        return;
+    } else if (strcmp(key, "verify_jobs") == 0) {
+        cfg->verify_jobs = parse_int(key, value, 0, 256, cfg->verify_jobs);
+        return;
+    } else if (strcmp(key, "remove_jobs") == 0) {
+        cfg->remove_jobs = parse_int(key, value, 0, 256, cfg->remove_jobs);
+        return;
+    } else if (strcmp(key, "root_jobs") == 0) {
+        cfg->root_jobs = parse_int(key, value, 0, 256, cfg->root_jobs);
+        return;
+    } else if (strcmp(key, "cache_limit") == 0) {
+        cfg->cache_limit = parse_int(key, value, 0, INT_MAX,
+                                     cfg->cache_limit);
+        return;
+    } else if (strcmp(key, "durability") == 0) {
+        cfg->durability = parse_durability(key, value, cfg->durability);
+        return;
+    } else if (strcmp(key, "connection_cache") == 0) {
+        cfg->connection_cache = parse_int(key, value, 0, 256,
+                                          cfg->connection_cache);
+        return;
+    } else if (strcmp(key, "download_rate") == 0) {
+        cfg->download_rate = parse_int(key, value, 0, INT_MAX,
+                                       cfg->download_rate);
+        return;
+    } else if (strcmp(key, "download_jobs") == 0) {
+        cfg->download_jobs = parse_int(key, value, 1, AEPT_MAX_DOWNLOAD_JOBS,
+                                       cfg->download_jobs);
+        return;
     } else {
         aept_log_warning("unknown option '%s'", key);
         return;
@@ -157,6 +283,10 @@ void aept_config_apply_offline_root(struct aept_config *cfg)
     aept_asprintf(&tmp, "%s%s", cfg->offline_root, cfg->pin_file);
     free(cfg->pin_file);
     cfg->pin_file = tmp;
+
+    aept_asprintf(&tmp, "%s%s", cfg->offline_root, cfg->upgradable_file);
+    free(cfg->upgradable_file);
+    cfg->upgradable_file = tmp;
 }
 
 int aept_config_load(struct aept_config *cfg, const char *filename)
@@ -196,16 +326,10 @@ int aept_config_load(struct aept_config *cfg, const char *filename)
 
         token = strsep(&line, " \t");
 
-        if (strcmp(token, "src/gz") == 0) {
+        if (strcmp(token, "src/gz") == 0 || strcmp(token, "src") == 0) {
             char *name = strsep(&line, " \t");
-            char *url = strsep(&line, " \t");
-            if (name && url)
-                add_source(cfg, name, url, 1);
-        } else if (strcmp(token, "src") == 0) {
-            char *name = strsep(&line, " \t");
-            char *url = strsep(&line, " \t");
-            if (name && url)
-                add_source(cfg, name, url, 0);
+            if (name && line && line[strspn(line, " \t")] != '\0')
+                add_source(cfg, name, line, strcmp(token, "src/gz") == 0);
         } else if (strcmp(token, "option") == 0) {
             char *key = strsep(&line, " \t");
             char *value = strsep(&line, " \t");
@@ -255,13 +379,12 @@ int aept_config_validate(const struct aept_config *cfg)
     r |= validate_dir("lists_dir", cfg->lists_dir);
     r |= validate_dir("cache_dir", cfg->cache_dir);
     r |= validate_dir("tmp_dir", cfg->tmp_dir);
+    if (cfg->shared_cache_dir)
+        r |= validate_dir("shared_cache_dir", cfg->shared_cache_dir);
+    if (cfg->unpacked_store)
+        r |= validate_dir("unpacked_store", cfg->unpacked_store);
     r |= validate_dir("usign_keydir", cfg->usign_keydir);
 
-    if (aept_file_exists(AEPT_USIGN_BIN) && aept_file_is_dir(AEPT_USIGN_BIN)) {
-        aept_log_error("usign_bin '%s' is a directory", AEPT_USIGN_BIN);
-        r = -1;
-    }
-
     return r;
 }
 
@@ -271,7 +394,9 @@ void aept_config_free(struct aept_config *cfg)
 
     for (i = 0; i < cfg->nsources; i++) {
         free(cfg->sources[i].name);
-        free(cfg->sources[i].url);
+        for (int j = 0; j < cfg->sources[i].nmirrors; j++)
+            free(cfg->sources[i].mirrors[j].url);
+        free(cfg->sources[i].mirrors);
     }
     free(cfg->sources);
 
@@ -284,12 +409,16 @@ void aept_config_free(struct aept_config *cfg)
     free(cfg->lists_dir);
     free(cfg->cache_dir);
     free(cfg->tmp_dir);
+    free(cfg->shared_cache_dir);
+    free(cfg->unpacked_store);
     free(cfg->lock_file);
     free(cfg->usign_keydir);
     free(cfg->auto_file);
     free(cfg->pin_file);
+    free(cfg->upgradable_file);
     free(cfg->ssl_client_cert);
     free(cfg->ssl_client_key);
+    free(cfg->trace_file);
 
     memset(cfg, 0, sizeof(*cfg));
 }
@@ -331,6 +460,9 @@ int aept_config_lock(struct aept_ctx *ctx)
 
 void aept_config_unlock(struct aept_ctx *ctx)
 {
+    /* Scripts of the transaction are done */
+    aept_root_helper_stop(ctx);
+
     if (ctx->lock_fd >= 0) {
         flock(ctx->lock_fd, LOCK_UN);
         close(ctx->lock_fd);
@@ -0,0 +1,181 @@
+/* delta.c - rebuilding packages from delta files
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aept/archive.h"
+#include "aept/delta.h"
+#include "aept/msg.h"
+#include "aept/util.h"
+
+#define DELTA_MAGIC     "AEPTDLT1"
+#define DELTA_MAGIC_LEN 8
+#define COPY_SIZE       0x10000
+
+/* Read exactly len bytes of the delta.  A short read is an error. */
+static int read_exact(struct aept_ar *ar, void *buf, size_t len)
+{
+    unsigned char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = aept_ar_read(ar, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_u64(struct aept_ar *ar, uint64_t *v)
+{
+    unsigned char b[8];
+
+    if (read_exact(ar, b, sizeof(b)) < 0)
+        return -1;
+
+    *v = 0;
+    for (int i = 0; i < 8; i++)
+        *v = (*v << 8) | b[i];
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int copy_old(int old_fd, off_t old_size, uint64_t offset,
+                    uint64_t len, int out_fd, char *buf)
+{
+    if (offset > (uint64_t)old_size || len > (uint64_t)old_size - offset)
+        return -1;
+
+    while (len > 0) {
+        size_t chunk = len < COPY_SIZE ? (size_t)len : COPY_SIZE;
+        ssize_t n = pread(old_fd, buf, chunk, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || write_full(out_fd, buf, (size_t)n) < 0)
+            return -1;
+        offset += (uint64_t)n;
+        len -= (uint64_t)n;
+    }
+    return 0;
+}
+
+static int insert_literal(struct aept_ar *ar, uint64_t len, int out_fd,
+                          char *buf)
+{
+    while (len > 0) {
+        size_t chunk = len < COPY_SIZE ? (size_t)len : COPY_SIZE;
+        if (read_exact(ar, buf, chunk) < 0 ||
+                write_full(out_fd, buf, chunk) < 0)
+            return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int aept_delta_apply(const char *old_path, const char *delta_path,
+                     const char *out_path)
+{
+    struct aept_ar *ar = NULL;
+    char magic[DELTA_MAGIC_LEN];
+    struct stat st;
+    char *buf = NULL;
+    int old_fd, out_fd = -1, ret = -1;
+
+    old_fd = open(old_path, O_RDONLY | O_CLOEXEC);
+    if (old_fd < 0 || fstat(old_fd, &st) < 0) {
+        aept_log_error("cannot open '%s': %s", old_path, strerror(errno));
+        goto cleanup;
+    }
+
+    ar = aept_ar_open_compressed_file(delta_path, 1);
+    if (!ar)
+        goto cleanup;
+
+    if (read_exact(ar, magic, sizeof(magic)) < 0 ||
+            memcmp(magic, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0) {
+        aept_log_error("'%s' is not a package delta", delta_path);
+        goto cleanup;
+    }
+
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        aept_log_error("cannot create '%s': %s", out_path, strerror(errno));
+        goto cleanup;
+    }
+
+    buf = aept_malloc(COPY_SIZE);
+
+    for (;;) {
+        unsigned char op;
+        uint64_t a, b;
+        int r;
+
+        if (read_exact(ar, &op, 1) < 0)
+            break;
+
+        if (op == 'E') {
+            ret = 0;
+            break;
+        } else if (op == 'C') {
+            r = read_u64(ar, &a) < 0 || read_u64(ar, &b) < 0 ? -1
+                : copy_old(old_fd, st.st_size, a, b, out_fd, buf);
+        } else if (op == 'I') {
+            r = read_u64(ar, &a) < 0 ? -1
+                : insert_literal(ar, a, out_fd, buf);
+        } else {
+            r = -1;
+        }
+
+        if (r < 0)
+            break;
+    }
+
+    if (ret < 0)
+        aept_log_error("cannot apply delta '%s'", delta_path);
+
+    if (close(out_fd) != 0 && ret == 0) {
+        aept_log_error("write error for '%s': %s", out_path,
+                       strerror(errno));
+        ret = -1;
+    }
+    out_fd = -1;
+
+cleanup:
+    if (out_fd >= 0)
+        close(out_fd);
+    if (ret < 0)
+        unlink(out_path);
+    if (ar)
+        aept_ar_close(ar);
+    if (old_fd >= 0)
+        close(old_fd);
+    free(buf);
+    return ret;
+}
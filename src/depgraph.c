@@ -0,0 +1,162 @@
+/* depgraph.c - dependency graph of the installed packages
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <solv/knownid.h>
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/solvable.h>
+
+#include "aept/depgraph.h"
+#include "aept/util.h"
+
+void aept_depgraph_build(aept_depgraph_t *g, Pool *pool)
+{
+    Repo *installed = pool->installed;
+    int *fwd = NULL, *seen, *indeg;
+    int nfwd = 0, alloc = 0;
+    int i, j;
+
+    memset(g, 0, sizeof(*g));
+
+    if (!installed || installed->end <= installed->start)
+        return;
+
+    if (!pool->whatprovides)
+        pool_createwhatprovides(pool);
+
+    g->start = installed->start;
+    g->n = installed->end - installed->start;
+    g->fwd_off = aept_malloc((g->n + 1) * sizeof(int));
+
+    /* seen[j] is i + 1 once node i has an edge to j, so that requires
+     * met by the same package add one edge only. */
+    seen = aept_malloc(g->n * sizeof(int));
+    memset(seen, 0, g->n * sizeof(int));
+
+    for (i = 0; i < g->n; i++) {
+        Solvable *s = pool_id2solvable(pool, g->start + i);
+        Id *reqp, req;
+
+        g->fwd_off[i] = nfwd;
+
+        if (s->repo != installed || !s->requires)
+            continue;
+
+        reqp = s->repo->idarraydata + s->requires;
+        while ((req = *reqp++) != 0) {
+            Id p2, pp2;
+
+            if (req == SOLVABLE_PREREQMARKER)
+                continue;
+
+            FOR_PROVIDES(p2, pp2, req) {
+                if (pool->solvables[p2].repo != installed)
+                    continue;
+
+                j = p2 - g->start;
+                if (j == i || seen[j] == i + 1)
+                    continue;
+                seen[j] = i + 1;
+
+                if (nfwd >= alloc) {
+                    alloc = alloc ? alloc * 2 : 1024;
+                    fwd = aept_realloc(fwd, alloc * sizeof(int));
+                }
+                fwd[nfwd++] = j;
+            }
+        }
+    }
+    g->fwd_off[g->n] = nfwd;
+    g->fwd = fwd ? fwd : aept_malloc(sizeof(int));
+    free(seen);
+
+    /* Reverse edges by counting sort over the targets.  Sources are
+     * visited in order, so each reverse list comes out sorted. */
+    indeg = aept_malloc((g->n + 1) * sizeof(int));
+    memset(indeg, 0, (g->n + 1) * sizeof(int));
+    for (i = 0; i < nfwd; i++)
+        indeg[g->fwd[i] + 1]++;
+    for (i = 0; i < g->n; i++)
+        indeg[i + 1] += indeg[i];
+
+    g->rev_off = aept_malloc((g->n + 1) * sizeof(int));
+    memcpy(g->rev_off, indeg, (g->n + 1) * sizeof(int));
+    g->rev = aept_malloc((nfwd > 0 ? nfwd : 1) * sizeof(int));
+
+    for (i = 0; i < g->n; i++) {
+        for (j = g->fwd_off[i]; j < g->fwd_off[i + 1]; j++)
+            g->rev[indeg[g->fwd[j]]++] = i;
+    }
+    free(indeg);
+}
+
+void aept_depgraph_free(aept_depgraph_t *g)
+{
+    free(g->fwd_off);
+    free(g->fwd);
+    free(g->rev_off);
+    free(g->rev);
+    memset(g, 0, sizeof(*g));
+}
+
+int aept_depgraph_node(const aept_depgraph_t *g, Id p)
+{
+    if (p < g->start || p - g->start >= g->n)
+        return -1;
+    return p - g->start;
+}
+
+size_t aept_depgraph_words(const aept_depgraph_t *g)
+{
+    return ((size_t)g->n + 63) / 64;
+}
+
+int aept_depgraph_test(const uint64_t *mark, int i)
+{
+    return (mark[i >> 6] >> (i & 63)) & 1;
+}
+
+void aept_depgraph_set(uint64_t *mark, int i)
+{
+    mark[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+/* Depth first with an explicit stack.  Every node is pushed at most
+ * once, when it gets marked, so the stack never holds more than n. */
+void aept_depgraph_reach(const aept_depgraph_t *g, uint64_t *mark,
+                         int reverse)
+{
+    const int *off = reverse ? g->rev_off : g->fwd_off;
+    const int *adj = reverse ? g->rev : g->fwd;
+    int *stack;
+    int top = 0, i, j;
+
+    if (g->n == 0)
+        return;
+
+    stack = aept_malloc(g->n * sizeof(int));
+
+    for (i = 0; i < g->n; i++) {
+        if (aept_depgraph_test(mark, i))
+            stack[top++] = i;
+    }
+
+    while (top > 0) {
+        i = stack[--top];
+        for (j = off[i]; j < off[i + 1]; j++) {
+            int t = adj[j];
+            if (!aept_depgraph_test(mark, t)) {
+                aept_depgraph_set(mark, t);
+                stack[top++] = t;
+            }
+        }
+    }
+
+    free(stack);
+}
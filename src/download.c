@@ -5,10 +5,16 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fetch.h>
@@ -16,66 +22,333 @@
 #include <solv/knownid.h>
 #include <solv/pool.h>
 #include <solv/solvable.h>
+#include <solv/util.h>
 
 #include "aept/internal.h"
+#include "aept/archive.h"
+#include "aept/delta.h"
 #include "aept/download.h"
+#include "aept/mirror.h"
+#include "aept/progress.h"
 #include "aept/msg.h"
 #include "aept/solver.h"
+#include "aept/stats.h"
+#include "aept/trace.h"
 #include "aept/util.h"
 
-int aept_download(struct aept_ctx *ctx, const char *url, const char *dest,
-                  const char *name)
+/* A package fetch prepared on the main thread.  Everything that needs
+ * the pool is looked up up front, because libsolv lookups are not safe
+ * to run concurrently; workers only touch the network and the disk. */
+typedef struct {
+    char *name;
+    char *url;                  /* on the mirror being tried */
+    char *dest;
+    const char *base;
+    char *location;
+    char *location_copy;
+    int src_idx;
+    unsigned int shift;         /* where mirror_split starts this job */
+    Id checksum_type;
+    const unsigned char *checksum;
+    char *delta_location;       /* NULL if there is no usable delta */
+    char *delta_url;            /* on the mirror being tried */
+    char *delta_old;            /* cached package the delta applies to */
+    unsigned char delta_old_sum[32];
+    unsigned char delta_sum[32];
+    int shared;                 /* dest is in shared_cache_dir */
+} download_job_t;
+
+static void export_env(const char *name, const char *value)
 {
-    fetchIO *fio = NULL;
-    FILE *fp = NULL;
-    char *tmp = NULL;
-    char buf[65536];
+    const char *cur = getenv(name);
+
+    if (value && (!cur || strcmp(cur, value) != 0))
+        setenv(name, value, 1);
+}
+
+/* Pass client cert config to libfetch via env vars.  The environment is
+ * only written when it changes, so that after aept_download_init() this
+ * is safe to call from download workers. */
+static void export_ssl_env(struct aept_ctx *ctx)
+{
+    export_env("SSL_CLIENT_CERT_FILE", ctx->config.ssl_client_cert);
+    export_env("SSL_CLIENT_KEY_FILE", ctx->config.ssl_client_key);
+}
+
+void aept_download_init(struct aept_ctx *ctx)
+{
+    export_ssl_env(ctx);
+}
+
+/* HTTP status of a conditional GET whose target did not change */
+#define HTTP_NOT_MODIFIED 304
+
+/* Account for n bytes received and, with download_rate set, hold the
+ * transfer back until that rate allows them.  All downloads share the
+ * budget: each chunk is given the next free slot after those before
+ * it, and time nothing was downloaded in is not saved up.  While a
+ * transfer sleeps it does not read, so TCP slows the sender down. */
+static void transferred(struct aept_ctx *ctx, aept_mirror_req_t *req,
+                        size_t n)
+{
+    long long rate = (long long)ctx->config.download_rate * 1024;
+    long long now, start, done;
+    struct timespec ts;
+
+    aept_stats_add(ctx, AEPT_STAT_BYTES_DOWNLOADED, n);
+    aept_mirror_received(req, n);
+    aept_progress_add(n);
+
+    if (rate <= 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    start = atomic_load(&ctx->rate_next);
+    do {
+        done = (start > now ? start : now) +
+               (long long)((double)n * 1e9 / (double)rate);
+    } while (!atomic_compare_exchange_weak(&ctx->rate_next, &start, done));
+
+    /* Sleep in short steps to notice cancellation */
+    while (now < done && !aept_cancelled()) {
+        long long step = done - now;
+
+        if (step > 100000000LL)
+            step = 100000000LL;
+        ts.tv_sec = 0;
+        ts.tv_nsec = step;
+        nanosleep(&ts, NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+}
+
+/* Source of a transfer being decompressed on the fly */
+typedef struct {
+    struct aept_ctx *ctx;
+    fetchIO *fio;
+    const char *url;
+    aept_mirror_req_t *req;
+} fetch_reader_t;
+
+static ssize_t fetch_reader_read(void *userdata, void *buf, size_t size)
+{
+    fetch_reader_t *r = userdata;
     ssize_t n;
-    int ret = -1;
 
-    aept_log_info("downloading %s", name);
+    do {
+        n = fetchIO_read(r->fio, buf, size);
+    } while (n < 0 && errno == EINTR && !aept_cancelled());
 
-    /* Pass client cert config to libfetch via env vars */
-    if (ctx->config.ssl_client_cert)
-        setenv("SSL_CLIENT_CERT_FILE", ctx->config.ssl_client_cert, 1);
-    if (ctx->config.ssl_client_key)
-        setenv("SSL_CLIENT_KEY_FILE", ctx->config.ssl_client_key, 1);
+    if (aept_cancelled())
+        return -1;
+    if (n < 0) {
+        aept_log_error("failed to download '%s'", r->url);
+    } else {
+        transferred(r->ctx, r->req, n);
+    }
+    return n;
+}
 
-    fio = fetchGetURL(url, "");
-    if (!fio) {
-        aept_log_error("failed to download '%s'", url);
+/* Digest of the first len bytes of a package transfer, kept up to date
+ * as data arrives so that the file need not be read back to verify it. */
+typedef struct {
+    Id type;
+    const unsigned char *expected;
+    Chksum *chk;
+    off_t len;
+} running_sum_t;
+
+static int sum_init(running_sum_t *rs, Id type, const unsigned char *expected,
+                    const char *name)
+{
+    rs->type = type;
+    rs->expected = expected;
+    rs->len = 0;
+    rs->chk = solv_chksum_create(type);
+    if (!rs->chk) {
+        aept_log_error("unsupported checksum type for '%s'", name);
         return -1;
     }
+    return 0;
+}
 
-    /* Download to <dest>.<pid>, then rename into place. This ensures
-     * readers never see a partially-written file, even when multiple
-     * aept instances share the same download cache. */
-    aept_asprintf(&tmp, "%s.%d", dest, (int)getpid());
+static void sum_free(running_sum_t *rs)
+{
+    if (rs->chk)
+        solv_chksum_free(rs->chk, NULL);
+    rs->chk = NULL;
+}
 
-    fp = fopen(tmp, "wb");
-    if (!fp) {
-        aept_log_error("cannot create '%s': %s", tmp, strerror(errno));
-        goto cleanup;
+static void sum_reset(running_sum_t *rs)
+{
+    solv_chksum_free(rs->chk, NULL);
+    rs->chk = solv_chksum_create(rs->type);
+    rs->len = 0;
+}
+
+static void sum_add(running_sum_t *rs, const void *buf, size_t n)
+{
+    solv_chksum_add(rs->chk, buf, (int)n);
+    rs->len += n;
+}
+
+/* Bring rs to cover exactly the first len bytes of fd, reading back only
+ * what it has not seen, i.e. the part kept from an earlier run. */
+static int sum_catch_up(running_sum_t *rs, int fd, off_t len)
+{
+    char buf[65536];
+    ssize_t n;
+
+    if (rs->len > len)
+        sum_reset(rs);
+
+    while (rs->len < len) {
+        n = pread(fd, buf, len - rs->len < (off_t)sizeof(buf) ?
+                  (size_t)(len - rs->len) : sizeof(buf), rs->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sum_add(rs, buf, n);
     }
+    return 0;
+}
+
+static int sum_matches(running_sum_t *rs, const char *name)
+{
+    const unsigned char *computed;
+    int len;
+
+    computed = solv_chksum_get(rs->chk, &len);
+    if (len != solv_chksum_len(rs->type) ||
+            memcmp(computed, rs->expected, len) != 0) {
+        aept_log_error("%s checksum mismatch for '%s'",
+                       solv_chksum_type2str(rs->type), name);
+        return 0;
+    }
+    return 1;
+}
+
+/* Copy the transfer to fp, adding it to rs unless that is NULL. */
+static int copy_plain(struct aept_ctx *ctx, fetchIO *fio, FILE *fp,
+                      const char *url, const char *tmp, running_sum_t *rs,
+                      aept_mirror_req_t *req)
+{
+    char buf[65536];
+    ssize_t n;
 
     for (;;) {
         n = fetchIO_read(fio, buf, sizeof(buf));
         if (aept_cancelled())
-            goto cleanup;
+            return -1;
         if (n == 0)
-            break;
+            return 0;
         if (n < 0) {
             if (errno == EINTR)
                 continue;
             aept_log_error("failed to download '%s'", url);
-            goto cleanup;
+            return -1;
         }
+        transferred(ctx, req, n);
         if (fwrite(buf, 1, n, fp) != (size_t)n) {
             aept_log_error("write error for '%s': %s", tmp, strerror(errno));
-            goto cleanup;
+            return -1;
+        }
+        if (rs)
+            sum_add(rs, buf, n);
+    }
+}
+
+static int copy_gunzip(struct aept_ctx *ctx, fetchIO *fio, FILE *fp,
+                       const char *url, aept_mirror_req_t *req)
+{
+    fetch_reader_t reader = { ctx, fio, url, req };
+    struct aept_ar *ar;
+    int r;
+
+    ar = aept_ar_open_compressed_stream(fetch_reader_read, &reader);
+    if (!ar)
+        return -1;
+
+    r = aept_ar_copy_to_stream(ar, fp);
+    aept_ar_close(ar);
+    return r;
+}
+
+/* Download url to dest.  If mtime is not NULL and *mtime > 0, the request
+ * is made conditional on the document having changed since *mtime and 1
+ * is returned, with dest untouched, if it did not.  On a download,
+ * *mtime is set to the server's Last-Modified time, or 0 if unknown.
+ * With gunzip set, the transfer is decompressed on its way to dest.
+ * With rs set, the transfer is hashed into it and dest is only created
+ * if the digest matches.  The request is accounted to req's mirror. */
+static int do_fetch_to_file(struct aept_ctx *ctx, const char *url,
+                            const char *dest, const char *name,
+                            time_t *mtime, int gunzip, running_sum_t *rs,
+                            aept_mirror_req_t *req)
+{
+    struct url *u;
+    struct url_stat us;
+    fetchIO *fio = NULL;
+    FILE *fp = NULL;
+    char *tmp = NULL;
+    int ret = -1;
+
+    u = fetchParseURL(url);
+    if (!u) {
+        aept_log_error("invalid URL '%s'", url);
+        return -1;
+    }
+
+    memset(&us, 0, sizeof(us));
+    if (mtime && *mtime > 0)
+        u->last_modified = *mtime;
+
+    fio = fetchXGet(u, &us, (mtime && *mtime > 0) ? "i" : "");
+    fetchFreeURL(u);
+
+    if (!fio) {
+        if (mtime && fetchLastErrCode.category == FETCH_ERRCAT_HTTP &&
+                fetchLastErrCode.code == HTTP_NOT_MODIFIED) {
+            aept_mirror_responded(req);
+            aept_log_debug("%s not modified", name);
+            return 1;
         }
+        aept_log_error("failed to download '%s'", url);
+        return -1;
     }
 
+    aept_mirror_responded(req);
+    if (us.size > 0)
+        aept_progress_total(us.size);
+
+    aept_log_info("downloading %s", name);
+
+    if (mtime)
+        *mtime = us.mtime > 0 ? us.mtime : 0;
+
+    /* Download to <dest>.<pid>, then rename into place. This ensures
+     * readers never see a partially-written file, even when multiple
+     * aept instances share the same download cache. */
+    aept_asprintf(&tmp, "%s.%d", dest, (int)getpid());
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        aept_log_error("cannot create '%s': %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+
+    if ((gunzip ? copy_gunzip(ctx, fio, fp, url, req)
+                : copy_plain(ctx, fio, fp, url, tmp, rs, req)) != 0)
+        goto cleanup;
+
+    if (rs && !sum_matches(rs, name))
+        goto cleanup;
+
     if (fclose(fp) != 0) {
         aept_log_error("write error for '%s': %s", tmp, strerror(errno));
         fp = NULL;
@@ -101,121 +374,1009 @@ cleanup:
     return ret;
 }
 
-static int verify_checksum(const char *path, Pool *pool, Solvable *s)
+static int fetch_to_file(struct aept_ctx *ctx, const char *url,
+                         const char *dest, const char *name, time_t *mtime,
+                         int gunzip, running_sum_t *rs, aept_mirror_t *mirror)
+{
+    aept_stats_timer_t timer;
+    aept_progress_t progress;
+    aept_mirror_req_t req;
+    int r;
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_DOWNLOAD);
+    aept_progress_begin(ctx, &progress, AEPT_PHASE_DOWNLOAD, name, 0);
+    aept_mirror_begin(&req, mirror);
+    r = do_fetch_to_file(ctx, url, dest, name, mtime, gunzip, rs, &req);
+    aept_mirror_end(&req, r >= 0);
+    aept_progress_end(&progress, r >= 0);
+    if (r == 0) {
+        aept_stats_add(ctx, AEPT_STAT_FILES_DOWNLOADED, 1);
+        aept_log_debug("fetched %s in %.2fs", name,
+                       aept_stats_elapsed(&timer));
+    }
+    aept_stats_end(&timer);
+    return r;
+}
+
+int aept_download(struct aept_ctx *ctx, const char *url, const char *dest,
+                  const char *name, aept_mirror_t *mirror)
+{
+    export_ssl_env(ctx);
+    return fetch_to_file(ctx, url, dest, name, NULL, 0, NULL, mirror);
+}
+
+int aept_download_if_modified(struct aept_ctx *ctx, const char *url,
+                              const char *dest, const char *name,
+                              time_t *mtime, aept_mirror_t *mirror)
+{
+    export_ssl_env(ctx);
+    return fetch_to_file(ctx, url, dest, name, mtime, 0, NULL, mirror);
+}
+
+int aept_download_gunzip(struct aept_ctx *ctx, const char *url,
+                         const char *dest, const char *name, time_t *mtime,
+                         aept_mirror_t *mirror)
+{
+    export_ssl_env(ctx);
+    return fetch_to_file(ctx, url, dest, name, mtime, 1, NULL, mirror);
+}
+
+/* Transfer url into fd starting at byte offset start, adding the new
+ * bytes to rs, which must cover the first start bytes already.  The
+ * server may ignore the Range request, in which case the file is
+ * rewritten from the beginning.  *end is set to the file size reached,
+ * even on failure. */
+static int fetch_range(struct aept_ctx *ctx, const char *url, int fd,
+                       off_t start, off_t *end, const char *name,
+                       running_sum_t *rs, aept_mirror_t *mirror)
+{
+    struct url *u;
+    fetchIO *fio;
+    aept_mirror_req_t req;
+    char buf[65536];
+    ssize_t n, w;
+    off_t pos = start;
+    int ret = -1;
+
+    *end = start;
+
+    u = fetchParseURL(url);
+    if (!u)
+        return -1;
+    u->offset = start;
+
+    aept_mirror_begin(&req, mirror);
+    fio = fetchGet(u, "");
+    if (!fio) {
+        aept_mirror_end(&req, 0);
+        fetchFreeURL(u);
+        return -1;
+    }
+    aept_mirror_responded(&req);
+
+    /* libfetch reports back the offset the server actually honoured */
+    if (u->offset != start) {
+        if (u->offset != 0)
+            goto cleanup;
+        aept_log_debug("server ignored range request for %s", name);
+        if (ftruncate(fd, 0) < 0)
+            goto cleanup;
+        sum_reset(rs);
+        pos = 0;
+        *end = 0;
+    }
+    if (u->length > 0)
+        aept_progress_total(u->offset + u->length);
+    aept_progress_set(pos);
+
+    for (;;) {
+        n = fetchIO_read(fio, buf, sizeof(buf));
+        if (aept_cancelled())
+            goto cleanup;
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            goto cleanup;
+        }
+        w = pwrite(fd, buf, n, pos);
+        if (w != n) {
+            aept_log_error("write error for '%s': %s", name,
+                           w < 0 ? strerror(errno) : "short write");
+            goto cleanup;
+        }
+        transferred(ctx, &req, n);
+        sum_add(rs, buf, n);
+        pos += n;
+        *end = pos;
+    }
+
+    ret = 0;
+
+cleanup:
+    aept_mirror_end(&req, ret == 0);
+    fetchIO_close(fio);
+    fetchFreeURL(u);
+    return ret;
+}
+
+/* Download a package to its dest through a partial file <dest>.part that
+ * survives failures and is resumed with a Range request by the next
+ * attempt, whether a retry within this run or a later invocation.  The
+ * checksum is computed as the data arrives; only bytes kept from an
+ * earlier invocation are read back.  *resumed is set if any bytes came
+ * from an earlier attempt.  Returns 1, with the partial file removed,
+ * if the result does not match the checksum. */
+static int fetch_resumable(struct aept_ctx *ctx, const download_job_t *job,
+                           aept_mirror_t *mirror, int *resumed)
+{
+    const char *name = job->base;
+    char *part = NULL;
+    struct stat st;
+    off_t start, end = 0;
+    aept_stats_timer_t timer;
+    aept_progress_t progress;
+    running_sum_t rs;
+    int fd, attempt, r = -1;
+
+    *resumed = 0;
+    if (sum_init(&rs, job->checksum_type, job->checksum, job->name) < 0)
+        return -1;
+
+    aept_asprintf(&part, "%s.part", job->dest);
+
+    fd = open(part, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        aept_log_error("cannot create '%s': %s", part, strerror(errno));
+        sum_free(&rs);
+        free(part);
+        return -1;
+    }
+
+    /* Another aept instance sharing the cache is fetching the same file;
+     * fall back to a private temporary file. */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        free(part);
+        r = fetch_to_file(ctx, job->url, job->dest, name, NULL, 0, &rs,
+                          mirror);
+        sum_free(&rs);
+        return r;
+    }
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_DOWNLOAD);
+    aept_progress_begin(ctx, &progress, AEPT_PHASE_DOWNLOAD, name, 0);
+
+    for (attempt = 1; attempt <= AEPT_DOWNLOAD_ATTEMPTS; attempt++) {
+        if (fstat(fd, &st) < 0)
+            break;
+        start = st.st_size;
+
+        if (sum_catch_up(&rs, fd, start) < 0) {
+            aept_log_error("cannot read '%s': %s", part, strerror(errno));
+            break;
+        }
+
+        if (start > 0) {
+            aept_log_info("resuming %s at %lld bytes", name,
+                          (long long)start);
+            *resumed = 1;
+        } else {
+            aept_log_info("downloading %s", name);
+        }
+
+        r = fetch_range(ctx, job->url, fd, start, &end, name, &rs, mirror);
+        if (r == 0 || aept_cancelled())
+            break;
+
+        /* No progress at all: try once more from scratch in case the
+         * partial file is what the server is refusing, then give up. */
+        if (end == start) {
+            if (start == 0)
+                break;
+            if (ftruncate(fd, 0) < 0)
+                break;
+        }
+    }
+
+    if (r < 0) {
+        if (!aept_cancelled())
+            aept_log_error("failed to download '%s'", job->url);
+    } else if (!sum_matches(&rs, job->name)) {
+        unlink(part);
+        r = 1;
+    } else if (rename(part, job->dest) != 0) {
+        aept_log_error("rename '%s' -> '%s': %s", part, job->dest,
+                       strerror(errno));
+        r = -1;
+    } else {
+        aept_stats_add(ctx, AEPT_STAT_FILES_DOWNLOADED, 1);
+        aept_log_debug("fetched %s: %lld bytes in %.2fs", name,
+                       (long long)end, aept_stats_elapsed(&timer));
+    }
+
+    aept_progress_end(&progress, r == 0);
+    aept_stats_end(&timer);
+    sum_free(&rs);
+    close(fd);
+    free(part);
+    return r;
+}
+
+/* Hash the file at path.  Returns 1 if it matches expected, 0 if not
+ * and -1 if it cannot be read, with errno set. */
+static int checksum_matches(const char *path, Id checksum_type,
+                            const unsigned char *expected)
 {
-    Id checksum_type;
-    const unsigned char *expected;
     Chksum *chk;
     FILE *fp;
     char buf[4096];
     size_t n;
     const unsigned char *computed;
-    int len;
-    const char *name = pool_id2str(pool, s->name);
+    int len, ok;
 
-    expected = solvable_lookup_bin_checksum(s, SOLVABLE_CHECKSUM,
-                                            &checksum_type);
-    if (!expected) {
-        aept_log_error("no checksum for '%s'", name);
+    fp = fopen(path, "rb");
+    if (!fp)
         return -1;
-    }
 
     chk = solv_chksum_create(checksum_type);
-    if (!chk) {
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        solv_chksum_add(chk, buf, (int)n);
+
+    fclose(fp);
+
+    computed = solv_chksum_get(chk, &len);
+    ok = len == solv_chksum_len(checksum_type) &&
+         memcmp(computed, expected, len) == 0;
+
+    solv_chksum_free(chk, NULL);
+    return ok;
+}
+
+static int verify_checksum(const char *path, const char *name,
+                           Id checksum_type, const unsigned char *expected)
+{
+    int r;
+
+    if (solv_chksum_len(checksum_type) <= 0) {
         aept_log_error("unsupported checksum type for '%s'", name);
         return -1;
     }
 
-    fp = fopen(path, "rb");
-    if (!fp) {
+    r = checksum_matches(path, checksum_type, expected);
+    if (r < 0) {
         aept_log_error("cannot open '%s' for checksum verification: %s",
                   path, strerror(errno));
-        solv_chksum_free(chk, NULL);
         return -1;
     }
 
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
-        solv_chksum_add(chk, buf, (int)n);
-
-    fclose(fp);
-
-    computed = solv_chksum_get(chk, &len);
-
-    if (len != solv_chksum_len(checksum_type) ||
-            memcmp(computed, expected, len) != 0) {
+    if (r == 0) {
         aept_log_error("%s checksum mismatch for '%s'",
                   solv_chksum_type2str(checksum_type), name);
-        solv_chksum_free(chk, NULL);
         unlink(path);
         return -1;
     }
 
-    solv_chksum_free(chk, NULL);
     return 0;
 }
 
-int aept_download_package(struct aept_ctx *ctx, Id p, Pool *pool,
-                          char **dest_out)
+/*
+ * Delta downloads.  A package stanza may list deltas from older builds:
+ *
+ *   Delta-From:
+ *    <old sha256> <old file> <delta file> <delta sha256>
+ *
+ * where <old file> is the name of the older package in the cache and
+ * <delta file> is relative to the repository like Filename.  If the
+ * package is not cached but one of the older ones is, the delta (see
+ * delta.h) is fetched instead and applied to it.  The result still has
+ * to pass the package's own checksum, and any failure falls back to the
+ * full download.
+ */
+
+static int parse_sha256(const char *hex, unsigned char *out)
+{
+    const char *p = hex;
+
+    return strlen(hex) == 64 && solv_hex2bin(&p, out, 32) == 32;
+}
+
+/* Path of the package with the given checksum in shared_cache_dir, or
+ * NULL if there is no shared cache.  Entries are named <type>-<hex>, so
+ * any root or configuration that resolves to the same package finds the
+ * same file whatever the repository calls it. */
+static char *shared_cache_path(struct aept_ctx *ctx, Id type,
+                               const unsigned char *sum)
+{
+    char hex[2 * 64 + 1];
+    char *path = NULL;
+    int len = solv_chksum_len(type);
+
+    if (!ctx->config.shared_cache_dir || len <= 0 || len > 64)
+        return NULL;
+    solv_bin2hex(sum, len, hex);
+
+    aept_asprintf(&path, "%s/%s-%s", ctx->config.shared_cache_dir,
+                  solv_chksum_type2str(type), hex);
+    return path;
+}
+
+static void prepare_delta(struct aept_ctx *ctx, Solvable *s,
+                          download_job_t *job)
+{
+    Id key = pool_str2id(s->repo->pool, AEPT_DELTA_FROM_KEY, 0);
+    const char *field;
+    char *copy, *line, *save = NULL;
+
+    if (!key || !ctx->config.delta_downloads ||
+            access(job->dest, F_OK) == 0)
+        return;
+
+    field = solvable_lookup_str(s, key);
+    if (!field)
+        return;
+
+    copy = aept_strdup(field);
+    for (line = strtok_r(copy, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        char old_sum[65], old_file[256], delta_file[1024], delta_sum[65];
+        char *old_path = NULL;
+
+        if (sscanf(line, "%64s %255s %1023s %64s", old_sum, old_file,
+                   delta_file, delta_sum) != 4)
+            continue;
+
+        if (strchr(old_file, '/') || old_file[0] == '.' ||
+                !aept_archive_path_is_safe(delta_file) ||
+                !parse_sha256(old_sum, job->delta_old_sum) ||
+                !parse_sha256(delta_sum, job->delta_sum)) {
+            aept_log_debug("ignoring malformed delta for '%s'", job->name);
+            continue;
+        }
+
+        old_path = shared_cache_path(ctx, REPOKEY_TYPE_SHA256,
+                                     job->delta_old_sum);
+        if (!old_path || access(old_path, F_OK) != 0) {
+            free(old_path);
+            aept_asprintf(&old_path, "%s/%s", ctx->config.cache_dir,
+                          old_file);
+        }
+        if (access(old_path, F_OK) != 0) {
+            free(old_path);
+            continue;
+        }
+
+        job->delta_old = old_path;
+        job->delta_location = aept_strdup(delta_file);
+        break;
+    }
+    free(copy);
+}
+
+static int prepare_job(struct aept_ctx *ctx, Id p, Pool *pool,
+                       download_job_t *job)
 {
     Solvable *s = pool_id2solvable(pool, p);
     unsigned int medianr;
-    const char *location = solvable_lookup_location(s, &medianr);
+    const char *location;
+    char *shared;
     int src_idx;
-    char *url = NULL;
-    char *dest = NULL;
-    char *location_copy = NULL;
-    char *base;
-    int r;
 
+    memset(job, 0, sizeof(*job));
+    job->name = aept_strdup(pool_id2str(pool, s->name));
+
+    job->checksum = solvable_lookup_bin_checksum(s, SOLVABLE_CHECKSUM,
+                                                 &job->checksum_type);
+    if (!job->checksum) {
+        aept_log_error("no checksum for '%s'", job->name);
+        return -1;
+    }
+
+    location = solvable_lookup_location(s, &medianr);
     if (!location) {
-        aept_log_error("no download location for '%s'",
-                  pool_id2str(pool, s->name));
+        aept_log_error("no download location for '%s'", job->name);
         return -1;
     }
 
     src_idx = aept_solver_solvable_source_index(ctx->solver, p);
     if (src_idx < 0 || src_idx >= ctx->config.nsources) {
-        aept_log_error("unknown source for '%s'",
-                  pool_id2str(pool, s->name));
+        aept_log_error("unknown source for '%s'", job->name);
         return -1;
     }
 
-    aept_asprintf(&url, "%s/%s", ctx->config.sources[src_idx].url, location);
+    job->src_idx = src_idx;
+    job->location = aept_strdup(location);
+    job->location_copy = aept_strdup(location);
+    job->base = basename(job->location_copy);
 
-    location_copy = aept_strdup(location);
-    base = basename(location_copy);
-    aept_asprintf(&dest, "%s/%s", ctx->config.cache_dir, base);
+    /* A shared cache that cannot be written to is only read from */
+    shared = shared_cache_path(ctx, job->checksum_type, job->checksum);
+    if (shared && (access(shared, F_OK) == 0 ||
+            (aept_file_mkdir_hier(ctx->config.shared_cache_dir, 0755) == 0 &&
+             access(ctx->config.shared_cache_dir, W_OK) == 0))) {
+        job->dest = shared;
+        job->shared = 1;
+    } else {
+        free(shared);
+        aept_asprintf(&job->dest, "%s/%s", ctx->config.cache_dir, job->base);
+    }
 
-    aept_file_mkdir_hier(ctx->config.cache_dir, 0755);
+    prepare_delta(ctx, s, job);
+    return 0;
+}
+
+static void free_job(download_job_t *job)
+{
+    free(job->name);
+    free(job->url);
+    free(job->dest);
+    free(job->location);
+    free(job->location_copy);
+    free(job->delta_location);
+    free(job->delta_url);
+    free(job->delta_old);
+}
+
+/* A cached package that passed verification gets a record <dest>.verified
+ * naming the file's identity and the digest it matched.  While the file
+ * is unchanged a matching record stands in for hashing it again; any
+ * difference falls back to a full verify. */
+
+#define VERIFIED_RECORD_VERSION 1
+
+static char *verified_record(Id type, const unsigned char *sum,
+                             const struct stat *st)
+{
+    char hex[2 * 64 + 1];
+    char *rec = NULL;
+    int len = solv_chksum_len(type);
+
+    if (len <= 0 || len > 64)
+        return NULL;
+    solv_bin2hex(sum, len, hex);
+
+    aept_asprintf(&rec, "aept-verified %d %llu %llu %lld.%09ld %lld %s %s\n",
+                  VERIFIED_RECORD_VERSION,
+                  (unsigned long long)st->st_dev,
+                  (unsigned long long)st->st_ino,
+                  (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec,
+                  (long long)st->st_size, solv_chksum_type2str(type), hex);
+    return rec;
+}
+
+static int verified_record_matches(const char *dest, Id type,
+                                   const unsigned char *sum)
+{
+    struct stat st;
+    char *path = NULL, *want;
+    char buf[512];
+    FILE *fp;
+    int ok = 0;
 
-    /* Try cached copy first */
-    if (access(dest, F_OK) == 0) {
-        if (verify_checksum(dest, pool, s) == 0) {
-            aept_log_debug("using cached %s",
-                     pool_id2str(pool, s->name));
-            free(url);
-            free(location_copy);
-            *dest_out = dest;
+    if (stat(dest, &st) != 0)
+        return 0;
+    want = verified_record(type, sum, &st);
+    if (!want)
+        return 0;
+
+    aept_asprintf(&path, "%s.verified", dest);
+    fp = fopen(path, "r");
+    if (fp) {
+        ok = fgets(buf, sizeof(buf), fp) && strcmp(buf, want) == 0;
+        fclose(fp);
+    }
+
+    free(path);
+    free(want);
+    return ok;
+}
+
+/* Record that job->dest matches its checksum.  Failure is not an error:
+ * the package is simply hashed again next time. */
+static void verified_record_save(struct aept_ctx *ctx,
+                                 const download_job_t *job)
+{
+    struct stat st;
+    char *path = NULL, *tmp = NULL, *rec;
+
+    if ((ctx->config.no_cache && !job->shared) || stat(job->dest, &st) != 0)
+        return;
+    rec = verified_record(job->checksum_type, job->checksum, &st);
+    if (!rec)
+        return;
+
+    aept_asprintf(&path, "%s.verified", job->dest);
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp) {
+        int ok = fputs(rec, fp) >= 0;
+
+        if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0)
+            unlink(tmp);
+    }
+
+    free(rec);
+    free(tmp);
+    free(path);
+}
+
+/* Mark a cache hit for the cache_limit eviction order.  The record does
+ * not cover its own mtime, so it stays valid. */
+static void verified_record_touch(const char *dest)
+{
+    char *path = NULL;
+
+    aept_asprintf(&path, "%s.verified", dest);
+    utimensat(AT_FDCWD, path, NULL, 0);
+    free(path);
+}
+
+static void verified_record_drop(const char *dest)
+{
+    char *path = NULL;
+
+    aept_asprintf(&path, "%s.verified", dest);
+    unlink(path);
+    free(path);
+}
+
+void aept_download_discard(struct aept_ctx *ctx, const char *path)
+{
+    const char *dir = ctx->config.shared_cache_dir;
+    size_t len = dir ? strlen(dir) : 0;
+
+    /* Other roots may still want it */
+    if (dir && strncmp(path, dir, len) == 0 && path[len] == '/')
+        return;
+
+    unlink(path);
+    verified_record_drop(path);
+}
+
+static int verify_job(struct aept_ctx *ctx, download_job_t *job)
+{
+    aept_stats_timer_t timer;
+    int r;
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_VERIFY);
+    r = verify_checksum(job->dest, job->name, job->checksum_type,
+                        job->checksum);
+    aept_stats_end(&timer);
+    return r;
+}
+
+/* Rebuild job->dest from the cached older package and the delta chosen
+ * by prepare_delta().  Returns 0 on success, -1 if the package has to be
+ * downloaded in full. */
+static int fetch_delta(struct aept_ctx *ctx, download_job_t *job,
+                       aept_mirror_t *mirror)
+{
+    aept_stats_timer_t timer;
+    char *delta = NULL, *rebuilt = NULL;
+    const char *delta_name = strrchr(job->delta_url, '/') + 1;
+    running_sum_t rs;
+    int r = -1;
+
+    if (!verified_record_matches(job->delta_old, REPOKEY_TYPE_SHA256,
+                                 job->delta_old_sum) &&
+            checksum_matches(job->delta_old, REPOKEY_TYPE_SHA256,
+                             job->delta_old_sum) != 1) {
+        aept_log_debug("cached '%s' does not match the delta base",
+                       job->delta_old);
+        free(job->delta_location);
+        job->delta_location = NULL;
+        return -1;
+    }
+
+    if (sum_init(&rs, REPOKEY_TYPE_SHA256, job->delta_sum, job->name) < 0)
+        return -1;
+
+    aept_asprintf(&delta, "%s.delta.%d", job->dest, (int)getpid());
+    aept_asprintf(&rebuilt, "%s.%d", job->dest, (int)getpid());
+
+    if (fetch_to_file(ctx, job->delta_url, delta, delta_name, NULL, 0,
+                      &rs, mirror) == 0) {
+        aept_stats_begin(ctx, &timer, AEPT_PHASE_DOWNLOAD);
+        r = aept_delta_apply(job->delta_old, delta, rebuilt);
+        aept_stats_end(&timer);
+        unlink(delta);
+    }
+
+    if (r == 0) {
+        aept_stats_begin(ctx, &timer, AEPT_PHASE_VERIFY);
+        r = verify_checksum(rebuilt, job->name, job->checksum_type,
+                            job->checksum);
+        aept_stats_end(&timer);
+    }
+
+    if (r == 0 && rename(rebuilt, job->dest) != 0) {
+        aept_log_error("rename '%s' -> '%s': %s", rebuilt, job->dest,
+                       strerror(errno));
+        unlink(rebuilt);
+        r = -1;
+    }
+
+    if (r == 0)
+        aept_log_debug("rebuilt %s from '%s'", job->name, job->delta_old);
+    else if (!aept_cancelled())
+        aept_log_warning("cannot use delta for %s, downloading it in full",
+                         job->name);
+
+    sum_free(&rs);
+    free(delta);
+    free(rebuilt);
+    return r;
+}
+
+/* Fetch job from one mirror, by delta if it has one, and verify it. */
+static int fetch_from(struct aept_ctx *ctx, download_job_t *job,
+                      aept_mirror_t *mirror)
+{
+    int resumed, r;
+
+    free(job->url);
+    aept_asprintf(&job->url, "%s/%s", mirror->url, job->location);
+
+    if (job->delta_location) {
+        free(job->delta_url);
+        aept_asprintf(&job->delta_url, "%s/%s", mirror->url,
+                      job->delta_location);
+        if (fetch_delta(ctx, job, mirror) == 0)
             return 0;
-        }
-        /* checksum failed — verify_checksum already deleted the file */
     }
 
-    r = aept_download(ctx, url, dest, base);
-    free(url);
-    free(location_copy);
+    r = fetch_resumable(ctx, job, mirror, &resumed);
+    if (r <= 0)
+        return r;
 
-    if (r < 0) {
-        free(dest);
+    /* A resumed file may have been stitched together from two different
+     * uploads of the same name.  Start over once before giving up. */
+    if (!resumed || aept_cancelled())
         return -1;
+
+    aept_log_warning("discarding resumed download of %s", job->name);
+
+    return fetch_resumable(ctx, job, mirror, &resumed) == 0 ? 0 : -1;
+}
+
+/* Use a cached copy at job->dest if there is one and it is intact.
+ * Returns 0 if it can be used, -1 if the package has to be fetched. */
+static int use_cached(struct aept_ctx *ctx, download_job_t *job)
+{
+    if (access(job->dest, F_OK) != 0)
+        return -1;
+
+    if (verified_record_matches(job->dest, job->checksum_type,
+                                job->checksum)) {
+        aept_log_debug("using cached %s (verified before)", job->name);
+        verified_record_touch(job->dest);
+        return 0;
+    }
+    if (verify_job(ctx, job) == 0) {
+        aept_log_debug("using cached %s", job->name);
+        verified_record_save(ctx, job);
+        return 0;
     }
+    /* checksum failed — verify_checksum already deleted the file */
+    verified_record_drop(job->dest);
+    return -1;
+}
 
-    r = verify_checksum(dest, pool, s);
-    if (r < 0) {
-        free(dest);
+static int do_run_job(struct aept_ctx *ctx, download_job_t *job)
+{
+    aept_source_t *src = &ctx->config.sources[job->src_idx];
+    int *order;
+    int i, n, r = -1;
+
+    if (use_cached(ctx, job) == 0)
+        return 0;
+
+    /* A bad entry of a shared cache that is only read from can be
+     * neither removed nor replaced.  Take it as a miss and fetch into
+     * cache_dir as without a shared cache. */
+    if (job->shared && access(ctx->config.shared_cache_dir, W_OK) != 0) {
+        free(job->dest);
+        aept_asprintf(&job->dest, "%s/%s", ctx->config.cache_dir, job->base);
+        job->shared = 0;
+        if (use_cached(ctx, job) == 0)
+            return 0;
+    }
+
+    order = aept_malloc(src->nmirrors * sizeof(int));
+    n = aept_mirror_order(ctx, job->src_idx, job->shift, order);
+
+    for (i = 0; i < n; i++) {
+        aept_mirror_t *mirror = &src->mirrors[order[i]];
+
+        if (i > 0)
+            aept_log_info("trying mirror %s for %s", mirror->url,
+                          job->name);
+
+        r = fetch_from(ctx, job, mirror);
+        if (r == 0) {
+            verified_record_save(ctx, job);
+            break;
+        }
+        if (aept_cancelled())
+            break;
+    }
+
+    free(order);
+    return r == 0 ? 0 : -1;
+}
+
+/* Fetch and verify a prepared job, trying the mirrors of its source in
+ * turn.  Safe to call from a worker thread. */
+static int run_job(struct aept_ctx *ctx, download_job_t *job)
+{
+    aept_trace_span_t span;
+    int r;
+
+    aept_trace_begin(ctx, &span, "download", job->name);
+    r = do_run_job(ctx, job);
+    aept_trace_end(&span);
+    return r;
+}
+
+int aept_download_package(struct aept_ctx *ctx, Id p, Pool *pool,
+                          char **dest_out)
+{
+    download_job_t job;
+    int r;
+
+    r = prepare_job(ctx, p, pool, &job);
+    if (r == 0) {
+        aept_file_mkdir_hier(ctx->config.cache_dir, 0755);
+        export_ssl_env(ctx);
+        aept_mirror_probe(ctx);
+        r = run_job(ctx, &job);
+    }
+
+    if (r == 0) {
+        *dest_out = job.dest;
+        job.dest = NULL;
+    }
+
+    free_job(&job);
+    return r;
+}
+
+/* ── Download queue ─────────────────────────────────────────────── */
+
+enum {
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED
+};
+
+struct aept_download_queue {
+    struct aept_ctx *ctx;
+    download_job_t *jobs;
+    int *state;
+    int count;
+
+    int next;           /* next job to hand out */
+    int claimed;        /* one past the highest job claimed by the consumer */
+    int window;         /* max jobs ahead of claimed, 0 = unbounded */
+    int active;         /* workers still running */
+    int stop;
+    int failed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;    /* a job finished or a worker exited */
+    pthread_cond_t space;   /* consumer advanced or queue is stopping */
+
+    pthread_t *threads;
+    int nthreads;
+};
+
+/* Run job i outside the lock and record the result. Called with
+ * q->lock held and returns with it held. */
+static void run_locked(aept_download_queue_t *q, int i)
+{
+    int r;
+
+    q->state[i] = JOB_RUNNING;
+    pthread_mutex_unlock(&q->lock);
+
+    r = run_job(q->ctx, &q->jobs[i]);
+
+    pthread_mutex_lock(&q->lock);
+    q->state[i] = (r == 0) ? JOB_DONE : JOB_FAILED;
+    if (r < 0)
+        q->failed = 1;
+    pthread_cond_broadcast(&q->done);
+}
+
+static void *download_worker(void *arg)
+{
+    aept_download_queue_t *q = arg;
+    int i;
+
+    /* Logging and cancellation are keyed off the thread-local context */
+    aept_log_set_ctx(q->ctx);
+
+    pthread_mutex_lock(&q->lock);
+
+    for (;;) {
+        while (!q->stop && !q->failed && q->next < q->count &&
+                q->window > 0 && q->next >= q->claimed + q->window)
+            pthread_cond_wait(&q->space, &q->lock);
+
+        if (q->stop || q->failed || q->next >= q->count || aept_cancelled())
+            break;
+
+        /* The consumer may already have run this job inline */
+        i = q->next++;
+        if (q->state[i] != JOB_PENDING)
+            continue;
+
+        run_locked(q, i);
+    }
+
+    q->active--;
+    pthread_cond_broadcast(&q->done);
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+aept_download_queue_t *aept_download_start(struct aept_ctx *ctx, Pool *pool,
+                                           const Id *pkgs, int count,
+                                           int window)
+{
+    aept_download_queue_t *q;
+    int i, njobs = 0, nthreads;
+
+    q = aept_malloc(sizeof(*q));
+    memset(q, 0, sizeof(*q));
+    q->ctx = ctx;
+    q->count = count;
+    q->window = window;
+    q->jobs = aept_malloc(count * sizeof(*q->jobs));
+    memset(q->jobs, 0, count * sizeof(*q->jobs));
+    q->state = aept_malloc(count * sizeof(*q->state));
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->done, NULL);
+    pthread_cond_init(&q->space, NULL);
+
+    /* Pool lookups happen here, before any worker starts */
+    for (i = 0; i < count; i++) {
+        q->state[i] = JOB_DONE;
+        if (!pkgs[i])
+            continue;
+        if (prepare_job(ctx, pkgs[i], pool, &q->jobs[i]) < 0) {
+            aept_download_finish(q, 0);
+            return NULL;
+        }
+        q->jobs[i].shift = njobs;
+        q->state[i] = JOB_PENDING;
+        njobs++;
+    }
+
+    aept_file_mkdir_hier(ctx->config.cache_dir, 0755);
+    export_ssl_env(ctx);
+    if (njobs > 0)
+        aept_mirror_probe(ctx);
+
+    nthreads = ctx->config.download_jobs;
+    if (nthreads > njobs)
+        nthreads = njobs;
+
+    if (nthreads > 0)
+        q->threads = aept_malloc(nthreads * sizeof(*q->threads));
+
+    pthread_mutex_lock(&q->lock);
+    for (q->nthreads = 0; q->nthreads < nthreads; q->nthreads++) {
+        if (pthread_create(&q->threads[q->nthreads], NULL,
+                           download_worker, q) != 0)
+            break;
+        q->active++;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (nthreads > 0 && q->nthreads == 0)
+        aept_log_warning("cannot start download workers, "
+                         "downloading sequentially");
+
+    return q;
+}
+
+int aept_download_wait(aept_download_queue_t *q, int i, char **dest_out)
+{
+    int r = -1;
+
+    pthread_mutex_lock(&q->lock);
+
+    if (q->claimed < i + 1) {
+        q->claimed = i + 1;
+        pthread_cond_broadcast(&q->space);
+    }
+
+    while (q->state[i] == JOB_PENDING || q->state[i] == JOB_RUNNING) {
+        /* No worker left to pick the job up: run it here, unless the
+         * queue already stopped because of an error. */
+        if (q->state[i] == JOB_PENDING && q->active == 0) {
+            if (q->failed || aept_cancelled())
+                break;
+            run_locked(q, i);
+            continue;
+        }
+        pthread_cond_wait(&q->done, &q->lock);
+    }
+
+    if (q->state[i] == JOB_DONE && q->jobs[i].dest) {
+        *dest_out = q->jobs[i].dest;
+        q->jobs[i].dest = NULL;
+        r = 0;
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+void aept_download_finish(aept_download_queue_t *q, int discard)
+{
+    int i;
+
+    if (!q)
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->space);
+    pthread_mutex_unlock(&q->lock);
+
+    for (i = 0; i < q->nthreads; i++)
+        pthread_join(q->threads[i], NULL);
+
+    for (i = 0; i < q->count; i++) {
+        if (discard && q->state[i] == JOB_DONE && q->jobs[i].dest)
+            aept_download_discard(q->ctx, q->jobs[i].dest);
+        free_job(&q->jobs[i]);
+    }
+
+    pthread_cond_destroy(&q->space);
+    pthread_cond_destroy(&q->done);
+    pthread_mutex_destroy(&q->lock);
+
+    free(q->threads);
+    free(q->jobs);
+    free(q->state);
+    free(q);
+}
+
+int aept_download_packages(struct aept_ctx *ctx, Pool *pool, const Id *pkgs,
+                           int count, char **paths_out)
+{
+    aept_download_queue_t *q;
+    char **paths;
+    int i, ret = 0;
+
+    q = aept_download_start(ctx, pool, pkgs, count, 0);
+    if (!q)
         return -1;
+
+    paths = aept_malloc(count * sizeof(char *));
+    memset(paths, 0, count * sizeof(char *));
+
+    for (i = 0; i < count && ret == 0; i++) {
+        if (pkgs[i])
+            ret = aept_download_wait(q, i, &paths[i]);
     }
 
-    *dest_out = dest;
-    return 0;
+    aept_download_finish(q, 0);
+
+    for (i = 0; i < count; i++) {
+        if (ret == 0 && pkgs[i])
+            paths_out[i] = paths[i];
+        else
+            free(paths[i]);
+    }
+
+    free(paths);
+    return ret;
 }
@@ -0,0 +1,178 @@
+/* event.c - queue of events collected by another thread
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "aept/internal.h"
+#include "aept/event.h"
+#include "aept/util.h"
+
+struct aept_event_queue {
+    pthread_mutex_t lock;
+    aept_event_t ev[AEPT_EVENT_QUEUE_MAX];
+    int head;                   /* oldest pending event */
+    int count;
+    unsigned long dropped;      /* since the last take */
+    int fd[2];
+};
+
+int aept_event_queue_open(struct aept_ctx *ctx)
+{
+    aept_event_queue_t *q = ctx->events;
+
+    if (q)
+        return q->fd[0];
+
+    q = aept_malloc(sizeof(*q));
+    if (pipe2(q->fd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        free(q);
+        return -1;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    q->head = 0;
+    q->count = 0;
+    q->dropped = 0;
+
+    ctx->events = q;
+    return q->fd[0];
+}
+
+void aept_event_queue_free(struct aept_ctx *ctx)
+{
+    aept_event_queue_t *q = ctx->events;
+    int i;
+
+    if (!q)
+        return;
+
+    for (i = 0; i < q->count; i++)
+        free(q->ev[(q->head + i) % AEPT_EVENT_QUEUE_MAX].text);
+    close(q->fd[0]);
+    close(q->fd[1]);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+    ctx->events = NULL;
+}
+
+/* Claim the next free entry of q, dropping the oldest if the ring is
+ * full.  Called with q->lock held. */
+static aept_event_t *event_slot(aept_event_queue_t *q)
+{
+    if (q->count == AEPT_EVENT_QUEUE_MAX) {
+        free(q->ev[q->head].text);
+        q->head = (q->head + 1) % AEPT_EVENT_QUEUE_MAX;
+        q->count--;
+        q->dropped++;
+    }
+
+    return &q->ev[(q->head + q->count) % AEPT_EVENT_QUEUE_MAX];
+}
+
+/* Publish the entry claimed last.  Called with q->lock held. */
+static void event_queued(aept_event_queue_t *q)
+{
+    /* Wake the reader on the first pending event only */
+    if (q->count++ == 0) {
+        ssize_t n;
+
+        do {
+            n = write(q->fd[1], "", 1);
+        } while (n < 0 && errno == EINTR);
+    }
+}
+
+int aept_event_push(struct aept_ctx *ctx, int type, int level,
+                    const char *text)
+{
+    aept_event_queue_t *q = ctx->events;
+    aept_event_t *e;
+
+    if (!q)
+        return -1;
+
+    pthread_mutex_lock(&q->lock);
+
+    e = event_slot(q);
+    e->type = type;
+    e->level = level;
+    e->text = aept_strdup(text);
+    e->phase = 0;
+    e->done = 0;
+    e->total = 0;
+    event_queued(q);
+
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+int aept_event_push_progress(struct aept_ctx *ctx, int phase,
+                             const char *package, unsigned long long done,
+                             unsigned long long total)
+{
+    aept_event_queue_t *q = ctx->events;
+    aept_event_t *e;
+
+    if (!q)
+        return -1;
+
+    pthread_mutex_lock(&q->lock);
+
+    e = event_slot(q);
+    e->type = AEPT_EVENT_PROGRESS;
+    e->level = AEPT_LOG_INFO;
+    e->text = aept_strdup(package ? package : "");
+    e->phase = phase;
+    e->done = done;
+    e->total = total;
+    event_queued(q);
+
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+int aept_event_take(struct aept_ctx *ctx, aept_event_t *out, int max)
+{
+    aept_event_queue_t *q = ctx->events;
+    int n = 0;
+
+    if (!q || max <= 0)
+        return 0;
+
+    pthread_mutex_lock(&q->lock);
+
+    if (q->dropped) {
+        out[n].type = AEPT_EVENT_LOG;
+        out[n].level = AEPT_LOG_WARNING;
+        out[n].text = NULL;
+        out[n].phase = 0;
+        out[n].done = 0;
+        out[n].total = 0;
+        aept_asprintf(&out[n].text, "%lu events dropped", q->dropped);
+        q->dropped = 0;
+        n++;
+    }
+
+    while (n < max && q->count > 0) {
+        out[n++] = q->ev[q->head];
+        q->head = (q->head + 1) % AEPT_EVENT_QUEUE_MAX;
+        q->count--;
+    }
+
+    if (q->count == 0) {
+        char buf[64];
+
+        while (read(q->fd[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
@@ -0,0 +1,694 @@
+/* extract.c - directory fd relative file creation
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aept/extract.h"
+#include "aept/msg.h"
+#include "aept/util.h"
+
+#define DIR_CACHE_SIZE   16
+#define TMP_ATTEMPTS     100
+
+/* Open directory below the root, by path relative to it */
+typedef struct {
+    char *rel;                  /* NULL if the slot is free */
+    int fd;
+    unsigned long used;         /* for least recently used eviction */
+} dir_slot_t;
+
+/* A directory created by the extraction.  Its mode, owner and times
+ * are applied once everything below it is in place. */
+typedef struct {
+    char *rel;
+    char *path;
+    char *uname;
+    char *gname;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    long long mtime;
+    long mtime_nsec;
+} fixup_t;
+
+struct aept_extract {
+    char *prefix;
+    int root_fd;
+    int owner;
+
+    dir_slot_t dirs[DIR_CACHE_SIZE];
+    unsigned long tick;
+
+    char *uname_cache;          /* last owner names looked up */
+    uid_t uid_cache;
+    char *gname_cache;
+    gid_t gid_cache;
+
+    fixup_t *fixups;
+    int nfixups;
+    int fixups_alloc;
+};
+
+/* Temporary names are unique within the process */
+static _Atomic unsigned int tmp_seq;
+
+/* Strip "./" and "/" and drop "." components */
+static char *relative_path(const char *path)
+{
+    char *out = aept_malloc(strlen(path) + 1);
+    char *dst = out;
+    const char *p = path;
+
+    while (*p) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        if (len > 0 && !(len == 1 && p[0] == '.')) {
+            if (dst != out)
+                *dst++ = '/';
+            memcpy(dst, p, len);
+            dst += len;
+        }
+        p += len;
+        while (*p == '/')
+            p++;
+    }
+    *dst = '\0';
+    return out;
+}
+
+/* ── Directory handles ────────────────────────────────────────────── */
+
+static int cache_find(aept_extract_t *x, const char *rel, size_t len)
+{
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        const char *r = x->dirs[i].rel;
+        if (r && strlen(r) == len && strncmp(r, rel, len) == 0) {
+            x->dirs[i].used = ++x->tick;
+            return x->dirs[i].fd;
+        }
+    }
+    return -1;
+}
+
+static void cache_add(aept_extract_t *x, const char *rel, int fd)
+{
+    dir_slot_t *victim = &x->dirs[0];
+
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (!x->dirs[i].rel) {
+            victim = &x->dirs[i];
+            break;
+        }
+        if (x->dirs[i].used < victim->used)
+            victim = &x->dirs[i];
+    }
+
+    if (victim->rel) {
+        close(victim->fd);
+        free(victim->rel);
+    }
+    victim->rel = aept_strdup(rel);
+    victim->fd = fd;
+    victim->used = ++x->tick;
+}
+
+/* Forget rel and everything below it, after it was removed */
+static void cache_drop(aept_extract_t *x, const char *rel)
+{
+    size_t len = strlen(rel);
+
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        const char *r = x->dirs[i].rel;
+        if (r && strncmp(r, rel, len) == 0 &&
+                (r[len] == '\0' || r[len] == '/')) {
+            close(x->dirs[i].fd);
+            free(x->dirs[i].rel);
+            x->dirs[i].rel = NULL;
+        }
+    }
+}
+
+/* Handle on directory rel below the root, which the cache keeps open.
+ * The walk starts from the nearest cached ancestor, and opens each
+ * further component without following symlinks.  With create set,
+ * missing components are created.  Returns -1 with errno set on error. */
+static int open_dir(aept_extract_t *x, const char *rel, int create)
+{
+    size_t len = strlen(rel);
+    const char *rest;
+    char *work, *save = NULL;
+    int fd, base;
+
+    if (len == 0)
+        return x->root_fd;
+
+    fd = cache_find(x, rel, len);
+    if (fd >= 0)
+        return fd;
+
+    /* Nearest open ancestor */
+    base = x->root_fd;
+    rest = rel;
+    for (size_t n = len - 1; n > 0; n--) {
+        if (rel[n] == '/' && (fd = cache_find(x, rel, n)) >= 0) {
+            base = fd;
+            rest = rel + n + 1;
+            break;
+        }
+    }
+
+    work = aept_strdup(rest);
+    fd = base;
+    for (char *c = strtok_r(work, "/", &save); c && fd >= 0;
+         c = strtok_r(NULL, "/", &save)) {
+        int next = openat(fd, c, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                          O_CLOEXEC);
+
+        if (next < 0 && errno == ENOENT && create &&
+                (mkdirat(fd, c, 0755) == 0 || errno == EEXIST))
+            next = openat(fd, c, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                          O_CLOEXEC);
+        if (next < 0 && (errno == ELOOP || errno == ENOTDIR))
+            aept_log_error("cannot extract through symlink or file '%s' "
+                           "in '%s'", c, rel);
+
+        if (fd != base) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+        }
+        fd = next;
+    }
+    free(work);
+
+    if (fd >= 0 && fd != base)
+        cache_add(x, rel, fd);
+    return fd;
+}
+
+/* Handle on the directory holding rel.  *leaf is set to the last
+ * component of rel. */
+static int parent_fd(aept_extract_t *x, const char *rel, const char **leaf)
+{
+    const char *slash = strrchr(rel, '/');
+    char *dir;
+    int fd;
+
+    *leaf = slash ? slash + 1 : rel;
+    if (!slash)
+        return x->root_fd;
+
+    dir = aept_malloc((size_t)(slash - rel) + 1);
+    memcpy(dir, rel, (size_t)(slash - rel));
+    dir[slash - rel] = '\0';
+    fd = open_dir(x, dir, 1);
+    free(dir);
+    return fd;
+}
+
+/* ── Owners, modes and times ──────────────────────────────────────── */
+
+static uid_t lookup_uid(aept_extract_t *x, const char *uname,
+                        unsigned int uid)
+{
+    struct passwd pw, *res = NULL;
+    char buf[1024];
+
+    if (!uname)
+        return (uid_t)uid;
+    if (x->uname_cache && strcmp(x->uname_cache, uname) == 0)
+        return x->uid_cache;
+
+    free(x->uname_cache);
+    x->uname_cache = aept_strdup(uname);
+    x->uid_cache = getpwnam_r(uname, &pw, buf, sizeof(buf), &res) == 0
+        && res ? res->pw_uid : (uid_t)uid;
+    return x->uid_cache;
+}
+
+static gid_t lookup_gid(aept_extract_t *x, const char *gname,
+                        unsigned int gid)
+{
+    struct group gr, *res = NULL;
+    char buf[1024];
+
+    if (!gname)
+        return (gid_t)gid;
+    if (x->gname_cache && strcmp(x->gname_cache, gname) == 0)
+        return x->gid_cache;
+
+    free(x->gname_cache);
+    x->gname_cache = aept_strdup(gname);
+    x->gid_cache = getgrnam_r(gname, &gr, buf, sizeof(buf), &res) == 0
+        && res ? res->gr_gid : (gid_t)gid;
+    return x->gid_cache;
+}
+
+/* Owner and permission bits for an entry, dropping set-id bits that
+ * would not match the file's actual owner, as libarchive does. */
+static mode_t apply_owner(aept_extract_t *x, const char *uname,
+                          const char *gname, unsigned int e_mode,
+                          unsigned int e_uid, unsigned int e_gid,
+                          int dfd, const char *name, int fd)
+{
+    mode_t mode = e_mode & 07777;
+    uid_t want_uid = lookup_uid(x, uname, e_uid);
+    gid_t want_gid = lookup_gid(x, gname, e_gid);
+    uid_t uid = geteuid();
+    gid_t gid = getegid();
+
+    if (x->owner) {
+        int r = fd >= 0 ? fchown(fd, want_uid, want_gid)
+            : fchownat(dfd, name, want_uid, want_gid, AT_SYMLINK_NOFOLLOW);
+
+        if (r == 0) {
+            uid = want_uid;
+            gid = want_gid;
+        }
+    }
+
+    if (uid != want_uid)
+        mode &= ~(mode_t)S_ISUID;
+    if (gid != want_gid)
+        mode &= ~(mode_t)S_ISGID;
+    return mode;
+}
+
+/* Whether st has the owner that extracting hdr would give it */
+static int owner_matches(aept_extract_t *x, const aept_ar_header_t *hdr,
+                         const struct stat *st)
+{
+    if (x->owner)
+        return st->st_uid == lookup_uid(x, hdr->uname, hdr->uid) &&
+               st->st_gid == lookup_gid(x, hdr->gname, hdr->gid);
+    return st->st_uid == geteuid();
+}
+
+static mode_t apply_hdr_owner(aept_extract_t *x, const aept_ar_header_t *hdr,
+                              int dfd, const char *name, int fd)
+{
+    return apply_owner(x, hdr->uname, hdr->gname, hdr->mode, hdr->uid,
+                       hdr->gid, dfd, name, fd);
+}
+
+/* Access time now, modification time as in the archive */
+static void make_times(struct timespec ts[2], long long mtime,
+                       long mtime_nsec)
+{
+    ts[0] = (struct timespec){ .tv_nsec = UTIME_NOW };
+    ts[1] = (struct timespec){ .tv_sec = (time_t)mtime,
+                               .tv_nsec = mtime_nsec };
+}
+
+static int set_times_fd(long long mtime, long mtime_nsec, int fd)
+{
+    struct timespec ts[2];
+
+    make_times(ts, mtime, mtime_nsec);
+    return futimens(fd, ts);
+}
+
+static int set_times_at(long long mtime, long mtime_nsec, int dfd,
+                        const char *name)
+{
+    struct timespec ts[2];
+
+    make_times(ts, mtime, mtime_nsec);
+    return utimensat(dfd, name, ts, AT_SYMLINK_NOFOLLOW);
+}
+
+/* ── Creating entries ─────────────────────────────────────────────── */
+
+/* Create the temporary name in dfd with make(), retrying while the
+ * name is taken.  tmp receives the name used. */
+static int make_tmp(int dfd, char tmp[64],
+                    int (*make)(int dfd, const char *tmp, void *arg),
+                    void *arg)
+{
+    for (int i = 0; i < TMP_ATTEMPTS; i++) {
+        snprintf(tmp, 64, ".aept-%d-%u", (int)getpid(), tmp_seq++);
+        int r = make(dfd, tmp, arg);
+        if (r >= 0 || errno != EEXIST)
+            return r;
+    }
+    return -1;
+}
+
+static int make_symlink(int dfd, const char *tmp, void *arg)
+{
+    return symlinkat(arg, dfd, tmp);
+}
+
+static int make_open(int dfd, const char *tmp, void *arg)
+{
+    (void)arg;
+    return openat(dfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+}
+
+typedef struct {
+    int from_dfd;
+    const char *from;
+} link_arg_t;
+
+static int make_link(int dfd, const char *tmp, void *arg)
+{
+    link_arg_t *l = arg;
+    return linkat(l->from_dfd, l->from, dfd, tmp, 0);
+}
+
+/* Rename tmp over name, removing an empty directory in the way as
+ * libarchive does.  tmp is removed on failure. */
+static int place(aept_extract_t *x, int dfd, const char *tmp,
+                 const char *name, const char *rel)
+{
+    int r = renameat(dfd, tmp, dfd, name);
+
+    if (r < 0 && errno == EISDIR && unlinkat(dfd, name, AT_REMOVEDIR) == 0) {
+        cache_drop(x, rel);
+        r = renameat(dfd, tmp, dfd, name);
+    }
+
+    if (r < 0) {
+        int saved = errno;
+        unlinkat(dfd, tmp, 0);
+        errno = saved;
+    }
+    return r;
+}
+
+static int extract_file(aept_extract_t *x, const aept_ar_header_t *hdr,
+                        const char *rel, int dfd, const char *name,
+                        aept_extract_fill_fn fill, void *userdata)
+{
+    char tmp[64];
+    int out, r = -1;
+
+    out = make_tmp(dfd, tmp, make_open, NULL);
+    if (out < 0)
+        return -1;
+
+    if (fill(userdata, out) == 0 &&
+            fchmod(out, apply_hdr_owner(x, hdr, dfd, tmp, out)) == 0 &&
+            set_times_fd(hdr->mtime, hdr->mtime_nsec, out) == 0)
+        r = 0;
+
+    if (close(out) != 0)
+        r = -1;
+    if (r < 0) {
+        int saved = errno;
+        unlinkat(dfd, tmp, 0);
+        errno = saved;
+        return -1;
+    }
+    return place(x, dfd, tmp, name, rel);
+}
+
+static int extract_symlink(aept_extract_t *x, const aept_ar_header_t *hdr,
+                           const char *rel, int dfd, const char *name)
+{
+    char tmp[64];
+
+    if (make_tmp(dfd, tmp, make_symlink, (void *)hdr->link_target) < 0)
+        return -1;
+
+    apply_hdr_owner(x, hdr, dfd, tmp, -1);
+    set_times_at(hdr->mtime, hdr->mtime_nsec, dfd, tmp);
+
+    return place(x, dfd, tmp, name, rel);
+}
+
+static int extract_hardlink(aept_extract_t *x, const aept_ar_header_t *hdr,
+                            const char *rel, int dfd, const char *name)
+{
+    char *target = relative_path(hdr->hardlink);
+    const char *leaf;
+    char tmp[64];
+    int tfd, r = -1;
+
+    tfd = parent_fd(x, target, &leaf);
+    if (tfd >= 0) {
+        link_arg_t l = { tfd, leaf };
+
+        r = make_tmp(dfd, tmp, make_link, &l);
+        if (r == 0)
+            r = place(x, dfd, tmp, name, rel);
+    }
+
+    free(target);
+    return r;
+}
+
+/* An existing directory is kept as it is, anything else in its place is
+ * replaced. */
+static int extract_dir(aept_extract_t *x, const aept_ar_header_t *hdr,
+                       const char *rel, int dfd, const char *name)
+{
+    struct stat sb;
+    fixup_t *f;
+
+    if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0) {
+        if (S_ISDIR(sb.st_mode))
+            return 0;
+        if (unlinkat(dfd, name, 0) < 0)
+            return -1;
+    }
+
+    if (mkdirat(dfd, name, 0700) < 0)
+        return -1;
+
+    if (x->nfixups >= x->fixups_alloc) {
+        x->fixups_alloc = x->fixups_alloc ? x->fixups_alloc * 2 : 32;
+        x->fixups = aept_realloc(x->fixups,
+                                 x->fixups_alloc * sizeof(*x->fixups));
+    }
+    f = &x->fixups[x->nfixups++];
+    f->rel = aept_strdup(rel);
+    f->path = aept_strdup(hdr->path);
+    f->uname = hdr->uname ? aept_strdup(hdr->uname) : NULL;
+    f->gname = hdr->gname ? aept_strdup(hdr->gname) : NULL;
+    f->mode = hdr->mode;
+    f->uid = hdr->uid;
+    f->gid = hdr->gid;
+    f->mtime = hdr->mtime;
+    f->mtime_nsec = hdr->mtime_nsec;
+    return 0;
+}
+
+static void apply_fixups(aept_extract_t *x)
+{
+    for (int i = x->nfixups - 1; i >= 0; i--) {
+        fixup_t *f = &x->fixups[i];
+        int fd = open_dir(x, f->rel, 0);
+
+        if (fd >= 0 && (fchmod(fd, apply_owner(x, f->uname, f->gname,
+                        f->mode, f->uid, f->gid, -1, NULL, fd)) < 0 ||
+                set_times_fd(f->mtime, f->mtime_nsec, fd) < 0))
+            aept_log_debug("cannot set attributes of '%s': %s", f->path,
+                           strerror(errno));
+
+        free(f->rel);
+        free(f->path);
+        free(f->uname);
+        free(f->gname);
+    }
+    free(x->fixups);
+    x->fixups = NULL;
+    x->nfixups = 0;
+}
+
+/* Find the directory and name for hdr.  Returns 1 for the root itself,
+ * -1 on error. */
+static int locate(aept_extract_t *x, const aept_ar_header_t *hdr,
+                  const char *suffix, char **rel, int *dfd, char **name)
+{
+    const char *leaf;
+
+    *rel = relative_path(hdr->path);
+    *name = NULL;
+    if ((*rel)[0] == '\0') {
+        free(*rel);
+        *rel = NULL;
+        return 1;
+    }
+
+    *dfd = parent_fd(x, *rel, &leaf);
+    if (*dfd < 0) {
+        aept_log_error("failed to extract '%s': %s", hdr->path,
+                       strerror(errno));
+        free(*rel);
+        *rel = NULL;
+        return -1;
+    }
+
+    aept_asprintf(name, "%s%s", leaf, suffix ? suffix : "");
+    aept_log_debug("extracting '%s/%s%s'", x->prefix, *rel,
+                   suffix ? suffix : "");
+    return 0;
+}
+
+/* ── Public API ───────────────────────────────────────────────────── */
+
+aept_extract_t *aept_extract_begin(const char *prefix, int owner)
+{
+    aept_extract_t *x = aept_malloc(sizeof(*x));
+    size_t plen = strlen(prefix);
+
+    memset(x, 0, sizeof(*x));
+    x->owner = owner;
+
+    while (plen > 1 && prefix[plen - 1] == '/')
+        plen--;
+    x->prefix = aept_malloc(plen + 1);
+    memcpy(x->prefix, prefix, plen);
+    x->prefix[plen] = '\0';
+
+    x->root_fd = open(prefix, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (x->root_fd < 0) {
+        aept_log_error("cannot open '%s': %s", prefix, strerror(errno));
+        free(x->prefix);
+        free(x);
+        return NULL;
+    }
+    return x;
+}
+
+void aept_extract_end(aept_extract_t *x)
+{
+    if (!x)
+        return;
+
+    apply_fixups(x);
+
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (x->dirs[i].rel) {
+            close(x->dirs[i].fd);
+            free(x->dirs[i].rel);
+        }
+    }
+    close(x->root_fd);
+    free(x->uname_cache);
+    free(x->gname_cache);
+    free(x->prefix);
+    free(x);
+}
+
+int aept_extract_supported(const aept_ar_header_t *hdr)
+{
+    /* Hard links keep whatever mode the archive gives them */
+    if (hdr->hardlink)
+        return aept_archive_path_is_safe(hdr->hardlink);
+    if (S_ISLNK(hdr->mode))
+        return hdr->link_target != NULL;
+    return S_ISREG(hdr->mode) || S_ISDIR(hdr->mode);
+}
+
+int aept_extract_entry(aept_extract_t *x, const aept_ar_header_t *hdr,
+                       const char *suffix, aept_extract_fill_fn fill,
+                       void *userdata)
+{
+    char *rel, *name;
+    int dfd, r;
+
+    r = locate(x, hdr, suffix, &rel, &dfd, &name);
+    if (r != 0)
+        return r;
+
+    if (hdr->hardlink)
+        r = extract_hardlink(x, hdr, rel, dfd, name);
+    else if (S_ISDIR(hdr->mode))
+        r = extract_dir(x, hdr, rel, dfd, name);
+    else if (S_ISLNK(hdr->mode))
+        r = extract_symlink(x, hdr, rel, dfd, name);
+    else
+        r = extract_file(x, hdr, rel, dfd, name, fill, userdata);
+
+    if (r < 0)
+        aept_log_error("failed to extract '%s': %s", hdr->path,
+                       strerror(errno));
+
+    free(name);
+    free(rel);
+    return r < 0 ? -1 : 0;
+}
+
+int aept_extract_link(aept_extract_t *x, const aept_ar_header_t *hdr,
+                      const char *suffix, int from_dfd, const char *from,
+                      const struct stat *obj)
+{
+    link_arg_t l = { from_dfd, from };
+    char *rel, *name;
+    char tmp[64];
+    int dfd, r;
+
+    if ((obj->st_mode & 0777) != (hdr->mode & 0777) ||
+            obj->st_mtim.tv_sec != (time_t)hdr->mtime ||
+            obj->st_mtim.tv_nsec != hdr->mtime_nsec)
+        return 1;
+    if (!owner_matches(x, hdr, obj))
+        return 1;
+
+    r = locate(x, hdr, suffix, &rel, &dfd, &name);
+    if (r != 0)
+        return r;
+
+    r = make_tmp(dfd, tmp, make_link, &l) == 0 &&
+        place(x, dfd, tmp, name, rel) == 0 ? 0 : 1;
+
+    free(name);
+    free(rel);
+    return r;
+}
+
+int aept_extract_keep(aept_extract_t *x, const aept_ar_header_t *hdr,
+                      const aept_ar_file_entry_t *old, const char *digest)
+{
+    const char *leaf;
+    struct stat st;
+    char *rel;
+    int dfd, r = 1;
+
+    if (!old || !old->digest || hdr->hardlink || !S_ISREG(hdr->mode) ||
+            hdr->mode != old->mode ||
+            (unsigned long long)hdr->size != old->size)
+        return 1;
+    if (digest && strcmp(digest, old->digest) != 0)
+        return 1;
+
+    rel = relative_path(hdr->path);
+    if (rel[0] == '\0' || (dfd = parent_fd(x, rel, &leaf)) < 0)
+        goto out;
+
+    /* Still the file the .list describes, with what hdr asks for */
+    if (fstatat(dfd, leaf, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+            !S_ISREG(st.st_mode) ||
+            (unsigned long long)st.st_size != old->size ||
+            (long long)st.st_mtim.tv_sec != old->mtime ||
+            (st.st_mode & 07777) != (hdr->mode & 07777) ||
+            !owner_matches(x, hdr, &st))
+        goto out;
+
+    r = 0;
+    if (digest && (st.st_mtim.tv_sec != (time_t)hdr->mtime ||
+                   st.st_mtim.tv_nsec != hdr->mtime_nsec) &&
+            set_times_at(hdr->mtime, hdr->mtime_nsec, dfd, leaf) < 0)
+        r = 1;
+
+    if (r == 0 && digest)
+        aept_log_debug("keeping unchanged '%s/%s'", x->prefix, rel);
+
+out:
+    free(rel);
+    return r;
+}
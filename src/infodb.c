@@ -0,0 +1,976 @@
+/* infodb.c - consolidated package database
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aept/infodb.h"
+#include "aept/internal.h"
+#include "aept/msg.h"
+#include "aept/util.h"
+
+/*
+ * {info_dir}.db is written in native byte order and read from a
+ * read-only mapping:
+ *
+ *   header
+ *   record, record, ...
+ *
+ * A record holds all files of one package:
+ *
+ *   record header, package name (NUL-terminated, padded to 8 bytes)
+ *   file header, content (NUL-terminated, padded to 8 bytes)
+ *   ...
+ *
+ * Records are only ever appended.  A package that changed gets a new
+ * record, one that is gone a record without files, and the last record
+ * of a name is the one that counts.  The header says how much of the
+ * file is committed: new records are written past that and become
+ * valid when the header is updated, so a crash in between loses them
+ * but nothing else.  Compaction copies the records that count to a new
+ * file renamed over the old one.
+ *
+ * The header records the info_dir inode and mtime the database was
+ * brought up to date with.  Every change to the database renames or
+ * unlinks a file in info_dir, so readers without the lock use it only
+ * while those match and read info_dir otherwise.  With the lock held,
+ * it is first brought up to date: info_dir is scanned with stat() and
+ * the packages whose files changed size, mtime or inode are read
+ * again, which also catches files rewritten in place.
+ */
+
+#define INFODB_MAGIC    "AEPTINFO"
+#define INFODB_VERSION  1
+
+/* Compact once replaced records are half the file and at least this */
+#define INFODB_COMPACT_MIN (1 << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t committed;     /* valid bytes, header included */
+    uint64_t dead;          /* bytes of records later ones replaced */
+    uint64_t dir_dev;
+    uint64_t dir_ino;
+    int64_t dir_mtime_sec;
+    int64_t dir_mtime_nsec;
+} infodb_header_t;
+
+typedef struct {
+    uint64_t size;          /* of the record, padding included */
+    uint32_t n_files;       /* 0 if the package is gone */
+    uint32_t name_len;
+    uint64_t signature;     /* see pkg_signature() */
+} infodb_record_t;
+
+typedef struct {
+    uint64_t size;          /* of the entry, padding included */
+    uint64_t len;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t mode;
+    char ext[12];
+} infodb_file_t;
+
+/* The files a package keeps in info_dir, see remove_info_files() */
+static const char *const info_exts[] = {
+    "list", "control", "conffiles",
+    "preinst", "postinst", "prerm", "postrm",
+    "trigger", "triggers", NULL
+};
+
+struct aept_infodb {
+    char *map;
+    size_t size;            /* committed bytes */
+    uint64_t *recs;         /* offset of the last record of each name */
+    int n_recs;
+    int recs_alloc;
+    aept_pathmap_t index;   /* name -> position in recs */
+};
+
+static size_t pad8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+static char *db_path(const char *info_dir, const char *suffix)
+{
+    char *path = NULL;
+    aept_asprintf(&path, "%s.%s", info_dir, suffix);
+    return path;
+}
+
+static void stamp_of(const struct stat *st, infodb_header_t *hdr)
+{
+    hdr->dir_dev = (uint64_t)st->st_dev;
+    hdr->dir_ino = (uint64_t)st->st_ino;
+    hdr->dir_mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    hdr->dir_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+}
+
+static int stamp_equal(const infodb_header_t *a, const infodb_header_t *b)
+{
+    return a->dir_dev == b->dir_dev && a->dir_ino == b->dir_ino &&
+           a->dir_mtime_sec == b->dir_mtime_sec &&
+           a->dir_mtime_nsec == b->dir_mtime_nsec;
+}
+
+static int read_header(int fd, infodb_header_t *hdr)
+{
+    if (pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+            memcmp(hdr->magic, INFODB_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != INFODB_VERSION ||
+            hdr->committed < sizeof(*hdr))
+        return -1;
+    return 0;
+}
+
+static int write_header(int fd, const infodb_header_t *hdr)
+{
+    return pwrite(fd, hdr, sizeof(*hdr), 0) == (ssize_t)sizeof(*hdr)
+           ? 0 : -1;
+}
+
+/* ── Reading ─────────────────────────────────────────────────────── */
+
+void aept_infodb_close(aept_infodb_t *db)
+{
+    if (!db)
+        return;
+    aept_pathmap_free(&db->index);
+    free(db->recs);
+    if (db->map)
+        munmap(db->map, db->size);
+    free(db);
+}
+
+/* Check that the record at off lies within the map, with all its files.
+ * Returns its size, or 0 if it doesn't. */
+static uint64_t check_record(const aept_infodb_t *db, uint64_t off)
+{
+    const infodb_record_t *rec;
+    uint64_t pos, end;
+
+    if (db->size - off < sizeof(*rec))
+        return 0;
+    rec = (const infodb_record_t *)(db->map + off);
+    if (rec->size % 8 != 0 || rec->size < sizeof(*rec) ||
+            rec->size > db->size - off || rec->name_len == 0 ||
+            (uint64_t)rec->name_len + 1 > rec->size - sizeof(*rec) ||
+            db->map[off + sizeof(*rec) + rec->name_len] != '\0')
+        return 0;
+
+    end = off + rec->size;
+    pos = off + pad8(sizeof(*rec) + rec->name_len + 1);
+    for (uint32_t i = 0; i < rec->n_files; i++) {
+        const infodb_file_t *f;
+
+        if (end - pos < sizeof(*f))
+            return 0;
+        f = (const infodb_file_t *)(db->map + pos);
+        if (f->size % 8 != 0 || f->size < sizeof(*f) ||
+                f->size > end - pos || f->len >= f->size - sizeof(*f) ||
+                !memchr(f->ext, '\0', sizeof(f->ext)) ||
+                db->map[pos + sizeof(*f) + f->len] != '\0')
+            return 0;
+        pos += f->size;
+    }
+
+    return pos == end ? rec->size : 0;
+}
+
+static const char *record_name(const aept_infodb_t *db, uint64_t off)
+{
+    return db->map + off + sizeof(infodb_record_t);
+}
+
+/* Map the committed part of the database at path and index its records.
+ * Returns NULL if there is none or it is corrupt. */
+static aept_infodb_t *db_load(const char *path, uint64_t committed)
+{
+    aept_infodb_t *db;
+    uint64_t off, size;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    db = aept_malloc(sizeof(*db));
+    memset(db, 0, sizeof(*db));
+    aept_pathmap_init(&db->index);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < committed ||
+            committed < sizeof(infodb_header_t)) {
+        close(fd);
+        goto fail;
+    }
+
+    db->size = (size_t)committed;
+    db->map = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (db->map == MAP_FAILED) {
+        db->map = NULL;
+        goto fail;
+    }
+
+    for (off = sizeof(infodb_header_t); off < db->size; off += size) {
+        const char *name;
+        int i;
+
+        size = check_record(db, off);
+        if (size == 0) {
+            aept_log_warning("ignoring corrupt package database '%s'", path);
+            goto fail;
+        }
+
+        name = record_name(db, off);
+        i = aept_pathmap_get(&db->index, name);
+        if (i < 0) {
+            if (db->n_recs >= db->recs_alloc) {
+                db->recs_alloc = db->recs_alloc ? db->recs_alloc * 2 : 1024;
+                db->recs = aept_realloc(db->recs,
+                                        db->recs_alloc * sizeof(*db->recs));
+            }
+            i = db->n_recs++;
+        }
+        db->recs[i] = off;
+        aept_pathmap_put(&db->index, name, i);
+    }
+
+    return db;
+
+fail:
+    aept_infodb_close(db);
+    return NULL;
+}
+
+/* Open the database of dir if it was brought up to date with dir as it
+ * is now.  A generation, see aept_status_publish(), shares the database
+ * of info_dir and has a header of its own in {dir}.dbview. */
+static aept_infodb_t *db_open_current(const char *dir)
+{
+    infodb_header_t hdr, cur;
+    aept_infodb_t *db = NULL;
+    struct stat st;
+    char *path, *view;
+    int fd;
+
+    if (stat(dir, &st) != 0)
+        return NULL;
+    stamp_of(&st, &cur);
+
+    path = db_path(dir, "db");
+    view = db_path(dir, "dbview");
+
+    fd = open(view, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        goto out;
+
+    if (read_header(fd, &hdr) != 0) {
+        close(fd);
+        goto out;
+    }
+    close(fd);
+
+    if (!stamp_equal(&hdr, &cur)) {
+        aept_log_debug("package database is out of date");
+        goto out;
+    }
+
+    db = db_load(path, hdr.committed);
+
+out:
+    free(view);
+    free(path);
+    return db;
+}
+
+aept_infodb_t *aept_infodb_open(struct aept_ctx *ctx)
+{
+    if (!ctx->config.info_db)
+        return NULL;
+
+    /* With the lock, nothing else changes info_dir, so it can be
+     * brought up to date.  Readers without it take what is there, as
+     * do readers of a generation, which is never changed. */
+    if (ctx->lock_fd >= 0) {
+        char *view = db_path(ctx->config.info_dir, "dbview");
+        int is_view = aept_file_exists(view);
+
+        free(view);
+        if (!is_view && aept_infodb_sync(ctx) < 0)
+            return NULL;
+    }
+
+    return db_open_current(ctx->config.info_dir);
+}
+
+/* Fill out from the file at pos of the record at off */
+static void file_at(const aept_infodb_t *db, uint64_t off, uint64_t pos,
+                    aept_infodb_file_t *out)
+{
+    const infodb_file_t *f = (const infodb_file_t *)(db->map + pos);
+
+    out->name = record_name(db, off);
+    out->ext = f->ext;
+    out->data = db->map + pos + sizeof(*f);
+    out->len = (size_t)f->len;
+    out->mode = f->mode;
+    out->mtime_sec = f->mtime_sec;
+    out->mtime_nsec = (long)f->mtime_nsec;
+}
+
+/* Find file ext of the record at off.  Returns 0, or -1 if it has none. */
+static int record_file(const aept_infodb_t *db, uint64_t off,
+                       const char *ext, aept_infodb_file_t *out)
+{
+    const infodb_record_t *rec = (const infodb_record_t *)(db->map + off);
+    uint64_t pos = off + pad8(sizeof(*rec) + rec->name_len + 1);
+
+    for (uint32_t i = 0; i < rec->n_files; i++) {
+        const infodb_file_t *f = (const infodb_file_t *)(db->map + pos);
+
+        if (strcmp(f->ext, ext) == 0) {
+            file_at(db, off, pos, out);
+            return 0;
+        }
+        pos += f->size;
+    }
+    return -1;
+}
+
+int aept_infodb_foreach(aept_infodb_t *db, const char *ext,
+                        aept_infodb_fn fn, void *userdata)
+{
+    aept_infodb_file_t f;
+    int r;
+
+    for (int i = 0; i < db->n_recs; i++) {
+        if (record_file(db, db->recs[i], ext, &f) < 0)
+            continue;
+        r = fn(&f, userdata);
+        if (r != 0)
+            return r;
+    }
+    return 0;
+}
+
+int aept_infodb_get(aept_infodb_t *db, const char *name, const char *ext,
+                    aept_infodb_file_t *out)
+{
+    int i = aept_pathmap_get(&db->index, name);
+
+    if (i < 0)
+        return -1;
+    return record_file(db, db->recs[i], ext, out);
+}
+
+/* ── Updating ────────────────────────────────────────────────────── */
+
+/* A file found in info_dir */
+typedef struct {
+    char *name;             /* package */
+    int ext;                /* position in info_exts */
+    struct stat st;
+} scan_entry_t;
+
+typedef struct {
+    scan_entry_t *entries;
+    int count;
+    int alloc;
+} scan_t;
+
+static int scan_entry_cmp(const void *a, const void *b)
+{
+    const scan_entry_t *ea = a;
+    const scan_entry_t *eb = b;
+    int c = strcmp(ea->name, eb->name);
+    return c != 0 ? c : ea->ext - eb->ext;
+}
+
+/* List the package files in dir, sorted by package and extension */
+static int scan_info_dir(DIR *dir, scan_t *s)
+{
+    struct dirent *ent;
+
+    while ((ent = readdir(dir)) != NULL) {
+        const char *dot = strrchr(ent->d_name, '.');
+        struct stat st;
+        int e;
+
+        if (!dot || dot == ent->d_name)
+            continue;
+        for (e = 0; info_exts[e]; e++) {
+            if (strcmp(dot + 1, info_exts[e]) == 0)
+                break;
+        }
+        if (!info_exts[e])
+            continue;
+
+        if (fstatat(dirfd(dir), ent->d_name, &st,
+                    AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (s->count >= s->alloc) {
+            s->alloc = s->alloc ? s->alloc * 2 : 1024;
+            s->entries = aept_realloc(s->entries,
+                                      s->alloc * sizeof(*s->entries));
+        }
+        s->entries[s->count].name = aept_strndup(ent->d_name,
+                                                 (size_t)(dot - ent->d_name));
+        s->entries[s->count].ext = e;
+        s->entries[s->count].st = st;
+        s->count++;
+    }
+
+    qsort(s->entries, s->count, sizeof(*s->entries), scan_entry_cmp);
+    return 0;
+}
+
+static void scan_free(scan_t *s)
+{
+    for (int i = 0; i < s->count; i++)
+        free(s->entries[i].name);
+    free(s->entries);
+}
+
+/* FNV-1a over what identifies the state of the files e[0..n) */
+static uint64_t pkg_signature(const scan_entry_t *e, int n)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t v[5] = {
+            (uint64_t)e[i].ext,
+            (uint64_t)e[i].st.st_size,
+            (uint64_t)e[i].st.st_mtim.tv_sec,
+            (uint64_t)e[i].st.st_mtim.tv_nsec,
+            (uint64_t)e[i].st.st_ino,
+        };
+        const unsigned char *p = (const unsigned char *)v;
+
+        for (size_t k = 0; k < sizeof(v); k++) {
+            h ^= p[k];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+/* Growing buffer a record is built in */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t alloc;
+} recbuf_t;
+
+static void *recbuf_grow(recbuf_t *b, size_t len)
+{
+    size_t at = b->size;
+
+    if (b->size + len > b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 0x10000;
+        while (b->size + len > b->alloc)
+            b->alloc *= 2;
+        b->data = aept_realloc(b->data, b->alloc);
+    }
+    memset(b->data + at, 0, len);
+    b->size += len;
+    return b->data + at;
+}
+
+/* Build the record of package name with the files e[0..n) in b.  A
+ * record without files marks the package as gone. */
+static int build_record(DIR *dir, recbuf_t *b, const char *name,
+                        const scan_entry_t *e, int n, uint64_t signature)
+{
+    size_t name_len = strlen(name);
+    infodb_record_t *rec;
+
+    b->size = 0;
+    recbuf_grow(b, pad8(sizeof(*rec) + name_len + 1));
+    memcpy(b->data + sizeof(*rec), name, name_len);
+
+    for (int i = 0; i < n; i++) {
+        const char *ext = info_exts[e[i].ext];
+        char *fname = NULL;
+        struct stat st;
+        size_t at = b->size, len;
+        infodb_file_t *f;
+        int fd;
+
+        aept_asprintf(&fname, "%s.%s", name, ext);
+        fd = openat(dirfd(dir), fname, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            aept_log_error("cannot read '%s': %s", fname, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            free(fname);
+            return -1;
+        }
+
+        len = (size_t)st.st_size;
+        recbuf_grow(b, pad8(sizeof(*f) + len + 1));
+        f = (infodb_file_t *)(b->data + at);
+        f->size = b->size - at;
+        f->len = len;
+        f->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+        f->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+        f->mode = (uint32_t)(st.st_mode & 07777);
+        memcpy(f->ext, ext, strlen(ext));
+
+        char *data = b->data + at + sizeof(*f);
+        size_t got = 0;
+        while (got < len) {
+            ssize_t r = read(fd, data + got, len - got);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            got += (size_t)r;
+        }
+        close(fd);
+        if (got != len) {
+            aept_log_error("cannot read '%s'", fname);
+            free(fname);
+            return -1;
+        }
+        free(fname);
+    }
+
+    rec = (infodb_record_t *)b->data;
+    rec->size = b->size;
+    rec->n_files = (uint32_t)n;
+    rec->name_len = (uint32_t)name_len;
+    rec->signature = signature;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = pwrite(fd, p, len, (off_t)off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= (size_t)r;
+        off += (uint64_t)r;
+    }
+    return 0;
+}
+
+/* Create an empty database in fd */
+static int db_init(int fd, infodb_header_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, INFODB_MAGIC, sizeof(hdr->magic));
+    hdr->version = INFODB_VERSION;
+    hdr->committed = sizeof(*hdr);
+
+    if (ftruncate(fd, 0) != 0)
+        return -1;
+    return write_header(fd, hdr);
+}
+
+int aept_infodb_sync(struct aept_ctx *ctx)
+{
+    const char *info_dir = ctx->config.info_dir;
+    infodb_header_t hdr, cur;
+    aept_infodb_t *db = NULL;
+    scan_t scan = {0};
+    recbuf_t buf = {0};
+    char *seen = NULL;
+    char *path;
+    DIR *dir;
+    struct stat st;
+    uint64_t end;
+    int fd = -1, appended = 0, ret = -1;
+
+    dir = opendir(info_dir);
+    if (!dir)
+        return 0;   /* nothing installed, nothing to mirror */
+
+    path = db_path(info_dir, "db");
+
+    /* The stamp is taken first: a change during the scan then makes the
+     * database look out of date rather than current. */
+    if (fstat(dirfd(dir), &st) != 0)
+        goto cleanup;
+    stamp_of(&st, &cur);
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        aept_log_error("cannot open package database '%s': %s", path,
+                       strerror(errno));
+        goto cleanup;
+    }
+
+    if (read_header(fd, &hdr) != 0 ||
+            !(db = db_load(path, hdr.committed))) {
+        aept_log_debug("creating package database '%s'", path);
+        if (db_init(fd, &hdr) != 0 || !(db = db_load(path, hdr.committed))) {
+            aept_log_error("cannot write package database '%s': %s", path,
+                           strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    if (scan_info_dir(dir, &scan) < 0)
+        goto cleanup;
+
+    /* Anything past the committed end is left from an interrupted sync */
+    end = hdr.committed;
+    if (ftruncate(fd, (off_t)end) != 0)
+        goto cleanup;
+
+    seen = aept_malloc((size_t)db->n_recs + 1);
+    memset(seen, 0, (size_t)db->n_recs + 1);
+
+    for (int i = 0, j; i < scan.count; i = j) {
+        const char *name = scan.entries[i].name;
+        const infodb_record_t *old = NULL;
+        uint64_t sig;
+        int k;
+
+        for (j = i + 1; j < scan.count; j++) {
+            if (strcmp(scan.entries[j].name, name) != 0)
+                break;
+        }
+        sig = pkg_signature(&scan.entries[i], j - i);
+
+        k = aept_pathmap_get(&db->index, name);
+        if (k >= 0) {
+            seen[k] = 1;
+            old = (const infodb_record_t *)(db->map + db->recs[k]);
+            if (old->n_files > 0 && old->signature == sig)
+                continue;
+        }
+
+        if (build_record(dir, &buf, name, &scan.entries[i], j - i, sig) < 0 ||
+                write_all(fd, buf.data, buf.size, end) != 0)
+            goto cleanup;
+        end += buf.size;
+        if (old && old->n_files > 0)
+            hdr.dead += old->size;
+        appended = 1;
+    }
+
+    /* Packages that are gone */
+    for (int k = 0; k < db->n_recs; k++) {
+        const infodb_record_t *old =
+            (const infodb_record_t *)(db->map + db->recs[k]);
+
+        if (seen[k] || old->n_files == 0)
+            continue;
+        if (build_record(dir, &buf, record_name(db, db->recs[k]),
+                         NULL, 0, 0) < 0 ||
+                write_all(fd, buf.data, buf.size, end) != 0)
+            goto cleanup;
+        end += buf.size;
+        hdr.dead += old->size + buf.size;
+        appended = 1;
+    }
+
+    if (!appended && stamp_equal(&hdr, &cur)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* The records must be on disk before the header points past them */
+    if (appended && ctx->config.durability != AEPT_DURABILITY_NONE &&
+            fdatasync(fd) != 0)
+        goto cleanup;
+
+    hdr.committed = end;
+    hdr.dir_dev = cur.dir_dev;
+    hdr.dir_ino = cur.dir_ino;
+    hdr.dir_mtime_sec = cur.dir_mtime_sec;
+    hdr.dir_mtime_nsec = cur.dir_mtime_nsec;
+    if (write_header(fd, &hdr) != 0)
+        goto cleanup;
+
+    ret = 0;
+
+    if (hdr.dead >= INFODB_COMPACT_MIN && hdr.dead > hdr.committed / 2) {
+        aept_infodb_close(db);
+        db = NULL;
+        close(fd);
+        fd = -1;
+        aept_infodb_compact(ctx);
+    }
+
+cleanup:
+    if (ret != 0)
+        aept_log_error("failed to update package database '%s'", path);
+    if (fd >= 0)
+        close(fd);
+    closedir(dir);
+    aept_infodb_close(db);
+    scan_free(&scan);
+    free(buf.data);
+    free(seen);
+    free(path);
+    return ret;
+}
+
+int aept_infodb_compact(struct aept_ctx *ctx)
+{
+    infodb_header_t hdr;
+    aept_infodb_t *db = NULL;
+    char *path, *tmp = NULL;
+    uint64_t end = sizeof(hdr);
+    int fd, ret = -1;
+
+    path = db_path(ctx->config.info_dir, "db");
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ret = 0;    /* nothing to compact */
+        goto cleanup;
+    }
+    if (read_header(fd, &hdr) != 0) {
+        close(fd);
+        aept_log_error("'%s' is not a package database", path);
+        goto cleanup;
+    }
+    close(fd);
+
+    db = db_load(path, hdr.committed);
+    if (!db)
+        goto cleanup;
+
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        aept_log_error("cannot write '%s': %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+
+    /* Records refer to nothing outside of themselves, so the live ones
+     * are copied as they are */
+    for (int i = 0; i < db->n_recs; i++) {
+        const infodb_record_t *rec =
+            (const infodb_record_t *)(db->map + db->recs[i]);
+
+        if (rec->n_files == 0)
+            continue;
+        if (write_all(fd, rec, rec->size, end) != 0)
+            goto write_failed;
+        end += rec->size;
+    }
+
+    aept_log_debug("compacted package database from %llu to %llu bytes",
+                   (unsigned long long)hdr.committed,
+                   (unsigned long long)end);
+
+    hdr.committed = end;
+    hdr.dead = 0;
+    if (write_header(fd, &hdr) != 0 ||
+            (ctx->config.durability != AEPT_DURABILITY_NONE &&
+             fsync(fd) != 0))
+        goto write_failed;
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto write_failed;
+    }
+    fd = -1;
+
+    if (rename(tmp, path) != 0) {
+        aept_log_error("cannot rename '%s': %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+
+    ret = 0;
+    goto cleanup;
+
+write_failed:
+    aept_log_error("failed to write '%s': %s", tmp, strerror(errno));
+
+cleanup:
+    if (fd >= 0)
+        close(fd);
+    if (ret != 0 && tmp)
+        unlink(tmp);
+    aept_infodb_close(db);
+    free(tmp);
+    free(path);
+    return ret;
+}
+
+/* ── Export and generations ──────────────────────────────────────── */
+
+static int export_file(const char *dir, const aept_infodb_file_t *f)
+{
+    struct timespec ts[2];
+    char *path = NULL;
+    int fd, r = -1;
+
+    aept_asprintf(&path, "%s/%s.%s", dir, f->name, f->ext);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+              (mode_t)f->mode);
+    if (fd < 0) {
+        aept_log_error("cannot write '%s': %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    ts[0].tv_sec = (time_t)f->mtime_sec;
+    ts[0].tv_nsec = f->mtime_nsec;
+    ts[1] = ts[0];
+
+    if (write_all(fd, f->data, f->len, 0) != 0 ||
+            fchmod(fd, (mode_t)f->mode) != 0 || futimens(fd, ts) != 0)
+        aept_log_error("failed to write '%s': %s", path, strerror(errno));
+    else
+        r = 0;
+
+    if (close(fd) != 0)
+        r = -1;
+    free(path);
+    return r;
+}
+
+int aept_infodb_export(struct aept_ctx *ctx, const char *dir)
+{
+    infodb_header_t hdr;
+    aept_infodb_t *db;
+    char *path;
+    int fd, ret = 0;
+
+    path = db_path(ctx->config.info_dir, "db");
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read_header(fd, &hdr) != 0) {
+        aept_log_error("no package database at '%s'", path);
+        if (fd >= 0)
+            close(fd);
+        free(path);
+        return -1;
+    }
+    close(fd);
+
+    db = db_load(path, hdr.committed);
+    free(path);
+    if (!db)
+        return -1;
+
+    if (aept_file_mkdir_hier(dir, 0755) < 0) {
+        aept_log_error("cannot create '%s': %s", dir, strerror(errno));
+        aept_infodb_close(db);
+        return -1;
+    }
+
+    for (int i = 0; i < db->n_recs; i++) {
+        for (int e = 0; info_exts[e]; e++) {
+            aept_infodb_file_t f;
+
+            if (record_file(db, db->recs[i], info_exts[e], &f) == 0 &&
+                    export_file(dir, &f) < 0)
+                ret = -1;
+        }
+    }
+
+    aept_infodb_close(db);
+    return ret;
+}
+
+int aept_infodb_publish(struct aept_ctx *ctx, const char *dir)
+{
+    infodb_header_t hdr, cur;
+    struct stat st;
+    char *live, *link_path, *view, *tmp = NULL;
+    int fd, ret = -1;
+
+    if (!ctx->config.info_db)
+        return 0;
+
+    live = db_path(ctx->config.info_dir, "db");
+    link_path = db_path(dir, "db");
+    view = db_path(dir, "dbview");
+
+    /* Only a database that is current for info_dir is current for its
+     * copy in dir */
+    fd = open(live, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read_header(fd, &hdr) != 0 ||
+            stat(ctx->config.info_dir, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        goto cleanup;
+    }
+    close(fd);
+    stamp_of(&st, &cur);
+    if (!stamp_equal(&hdr, &cur))
+        goto cleanup;
+
+    /* The committed part of the file never changes, and compaction
+     * replaces the file rather than rewriting it, so the generation can
+     * share it.  Its header is kept next to it. */
+    unlink(link_path);
+    if (link(live, link_path) != 0) {
+        aept_log_debug("cannot link '%s': %s", link_path, strerror(errno));
+        goto cleanup;
+    }
+
+    if (stat(dir, &st) != 0)
+        goto cleanup;
+    stamp_of(&st, &hdr);
+
+    aept_asprintf(&tmp, "%s.%d", view, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        goto cleanup;
+    if (write_header(fd, &hdr) != 0) {
+        close(fd);
+        unlink(tmp);
+        goto cleanup;
+    }
+    close(fd);
+
+    if (rename(tmp, view) != 0) {
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret != 0)
+        aept_infodb_unpublish(dir);
+    free(tmp);
+    free(view);
+    free(link_path);
+    free(live);
+    return ret;
+}
+
+void aept_infodb_unpublish(const char *dir)
+{
+    char *path = db_path(dir, "dbview");
+    unlink(path);
+    free(path);
+
+    path = db_path(dir, "db");
+    unlink(path);
+    free(path);
+}
@@ -8,8 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <solv/chksum.h>
+#include <solv/knownid.h>
 #include <solv/pool.h>
 #include <solv/repo.h>
 #include <solv/solvable.h>
@@ -19,18 +23,24 @@
 #include "aept/internal.h"
 #include "aept/archive.h"
 #include "aept/clash.h"
+#include "aept/clean.h"
 #include "aept/conffile.h"
 #include "aept/config.h"
 #include "aept/download.h"
 #include "aept/msg.h"
 #include "aept/owner_index.h"
 #include "aept/pin.h"
+#include "aept/progress.h"
 #include "aept/remove.h"
 #include "aept/script.h"
 #include "aept/solver.h"
+#include "aept/stats.h"
 #include "aept/status.h"
+#include "aept/store.h"
+#include "aept/trace.h"
 #include "aept/trigger.h"
 #include "aept/install.h"
+#include "aept/mirror.h"
 #include "aept/util.h"
 
 static int load_repos(struct aept_ctx *ctx)
@@ -52,8 +62,13 @@ static int load_repos(struct aept_ctx *ctx)
             return -1;
         }
 
-        int r = aept_solver_load_repo(ctx, ctx->config.sources[i].name, fp, i);
+        char *cache_path = NULL;
+        aept_asprintf(&cache_path, "%s.solv", list_path);
+
+        int r = aept_solver_load_repo(ctx, ctx->config.sources[i].name, fp,
+                                      cache_path, i);
         fclose(fp);
+        free(cache_path);
         free(list_path);
 
         if (r < 0)
@@ -185,7 +200,7 @@ static int display_transaction(struct aept_ctx *ctx, Transaction *trans,
     free(erase_names);
     free(reinstall_names);
 
-    if ((n_erase > 0 ||
+    if (!ctx->config.prefetch && (n_erase > 0 ||
                 (user_count > 0 &&
                  n_install + n_upgrade > user_count)) &&
             !aept_confirm_continue())
@@ -194,112 +209,344 @@ static int display_transaction(struct aept_ctx *ctx, Transaction *trans,
     return 0;
 }
 
-static int do_install_package(struct aept_ctx *ctx, const char *ipk_path,
-                              Pool *pool, Id p, const char *old_version,
-                              aept_owner_index_t *owners)
+/* With spool_data set, decompress the data archive of ipk_path once
+ * into tmpdir, so that the clash check and the extraction both read the
+ * plain tar.  *spool_out is left NULL if spooling is disabled, also by
+ * low_memory since tmp_dir is often a tmpfs, or the package is in the
+ * unpacked store, which makes the archive unneeded. */
+static int spool_data_archive(struct aept_ctx *ctx, const char *ipk_path,
+                              const char *tmpdir, const char *store_entry,
+                              char **spool_out)
 {
-    Solvable *s = pool_id2solvable(pool, p);
-    const char *name = pool_id2str(pool, s->name);
-    struct aept_ar *ctrl_ar = NULL;
-    struct aept_ar *data_ar = NULL;
-    char *tmpdir = NULL;
-    if (!aept_pkg_name_is_safe(name)) {
-        aept_log_error("refusing to install package with unsafe name '%s'", name);
+    char *spool_path = NULL;
+
+    *spool_out = NULL;
+    if (!ctx->config.spool_data || ctx->config.low_memory ||
+            (store_entry && aept_store_exists(store_entry)))
+        return 0;
+
+    aept_asprintf(&spool_path, "%s/data.tar", tmpdir);
+    if (aept_ar_spool_pkg_data_archive(ipk_path, spool_path,
+                                       ctx->config.decompress_threads) < 0) {
+        aept_log_error("failed to decompress data archive in '%s'",
+                  ipk_path);
+        free(spool_path);
         return -1;
     }
-    char *ctrl_path = NULL;
-    char *list_path = NULL;
+
+    *spool_out = spool_path;
+    return 0;
+}
+
+static struct aept_ar *open_data_archive(struct aept_ctx *ctx,
+                                         const char *ipk_path,
+                                         const char *spool_path)
+{
+    if (spool_path)
+        return aept_ar_open_spooled_data_archive(spool_path,
+                                                 ctx->config.ignore_uid);
+    return aept_ar_open_pkg_data_archive(ipk_path, ctx->config.ignore_uid,
+                                         ctx->config.decompress_threads);
+}
+
+/* List the data paths of a package, from its store entry if it has one. */
+static int list_data_paths(struct aept_ctx *ctx, const char *ipk_path,
+                           const char *spool_path, const char *store_entry,
+                           aept_ar_file_list_t *files)
+{
+    struct aept_ar *ar;
+    int r;
+
+    if (store_entry && aept_store_exists(store_entry) &&
+            aept_store_list(store_entry, files) == 0)
+        return 0;
+
+    ar = open_data_archive(ctx, ipk_path, spool_path);
+    if (!ar)
+        return -1;
+
+    r = aept_ar_list_paths(ar, files);
+    aept_ar_close(ar);
+    return r;
+}
+
+/* With unpacked_store set, add the package to the store unless it is
+ * there already.  Returns 0 if the package can be extracted from it. */
+static int store_data_archive(struct aept_ctx *ctx, const char *ipk_path,
+                              const char *spool_path, const char *store_entry)
+{
+    struct aept_ar *ar;
+    int r;
+
+    if (!store_entry)
+        return -1;
+    if (aept_store_exists(store_entry))
+        return 0;
+
+    ar = open_data_archive(ctx, ipk_path, spool_path);
+    if (!ar)
+        return -1;
+
+    r = aept_store_add(ctx, store_entry, ar);
+    aept_ar_close(ar);
+    return r == 0 ? 0 : -1;
+}
+
+/* Extract the data archive of package name, installed_size bytes, into
+ * the root, from the unpacked store where possible.  The conffiles
+ * listed in control_dir are never hard-linked to the store.  Files that
+ * are the same in installed, the version being replaced, are left
+ * alone.  See aept_ar_extract_all(). */
+static int extract_data_archive(struct aept_ctx *ctx, const char *name,
+                                unsigned long long installed_size,
+                                const char *ipk_path,
+                                const char *spool_path,
+                                const char *store_entry,
+                                const char *control_dir,
+                                aept_fileset_t *conffiles,
+                                aept_ar_file_list_t *recorded,
+                                aept_ar_installed_t *installed)
+{
+    aept_stats_timer_t timer;
+    aept_progress_t progress;
+    aept_trace_span_t span;
+    unsigned long size = 0;
+    struct aept_ar *ar;
+    char *extract_root;
     int r = -1;
 
-    aept_log_info("installing %s", name);
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_UNPACK);
+    aept_progress_begin(ctx, &progress, AEPT_PHASE_UNPACK, name,
+                        installed_size);
+    aept_trace_begin(ctx, &span, "unpack", name);
 
-    aept_asprintf(&tmpdir, "%s/aept-XXXXXX", ctx->config.tmp_dir);
+    extract_root = aept_config_root_path(&ctx->config, "/");
 
-    if (!mkdtemp(tmpdir)) {
+    if (store_data_archive(ctx, ipk_path, spool_path, store_entry) == 0) {
+        aept_conffile_set_t cf;
+        aept_fileset_t no_link;
+
+        aept_conffile_set_init(&cf);
+        aept_fileset_init(&no_link);
+        if (ctx->config.store_hardlinks &&
+                aept_conffile_parse_list(control_dir, &cf) == 0) {
+            for (int i = 0; i < cf.count; i++)
+                aept_fileset_add(&no_link, cf.entries[i].path);
+        }
+
+        r = aept_store_extract(ctx, store_entry, extract_root, &size,
+                               conffiles, ".aept-new", &no_link, recorded,
+                               installed);
+        aept_fileset_free(&no_link);
+        aept_conffile_set_free(&cf);
+        if (r < 0) {
+            aept_log_warning("cannot extract '%s' from the unpacked store, "
+                             "unpacking it instead", ipk_path);
+            aept_ar_file_list_free(recorded);
+            aept_ar_file_list_init(recorded);
+            aept_progress_set(0);
+            size = 0;
+            if (installed)
+                installed->unchanged = 0;
+        }
+    }
+
+    if (r < 0) {
+        ar = open_data_archive(ctx, ipk_path, spool_path);
+        if (ar) {
+            r = aept_ar_extract_all(ar, extract_root, &size, conffiles,
+                                    ".aept-new", recorded, installed);
+            aept_ar_close(ar);
+        } else {
+            aept_log_error("failed to open data archive in '%s'", ipk_path);
+        }
+    }
+    free(extract_root);
+
+    aept_stats_add(ctx, AEPT_STAT_BYTES_EXTRACTED, size);
+    if (installed) {
+        aept_stats_add(ctx, AEPT_STAT_FILES_EXTRACTED,
+                       recorded->count - installed->unchanged);
+        aept_stats_add(ctx, AEPT_STAT_FILES_UNCHANGED, installed->unchanged);
+    } else {
+        aept_stats_add(ctx, AEPT_STAT_FILES_EXTRACTED, recorded->count);
+    }
+    aept_trace_end(&span);
+    aept_progress_end(&progress, r == 0);
+    aept_stats_end(&timer);
+    return r;
+}
+
+/* Returns the number of clashes, or -1 if the package can't be read. */
+static int check_clashes(struct aept_ctx *ctx, const char *ipk_path,
+                         const char *spool_path, const char *store_entry,
+                         Pool *pool, Id p, aept_fileset_t *old_files,
+                         aept_owner_index_t *owners)
+{
+    aept_ar_file_list_t new_files;
+    int r;
+
+    aept_ar_file_list_init(&new_files);
+    r = list_data_paths(ctx, ipk_path, spool_path, store_entry, &new_files);
+
+    if (r == 0)
+        r = aept_clash_check(ctx, &new_files, pool, p, old_files, owners);
+
+    aept_ar_file_list_free(&new_files);
+    return r;
+}
+
+/* A fresh install, split into the stages that install_batch() runs for
+ * several packages at once: open (control archive), scan (data paths),
+ * preinst and clash check, unpack, and configure. */
+typedef struct {
+    const char *ipk_path;
+    Id p;
+    const char *name;
+    unsigned long long installed_size;
+    char *tmpdir;
+    char *spool_path;
+    char *store_entry;              /* NULL without unpacked_store */
+    char *list_path;                /* set once unpacked */
+    aept_ar_file_list_t files;      /* data paths, see job_scan() */
+    aept_ar_file_list_t extracted;  /* .list entries, see job_unpack() */
+    int scanned;
+    int r;                          /* 0, -1, or 1 if never attempted */
+} install_job_t;
+
+static void job_init(struct aept_ctx *ctx, install_job_t *job, Pool *pool,
+                     Id p, const char *ipk_path)
+{
+    Solvable *s = pool_id2solvable(pool, p);
+
+    memset(job, 0, sizeof(*job));
+    job->ipk_path = ipk_path;
+    job->p = p;
+    job->name = pool_id2str(pool, s->name);
+    job->installed_size = solvable_lookup_num(s, SOLVABLE_INSTALLSIZE, 0);
+    job->store_entry = aept_store_entry_path(ctx, pool, p);
+    job->r = 1;
+    aept_ar_file_list_init(&job->files);
+    aept_ar_file_list_init(&job->extracted);
+}
+
+static void job_free(install_job_t *job)
+{
+    if (job->tmpdir) {
+        const char *rm_argv[] = {"rm", "-rf", job->tmpdir, NULL};
+        aept_system(rm_argv);
+    }
+
+    free(job->tmpdir);
+    free(job->spool_path);
+    free(job->store_entry);
+    free(job->list_path);
+    job->tmpdir = job->spool_path = job->store_entry = job->list_path = NULL;
+    aept_ar_file_list_free(&job->files);
+    aept_ar_file_list_init(&job->files);
+    aept_ar_file_list_free(&job->extracted);
+    aept_ar_file_list_init(&job->extracted);
+}
+
+/* Create the temp directory and extract the control archive into it. */
+static int job_open(struct aept_ctx *ctx, install_job_t *job)
+{
+    struct aept_ar *ctrl_ar;
+    aept_trace_span_t span;
+    int r;
+
+    if (!aept_pkg_name_is_safe(job->name)) {
+        aept_log_error("refusing to install package with unsafe name '%s'",
+                  job->name);
+        return -1;
+    }
+
+    aept_asprintf(&job->tmpdir, "%s/aept-XXXXXX", ctx->config.tmp_dir);
+
+    if (!mkdtemp(job->tmpdir)) {
         aept_log_error("failed to create temp directory: %s",
                   strerror(errno));
-        free(tmpdir);
+        free(job->tmpdir);
+        job->tmpdir = NULL;
         return -1;
     }
 
-    /* Extract control archive */
-    ctrl_ar = aept_ar_open_pkg_control_archive(ipk_path);
+    ctrl_ar = aept_ar_open_pkg_control_archive(job->ipk_path);
     if (!ctrl_ar) {
-        aept_log_error("failed to open control archive in '%s'", ipk_path);
-        goto cleanup;
+        aept_log_error("failed to open control archive in '%s'",
+                  job->ipk_path);
+        return -1;
     }
 
-    r = aept_ar_extract_all(ctrl_ar, tmpdir, NULL, NULL, NULL, NULL);
+    aept_trace_begin(ctx, &span, "control", job->name);
+    r = aept_ar_extract_all(ctrl_ar, job->tmpdir, NULL, NULL, NULL, NULL,
+                            NULL);
+    aept_trace_end(&span);
     aept_ar_close(ctrl_ar);
-    ctrl_ar = NULL;
 
     if (r < 0) {
         aept_log_error("failed to extract control archive");
-        goto cleanup;
+        return -1;
     }
 
-    /* Run preinst */
-    r = aept_run_script(ctx, tmpdir, NULL, "preinst",
-                   old_version ? "upgrade" : "install", old_version);
-    if (r != 0)
-        goto cleanup;
+    return 0;
+}
 
-    /* Check for file conflicts before extraction */
-    r = aept_clash_check(ctx, ipk_path, pool, p, NULL, owners);
-    if (r != 0) {
-        r = -1;
-        goto cleanup;
-    }
+/* Spool the data archive and list its paths into job->files. */
+static int job_scan(struct aept_ctx *ctx, install_job_t *job)
+{
+    job->scanned = 1;
+    if (spool_data_archive(ctx, job->ipk_path, job->tmpdir,
+                           job->store_entry, &job->spool_path) < 0)
+        return -1;
 
-    /* Extract data archive to root, recording each entry so the
-     * .list file can be written without re-opening the archive. */
-    aept_ar_file_list_t extracted;
-    aept_ar_file_list_init(&extracted);
+    return list_data_paths(ctx, job->ipk_path, job->spool_path,
+                           job->store_entry, &job->files);
+}
 
-    data_ar = aept_ar_open_pkg_data_archive(ipk_path, ctx->config.ignore_uid);
-    if (!data_ar) {
-        aept_log_error("failed to open data archive in '%s'", ipk_path);
-        aept_ar_file_list_free(&extracted);
-        r = -1;
-        goto cleanup;
-    }
+/* Extract the data archive to the root and write the package's .list,
+ * conffile checksums, scripts and triggers to info_dir. */
+static int job_unpack(struct aept_ctx *ctx, install_job_t *job)
+{
+    int r;
 
-    char *extract_root = aept_config_root_path(&ctx->config, "/");
-    r = aept_ar_extract_all(data_ar, extract_root, NULL, NULL, NULL,
-                             &extracted);
-    free(extract_root);
-    aept_ar_close(data_ar);
-    data_ar = NULL;
+    /* Record each entry so the .list file can be written without
+     * re-opening the archive.  job_configure() hands the same entries
+     * to the owner index. */
+    r = extract_data_archive(ctx, job->name, job->installed_size,
+                             job->ipk_path, job->spool_path,
+                             job->store_entry, job->tmpdir, NULL,
+                             &job->extracted, NULL);
 
     if (r < 0) {
         aept_log_error("failed to extract data archive");
-        aept_ar_file_list_free(&extracted);
-        goto cleanup;
+        return -1;
     }
 
     /* Record file list from the in-memory capture */
     aept_file_mkdir_hier(ctx->config.info_dir, 0755);
-    aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, name);
+    aept_asprintf(&job->list_path, "%s/%s.list", ctx->config.info_dir,
+                  job->name);
 
     {
-        FILE *list_fp = fopen(list_path, "w");
+        FILE *list_fp = fopen(job->list_path, "w");
         if (list_fp) {
-            if (aept_ar_file_list_write(&extracted, list_fp) < 0
+            if (aept_ar_file_list_write(&job->extracted, list_fp) < 0
                     || ferror(list_fp) || fclose(list_fp) != 0)
-                aept_log_warning("failed to write file list '%s'", list_path);
+                aept_log_warning("failed to write file list '%s'",
+                            job->list_path);
         } else {
-            aept_log_warning("failed to write file list '%s'", list_path);
+            aept_log_warning("failed to write file list '%s'", job->list_path);
         }
     }
 
-    aept_ar_file_list_free(&extracted);
-
     /* Save conffile metadata */
     {
         aept_conffile_set_t new_cf;
         aept_conffile_set_init(&new_cf);
 
-        if (aept_conffile_parse_list(tmpdir, &new_cf) == 0 && new_cf.count > 0) {
+        if (aept_conffile_parse_list(job->tmpdir, &new_cf) == 0
+                && new_cf.count > 0) {
             for (int ci = 0; ci < new_cf.count; ci++) {
                 char *cf_path = aept_config_root_path(&ctx->config, new_cf.entries[ci].path);
                 char *md5 = aept_conffile_md5(cf_path);
@@ -309,7 +556,7 @@ static int do_install_package(struct aept_ctx *ctx, const char *ipk_path,
                     new_cf.entries[ci].md5 = md5;
                 }
             }
-            aept_conffile_save(ctx, name, &new_cf);
+            aept_conffile_save(ctx, job->name, &new_cf);
         }
 
         aept_conffile_set_free(&new_cf);
@@ -321,12 +568,13 @@ static int do_install_package(struct aept_ctx *ctx, const char *ipk_path,
     };
     for (int i = 0; scripts[i]; i++) {
         char *src = NULL, *dst = NULL;
-        aept_asprintf(&src, "%s/%s", tmpdir, scripts[i]);
+        aept_asprintf(&src, "%s/%s", job->tmpdir, scripts[i]);
         if (aept_file_exists(src)) {
-            aept_asprintf(&dst, "%s/%s.%s", ctx->config.info_dir, name, scripts[i]);
+            aept_asprintf(&dst, "%s/%s.%s", ctx->config.info_dir, job->name,
+                          scripts[i]);
             if (rename(src, dst) < 0 && aept_file_copy(src, dst) < 0)
                 aept_log_warning("failed to install %s script for '%s'",
-                            scripts[i], name);
+                            scripts[i], job->name);
             free(dst);
         }
         free(src);
@@ -335,61 +583,504 @@ static int do_install_package(struct aept_ctx *ctx, const char *ipk_path,
     /* Copy triggers file to info_dir */
     {
         char *trig_src = NULL, *trig_dst = NULL;
-        aept_asprintf(&trig_src, "%s/triggers", tmpdir);
+        aept_asprintf(&trig_src, "%s/triggers", job->tmpdir);
         if (aept_file_exists(trig_src)) {
             aept_asprintf(&trig_dst, "%s/%s.triggers",
-                          ctx->config.info_dir, name);
+                          ctx->config.info_dir, job->name);
             if (rename(trig_src, trig_dst) < 0
                     && aept_file_copy(trig_src, trig_dst) < 0)
-                aept_log_warning("failed to install triggers for '%s'", name);
+                aept_log_warning("failed to install triggers for '%s'",
+                            job->name);
+            aept_trigger_index_invalidate(ctx);
             free(trig_dst);
         }
         free(trig_src);
     }
 
-    /* Run postinst */
+    return 0;
+}
+
+/* Run postinst and record the package as installed.  Its files are
+ * added to owners and, if non-NULL, to installed. */
+static int job_configure(struct aept_ctx *ctx, install_job_t *job,
+                         const char *old_version,
+                         aept_owner_index_t *owners,
+                         aept_fileset_t *installed)
+{
     const char *state = "installed";
+    int r;
 
-    r = aept_run_script(ctx, ctx->config.info_dir, name, "postinst",
+    r = aept_run_script(ctx, ctx->config.info_dir, job->name, "postinst",
                    "configure", old_version);
     if (r != 0) {
-        aept_log_error("postinst failed for '%s'", name);
+        aept_log_error("postinst failed for '%s'", job->name);
         state = "unpacked";
         r = -1;
     }
 
+    /* The package's files and info entries must be on disk before the
+     * .control file records it as installed. */
+    aept_durability_barrier(ctx, AEPT_DURABILITY_PACKAGE);
+
     /* Write the .control file with the install state.  This reads the
      * raw control from tmpdir and writes it to info_dir in one step,
      * replacing the separate copy + rewrite that used to happen. */
     {
-        char *ctrl_src = NULL;
-        aept_asprintf(&ctrl_src, "%s/control", tmpdir);
-        aept_asprintf(&ctrl_path, "%s/%s.control", ctx->config.info_dir, name);
+        char *ctrl_src = NULL, *ctrl_path = NULL;
+        aept_asprintf(&ctrl_src, "%s/control", job->tmpdir);
+        aept_asprintf(&ctrl_path, "%s/%s.control", ctx->config.info_dir,
+                      job->name);
         aept_status_add(ctx, ctrl_src, ctrl_path, state);
         free(ctrl_src);
         free(ctrl_path);
-        ctrl_path = NULL;
     }
 
-    if (owners && list_path)
-        aept_owner_index_add_owner_files(owners, name, list_path);
+    if (job->list_path) {
+        if (owners)
+            aept_owner_index_add_files(owners, job->name, &job->extracted);
+        for (int i = 0; installed && i < job->extracted.count; i++)
+            aept_fileset_add(installed, job->extracted.entries[i].path);
+    }
 
     if (r == 0)
-        aept_log_debug("installed %s", name);
+        aept_log_debug("installed %s", job->name);
 
-cleanup:
-    free(list_path);
+    return r;
+}
 
-    /* Clean up tmpdir */
-    {
-        const char *rm_argv[] = {"rm", "-rf", tmpdir, NULL};
-        aept_system(rm_argv);
-    }
+/* Run preinst and check the package's files for clashes with what is
+ * already installed. */
+static int job_check(struct aept_ctx *ctx, install_job_t *job, Pool *pool,
+                     const char *old_version, aept_owner_index_t *owners)
+{
+    int r;
+
+    aept_log_info("installing %s", job->name);
+
+    r = aept_run_script(ctx, job->tmpdir, NULL, "preinst",
+                   old_version ? "upgrade" : "install", old_version);
+    if (r != 0)
+        return -1;
+
+    if (!job->scanned && job_scan(ctx, job) < 0)
+        return -1;
+
+    r = aept_clash_check(ctx, &job->files, pool, job->p, NULL, owners);
+
+    aept_ar_file_list_free(&job->files);
+    aept_ar_file_list_init(&job->files);
+    return r != 0 ? -1 : 0;
+}
+
+/* Everything after job_open(), one package at a time. */
+static int job_install(struct aept_ctx *ctx, install_job_t *job, Pool *pool,
+                       const char *old_version, aept_owner_index_t *owners,
+                       aept_fileset_t *installed)
+{
+    if (job_check(ctx, job, pool, old_version, owners) < 0)
+        return -1;
+
+    if (job_unpack(ctx, job) < 0)
+        return -1;
+
+    return job_configure(ctx, job, old_version, owners, installed);
+}
+
+static int do_install_package(struct aept_ctx *ctx, const char *ipk_path,
+                              Pool *pool, Id p, const char *old_version,
+                              aept_owner_index_t *owners,
+                              aept_fileset_t *installed)
+{
+    install_job_t job;
+    int r;
+
+    job_init(ctx, &job, pool, p, ipk_path);
 
-    free(tmpdir);
+    r = job_open(ctx, &job);
+    if (r == 0)
+        r = job_install(ctx, &job, pool, old_version, owners, installed);
+
+    job_free(&job);
     return r;
 }
 
+/* ── Parallel installation ── */
+
+/* Packages of one dependency level handled per round, per install job.
+ * Bounds the spooled data archives kept in tmp_dir at once. */
+#define INSTALL_BATCH_PER_JOB 4
+
+/* Assign each package its dependency level within pkgs: one above the
+ * highest level among the earlier packages it requires, or 0.  Returns
+ * the number of levels. */
+static int install_levels(Pool *pool, const Id *pkgs, int n, int *level)
+{
+    int *pos;
+    int k, nlevels = 0;
+
+    /* pkgs index + 1 by solvable, only set for earlier packages */
+    pos = aept_malloc(pool->nsolvables * sizeof(int));
+    memset(pos, 0, pool->nsolvables * sizeof(int));
+
+    for (k = 0; k < n; k++) {
+        Solvable *s = pool_id2solvable(pool, pkgs[k]);
+        Id req, *reqp, p2, pp2;
+
+        level[k] = 0;
+
+        if (s->requires) {
+            reqp = s->repo->idarraydata + s->requires;
+            while ((req = *reqp++) != 0) {
+                if (req == SOLVABLE_PREREQMARKER)
+                    continue;
+
+                FOR_PROVIDES(p2, pp2, req) {
+                    int j = pos[p2] - 1;
+                    if (j >= 0 && level[j] + 1 > level[k])
+                        level[k] = level[j] + 1;
+                }
+            }
+        }
+
+        pos[pkgs[k]] = k + 1;
+        if (level[k] + 1 > nlevels)
+            nlevels = level[k] + 1;
+    }
+
+    free(pos);
+    return nlevels;
+}
+
+typedef struct {
+    const char *key;    /* data path without the leading "./" */
+    int len;
+    int job;
+    int is_file;        /* else a parent directory of one of its files */
+} batch_path_t;
+
+static int batch_path_cmp(const void *a, const void *b)
+{
+    const batch_path_t *x = a, *y = b;
+    int n = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->key, y->key, n);
+
+    if (c)
+        return c;
+    if (x->len != y->len)
+        return x->len - y->len;
+    return x->job - y->job;
+}
+
+/* Find the packages in jobs whose files overlap those of an earlier one,
+ * i.e. that share a path, or where one ships a file at a directory of
+ * the other.  Those are marked in deferred and installed one by one
+ * after the others, so that the clash check sees the files of the
+ * first. The rest are disjoint and can be unpacked concurrently. */
+static void find_overlaps(install_job_t **jobs, int n, const int *ok,
+                          int *deferred)
+{
+    batch_path_t *paths = NULL;
+    int npaths = 0, alloc = 0;
+    int j, i, g;
+
+    for (j = 0; j < n; j++) {
+        deferred[j] = 0;
+        if (!ok[j])
+            continue;
+
+        const char *prev = NULL;
+
+        for (i = 0; i < jobs[j]->files.count; i++) {
+            const char *key = jobs[j]->files.entries[i].path;
+            int full, len;
+
+            if (key[0] == '.' && key[1] == '/')
+                key += 2;
+            while (*key == '/')
+                key++;
+
+            full = strlen(key);
+            for (len = full; len > 0; ) {
+                /* Parents shared with the previous file are in already */
+                if (len < full && prev && strncmp(prev, key, len) == 0 &&
+                        prev[len] == '/')
+                    break;
+
+                if (npaths == alloc) {
+                    alloc = alloc ? alloc * 2 : 256;
+                    paths = aept_realloc(paths, alloc * sizeof(*paths));
+                }
+                paths[npaths].key = key;
+                paths[npaths].len = len;
+                paths[npaths].job = j;
+                paths[npaths].is_file = len == full;
+                npaths++;
+
+                while (len > 0 && key[len - 1] != '/')
+                    len--;
+                while (len > 0 && key[len - 1] == '/')
+                    len--;
+            }
+
+            prev = key;
+        }
+    }
+
+    qsort(paths, npaths, sizeof(*paths), batch_path_cmp);
+
+    /* In each run of equal paths that includes a file, only the first
+     * package stays in the batch. */
+    for (i = 0; i < npaths; i = g) {
+        int has_file = 0;
+
+        for (g = i; g < npaths && paths[g].len == paths[i].len &&
+                memcmp(paths[g].key, paths[i].key, paths[i].len) == 0; g++)
+            has_file |= paths[g].is_file;
+
+        if (!has_file)
+            continue;
+
+        for (j = i + 1; j < g; j++) {
+            if (paths[j].job != paths[i].job)
+                deferred[paths[j].job] = 1;
+        }
+    }
+
+    free(paths);
+}
+
+static int batch_open_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    install_job_t *job = ((install_job_t **)arg)[i];
+
+    if (job_open(ctx, job) < 0 || job_scan(ctx, job) < 0)
+        return -1;
+    return 0;
+}
+
+static int batch_unpack_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    return job_unpack(ctx, ((install_job_t **)arg)[i]);
+}
+
+/* Install one round of packages that don't depend on each other.  The
+ * control archives are opened and the data archives scanned in
+ * parallel; preinst and the clash checks run in order; then the data
+ * archives are extracted in parallel, and postinst runs and each
+ * package is recorded in order. Returns nonzero to stop the batch. */
+static int install_round(struct aept_ctx *ctx, Pool *pool,
+                         install_job_t **jobs, int n,
+                         aept_owner_index_t *owners,
+                         aept_fileset_t *installed)
+{
+    install_job_t **ready;
+    int *opened, *unpacked, *deferred;
+    int k, nready = 0, stop = 0;
+
+    opened = aept_malloc(n * sizeof(int));
+    unpacked = aept_malloc(n * sizeof(int));
+    deferred = aept_malloc(n * sizeof(int));
+    ready = aept_malloc(n * sizeof(*ready));
+
+    for (k = 0; k < n; k++)
+        opened[k] = -1;
+    aept_parallel_run(ctx, n, ctx->config.install_jobs, batch_open_task,
+                      jobs, opened);
+
+    for (k = 0; k < n; k++)
+        opened[k] = opened[k] == 0;
+    find_overlaps(jobs, n, opened, deferred);
+
+    for (k = 0; k < n && !stop; k++) {
+        if (aept_cancelled()) {
+            stop = 1;
+            break;
+        }
+
+        if (deferred[k])
+            continue;
+
+        if (!opened[k] || job_check(ctx, jobs[k], pool, NULL, owners) < 0) {
+            jobs[k]->r = -1;
+            stop = !ctx->config.keep_going;
+            continue;
+        }
+
+        ready[nready++] = jobs[k];
+    }
+
+    /* Unpack all packages that passed the checks, even if a later one
+     * failed, as their preinst already ran. */
+    for (k = 0; k < nready; k++)
+        unpacked[k] = -1;
+    aept_parallel_run(ctx, nready, ctx->config.install_jobs,
+                      batch_unpack_task, ready, unpacked);
+
+    for (k = 0; k < nready; k++) {
+        if (unpacked[k] == 0)
+            ready[k]->r = job_configure(ctx, ready[k], NULL, owners,
+                                        installed);
+        else
+            ready[k]->r = -1;
+
+        if (ready[k]->r < 0 && !ctx->config.keep_going)
+            stop = 1;
+    }
+
+    for (k = 0; k < n && !stop; k++) {
+        if (!deferred[k])
+            continue;
+
+        if (aept_cancelled()) {
+            stop = 1;
+            break;
+        }
+
+        jobs[k]->r = job_install(ctx, jobs[k], pool, NULL, owners,
+                                 installed);
+        if (jobs[k]->r < 0 && !ctx->config.keep_going)
+            stop = 1;
+    }
+
+    free(ready);
+    free(deferred);
+    free(unpacked);
+    free(opened);
+    return stop;
+}
+
+/* Install n fresh packages from consecutive transaction steps with up to
+ * install_jobs threads.  The packages are grouped by dependency level,
+ * so everything a package requires from the batch is configured before
+ * its preinst runs.  results[k] is 0 or -1 for packages that were
+ * installed or failed, and 1 for those not attempted after an error. */
+static void install_batch(struct aept_ctx *ctx, Pool *pool, const Id *pkgs,
+                          char **ipk_paths, int n,
+                          aept_owner_index_t *owners,
+                          aept_fileset_t *installed, int *results)
+{
+    install_job_t *jobs;
+    install_job_t **round;
+    int *level;
+    int k, l, nlevels, nround, stop = 0;
+    int max_round = ctx->config.install_jobs * INSTALL_BATCH_PER_JOB;
+
+    jobs = aept_malloc(n * sizeof(*jobs));
+    round = aept_malloc(n * sizeof(*round));
+    level = aept_malloc(n * sizeof(int));
+
+    for (k = 0; k < n; k++)
+        job_init(ctx, &jobs[k], pool, pkgs[k], ipk_paths[k]);
+
+    nlevels = install_levels(pool, pkgs, n, level);
+
+    for (l = 0; l < nlevels && !stop; l++) {
+        nround = 0;
+        for (k = 0; k < n && !stop; k++) {
+            if (level[k] != l)
+                continue;
+
+            round[nround++] = &jobs[k];
+            if (nround == max_round) {
+                stop = install_round(ctx, pool, round, nround, owners,
+                                     installed);
+                nround = 0;
+            }
+        }
+
+        if (nround > 0 && !stop)
+            stop = install_round(ctx, pool, round, nround, owners,
+                                 installed);
+
+        for (k = 0; k < n; k++) {
+            if (level[k] == l)
+                job_free(&jobs[k]);
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        results[k] = jobs[k].r;
+        job_free(&jobs[k]);
+    }
+
+    free(level);
+    free(round);
+    free(jobs);
+}
+
+static int is_fresh_install(int type)
+{
+    return (type & 0xf0) == SOLVER_TRANSACTION_INSTALL &&
+        type != SOLVER_TRANSACTION_UPGRADE &&
+        type != SOLVER_TRANSACTION_DOWNGRADE &&
+        type != SOLVER_TRANSACTION_REINSTALL;
+}
+
+/* Install the run of fresh-install steps starting at step i with
+ * install_batch(), waiting for their downloads first, and set
+ * *batch_end past it.  batch_r[k] gets the result of step k.  Runs of a
+ * single step are left to the caller.  Returns -1 if a download failed. */
+static int run_install_batch(struct aept_ctx *ctx, Transaction *trans,
+                             Pool *pool, int i, aept_download_queue_t *dlq,
+                             const Id *fetch, char **ipk_paths,
+                             aept_owner_index_t *owners,
+                             aept_fileset_t *installed, int *batch_r,
+                             int *batch_end)
+{
+    int end, k, n = 0;
+    int max = trans->steps.count - i;
+    int *results;
+    Id *pkgs;
+    char **paths;
+
+    /* With --no-cache, don't hold more packages than the download
+     * window allows. */
+    if (ctx->config.no_cache && max > ctx->config.download_jobs)
+        max = ctx->config.download_jobs;
+
+    for (end = i; end < i + max; end++) {
+        Id p = trans->steps.elements[end];
+        int type = transaction_type(trans, p,
+            SOLVER_TRANSACTION_SHOW_ACTIVE |
+            SOLVER_TRANSACTION_SHOW_ALL);
+
+        if (!is_fresh_install(type))
+            break;
+    }
+
+    if (end - i < 2)
+        return 0;
+
+    for (k = i; k < end; k++) {
+        if (dlq && fetch[k] && aept_download_wait(dlq, k, &ipk_paths[k]) < 0) {
+            if (aept_cancelled())
+                aept_log_warning("interrupted, stopping");
+            return -1;
+        }
+    }
+
+    pkgs = aept_malloc((end - i) * sizeof(Id));
+    paths = aept_malloc((end - i) * sizeof(char *));
+    results = aept_malloc((end - i) * sizeof(int));
+    for (k = i; k < end; k++) {
+        if (ipk_paths[k]) {
+            pkgs[n] = trans->steps.elements[k];
+            paths[n++] = ipk_paths[k];
+        }
+    }
+
+    install_batch(ctx, pool, pkgs, paths, n, owners, installed, results);
+
+    for (k = i, n = 0; k < end; k++)
+        batch_r[k] = ipk_paths[k] ? results[n++] : 1;
+
+    free(results);
+    free(paths);
+    free(pkgs);
+    *batch_end = end;
+    return 0;
+}
+
 static void remove_info_files(struct aept_ctx *ctx, const char *name)
 {
     const char *exts[] = {
@@ -415,10 +1106,12 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     Solvable *s = pool_id2solvable(pool, p);
     const char *name = pool_id2str(pool, s->name);
     struct aept_ar *ctrl_ar = NULL;
-    struct aept_ar *data_ar = NULL;
+    aept_trace_span_t span;
     char *tmpdir = NULL;
     char *ctrl_path = NULL;
     char *list_path = NULL;
+    char *spool_path = NULL;
+    char *store_entry = NULL;
     aept_conffile_set_t old_cf;
     int have_old_cf = 0;
     int is_reinstall = old_version && new_version &&
@@ -434,6 +1127,8 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
 
     aept_ar_file_list_t extracted;
     aept_ar_file_list_init(&extracted);
+    aept_ar_installed_t installed;
+    aept_ar_installed_init(&installed);
 
     aept_asprintf(&tmpdir, "%s/aept-XXXXXX", ctx->config.tmp_dir);
 
@@ -452,7 +1147,9 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
         goto cleanup;
     }
 
-    r = aept_ar_extract_all(ctrl_ar, tmpdir, NULL, NULL, NULL, NULL);
+    aept_trace_begin(ctx, &span, "control", name);
+    r = aept_ar_extract_all(ctrl_ar, tmpdir, NULL, NULL, NULL, NULL, NULL);
+    aept_trace_end(&span);
     aept_ar_close(ctrl_ar);
     ctrl_ar = NULL;
 
@@ -473,7 +1170,8 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     if (r != 0)
         goto cleanup;
 
-    /* 4. Save old file list before overwriting */
+    /* 4. Save old file list before overwriting.  Its records let the
+     * extraction leave files alone that did not change. */
     aept_fileset_t old_files;
     aept_fileset_t new_files;
     int have_old_files = 0;
@@ -484,25 +1182,10 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     aept_file_mkdir_hier(ctx->config.info_dir, 0755);
     aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, name);
 
-    {
-        FILE *lfp = fopen(list_path, "r");
-        if (lfp) {
-            char lbuf[4096];
-            while (fgets(lbuf, sizeof(lbuf), lfp)) {
-                char *tab;
-                if (aept_fgets_is_truncated(lbuf, sizeof(lbuf))) {
-                    aept_fgets_drain_line(lfp);
-                    continue;
-                }
-                lbuf[strcspn(lbuf, "\n")] = '\0';
-                tab = strchr(lbuf, '\t');
-                if (tab)
-                    *tab = '\0';
-                aept_fileset_add(&old_files, lbuf);
-            }
-            fclose(lfp);
-            have_old_files = 1;
-        }
+    if (aept_ar_installed_load(&installed, list_path) == 0) {
+        for (int i = 0; i < installed.files.count; i++)
+            aept_fileset_add(&old_files, installed.files.entries[i].path);
+        have_old_files = 1;
     }
 
     /* 5. Check for file conflicts before extraction.  Drop the old
@@ -512,7 +1195,13 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     if (owners)
         aept_owner_index_drop_owner(owners, name);
 
-    r = aept_clash_check(ctx, ipk_path, pool, p, &old_files, owners);
+    store_entry = aept_store_entry_path(ctx, pool, p);
+    r = spool_data_archive(ctx, ipk_path, tmpdir, store_entry, &spool_path);
+    if (r < 0)
+        goto cleanup_filesets;
+
+    r = check_clashes(ctx, ipk_path, spool_path, store_entry, pool, p,
+                      &old_files, owners);
     if (r != 0) {
         r = -1;
         goto cleanup_filesets;
@@ -533,25 +1222,14 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
         aept_fileset_init(&cf_paths);
         for (int ci = 0; ci < new_cf.count; ci++)
             aept_fileset_add(&cf_paths, new_cf.entries[ci].path);
-        aept_fileset_sort(&cf_paths);
 
         /* 6. Extract new data archive — conffiles get .aept-new suffix */
-        data_ar = aept_ar_open_pkg_data_archive(ipk_path, ctx->config.ignore_uid);
-        if (!data_ar) {
-            aept_log_error("failed to open data archive in '%s'", ipk_path);
-            aept_fileset_free(&cf_paths);
-            aept_conffile_set_free(&new_cf);
-            r = -1;
-            goto cleanup_filesets;
-        }
-
-        char *extract_root = aept_config_root_path(&ctx->config, "/");
-        r = aept_ar_extract_all(data_ar, extract_root, NULL,
-                           cf_paths.count > 0 ? &cf_paths : NULL,
-                           ".aept-new", &extracted);
-        free(extract_root);
-        aept_ar_close(data_ar);
-        data_ar = NULL;
+        r = extract_data_archive(ctx, name,
+                                 solvable_lookup_num(s, SOLVABLE_INSTALLSIZE,
+                                                     0),
+                                 ipk_path, spool_path, store_entry, tmpdir,
+                                 cf_paths.count > 0 ? &cf_paths : NULL,
+                                 &extracted, &installed);
         aept_fileset_free(&cf_paths);
 
         if (r < 0) {
@@ -571,8 +1249,6 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     for (int i = 0; i < extracted.count; i++)
         aept_fileset_add(&new_files, extracted.entries[i].path);
 
-    aept_fileset_sort(&new_files);
-
     /* 7. Remove old files not in new package */
     if (have_old_files) {
         for (int i = 0; i < old_files.count; i++) {
@@ -602,24 +1278,17 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
                       ctx->config.offline_root ? ctx->config.offline_root : "", path);
 
             /* Skip modified conffiles from old package */
-            if (old_cf.count > 0) {
-                char *abs_path = NULL;
-                aept_asprintf(&abs_path, "/%s", path);
-                const char *saved_md5 = aept_conffile_set_lookup(&old_cf,
-                                                            abs_path);
-                if (saved_md5) {
-                    char *cur_md5 = aept_conffile_md5(full_path);
-                    if (cur_md5 && strcmp(saved_md5, cur_md5) != 0) {
-                        aept_log_info("not removing modified conffile '%s'",
-                                 abs_path);
-                        free(cur_md5);
-                        free(abs_path);
-                        free(full_path);
-                        continue;
-                    }
+            const char *saved_md5 = aept_conffile_set_lookup(&old_cf, path);
+            if (saved_md5) {
+                char *cur_md5 = aept_conffile_md5(full_path);
+                if (cur_md5 && strcmp(saved_md5, cur_md5) != 0) {
+                    aept_log_info("not removing modified conffile '/%s'",
+                             path);
                     free(cur_md5);
+                    free(full_path);
+                    continue;
                 }
-                free(abs_path);
+                free(cur_md5);
             }
 
             if (unlink(full_path) < 0 && errno != ENOENT)
@@ -673,6 +1342,7 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
             if (rename(trig_src, trig_dst) < 0
                     && aept_file_copy(trig_src, trig_dst) < 0)
                 aept_log_warning("failed to install triggers for '%s'", name);
+            aept_trigger_index_invalidate(ctx);
             free(trig_dst);
         }
         free(trig_src);
@@ -701,7 +1371,9 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
         r = -1;
     }
 
-    /* 10. Write the .control file with the install state */
+    /* 10. Write the .control file with the install state, once the
+     * new files and info entries are on disk */
+    aept_durability_barrier(ctx, AEPT_DURABILITY_PACKAGE);
     {
         char *ctrl_src = NULL;
         aept_asprintf(&ctrl_src, "%s/control", tmpdir);
@@ -713,7 +1385,7 @@ static int do_upgrade_package(struct aept_ctx *ctx, const char *ipk_path,
     }
 
     if (owners)
-        aept_owner_index_add_owner_files(owners, name, list_path);
+        aept_owner_index_add_files(owners, name, &extracted);
 
     if (r == 0)
         aept_log_debug("%s %s", is_reinstall ? "reinstalled" : "upgraded", name);
@@ -725,9 +1397,12 @@ cleanup_filesets:
 
 cleanup:
     aept_ar_file_list_free(&extracted);
+    aept_ar_installed_free(&installed);
     if (have_old_cf)
         aept_conffile_set_free(&old_cf);
     free(list_path);
+    free(spool_path);
+    free(store_entry);
 
     if (tmpdir) {
         const char *rm_argv[] = {"rm", "-rf", tmpdir, NULL};
@@ -784,7 +1459,7 @@ static int do_reinstall(struct aept_ctx *ctx, const char **names, int count,
         r = do_upgrade_package(ctx, ipk_path, pool, avail, old_ver, old_ver,
                                 NULL, owners);
         if (ctx->config.no_cache && !is_local)
-            unlink(ipk_path);
+            aept_download_discard(ctx, ipk_path);
         free(ipk_path);
         if (r < 0) {
             had_error = 1;
@@ -796,44 +1471,221 @@ static int do_reinstall(struct aept_ctx *ctx, const char **names, int count,
     return had_error ? -1 : 0;
 }
 
+/* A prefetch runs at idle CPU and I/O priority so that it stays out of
+ * the way of whatever else the device is doing.  The priorities are
+ * changed for the calling thread, which the download workers inherit
+ * them from, and restored afterwards for callers that keep using the
+ * thread.  Raising them again may need privileges; without, the
+ * thread simply stays at the lower priority. */
+typedef struct {
+    int nice;
+    int ioprio;
+} background_priority_t;
+
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+
+static void background_priority_enter(background_priority_t *prio)
+{
+    errno = 0;
+    prio->nice = getpriority(PRIO_PROCESS, 0);
+    if (errno != 0)
+        prio->nice = 0;
+    if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+        aept_log_debug("cannot lower CPU priority: %s", strerror(errno));
+
+    prio->ioprio = -1;
+#ifdef SYS_ioprio_set
+    prio->ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+        aept_log_debug("cannot lower I/O priority: %s", strerror(errno));
+#endif
+}
+
+static void background_priority_leave(const background_priority_t *prio)
+{
+    if (setpriority(PRIO_PROCESS, 0, prio->nice) < 0)
+        aept_log_debug("cannot restore CPU priority: %s", strerror(errno));
+#ifdef SYS_ioprio_set
+    if (prio->ioprio >= 0 &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio->ioprio) < 0)
+        aept_log_debug("cannot restore I/O priority: %s", strerror(errno));
+#endif
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Digest of what a resolve depends on besides the package lists: the
+ * installed packages, in name order, and the pin file. */
+static void plan_state(struct aept_ctx *ctx, Pool *pool, unsigned char *out)
+{
+    Chksum *chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    const unsigned char *raw;
+    char **lines = NULL;
+    int n = 0, len, i;
+    Solvable *s;
+    FILE *fp;
+    Id p;
+
+    if (pool->installed) {
+        lines = aept_malloc(pool->installed->nsolvables * sizeof(char *));
+        FOR_REPO_SOLVABLES(pool->installed, p, s) {
+            aept_asprintf(&lines[n++], "%s %s %s\n",
+                          pool_id2str(pool, s->name),
+                          pool_id2str(pool, s->evr),
+                          pool_id2str(pool, s->arch));
+        }
+        qsort(lines, n, sizeof(char *), compare_strings);
+    }
+
+    for (i = 0; i < n; i++) {
+        solv_chksum_add(chk, lines[i], strlen(lines[i]));
+        free(lines[i]);
+    }
+    free(lines);
+
+    fp = fopen(ctx->config.pin_file, "r");
+    if (fp) {
+        char buf[4096];
+        size_t got;
+
+        solv_chksum_add(chk, "\0", 1);
+        while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+            solv_chksum_add(chk, buf, (int)got);
+        fclose(fp);
+    }
+
+    raw = solv_chksum_get(chk, &len);
+    memcpy(out, raw, len < 32 ? len : 32);
+    solv_chksum_free(chk, NULL);
+}
+
+/* Record the fetched package files of a download-only run in plan */
+static void plan_capture(aept_plan_t *plan, const Id *fetch,
+                         char **ipk_paths, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!fetch[i] || !ipk_paths[i])
+            continue;
+        plan->paths = aept_realloc(plan->paths,
+                                   (plan->npaths + 1) * sizeof(char *));
+        plan->paths[plan->npaths++] = aept_strdup(ipk_paths[i]);
+    }
+    plan->ready = 1;
+}
+
+void aept_plan_free(aept_plan_t *plan)
+{
+    int i;
+
+    for (i = 0; i < plan->npaths; i++)
+        free(plan->paths[i]);
+    free(plan->paths);
+    plan->paths = NULL;
+    plan->npaths = 0;
+}
+
+static int id_in(const Id *ids, int count, Id p)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (ids[i] == p)
+            return 1;
+    }
+    return 0;
+}
+
 int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                  const char **local_paths, int local_count)
+{
+    return aept_op_install_plan(ctx, names, name_count, local_paths,
+                                local_count, NULL);
+}
+
+int aept_op_install_plan(struct aept_ctx *ctx, const char **names,
+                         int name_count, const char **local_paths,
+                         int local_count, aept_plan_t *plan)
 {
     Transaction *trans;
     Pool *pool;
     Id *local_ids = NULL;
+    int download_only = ctx->config.download_only || ctx->config.prefetch;
+    int use_plan = 0;
+    int applied = 0;
     int i, r;
 
     r = aept_solver_init(ctx);
     if (r < 0)
         return -1;
 
+    /* Auto marks change in memory and are written once at the end. */
+    aept_status_auto_begin(ctx);
+
     r = aept_status_load(ctx);
     if (r < 0)
         goto out;
 
-    r = load_repos(ctx);
-    if (r < 0)
-        goto out;
+    pool = aept_solver_pool(ctx->solver);
 
-    aept_pin_load_into_solver(ctx);
+    /* A root in the state the plan was resolved against comes to the
+     * same transaction from the plan's packages alone. */
+    if (plan) {
+        unsigned char state[sizeof(plan->state)];
 
-    pool = aept_solver_pool(ctx->solver);
+        plan_state(ctx, pool, state);
+        if (plan->capture) {
+            memcpy(plan->state, state, sizeof(state));
+        } else if (memcmp(plan->state, state, sizeof(state)) == 0) {
+            use_plan = 1;
+        } else {
+            aept_log_info("'%s' differs from the reference root, "
+                          "resolving it separately",
+                          ctx->config.offline_root ?
+                              ctx->config.offline_root : "/");
+        }
+    }
+
+    if (!use_plan) {
+        r = load_repos(ctx);
+        if (r < 0)
+            goto out;
+    }
+
+    aept_pin_load_into_solver(ctx);
 
-    /* Load local .aep files into the solver.  Skip packages that are
-     * already installed at the same version (unless --reinstall). */
+    /* Load local .aep files into the solver, followed by the plan's
+     * packages, which are candidates but not requested.  Skip local
+     * packages that are already installed at the same version (unless
+     * --reinstall). */
     int n_local_ids = 0;
-    if (local_count > 0) {
-        local_ids = aept_malloc(local_count * sizeof(Id));
-        for (i = 0; i < local_count; i++) {
-            Id lid = aept_solver_load_local(ctx, local_paths[i]);
-            if (!lid) {
-                free(local_ids);
-                local_ids = NULL;
-                r = -1;
-                goto out;
-            }
+    int n_load = local_count + (use_plan ? plan->npaths : 0);
+    if (n_load > 0) {
+        const char **load_paths = aept_malloc(n_load * sizeof(char *));
+
+        for (i = 0; i < local_count; i++)
+            load_paths[i] = local_paths[i];
+        for (; i < n_load; i++)
+            load_paths[i] = plan->paths[i - local_count];
+
+        local_ids = aept_malloc(n_load * sizeof(Id));
+        r = aept_solver_load_locals(ctx, load_paths, n_load, local_ids);
+        free(load_paths);
+        if (r < 0) {
+            free(local_ids);
+            local_ids = NULL;
+            goto out;
+        }
 
+        for (i = 0; i < local_count; i++) {
+            Id lid = local_ids[i];
             Solvable *s = pool_id2solvable(pool, lid);
             const char *pkg_name = pool_id2str(pool, s->name);
             const char *pkg_ver = pool_id2str(pool, s->evr);
@@ -859,7 +1711,7 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
     /* Explicitly named packages become manually installed.
      * Resolve through provides so that e.g. "python" correctly
      * unmarks "python3.9" when python3.9 provides python. */
-    if (names && !ctx->config.noaction) {
+    if (names && !ctx->config.noaction && !ctx->config.prefetch) {
         for (i = 0; i < name_count; i++) {
             aept_status_unmark_auto(ctx, names[i]);
             Id nameid = pool_str2id(pool, names[i], 0);
@@ -875,26 +1727,26 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
     }
 
     /* Local packages are also explicitly requested */
-    if (local_ids && !ctx->config.noaction) {
+    if (local_ids && !ctx->config.noaction && !ctx->config.prefetch) {
         for (i = 0; i < n_local_ids; i++) {
             Solvable *s = pool_id2solvable(pool, local_ids[i]);
             aept_status_unmark_auto(ctx, pool_id2str(pool, s->name));
         }
     }
 
-    if (display_transaction(ctx, trans, pool,
-                           ctx->config.reinstall ? names : NULL,
-                           ctx->config.reinstall ? name_count : 0,
-                           (names ? name_count : 0) + n_local_ids)) {
+    /* The reference run has shown and confirmed the plan already */
+    if (use_plan ? trans->steps.count == 0 :
+            display_transaction(ctx, trans, pool,
+                                ctx->config.reinstall ? names : NULL,
+                                ctx->config.reinstall ? name_count : 0,
+                                (names ? name_count : 0) + n_local_ids)) {
+        if (plan && plan->capture && trans->steps.count == 0)
+            plan->ready = 1;
         r = 0;
         goto out;
     }
 
-    for (i = 0; i < ctx->config.nsources; i++) {
-        if (strncmp(ctx->config.sources[i].url, "https://", 8) != 0)
-            aept_log_warning("source '%s' uses insecure transport",
-                        ctx->config.sources[i].name);
-    }
+    aept_mirror_check_transport(ctx);
 
     if (ctx->config.noaction) {
         aept_log_info("dry run, not installing");
@@ -902,72 +1754,111 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
         goto out;
     }
 
-    if (ctx->config.no_cache && ctx->config.download_only) {
+    if (ctx->config.no_cache && download_only) {
         aept_log_warning("--no-cache ignored with --download-only");
         ctx->config.no_cache = 0;
     }
 
-    /* Download phase */
+    /* Download phase.  By default everything is fetched up front with a
+     * pool of download workers, so that a failed download leaves the
+     * system untouched.  In pipelined mode (always used with --no-cache)
+     * the fetches continue in the background and each INSTALL step
+     * below waits only for its own package.  Either way, the steps
+     * still run in solver order. */
     char **ipk_paths = NULL;
+    Id *fetch = NULL;
+    aept_download_queue_t *dlq = NULL;
     ipk_paths = aept_malloc(trans->steps.count * sizeof(char *));
     memset(ipk_paths, 0, trans->steps.count * sizeof(char *));
+    fetch = aept_malloc(trans->steps.count * sizeof(Id));
+    memset(fetch, 0, trans->steps.count * sizeof(Id));
 
-    if (!ctx->config.no_cache) {
-        for (i = 0; i < trans->steps.count; i++) {
-            if (aept_cancelled()) {
-                aept_log_warning("interrupted, stopping");
-                r = -1;
-                goto download_cleanup;
-            }
+    for (i = 0; i < trans->steps.count; i++) {
+        Id p = trans->steps.elements[i];
+        int type = transaction_type(trans, p,
+            SOLVER_TRANSACTION_SHOW_ACTIVE |
+            SOLVER_TRANSACTION_SHOW_ALL);
 
-            Id p = trans->steps.elements[i];
-            int type = transaction_type(trans, p,
-                SOLVER_TRANSACTION_SHOW_ACTIVE |
-                SOLVER_TRANSACTION_SHOW_ALL);
+        if ((type & 0xf0) != SOLVER_TRANSACTION_INSTALL)
+            continue;
 
-            if ((type & 0xf0) != SOLVER_TRANSACTION_INSTALL)
-                continue;
+        if (aept_solver_is_commandline(ctx->solver, p)) {
+            ipk_paths[i] = aept_strdup(aept_solver_commandline_path(ctx->solver, p));
+            continue;
+        }
 
-            if (aept_solver_is_commandline(ctx->solver, p)) {
-                ipk_paths[i] = aept_strdup(aept_solver_commandline_path(ctx->solver, p));
-                continue;
-            }
+        fetch[i] = p;
+    }
 
-            r = aept_download_package(ctx, p, pool, &ipk_paths[i]);
-            if (r < 0)
-                goto download_cleanup;
+    if (download_only ||
+            (!ctx->config.no_cache && !ctx->config.pipeline_downloads)) {
+        background_priority_t prio = {0};
 
-            if (ctx->config.download_only)
-                continue;
+        if (ctx->config.prefetch)
+            background_priority_enter(&prio);
+        r = aept_download_packages(ctx, pool, fetch, trans->steps.count,
+                                   ipk_paths);
+        if (ctx->config.prefetch)
+            background_priority_leave(&prio);
+        if (r < 0) {
+            if (aept_cancelled())
+                aept_log_warning("interrupted, stopping");
+            goto download_cleanup;
         }
 
-        if (ctx->config.download_only) {
+        if (download_only) {
+            if (plan && plan->capture)
+                plan_capture(plan, fetch, ipk_paths, trans->steps.count);
             aept_log_info("download complete");
             r = 0;
             goto download_cleanup;
         }
+    } else {
+        /* With --no-cache, stay at most download_jobs packages ahead so
+         * that the cache never holds more than that at once. */
+        dlq = aept_download_start(ctx, pool, fetch, trans->steps.count,
+                                  ctx->config.no_cache ?
+                                      ctx->config.download_jobs : 0);
+        if (!dlq) {
+            r = -1;
+            goto download_cleanup;
+        }
     }
 
     /* Execute transaction — track installed files so that removals
      * later in the same transaction don't delete them. */
     aept_fileset_t installed_files;
-    int fileset_sorted = 0;
     aept_fileset_init(&installed_files);
 
-    /* Build the file→owner index once, up-front.  Replaces the
+    /* Load the file→owner index once, up-front.  Replaces the
      * per-file directory scan that aept_clash_check used to do and
-     * is the dominant speedup for large transactions. */
+     * is the dominant speedup for large transactions.  It is only
+     * rebuilt from the .list files if the saved copy is stale. */
     aept_owner_index_t owner_idx;
     aept_owner_index_init(&owner_idx);
-    aept_owner_index_build(ctx, &owner_idx);
+    aept_owner_index_open(ctx, &owner_idx);
 
     aept_trigger_ctx_t tctx;
     aept_trigger_ctx_init(&tctx);
 
+    /* With install_jobs > 1, runs of fresh installs go through
+     * install_batch(); steps [i, batch_end) then take their result from
+     * batch_r. */
+    int *batch_r = NULL;
+    int batch_end = 0, batch_failed = 0;
+    if (ctx->config.install_jobs > 1)
+        batch_r = aept_malloc(trans->steps.count * sizeof(int));
+
     int had_error = 0;
+    applied = 1;
 
     for (i = 0; i < trans->steps.count; i++) {
-        if (aept_cancelled()) {
+        if (batch_failed && i >= batch_end) {
+            r = -1;
+            goto fileset_cleanup;
+        }
+
+        if (aept_cancelled() && i >= batch_end) {
             aept_log_warning("interrupted, stopping");
             r = -1;
             goto fileset_cleanup;
@@ -989,11 +1880,6 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                     type == SOLVER_TRANSACTION_REINSTALLED)
                 continue;
 
-            if (!fileset_sorted) {
-                aept_fileset_sort(&installed_files);
-                fileset_sorted = 1;
-            }
-
             aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
             r = aept_do_remove(ctx, pkg_name, NULL, &installed_files,
                                 &owner_idx);
@@ -1003,20 +1889,33 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                     goto fileset_cleanup;
             }
         } else if ((type & 0xf0) == SOLVER_TRANSACTION_INSTALL) {
-            if (ctx->config.no_cache) {
-                if (aept_solver_is_commandline(ctx->solver, p)) {
-                    ipk_paths[i] = aept_strdup(aept_solver_commandline_path(ctx->solver, p));
-                } else {
-                    r = aept_download_package(ctx, p, pool, &ipk_paths[i]);
-                    if (r < 0)
-                        goto fileset_cleanup;
-                }
+            if (batch_r && i >= batch_end && is_fresh_install(type)) {
+                r = run_install_batch(ctx, trans, pool, i, dlq, fetch,
+                                      ipk_paths, &owner_idx,
+                                      &installed_files, batch_r,
+                                      &batch_end);
+                if (r < 0)
+                    goto fileset_cleanup;
             }
 
-            if (!ipk_paths[i])
-                continue;
+            if (i < batch_end) {
+                if (!ipk_paths[i] || batch_r[i] > 0)
+                    continue;
 
-            if (type == SOLVER_TRANSACTION_UPGRADE ||
+                r = batch_r[i];
+                if (r == 0) {
+                    aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
+                    aept_trigger_ctx_add_fresh(&tctx, pkg_name);
+                }
+            } else if (dlq && fetch[i] &&
+                    aept_download_wait(dlq, i, &ipk_paths[i]) < 0) {
+                r = -1;
+                if (aept_cancelled())
+                    aept_log_warning("interrupted, stopping");
+                goto fileset_cleanup;
+            } else if (!ipk_paths[i]) {
+                continue;
+            } else if (type == SOLVER_TRANSACTION_UPGRADE ||
                     type == SOLVER_TRANSACTION_DOWNGRADE ||
                     type == SOLVER_TRANSACTION_REINSTALL) {
                 const char *old_ver = NULL;
@@ -1027,16 +1926,10 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                     old_ver = pool_id2str(pool, os->evr);
                 }
 
-                if (!fileset_sorted) {
-                    aept_fileset_sort(&installed_files);
-                    fileset_sorted = 1;
-                }
-
                 aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
                 r = do_upgrade_package(ctx, ipk_paths[i], pool, p,
                                        old_ver, new_ver,
                                        &installed_files, &owner_idx);
-                fileset_sorted = 0;
 
                 if (r == 0) {
                     aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
@@ -1044,7 +1937,7 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                 }
             } else {
                 r = do_install_package(ctx, ipk_paths[i], pool, p, NULL,
-                                        &owner_idx);
+                                        &owner_idx, &installed_files);
 
                 if (r == 0) {
                     aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
@@ -1054,19 +1947,26 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
 
             if (r < 0) {
                 had_error = 1;
-                if (!ctx->config.keep_going)
-                    goto fileset_cleanup;
+                if (!ctx->config.keep_going) {
+                    if (i >= batch_end)
+                        goto fileset_cleanup;
+
+                    /* The rest of the batch may have been installed
+                     * and still needs recording below. */
+                    batch_failed = 1;
+                    continue;
+                }
             }
 
             /* Mark as auto-installed if this is a fresh install
              * of a dependency (not explicitly requested).
              * Also check provides so that e.g. installing "python"
              * does not auto-mark the providing "python3.9". */
-            if ((names || local_ids) &&
+            if ((names || n_local_ids) &&
                     type != SOLVER_TRANSACTION_UPGRADE &&
                     type != SOLVER_TRANSACTION_DOWNGRADE &&
                     type != SOLVER_TRANSACTION_REINSTALL) {
-                int is_explicit = aept_solver_is_commandline(ctx->solver, p);
+                int is_explicit = id_in(local_ids, n_local_ids, p);
                 int j;
                 for (j = 0; !is_explicit && j < name_count; j++) {
                     if (strcmp(names[j], pkg_name) == 0) {
@@ -1090,47 +1990,22 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
                     aept_status_mark_auto(ctx, pkg_name);
             }
 
-            /* Record installed files for removal protection.
-             * Upgrades/reinstalls already update installed_files
-             * in do_upgrade_package(). */
-            if (type != SOLVER_TRANSACTION_UPGRADE &&
-                    type != SOLVER_TRANSACTION_DOWNGRADE &&
-                    type != SOLVER_TRANSACTION_REINSTALL) {
-                char *list_path = NULL;
-                FILE *lfp;
-                char lbuf[4096];
-
-                aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, pkg_name);
-                lfp = fopen(list_path, "r");
-                free(list_path);
-
-                if (lfp) {
-                    while (fgets(lbuf, sizeof(lbuf), lfp)) {
-                        char *tab;
-                        if (aept_fgets_is_truncated(lbuf, sizeof(lbuf))) {
-                            aept_fgets_drain_line(lfp);
-                            continue;
-                        }
-                        lbuf[strcspn(lbuf, "\n")] = '\0';
-                        tab = strchr(lbuf, '\t');
-                        if (tab)
-                            *tab = '\0';
-                        aept_fileset_add(&installed_files, lbuf);
-                    }
-                    fclose(lfp);
-                    fileset_sorted = 0;
-                }
-            }
-
             if (ctx->config.no_cache) {
                 if (!aept_solver_is_commandline(ctx->solver, p))
-                    unlink(ipk_paths[i]);
+                    aept_download_discard(ctx, ipk_paths[i]);
                 free(ipk_paths[i]);
                 ipk_paths[i] = NULL;
             }
         }
     }
 
+    free(batch_r);
+    batch_r = NULL;
+    if (batch_failed) {
+        r = -1;
+        goto fileset_cleanup;
+    }
+
     aept_fileset_free(&installed_files);
 
     /* Fire triggers for directories modified during the transaction */
@@ -1152,18 +2027,30 @@ int aept_op_install(struct aept_ctx *ctx, const char **names, int name_count,
     goto owner_cleanup;
 
 fileset_cleanup:
+    free(batch_r);
     aept_fileset_free(&installed_files);
     aept_trigger_ctx_free(&tctx);
 
 owner_cleanup:
+    if (r == 0)
+        aept_owner_index_save(ctx, &owner_idx);
+    else
+        aept_owner_index_discard(ctx);
     aept_owner_index_free(&owner_idx);
 
 download_cleanup:
+    aept_download_finish(dlq, ctx->config.no_cache);
+    aept_cache_trim(ctx, pool, trans);
     for (i = 0; i < trans->steps.count; i++)
         free(ipk_paths[i]);
     free(ipk_paths);
+    free(fetch);
 
 out:
+    if (aept_status_auto_commit(ctx) < 0)
+        r = -1;
+    if (applied)
+        aept_durability_barrier(ctx, AEPT_DURABILITY_TRANSACTION);
     free(local_ids);
     aept_solver_fini(ctx);
     return r;
@@ -0,0 +1,409 @@
+/* integrity.c - installed file verification
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * The .list file of a package records the size, mtime and SHA-256 of
+ * each regular file as it was extracted (see aept_ar_file_list_write()),
+ * and the target of each symlink.  Verification compares the root
+ * against these.  A size mismatch is reported without reading the
+ * file, and with AEPT_VERIFY_QUICK a file whose size and mtime are
+ * unchanged is trusted without being hashed.  The files of all
+ * requested packages are hashed in one aept_parallel_run() so that a
+ * few large packages do not leave the other threads idle.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <solv/chksum.h>
+#include <solv/knownid.h>
+#include <solv/util.h>
+
+#include "aept/internal.h"
+#include "aept/conffile.h"
+#include "aept/integrity.h"
+#include "aept/msg.h"
+#include "aept/stats.h"
+#include "aept/util.h"
+
+#define SHA256_HEX_LEN 64
+#define READ_SIZE      0x10000
+
+typedef struct {
+    int pkg;                    /* index into verify_run_t.names */
+    char *path;                 /* as in the .list file */
+    char *expect;               /* SHA-256 in hex, or symlink target */
+    unsigned int mode;
+    unsigned long long size;
+    long long mtime;
+    int problem;                /* AEPT_VERIFY_*, 0 if the file matches */
+} verify_file_t;
+
+typedef struct {
+    char **names;
+    int nnames;
+    verify_file_t *files;
+    int count;
+    int alloc;
+    int unchecked;              /* regular files without a digest */
+    int flags;
+} verify_run_t;
+
+static const char *strip_leading(const char *p)
+{
+    while (p[0] == '.' && p[1] == '/')
+        p += 2;
+    while (p[0] == '/')
+        p++;
+    return p;
+}
+
+static char *root_path(struct aept_ctx *ctx, const char *path)
+{
+    char *full = NULL;
+
+    aept_asprintf(&full, "%s/%s",
+                  ctx->config.offline_root ? ctx->config.offline_root : "",
+                  strip_leading(path));
+    return full;
+}
+
+/* Split line at tabs into at most max fields.  Returns the count. */
+static int split_fields(char *line, char **fields, int max)
+{
+    int n = 0;
+
+    while (n < max) {
+        fields[n++] = line;
+        line = strchr(line, '\t');
+        if (!line)
+            break;
+        *line++ = '\0';
+    }
+    return n;
+}
+
+static void add_file(verify_run_t *run, int pkg, const char *path,
+                     unsigned int mode, const char *expect,
+                     unsigned long long size, long long mtime)
+{
+    verify_file_t *f;
+
+    if (run->count >= run->alloc) {
+        run->alloc = run->alloc ? run->alloc * 2 : 256;
+        run->files = aept_realloc(run->files,
+                                  run->alloc * sizeof(*run->files));
+    }
+
+    f = &run->files[run->count++];
+    f->pkg = pkg;
+    f->path = aept_strdup(path);
+    f->expect = aept_strdup(expect);
+    f->mode = mode;
+    f->size = size;
+    f->mtime = mtime;
+    f->problem = 0;
+}
+
+/* Queue the checkable entries of package pkg's .list file. */
+static int load_list(struct aept_ctx *ctx, verify_run_t *run, int pkg)
+{
+    const char *name = run->names[pkg];
+    aept_conffile_set_t conffiles;
+    char *list_path = NULL;
+    char buf[4096];
+    FILE *fp;
+
+    aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, name);
+    fp = fopen(list_path, "r");
+    free(list_path);
+
+    if (!fp) {
+        if (errno == ENOENT)
+            aept_log_error("package '%s' is not installed", name);
+        else
+            aept_log_error("cannot read file list of '%s': %s", name,
+                           strerror(errno));
+        return -1;
+    }
+
+    /* Conffiles are meant to be edited */
+    aept_conffile_set_init(&conffiles);
+    aept_conffile_load(ctx, name, &conffiles);
+
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *fields[5];
+        unsigned int mode;
+        int n;
+
+        if (aept_fgets_is_truncated(buf, sizeof(buf))) {
+            aept_fgets_drain_line(fp);
+            continue;
+        }
+        buf[strcspn(buf, "\n")] = '\0';
+
+        n = split_fields(buf, fields, 5);
+        if (n < 2 || !aept_archive_path_is_safe(fields[0]))
+            continue;
+        mode = (unsigned int)strtoul(fields[1], NULL, 8);
+
+        if (!S_ISREG(mode) && !S_ISLNK(mode))
+            continue;
+
+        if (aept_conffile_set_lookup(&conffiles, fields[0]))
+            continue;
+
+        if (S_ISLNK(mode)) {
+            /* Targets that were not recorded can't be compared */
+            if (n >= 3 && strcmp(fields[2], "<redacted>") != 0)
+                add_file(run, pkg, fields[0], mode, fields[2], 0, 0);
+        } else if (n == 5 && strlen(fields[4]) == SHA256_HEX_LEN) {
+            add_file(run, pkg, fields[0], mode, fields[4],
+                     strtoull(fields[2], NULL, 10),
+                     strtoll(fields[3], NULL, 10));
+        } else {
+            run->unchecked++;
+        }
+    }
+
+    fclose(fp);
+    aept_conffile_set_free(&conffiles);
+    return 0;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Names of all packages with a .list file in info_dir, sorted. */
+static int list_installed(struct aept_ctx *ctx, verify_run_t *run)
+{
+    struct dirent *ent;
+    int alloc = 0;
+    DIR *dir;
+
+    dir = opendir(ctx->config.info_dir);
+    if (!dir)
+        return errno == ENOENT ? 0 : -1;
+
+    while ((ent = readdir(dir)) != NULL) {
+        const char *dot = strrchr(ent->d_name, '.');
+        size_t len;
+
+        if (!dot || strcmp(dot, ".list") != 0)
+            continue;
+
+        if (run->nnames >= alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            run->names = aept_realloc(run->names,
+                                      alloc * sizeof(*run->names));
+        }
+        len = (size_t)(dot - ent->d_name);
+        run->names[run->nnames] = aept_malloc(len + 1);
+        memcpy(run->names[run->nnames], ent->d_name, len);
+        run->names[run->nnames][len] = '\0';
+        run->nnames++;
+    }
+    closedir(dir);
+
+    if (run->nnames > 1)
+        qsort(run->names, run->nnames, sizeof(*run->names), name_cmp);
+    return 0;
+}
+
+/* SHA-256 of the file at path in hex.  Returns 0 or -1 with errno. */
+static int hash_file(const char *path, char *hex)
+{
+    unsigned char buf[READ_SIZE];
+    const unsigned char *raw;
+    Chksum *chk;
+    ssize_t n;
+    int fd, len;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            int saved = errno;
+            solv_chksum_free(chk, NULL);
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        solv_chksum_add(chk, buf, (int)n);
+    }
+    close(fd);
+
+    raw = solv_chksum_get(chk, &len);
+    solv_bin2hex(raw, len, hex);
+    solv_chksum_free(chk, NULL);
+    return 0;
+}
+
+static int check_symlink(const char *full, const verify_file_t *f)
+{
+    char target[4096];
+    ssize_t n;
+
+    n = readlink(full, target, sizeof(target) - 1);
+    if (n < 0)
+        return errno == EINVAL ? AEPT_VERIFY_MODIFIED
+                               : AEPT_VERIFY_UNREADABLE;
+    target[n] = '\0';
+
+    return strcmp(target, f->expect) == 0 ? 0 : AEPT_VERIFY_MODIFIED;
+}
+
+static int check_regular(const char *full, const struct stat *st,
+                         const verify_file_t *f, int flags)
+{
+    char hex[SHA256_HEX_LEN + 1];
+
+    if (!S_ISREG(st->st_mode) || (unsigned long long)st->st_size != f->size)
+        return AEPT_VERIFY_MODIFIED;
+
+    if ((flags & AEPT_VERIFY_QUICK) && (long long)st->st_mtime == f->mtime)
+        return 0;
+
+    if (hash_file(full, hex) < 0)
+        return AEPT_VERIFY_UNREADABLE;
+
+    return strcmp(hex, f->expect) == 0 ? 0 : AEPT_VERIFY_MODIFIED;
+}
+
+static int verify_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    verify_run_t *run = arg;
+    verify_file_t *f = &run->files[i];
+    char *full = root_path(ctx, f->path);
+    struct stat st;
+
+    if (lstat(full, &st) < 0)
+        f->problem = (errno == ENOENT || errno == ENOTDIR)
+            ? AEPT_VERIFY_MISSING : AEPT_VERIFY_UNREADABLE;
+    else if (S_ISLNK(f->mode))
+        f->problem = S_ISLNK(st.st_mode) ? check_symlink(full, f)
+                                         : AEPT_VERIFY_MODIFIED;
+    else
+        f->problem = check_regular(full, &st, f, run->flags);
+
+    if (f->problem)
+        aept_log_debug("'%s' of '%s' does not match", f->path,
+                       run->names[f->pkg]);
+
+    free(full);
+    return 0;
+}
+
+static int resolve_jobs(int jobs)
+{
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (int)n : 1;
+    }
+    return jobs;
+}
+
+int aept_op_verify(struct aept_ctx *ctx, const char **names, int count,
+                   int flags, aept_verify_problem_t **problems_out,
+                   int *count_out)
+{
+    verify_run_t run;
+    aept_stats_timer_t timer;
+    aept_verify_problem_t *problems = NULL;
+    int *results = NULL;
+    int i, nproblems = 0, ret = -1;
+
+    *problems_out = NULL;
+    *count_out = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.flags = flags;
+
+    if (count > 0) {
+        run.names = aept_malloc(count * sizeof(*run.names));
+        for (i = 0; i < count; i++) {
+            if (!aept_pkg_name_is_safe(names[i])) {
+                aept_log_error("invalid package name '%s'", names[i]);
+                goto cleanup;
+            }
+            run.names[run.nnames++] = aept_strdup(names[i]);
+        }
+    } else if (list_installed(ctx, &run) < 0) {
+        aept_log_error("cannot read '%s': %s", ctx->config.info_dir,
+                       strerror(errno));
+        goto cleanup;
+    }
+
+    for (i = 0; i < run.nnames; i++) {
+        if (load_list(ctx, &run, i) < 0)
+            goto cleanup;
+    }
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_VERIFY);
+    results = aept_malloc((run.count > 0 ? run.count : 1) * sizeof(int));
+    aept_parallel_run(ctx, run.count, resolve_jobs(ctx->config.verify_jobs),
+                      verify_task, &run, results);
+    aept_stats_end(&timer);
+
+    if (aept_cancelled())
+        goto cleanup;
+
+    if (run.unchecked > 0)
+        aept_log_info("%d files have no recorded digest and were not "
+                      "checked", run.unchecked);
+
+    for (i = 0; i < run.count; i++) {
+        if (run.files[i].problem)
+            nproblems++;
+    }
+
+    if (nproblems > 0) {
+        int n = 0;
+
+        problems = aept_malloc(nproblems * sizeof(*problems));
+        for (i = 0; i < run.count; i++) {
+            verify_file_t *f = &run.files[i];
+
+            if (!f->problem)
+                continue;
+            problems[n].package = aept_strdup(run.names[f->pkg]);
+            problems[n].path = f->path;
+            problems[n].problem = f->problem;
+            f->path = NULL;
+            n++;
+        }
+    }
+
+    *problems_out = problems;
+    *count_out = nproblems;
+    ret = nproblems > 0 ? 1 : 0;
+
+cleanup:
+    for (i = 0; i < run.count; i++) {
+        free(run.files[i].path);
+        free(run.files[i].expect);
+    }
+    free(run.files);
+    for (i = 0; i < run.nnames; i++)
+        free(run.names[i]);
+    free(run.names);
+    free(results);
+    return ret;
+}
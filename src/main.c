@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -65,6 +66,22 @@ static const char *resolve_conf(void)
     return path;
 }
 
+/* Parse a positive integer option argument. Returns -1 if invalid. */
+static int parse_count(const char *opt, const char *arg, long max)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || v < 1 || v > max) {
+        aept_log_error("invalid value '%s' for --%s", arg, opt);
+        return -1;
+    }
+
+    return (int)v;
+}
+
 static aept_ctx_t *init_aept(void)
 {
     const char *cf;
@@ -111,6 +128,92 @@ static aept_ctx_t *init_aept(void)
     return ctx;
 }
 
+/* Install or, without names and paths, upgrade; into each of roots if
+ * --root was given. */
+static int run_install(aept_ctx_t *ctx, const char **roots, int n_roots,
+                       const char **names, int n_names,
+                       const char **paths, int n_paths)
+{
+    int *results;
+    int r;
+
+    if (n_roots == 0) {
+        if (!names && !paths)
+            return aept_upgrade(ctx);
+        return aept_install(ctx, names, n_names, paths, n_paths);
+    }
+
+    results = aept_malloc(n_roots * sizeof(int));
+    r = aept_install_roots(ctx, roots, n_roots, names, n_names,
+                           paths, n_paths, results);
+    free(results);
+    return r;
+}
+
+/* How the mirrors of sources that have several did */
+static void print_mirror_stats(aept_ctx_t *ctx)
+{
+    aept_mirror_stats_t *ms;
+    int n, i;
+
+    n = aept_get_mirror_stats(ctx, NULL, 0);
+    if (n < 2)
+        return;
+
+    ms = aept_malloc(n * sizeof(*ms));
+    aept_get_mirror_stats(ctx, ms, n);
+
+    for (i = 0; i < n; i++) {
+        int several =
+            (i > 0 && strcmp(ms[i - 1].source, ms[i].source) == 0) ||
+            (i + 1 < n && strcmp(ms[i + 1].source, ms[i].source) == 0);
+
+        if (!several || ms[i].requests == 0)
+            continue;
+
+        printf("mirror %s: %lu requests, %lu failed", ms[i].url,
+               ms[i].requests, ms[i].failures);
+        if (ms[i].latency >= 0)
+            printf(", %.1f ms latency", ms[i].latency * 1e3);
+        if (ms[i].throughput > 0)
+            printf(", %.0f KiB/s", ms[i].throughput / 1024);
+        printf("\n");
+    }
+
+    free(ms);
+}
+
+/* With -v, summarize where a mutating command spent its time. */
+static void print_stats(aept_ctx_t *ctx)
+{
+    aept_stats_t st;
+    int i;
+
+    if (verbose_count == 0)
+        return;
+
+    aept_get_stats(ctx, &st);
+
+    printf("\n%-10s %10s %10s %8s\n", "phase", "wall", "cpu", "count");
+    for (i = 0; i < AEPT_PHASE_COUNT; i++) {
+        if (st.phase[i].count == 0)
+            continue;
+        printf("%-10s %9.3fs %9.3fs %8lu\n", aept_phase_name(i),
+               st.phase[i].wall, st.phase[i].cpu, st.phase[i].count);
+    }
+
+    printf("downloaded %llu files (%llu bytes), "
+           "extracted %llu files (%llu bytes)\n",
+           st.files_downloaded, st.bytes_downloaded,
+           st.files_extracted, st.bytes_extracted);
+    printf("kept %llu unchanged files, removed %llu files, "
+           "ran %llu scripts\n",
+           st.files_unchanged, st.files_removed, st.scripts_run);
+    printf("peak memory %llu KiB\n", st.peak_rss / 1024);
+
+    print_mirror_stats(ctx);
+}
+
 /* ── usage functions ───────────────────────────────────────────────── */
 
 static void usage_main(FILE *out)
@@ -138,6 +241,9 @@ static void usage_main(FILE *out)
         "  clean               Remove cached package files\n"
         "  files <pkg>         List files of an installed package\n"
         "  owns <path>         Find which package owns a file\n"
+        "  whatdepends <pkg>   List installed packages that depend on a package\n"
+        "  verify [pkgs...]    Check installed files against their digests\n"
+        "  db <action>         Manage the consolidated package database\n"
         "  print-architecture  Show configured architectures\n"
         "\n"
         "Run 'aept <command> --help' for command-specific options.\n",
@@ -178,6 +284,11 @@ static void usage_install(FILE *out)
         "  --force-confnew       Always install new conffiles without asking\n"
         "  --force-confold       Always keep old conffiles without asking\n"
         "  --keep-going          Continue past per-package errors\n"
+        "  --download-jobs=N     Fetch up to N packages in parallel\n"
+        "  --pipeline            Install packages while later ones download\n"
+        "  --prefetch            Only download, at low priority, for later\n"
+        "  --download-rate=KIB   Download at most KIB KiB/s\n"
+        "  --root=DIR            Apply to offline root DIR; may be repeated\n"
     );
 }
 
@@ -236,6 +347,11 @@ static void usage_upgrade(FILE *out)
         "  --force-confnew       Always install new conffiles without asking\n"
         "  --force-confold       Always keep old conffiles without asking\n"
         "  --keep-going          Continue past per-package errors\n"
+        "  --download-jobs=N     Fetch up to N packages in parallel\n"
+        "  --pipeline            Install packages while later ones download\n"
+        "  --prefetch            Only download, at low priority, for later\n"
+        "  --download-rate=KIB   Download at most KIB KiB/s\n"
+        "  --root=DIR            Apply to offline root DIR; may be repeated\n"
     );
 }
 
@@ -264,6 +380,8 @@ static void usage_list(FILE *out)
         "\n"
         "  --installed   Only show installed packages\n"
         "  --upgradable  Only show upgradable packages\n"
+        "  --cached      With --upgradable, answer from the saved summary\n"
+        "                while package lists and status are unchanged\n"
     );
 }
 
@@ -279,6 +397,19 @@ static void usage_owns(FILE *out)
     );
 }
 
+static void usage_whatdepends(FILE *out)
+{
+    fprintf(out,
+        "Usage: aept whatdepends [options] <package>\n"
+        "\n"
+        "List installed packages that depend on an installed package.\n"
+        "\n"
+        "Options:\n"
+        "  -r, --recursive  Also list packages that depend on it indirectly\n"
+        "  -h, --help       Show this help\n"
+    );
+}
+
 static void usage_files(FILE *out)
 {
     fprintf(out,
@@ -291,6 +422,21 @@ static void usage_files(FILE *out)
     );
 }
 
+static void usage_verify(FILE *out)
+{
+    fprintf(out,
+        "Usage: aept verify [options] [packages...]\n"
+        "\n"
+        "Check installed files against the digests recorded when they were\n"
+        "installed. With no arguments, check all installed packages.\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help  Show this help\n"
+        "\n"
+        "  --quick     Trust files whose size and mtime are unchanged\n"
+    );
+}
+
 static void usage_show(FILE *out)
 {
     fprintf(out,
@@ -333,6 +479,23 @@ static void usage_pin(FILE *out)
     );
 }
 
+static void usage_db(FILE *out)
+{
+    fprintf(out,
+        "Usage: aept db import\n"
+        "       aept db export <dir>\n"
+        "       aept db compact\n"
+        "\n"
+        "Manage the consolidated package database kept with the info_db\n"
+        "option.  import creates it from the info directory or brings it\n"
+        "up to date, export writes the files it holds to <dir> in the\n"
+        "layout of the info directory, compact drops replaced records.\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help  Show this help\n"
+    );
+}
+
 static void usage_print_architecture(FILE *out)
 {
     fprintf(out,
@@ -364,6 +527,11 @@ static struct option install_options[] = {
     {"force-confold",   no_argument, NULL, 0x104},
     {"non-interactive", no_argument, NULL, 0x105},
     {"keep-going",      no_argument, NULL, 0x106},
+    {"download-jobs",   required_argument, NULL, 0x107},
+    {"pipeline",        no_argument, NULL, 0x108},
+    {"prefetch",        no_argument, NULL, 0x109},
+    {"download-rate",   required_argument, NULL, 0x10a},
+    {"root",            required_argument, NULL, 0x10b},
     {NULL, 0, NULL, 0}
 };
 
@@ -398,6 +566,7 @@ static struct option list_options[] = {
     {"help",       no_argument, NULL, 'h'},
     {"installed",  no_argument, NULL, 0x100},
     {"upgradable", no_argument, NULL, 0x101},
+    {"cached",     no_argument, NULL, 0x102},
     {NULL, 0, NULL, 0}
 };
 
@@ -416,6 +585,18 @@ static struct option owns_options[] = {
     {NULL, 0, NULL, 0}
 };
 
+static struct option whatdepends_options[] = {
+    {"recursive", no_argument, NULL, 'r'},
+    {"help",      no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static struct option verify_options[] = {
+    {"help",  no_argument, NULL, 'h'},
+    {"quick", no_argument, NULL, 0x100},
+    {NULL, 0, NULL, 0}
+};
+
 static struct option mark_options[] = {
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0}
@@ -437,6 +618,11 @@ static struct option pin_options[] = {
     {NULL, 0, NULL, 0}
 };
 
+static struct option db_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
 static struct option print_arch_options[] = {
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0}
@@ -461,6 +647,7 @@ static int cmd_update(int argc, char *argv[])
         return 1;
 
     r = aept_update(ctx);
+    print_stats(ctx);
     aept_cleanup(ctx);
     return r != 0 ? 1 : 0;
 }
@@ -470,7 +657,10 @@ static int cmd_install(int argc, char *argv[])
     int force_depends = 0, download_only = 0, noaction = 0;
     int allow_downgrade = 0, reinstall = 0, no_cache = 0;
     int force_confnew = 0, force_confold = 0, non_interactive = 0;
-    int keep_going = 0;
+    int keep_going = 0, download_jobs = 0, pipeline = 0;
+    int prefetch = 0, download_rate = 0;
+    const char **roots = NULL;
+    int n_roots = 0;
     int opt, r;
 
     optind = 1;
@@ -486,6 +676,22 @@ static int cmd_install(int argc, char *argv[])
         case 0x104: force_confold = 1; break;
         case 0x105: non_interactive = 1; break;
         case 0x106: keep_going = 1; break;
+        case 0x107:
+            download_jobs = parse_count("download-jobs", optarg, 9999);
+            if (download_jobs < 0)
+                return 1;
+            break;
+        case 0x108: pipeline = 1; break;
+        case 0x109: prefetch = 1; break;
+        case 0x10a:
+            download_rate = parse_count("download-rate", optarg, INT_MAX);
+            if (download_rate < 0)
+                return 1;
+            break;
+        case 0x10b:
+            roots = aept_realloc(roots, (n_roots + 1) * sizeof(char *));
+            roots[n_roots++] = optarg;
+            break;
         case 'h': usage_install(stdout); return 0;
         default:  usage_install(stderr); return 1;
         }
@@ -493,6 +699,7 @@ static int cmd_install(int argc, char *argv[])
 
     if (optind >= argc) {
         aept_log_error("install requires at least one package name or .aep path");
+        free(roots);
         return 1;
     }
 
@@ -508,6 +715,7 @@ static int cmd_install(int argc, char *argv[])
             if (access(argv[j], R_OK) < 0) {
                 aept_log_error("cannot access '%s': %s",
                           argv[j], strerror(errno));
+                free(roots);
                 free(pkg_names);
                 free(local_paths);
                 return 1;
@@ -520,6 +728,7 @@ static int cmd_install(int argc, char *argv[])
 
     aept_ctx_t *ctx = init_aept();
     if (!ctx) {
+        free(roots);
         free(pkg_names);
         free(local_paths);
         return 1;
@@ -539,11 +748,21 @@ static int cmd_install(int argc, char *argv[])
     aept_set_flag(ctx, AEPT_FLAG_KEEP_GOING, keep_going);
     if (non_interactive && !force_confnew)
         aept_set_flag(ctx, AEPT_FLAG_FORCE_CONFOLD, 1);
-
-    r = aept_install(ctx, n_names > 0 ? pkg_names : NULL, n_names,
-                     n_locals > 0 ? local_paths : NULL, n_locals);
+    if (download_jobs > 0)
+        aept_set_download_jobs(ctx, download_jobs);
+    if (pipeline)
+        aept_set_flag(ctx, AEPT_FLAG_PIPELINE_DOWNLOADS, 1);
+    if (prefetch)
+        aept_set_flag(ctx, AEPT_FLAG_PREFETCH, 1);
+    if (download_rate > 0)
+        aept_set_download_rate(ctx, download_rate);
+
+    r = run_install(ctx, roots, n_roots, n_names > 0 ? pkg_names : NULL,
+                    n_names, n_locals > 0 ? local_paths : NULL, n_locals);
+    free(roots);
     free(pkg_names);
     free(local_paths);
+    print_stats(ctx);
     aept_cleanup(ctx);
     return r != 0 ? 1 : 0;
 }
@@ -580,6 +799,7 @@ static int cmd_autoremove(int argc, char *argv[])
     aept_set_flag(ctx, AEPT_FLAG_KEEP_GOING, keep_going);
 
     r = aept_autoremove(ctx);
+    print_stats(ctx);
     aept_cleanup(ctx);
     return r != 0 ? 1 : 0;
 }
@@ -621,6 +841,7 @@ static int cmd_remove(int argc, char *argv[])
     aept_set_flag(ctx, AEPT_FLAG_KEEP_GOING, keep_going);
 
     r = aept_remove(ctx, (const char **)&argv[optind], argc - optind);
+    print_stats(ctx);
     aept_cleanup(ctx);
     return r != 0 ? 1 : 0;
 }
@@ -630,7 +851,10 @@ static int cmd_upgrade(int argc, char *argv[])
     int force_depends = 0, download_only = 0, noaction = 0;
     int allow_downgrade = 0, no_cache = 0;
     int force_confnew = 0, force_confold = 0, non_interactive = 0;
-    int keep_going = 0;
+    int keep_going = 0, download_jobs = 0, pipeline = 0;
+    int prefetch = 0, download_rate = 0;
+    const char **roots = NULL;
+    int n_roots = 0;
     int opt, r;
 
     optind = 1;
@@ -646,14 +870,32 @@ static int cmd_upgrade(int argc, char *argv[])
         case 0x104: force_confold = 1; break;
         case 0x105: non_interactive = 1; break;
         case 0x106: keep_going = 1; break;
+        case 0x107:
+            download_jobs = parse_count("download-jobs", optarg, 9999);
+            if (download_jobs < 0)
+                return 1;
+            break;
+        case 0x108: pipeline = 1; break;
+        case 0x109: prefetch = 1; break;
+        case 0x10a:
+            download_rate = parse_count("download-rate", optarg, INT_MAX);
+            if (download_rate < 0)
+                return 1;
+            break;
+        case 0x10b:
+            roots = aept_realloc(roots, (n_roots + 1) * sizeof(char *));
+            roots[n_roots++] = optarg;
+            break;
         case 'h': usage_upgrade(stdout); return 0;
         default:  usage_upgrade(stderr); return 1;
         }
     }
 
     aept_ctx_t *ctx = init_aept();
-    if (!ctx)
+    if (!ctx) {
+        free(roots);
         return 1;
+    }
 
     non_interactive = non_interactive || !isatty(STDIN_FILENO);
 
@@ -668,8 +910,18 @@ static int cmd_upgrade(int argc, char *argv[])
     aept_set_flag(ctx, AEPT_FLAG_KEEP_GOING, keep_going);
     if (non_interactive && !force_confnew)
         aept_set_flag(ctx, AEPT_FLAG_FORCE_CONFOLD, 1);
-
-    r = aept_upgrade(ctx);
+    if (download_jobs > 0)
+        aept_set_download_jobs(ctx, download_jobs);
+    if (pipeline)
+        aept_set_flag(ctx, AEPT_FLAG_PIPELINE_DOWNLOADS, 1);
+    if (prefetch)
+        aept_set_flag(ctx, AEPT_FLAG_PREFETCH, 1);
+    if (download_rate > 0)
+        aept_set_download_rate(ctx, download_rate);
+
+    r = run_install(ctx, roots, n_roots, NULL, 0, NULL, 0);
+    free(roots);
+    print_stats(ctx);
     aept_cleanup(ctx);
     return r != 0 ? 1 : 0;
 }
@@ -695,18 +947,37 @@ static int cmd_clean(int argc, char *argv[])
     return r != 0 ? 1 : 0;
 }
 
+static int print_list_entry(const aept_pkg_entry_t *e, void *userdata)
+{
+    (void)userdata;
+    printf("%s - %s", e->name, e->version);
+
+    if (e->summary)
+        printf(" - %s", e->summary);
+
+    if (e->installed) {
+        if (e->upgradable)
+            printf(" [installed,upgradable]");
+        else
+            printf(" [installed]");
+    }
+
+    printf("\n");
+    return 0;
+}
+
 static int cmd_list(int argc, char *argv[])
 {
     const char *pattern = NULL;
-    int filter_installed = 0, filter_upgradable = 0;
-    aept_pkg_list_t list;
-    int opt, r, i;
+    int filter_installed = 0, filter_upgradable = 0, cached = 0;
+    int opt, r;
 
     optind = 1;
     while ((opt = getopt_long(argc, argv, "h", list_options, NULL)) != -1) {
         switch (opt) {
         case 0x100: filter_installed = 1; break;
         case 0x101: filter_upgradable = 1; break;
+        case 0x102: cached = 1; break;
         case 'h': usage_list(stdout); return 0;
         default:  usage_list(stderr); return 1;
         }
@@ -715,37 +986,30 @@ static int cmd_list(int argc, char *argv[])
     if (optind < argc)
         pattern = argv[optind];
 
-    aept_ctx_t *ctx = init_aept();
-    if (!ctx)
-        return 1;
-
-    r = aept_list(ctx, pattern, filter_installed, filter_upgradable, &list);
-    if (r < 0) {
-        aept_cleanup(ctx);
+    if (cached && (!filter_upgradable || filter_installed)) {
+        aept_log_error("--cached only works with --upgradable alone");
         return 1;
     }
 
-    for (i = 0; i < list.count; i++) {
-        aept_pkg_entry_t *e = &list.entries[i];
-
-        printf("%s - %s", e->name, e->version);
+    aept_ctx_t *ctx = init_aept();
+    if (!ctx)
+        return 1;
 
-        if (e->summary)
-            printf(" - %s", e->summary);
+    if (cached) {
+        aept_pkg_list_t list;
 
-        if (e->installed) {
-            if (e->upgradable)
-                printf(" [installed,upgradable]");
-            else
-                printf(" [installed]");
+        r = aept_list_upgradable_cached(ctx, pattern, &list);
+        if (r == 0) {
+            for (int i = 0; i < list.count; i++)
+                print_list_entry(&list.entries[i], NULL);
+            aept_pkg_list_free(&list);
         }
-
-        printf("\n");
+    } else {
+        r = aept_list_foreach(ctx, pattern, filter_installed,
+                              filter_upgradable, print_list_entry, NULL);
     }
-
-    aept_pkg_list_free(&list);
     aept_cleanup(ctx);
-    return 0;
+    return r < 0 ? 1 : 0;
 }
 
 static int cmd_show(int argc, char *argv[])
@@ -911,6 +1175,102 @@ static int cmd_owns(int argc, char *argv[])
     return 0;
 }
 
+static int cmd_whatdepends(int argc, char *argv[])
+{
+    char **names;
+    int count, flags = 0;
+    int opt, r, i;
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "rh", whatdepends_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'r': flags |= AEPT_WHATDEPENDS_RECURSIVE; break;
+        case 'h': usage_whatdepends(stdout); return 0;
+        default:  usage_whatdepends(stderr); return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        aept_log_error("whatdepends requires a package name");
+        return 1;
+    }
+
+    aept_ctx_t *ctx = init_aept();
+    if (!ctx)
+        return 1;
+
+    r = aept_whatdepends(ctx, argv[optind], flags, &names, &count);
+    if (r != 0) {
+        if (r > 0)
+            aept_log_error("package '%s' is not installed", argv[optind]);
+        aept_cleanup(ctx);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        printf("%s\n", names[i]);
+        free(names[i]);
+    }
+    free(names);
+
+    aept_cleanup(ctx);
+    return 0;
+}
+
+static const char *verify_problem_name(int problem)
+{
+    switch (problem) {
+    case AEPT_VERIFY_MISSING:    return "missing";
+    case AEPT_VERIFY_MODIFIED:   return "modified";
+    case AEPT_VERIFY_UNREADABLE: return "unreadable";
+    default:                     return "unknown";
+    }
+}
+
+static int cmd_verify(int argc, char *argv[])
+{
+    aept_verify_problem_t *problems;
+    int flags = 0;
+    int count;
+    int opt, r, i;
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "h", verify_options, NULL)) != -1) {
+        switch (opt) {
+        case 0x100: flags |= AEPT_VERIFY_QUICK; break;
+        case 'h': usage_verify(stdout); return 0;
+        default:  usage_verify(stderr); return 1;
+        }
+    }
+
+    aept_ctx_t *ctx = init_aept();
+    if (!ctx)
+        return 1;
+
+    r = aept_verify(ctx, (const char **)(argv + optind), argc - optind,
+                    flags, &problems, &count);
+    if (r < 0) {
+        aept_cleanup(ctx);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        const char *path = problems[i].path;
+
+        while (path[0] == '.' && path[1] == '/')
+            path += 2;
+        while (path[0] == '/')
+            path++;
+        printf("%s %s /%s\n", verify_problem_name(problems[i].problem),
+               problems[i].package, path);
+    }
+    aept_verify_problems_free(problems, count);
+
+    aept_cleanup(ctx);
+    return r != 0 ? 1 : 0;
+}
+
 static int cmd_mark_manual(int argc, char *argv[])
 {
     int all = 0;
@@ -1057,6 +1417,53 @@ static int cmd_unpin(int argc, char *argv[])
     return r != 0 ? 1 : 0;
 }
 
+static int cmd_db(int argc, char *argv[])
+{
+    const char *action;
+    int opt, r;
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "+h", db_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h': usage_db(stdout); return 0;
+        default:  usage_db(stderr); return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage_db(stderr);
+        return 1;
+    }
+
+    action = argv[optind];
+
+    if (strcmp(action, "import") != 0 && strcmp(action, "export") != 0 &&
+            strcmp(action, "compact") != 0) {
+        aept_log_error("unknown db action '%s'", action);
+        usage_db(stderr);
+        return 1;
+    }
+
+    if (optind + 1 + (strcmp(action, "export") == 0) != argc) {
+        usage_db(stderr);
+        return 1;
+    }
+
+    aept_ctx_t *ctx = init_aept();
+    if (!ctx)
+        return 1;
+
+    if (strcmp(action, "import") == 0)
+        r = aept_db_import(ctx);
+    else if (strcmp(action, "export") == 0)
+        r = aept_db_export(ctx, argv[optind + 1]);
+    else
+        r = aept_db_compact(ctx);
+
+    aept_cleanup(ctx);
+    return r != 0 ? 1 : 0;
+}
+
 static int cmd_print_architecture(int argc, char *argv[])
 {
     char **archs;
@@ -1149,12 +1556,18 @@ int main(int argc, char *argv[])
         rc = cmd_files(sub_argc, sub_argv);
     else if (strcmp(command, "owns") == 0)
         rc = cmd_owns(sub_argc, sub_argv);
+    else if (strcmp(command, "whatdepends") == 0)
+        rc = cmd_whatdepends(sub_argc, sub_argv);
+    else if (strcmp(command, "verify") == 0)
+        rc = cmd_verify(sub_argc, sub_argv);
     else if (strcmp(command, "mark") == 0)
         rc = cmd_mark(sub_argc, sub_argv);
     else if (strcmp(command, "pin") == 0)
         rc = cmd_pin(sub_argc, sub_argv);
     else if (strcmp(command, "unpin") == 0)
         rc = cmd_unpin(sub_argc, sub_argv);
+    else if (strcmp(command, "db") == 0)
+        rc = cmd_db(sub_argc, sub_argv);
     else if (strcmp(command, "print-architecture") == 0)
         rc = cmd_print_architecture(sub_argc, sub_argv);
     else {
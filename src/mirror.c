@@ -0,0 +1,235 @@
+/* mirror.c - choosing among the mirrors of a source
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fetch.h>
+
+#include "aept/internal.h"
+#include "aept/download.h"
+#include "aept/mirror.h"
+#include "aept/msg.h"
+#include "aept/util.h"
+
+/* Size of the download a ranking is made for */
+#define MIRROR_TYPICAL_BYTES (1024 * 1024)
+
+/* Fewer bytes received say nothing about a mirror's throughput */
+#define MIRROR_MIN_BYTES (64 * 1024)
+
+/* Latency assumed for a mirror never heard from, which puts it after
+ * the ones that were */
+#define MIRROR_UNKNOWN_NS (60ULL * 1000000000ULL)
+
+static unsigned long long ns_between(const struct timespec *a,
+                                     const struct timespec *b)
+{
+    long long d = (long long)(b->tv_sec - a->tv_sec) * 1000000000LL
+        + (b->tv_nsec - a->tv_nsec);
+
+    return d > 0 ? (unsigned long long)d : 0;
+}
+
+void aept_mirror_begin(aept_mirror_req_t *req, aept_mirror_t *m)
+{
+    memset(req, 0, sizeof(*req));
+    req->mirror = m;
+    clock_gettime(CLOCK_MONOTONIC, &req->start);
+}
+
+void aept_mirror_responded(aept_mirror_req_t *req)
+{
+    clock_gettime(CLOCK_MONOTONIC, &req->first);
+    req->responded = 1;
+}
+
+void aept_mirror_received(aept_mirror_req_t *req, unsigned long long n)
+{
+    req->bytes += n;
+}
+
+void aept_mirror_end(aept_mirror_req_t *req, int ok)
+{
+    aept_mirror_t *m = req->mirror;
+    struct timespec now;
+
+    /* An interrupted request says nothing about the mirror */
+    if (!m || (!ok && aept_cancelled()))
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    m->requests++;
+
+    if (req->responded) {
+        m->latency_ns = (long long)ns_between(&req->start, &req->first);
+        if (req->bytes > 0) {
+            m->bytes += req->bytes;
+            m->ns += ns_between(&req->first, &now);
+        }
+    }
+
+    if (ok) {
+        m->down = 0;
+    } else {
+        m->failures++;
+        m->down = 1;
+    }
+}
+
+/* Expected time in ns for m to deliver a typical package */
+static unsigned long long mirror_cost(aept_mirror_t *m)
+{
+    long long latency = m->latency_ns;
+    unsigned long long bytes = m->bytes, ns = m->ns;
+    unsigned long long cost;
+
+    cost = latency >= 0 ? (unsigned long long)latency : MIRROR_UNKNOWN_NS;
+    if (bytes >= MIRROR_MIN_BYTES)
+        cost += (unsigned long long)((double)ns * MIRROR_TYPICAL_BYTES /
+                                     bytes);
+    return cost;
+}
+
+int aept_mirror_order(struct aept_ctx *ctx, int src, unsigned int shift,
+                      int *order)
+{
+    aept_source_t *s = &ctx->config.sources[src];
+    int n = s->nmirrors, healthy = 0;
+    unsigned long long *cost;
+    int *down;
+    int i, j;
+
+    if (n == 1) {
+        order[0] = 0;
+        return 1;
+    }
+
+    cost = aept_malloc(n * sizeof(*cost));
+    down = aept_malloc(n * sizeof(*down));
+
+    /* Insertion sort: there are only a few, and ties keep the order of
+     * the configuration. */
+    for (i = 0; i < n; i++) {
+        cost[i] = mirror_cost(&s->mirrors[i]);
+        down[i] = s->mirrors[i].down;
+        healthy += !down[i];
+
+        for (j = i; j > 0; j--) {
+            int prev = order[j - 1];
+
+            if (down[prev] < down[i] ||
+                    (down[prev] == down[i] && cost[prev] <= cost[i]))
+                break;
+            order[j] = prev;
+        }
+        order[j] = i;
+    }
+
+    /* down[] is free by now and takes the rotated prefix */
+    if (ctx->config.mirror_split && healthy > 1 && shift % healthy) {
+        for (i = 0; i < healthy; i++)
+            down[i] = order[(i + shift) % healthy];
+        memcpy(order, down, healthy * sizeof(int));
+    }
+
+    free(down);
+    free(cost);
+    return n;
+}
+
+/* ── Probing ──────────────────────────────────────────────────────── */
+
+typedef struct {
+    aept_source_t *src;
+    aept_mirror_t *mirror;
+} probe_t;
+
+static int probe_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    probe_t *p = &((probe_t *)arg)[i];
+    aept_mirror_req_t req;
+    struct url_stat us;
+    struct url *u;
+    char *url = NULL;
+    int ok = 0;
+
+    (void)ctx;
+    aept_asprintf(&url, "%s/%s", p->mirror->url,
+                  p->src->gzip ? "Packages.gz" : "Packages");
+
+    aept_mirror_begin(&req, p->mirror);
+    u = fetchParseURL(url);
+    if (u) {
+        ok = fetchStat(u, &us, "") == 0;
+        fetchFreeURL(u);
+    }
+    if (ok)
+        aept_mirror_responded(&req);
+    aept_mirror_end(&req, ok);
+
+    if (ok)
+        aept_log_debug("mirror %s of '%s' answered in %.1f ms",
+                       p->mirror->url, p->src->name,
+                       p->mirror->latency_ns / 1e6);
+    else
+        aept_log_debug("mirror %s of '%s' did not answer", p->mirror->url,
+                       p->src->name);
+
+    free(url);
+    return 0;
+}
+
+void aept_mirror_probe(struct aept_ctx *ctx)
+{
+    probe_t *probes = NULL;
+    int *results;
+    int n = 0, i, j;
+
+    for (i = 0; i < ctx->config.nsources; i++) {
+        aept_source_t *src = &ctx->config.sources[i];
+
+        if (src->nmirrors < 2 || src->probed)
+            continue;
+        src->probed = 1;
+
+        probes = aept_realloc(probes,
+                              (n + src->nmirrors) * sizeof(*probes));
+        for (j = 0; j < src->nmirrors; j++) {
+            probes[n].src = src;
+            probes[n].mirror = &src->mirrors[j];
+            n++;
+        }
+    }
+
+    if (n == 0)
+        return;
+
+    aept_download_init(ctx);
+
+    results = aept_malloc(n * sizeof(int));
+    aept_parallel_run(ctx, n, ctx->config.download_jobs, probe_task, probes,
+                      results);
+
+    free(results);
+    free(probes);
+}
+
+void aept_mirror_check_transport(struct aept_ctx *ctx)
+{
+    for (int i = 0; i < ctx->config.nsources; i++) {
+        aept_source_t *src = &ctx->config.sources[i];
+
+        for (int j = 0; j < src->nmirrors; j++) {
+            if (strncmp(src->mirrors[j].url, "https://", 8) != 0) {
+                aept_log_warning("source '%s' uses insecure transport",
+                                 src->name);
+                break;
+            }
+        }
+    }
+}
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -14,6 +15,7 @@
 
 #include "aept/aept.h"
 #include "aept/internal.h"
+#include "aept/event.h"
 #include "aept/msg.h"
 
 /* Thread-local logging context pointer.  Each thread that calls aept_init()
@@ -21,6 +23,10 @@
  * roots in different threads. */
 static _Thread_local struct aept_ctx *aept_log_ctx;
 
+/* Serializes output so that messages from download workers running
+ * alongside the main thread are never interleaved. */
+static pthread_mutex_t aept_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static const char *level_name[] = {
     [AEPT_ERROR]   = "error",
     [AEPT_WARNING] = "warning",
@@ -40,8 +46,20 @@ void aept_log_set_ctx(struct aept_ctx *ctx)
     aept_log_ctx = ctx;
 }
 
+void aept_log_set_fn(struct aept_ctx *ctx,
+                     void (*fn)(int level, const char *msg, void *userdata),
+                     void *userdata)
+{
+    pthread_mutex_lock(&aept_log_lock);
+    ctx->log_fn = fn;
+    ctx->log_userdata = userdata;
+    pthread_mutex_unlock(&aept_log_lock);
+}
+
 void aept_log(int level, const char *file, int line, const char *fmt, ...)
 {
+    void (*fn)(int level, const char *msg, void *userdata);
+    void *userdata;
     va_list ap;
     FILE *out;
     int use_color;
@@ -52,7 +70,7 @@ void aept_log(int level, const char *file, int line, const char *fmt, ...)
     if (aept_log_ctx && level > aept_log_ctx->config.verbosity)
         return;
 
-    if (aept_log_ctx && aept_log_ctx->log_fn) {
+    if (aept_log_ctx && (aept_log_ctx->events || aept_log_ctx->log_fn)) {
         char buf[1024];
         int n;
 
@@ -65,13 +83,26 @@ void aept_log(int level, const char *file, int line, const char *fmt, ...)
             snprintf(buf + n, sizeof(buf) - n, " (%s:%d)", file, line);
         }
 
-        aept_log_ctx->log_fn(level, buf, aept_log_ctx->log_userdata);
-        return;
+        if (aept_event_push(aept_log_ctx, AEPT_EVENT_LOG, level, buf) == 0)
+            return;
+
+        /* Not called under the lock, so that it may call into aept */
+        pthread_mutex_lock(&aept_log_lock);
+        fn = aept_log_ctx->log_fn;
+        userdata = aept_log_ctx->log_userdata;
+        pthread_mutex_unlock(&aept_log_lock);
+
+        if (fn) {
+            fn(level, buf, userdata);
+            return;
+        }
     }
 
     use_color = aept_log_ctx ? aept_log_ctx->use_color : 0;
     out = (level <= AEPT_WARNING) ? stderr : stdout;
 
+    pthread_mutex_lock(&aept_log_lock);
+
     if (use_color) {
         fprintf(out, "\033[1maept\033[0m: %s\033[1m%s\033[0m: ",
                 level_color[level], level_name[level]);
@@ -87,6 +118,8 @@ void aept_log(int level, const char *file, int line, const char *fmt, ...)
         fprintf(out, " (%s:%d)", file, line);
 
     fputc('\n', out);
+
+    pthread_mutex_unlock(&aept_log_lock);
 }
 
 void aept_display_transaction(const struct aept_transaction *txn)
@@ -220,5 +253,8 @@ void aept_print_names(const char **list, int count)
 
 int aept_cancelled(void)
 {
-    return aept_log_ctx ? aept_log_ctx->cancelled : 0;
+    if (!aept_log_ctx)
+        return 0;
+    return aept_log_ctx->cancelled ||
+           (aept_log_ctx->parent && aept_log_ctx->parent->cancelled);
 }
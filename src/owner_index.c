@@ -7,11 +7,18 @@
 #include <config.h>
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "aept/infodb.h"
 #include "aept/internal.h"
+#include "aept/msg.h"
 #include "aept/owner_index.h"
 #include "aept/util.h"
 
@@ -24,13 +31,8 @@ void aept_owner_index_free(aept_owner_index_t *idx)
 {
     int i;
 
-    for (i = 0; i < idx->count; i++)
-        free(idx->entries[i].path);
-    free(idx->entries);
-
-    for (i = 0; i < idx->n_recent; i++)
-        free(idx->recent[i].path);
     free(idx->recent);
+    aept_arena_free(&idx->recent_paths);
 
     for (i = 0; i < idx->n_owners; i++)
         free(idx->owners[i]);
@@ -40,6 +42,13 @@ void aept_owner_index_free(aept_owner_index_t *idx)
         free((char *)idx->dead[i]);
     free(idx->dead);
 
+    if (idx->map)
+        munmap(idx->map, idx->map_size);
+    free(idx->built_blocks);
+    free(idx->built_slots);
+    free(idx->built_paths);
+    free(idx->rec_owners);
+
     memset(idx, 0, sizeof(*idx));
 }
 
@@ -92,29 +101,12 @@ static int is_dead(aept_owner_index_t *idx, const char *owner)
     return 0;
 }
 
-static void array_append(aept_owner_entry_t **arr, int *count, int *alloc,
-                         const char *path, const char *owner)
-{
-    if (*count >= *alloc) {
-        *alloc = *alloc ? *alloc * 2 : 256;
-        *arr = aept_realloc(*arr, *alloc * sizeof(**arr));
-    }
-    (*arr)[*count].path = aept_strdup(path);
-    (*arr)[*count].owner = owner;
-    (*count)++;
-}
-
-/* Read list_path and append its normalized entries into arr. */
-static void read_list_into(const char *list_path, const char *owner,
-                           aept_owner_entry_t **arr, int *count, int *alloc)
+/* Read the next path of a .list file into buf and return it normalized,
+ * or NULL at the end of the file. */
+static const char *next_list_path(FILE *fp, char *buf, size_t size)
 {
-    FILE *fp = fopen(list_path, "r");
-    if (!fp)
-        return;
-
-    char buf[4096];
-    while (fgets(buf, sizeof(buf), fp)) {
-        if (aept_fgets_is_truncated(buf, sizeof(buf))) {
+    while (fgets(buf, (int)size, fp)) {
+        if (aept_fgets_is_truncated(buf, size)) {
             aept_fgets_drain_line(fp);
             continue;
         }
@@ -125,23 +117,298 @@ static void read_list_into(const char *list_path, const char *owner,
         if (tab)
             *tab = '\0';
 
+        if (buf[0] == '\0')
+            continue;
+
+        /* The root directory is recorded as "." */
         const char *p = strip_leading(buf);
-        if (p[0] == '\0')
+        return p[0] != '\0' ? p : ".";
+    }
+    return NULL;
+}
+
+/*
+ * Main index table.  Records are sorted by path and numbered from 0.
+ * The paths are stored one after the other, in blocks of
+ * AEPT_OWNER_INDEX_BLOCK: the first path of a block is a plain
+ * NUL-terminated string, every other one is the length of the prefix
+ * it shares with the path before it (two bytes, little endian) followed
+ * by the rest of it, NUL-terminated.  A lookup bisects the first paths
+ * of the blocks and decodes one block.  Installed trees share long
+ * directory prefixes, so this is a fraction of the plain size.
+ */
+
+/* Longest path the table holds, including the terminator */
+#define OWNER_PATH_MAX 4096
+
+typedef struct {
+    uint32_t *blocks;
+    size_t n_blocks;
+    size_t blocks_alloc;
+    uint32_t *slots;
+    size_t n_recs;
+    size_t slots_alloc;
+    char *paths;
+    size_t paths_size;
+    size_t paths_alloc;
+    char prev[OWNER_PATH_MAX];
+    size_t prev_len;
+} table_writer_t;
+
+static void writer_put(table_writer_t *w, const void *data, size_t len)
+{
+    if (w->paths_size + len > w->paths_alloc) {
+        w->paths_alloc = w->paths_alloc ? w->paths_alloc * 2 : 0x10000;
+        while (w->paths_size + len > w->paths_alloc)
+            w->paths_alloc *= 2;
+        w->paths = aept_realloc(w->paths, w->paths_alloc);
+    }
+    memcpy(w->paths + w->paths_size, data, len);
+    w->paths_size += len;
+}
+
+/* Append a record; paths must come in sorted order.  Returns -1 if the
+ * table would grow past what 32-bit offsets address. */
+static int writer_add(table_writer_t *w, const char *path, uint32_t slot)
+{
+    size_t len = strlen(path);
+
+    if (len >= OWNER_PATH_MAX || w->paths_size + len + 3 > UINT32_MAX)
+        return -1;
+
+    if (w->n_recs % AEPT_OWNER_INDEX_BLOCK == 0) {
+        if (w->n_blocks >= w->blocks_alloc) {
+            w->blocks_alloc = w->blocks_alloc ? w->blocks_alloc * 2 : 64;
+            w->blocks = aept_realloc(w->blocks,
+                                     w->blocks_alloc * sizeof(*w->blocks));
+        }
+        w->blocks[w->n_blocks++] = (uint32_t)w->paths_size;
+        writer_put(w, path, len + 1);
+    } else {
+        size_t n = 0;
+        unsigned char shared[2];
+
+        while (n < len && n < w->prev_len && path[n] == w->prev[n])
+            n++;
+        shared[0] = (unsigned char)(n & 0xff);
+        shared[1] = (unsigned char)(n >> 8);
+        writer_put(w, shared, sizeof(shared));
+        writer_put(w, path + n, len - n + 1);
+    }
+
+    memcpy(w->prev, path, len + 1);
+    w->prev_len = len;
+
+    if (w->n_recs >= w->slots_alloc) {
+        w->slots_alloc = w->slots_alloc ? w->slots_alloc * 2 : 1024;
+        w->slots = aept_realloc(w->slots, w->slots_alloc * sizeof(*w->slots));
+    }
+    w->slots[w->n_recs++] = slot;
+    return 0;
+}
+
+static void writer_free(table_writer_t *w)
+{
+    free(w->blocks);
+    free(w->slots);
+    free(w->paths);
+}
+
+/* Sequential decoder of the main index, positioned on a block */
+typedef struct {
+    const aept_owner_index_t *idx;
+    size_t rec;
+    size_t pos;
+    char path[OWNER_PATH_MAX];
+} table_iter_t;
+
+static void iter_seek(table_iter_t *it, const aept_owner_index_t *idx,
+                      size_t block)
+{
+    it->idx = idx;
+    it->rec = block * AEPT_OWNER_INDEX_BLOCK;
+    it->pos = block < idx->n_blocks ? idx->blocks[block] : 0;
+}
+
+/* Decode the next record into it->path and return its owner slot, or
+ * -1 after the last record.  A mapped table was validated at load
+ * time. */
+static long iter_next(table_iter_t *it)
+{
+    const aept_owner_index_t *idx = it->idx;
+    const unsigned char *p;
+    size_t shared = 0, len;
+
+    if (it->rec >= idx->n_recs)
+        return -1;
+
+    if (it->rec % AEPT_OWNER_INDEX_BLOCK != 0) {
+        p = (const unsigned char *)idx->paths + it->pos;
+        shared = (size_t)p[0] | (size_t)p[1] << 8;
+        it->pos += 2;
+    }
+
+    len = strlen(idx->paths + it->pos);
+    memcpy(it->path + shared, idx->paths + it->pos, len + 1);
+    it->pos += len + 1;
+    return (long)idx->rec_slots[it->rec++];
+}
+
+/* Position it on the block in which the first record for path, if any,
+ * is found */
+static void iter_find(table_iter_t *it, const aept_owner_index_t *idx,
+                      const char *path)
+{
+    size_t lo = 0, hi = idx->n_blocks;
+
+    /* Last block whose first path sorts before path.  Equal paths may
+     * end the block before one that starts with path. */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->paths + idx->blocks[mid], path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    iter_seek(it, idx, lo > 0 ? lo - 1 : 0);
+}
+
+/* Report the live owners of path in the main index to fn, or with fn
+ * NULL return the first of them. */
+static const char *table_owners(aept_owner_index_t *idx, const char *path,
+                                void (*fn)(const char *owner, void *userdata),
+                                void *userdata)
+{
+    table_iter_t it;
+    long slot;
+
+    if (idx->n_recs == 0)
+        return NULL;
+
+    iter_find(&it, idx, path);
+    while ((slot = iter_next(&it)) >= 0) {
+        int c = strcmp(it.path, path);
+        if (c < 0)
             continue;
+        if (c > 0)
+            break;
 
-        array_append(arr, count, alloc, p, owner);
+        const char *owner = idx->rec_owners[slot];
+        if (is_dead(idx, owner))
+            continue;
+        if (!fn)
+            return owner;
+        fn(owner, userdata);
     }
+    return NULL;
+}
 
-    fclose(fp);
+/* Path and owner slot of a record read from the .list files */
+typedef struct {
+    uint32_t path;
+    uint32_t slot;
+} raw_rec_t;
+
+/* Records being built and the paths they point to */
+typedef struct {
+    raw_rec_t *recs;
+    size_t n_recs;
+    size_t recs_alloc;
+    char *strtab;
+    size_t strtab_size;
+    size_t strtab_alloc;
+} raw_table_t;
+
+static int raw_add(raw_table_t *t, const char *path, uint32_t slot)
+{
+    size_t len = strlen(path) + 1;
+
+    if (t->strtab_size + len > UINT32_MAX)
+        return -1;
+
+    if (t->strtab_size + len > t->strtab_alloc) {
+        t->strtab_alloc = t->strtab_alloc ? t->strtab_alloc * 2 : 0x10000;
+        while (t->strtab_size + len > t->strtab_alloc)
+            t->strtab_alloc *= 2;
+        t->strtab = aept_realloc(t->strtab, t->strtab_alloc);
+    }
+    if (t->n_recs >= t->recs_alloc) {
+        t->recs_alloc = t->recs_alloc ? t->recs_alloc * 2 : 1024;
+        t->recs = aept_realloc(t->recs, t->recs_alloc * sizeof(*t->recs));
+    }
+
+    memcpy(t->strtab + t->strtab_size, path, len);
+    t->recs[t->n_recs].path = (uint32_t)t->strtab_size;
+    t->recs[t->n_recs].slot = slot;
+    t->n_recs++;
+    t->strtab_size += len;
+    return 0;
 }
 
-int aept_owner_index_build(struct aept_ctx *ctx, aept_owner_index_t *idx)
+/* String table of the records qsort() is ordering on this thread */
+static _Thread_local const char *sort_strtab;
+
+static int raw_rec_cmp(const void *a, const void *b)
 {
-    DIR *dir = opendir(ctx->config.info_dir);
-    if (!dir)
-        return 0;     /* empty or missing info dir is fine */
+    const raw_rec_t *ra = a;
+    const raw_rec_t *rb = b;
+    return strcmp(sort_strtab + ra->path, sort_strtab + rb->path);
+}
+
+/* Read the paths of one .list file from fp into t.  Returns 0, or -1
+ * if t is full. */
+static int read_list_into(raw_table_t *t, FILE *fp, uint32_t slot)
+{
+    char buf[4096];
+    const char *path;
+    int ret = 0;
+
+    while (ret == 0 && (path = next_list_path(fp, buf, sizeof(buf))))
+        ret = raw_add(t, path, slot);
+
+    return ret;
+}
+
+/* Owner slot of name, interning it */
+static uint32_t owner_slot(aept_owner_index_t *idx, const char *name)
+{
+    const char *owner = intern_owner(idx, name);
+    uint32_t slot = 0;
+
+    while (idx->owners[slot] != owner)
+        slot++;
+    return slot;
+}
+
+typedef struct {
+    aept_owner_index_t *idx;
+    raw_table_t *t;
+} db_lists_t;
+
+static int read_db_list(const aept_infodb_file_t *f, void *userdata)
+{
+    db_lists_t *dl = userdata;
+    uint32_t slot = owner_slot(dl->idx, f->name);
+    FILE *fp;
+    int r;
+
+    if (f->len == 0)
+        return 0;
+
+    fp = fmemopen((void *)f->data, f->len, "r");
+    if (!fp)
+        return -1;
+    r = read_list_into(dl->t, fp, slot);
+    fclose(fp);
+    return r;
+}
 
+/* Read the .list files of info_dir into t */
+static int read_dir_lists(struct aept_ctx *ctx, aept_owner_index_t *idx,
+                          DIR *dir, raw_table_t *t)
+{
     struct dirent *ent;
+
     while ((ent = readdir(dir)) != NULL) {
         const char *dot = strrchr(ent->d_name, '.');
         if (!dot || strcmp(dot, ".list") != 0)
@@ -152,22 +419,87 @@ int aept_owner_index_build(struct aept_ctx *ctx, aept_owner_index_t *idx)
         memcpy(name, ent->d_name, name_len);
         name[name_len] = '\0';
 
-        const char *owner = intern_owner(idx, name);
+        uint32_t slot = owner_slot(idx, name);
         free(name);
 
         char *list_path = NULL;
         aept_asprintf(&list_path, "%s/%s", ctx->config.info_dir, ent->d_name);
 
-        read_list_into(list_path, owner,
-                       &idx->entries, &idx->count, &idx->alloc);
+        FILE *fp = fopen(list_path, "r");
         free(list_path);
-    }
-    closedir(dir);
+        if (!fp)
+            continue;
 
-    qsort(idx->entries, idx->count, sizeof(*idx->entries), entry_cmp);
+        int r = read_list_into(t, fp, slot);
+        fclose(fp);
+        if (r < 0)
+            return -1;
+    }
     return 0;
 }
 
+int aept_owner_index_build(struct aept_ctx *ctx, aept_owner_index_t *idx)
+{
+    raw_table_t t = {0};
+    table_writer_t *w = NULL;
+    aept_infodb_t *db;
+    int ret = -1, r;
+
+    DIR *dir = opendir(ctx->config.info_dir);
+    if (!dir)
+        return 0;     /* empty or missing info dir is fine */
+
+    db = aept_infodb_open(ctx);
+    if (db) {
+        db_lists_t dl = { idx, &t };
+
+        r = aept_infodb_foreach(db, "list", read_db_list, &dl);
+        aept_infodb_close(db);
+    } else {
+        r = read_dir_lists(ctx, idx, dir, &t);
+    }
+    if (r != 0) {
+        aept_log_error("too many installed files to index");
+        goto cleanup;
+    }
+
+    sort_strtab = t.strtab;
+    qsort(t.recs, t.n_recs, sizeof(*t.recs), raw_rec_cmp);
+    sort_strtab = NULL;
+
+    w = aept_malloc(sizeof(*w));
+    memset(w, 0, sizeof(*w));
+    for (size_t i = 0; i < t.n_recs; i++) {
+        if (writer_add(w, t.strtab + t.recs[i].path, t.recs[i].slot) < 0) {
+            aept_log_error("too many installed files to index");
+            writer_free(w);
+            goto cleanup;
+        }
+    }
+
+    idx->built_blocks = w->blocks;
+    idx->built_slots = w->slots;
+    idx->built_paths = w->paths;
+    idx->blocks = w->blocks;
+    idx->n_blocks = w->n_blocks;
+    idx->rec_slots = w->slots;
+    idx->n_recs = w->n_recs;
+    idx->paths = w->paths;
+    idx->paths_size = w->paths_size;
+
+    idx->n_rec_owners = (uint32_t)idx->n_owners;
+    idx->rec_owners = aept_malloc((idx->n_owners + 1) * sizeof(char *));
+    memcpy(idx->rec_owners, idx->owners, idx->n_owners * sizeof(char *));
+    ret = 0;
+
+cleanup:
+    closedir(dir);
+    free(t.recs);
+    free(t.strtab);
+    free(w);
+    return ret;
+}
+
 const char *aept_owner_index_find(aept_owner_index_t *idx, const char *path)
 {
     path = strip_leading(path);
@@ -175,7 +507,7 @@ const char *aept_owner_index_find(aept_owner_index_t *idx, const char *path)
         return NULL;
 
     aept_owner_entry_t key;
-    key.path = (char *)path;
+    key.path = path;
     key.owner = NULL;
 
     /* Recent additions reflect the current transaction state, so they
@@ -187,27 +519,100 @@ const char *aept_owner_index_find(aept_owner_index_t *idx, const char *path)
             return hit->owner;
     }
 
-    if (idx->count > 0) {
-        aept_owner_entry_t *hit = bsearch(&key, idx->entries, idx->count,
-                                          sizeof(*idx->entries), entry_cmp);
-        if (hit && !is_dead(idx, hit->owner))
-            return hit->owner;
+    return table_owners(idx, path, NULL, NULL);
+}
+
+/* Call fn for the live owner of every entry in arr[0..n) equal to path */
+static void foreach_entry(aept_owner_index_t *idx,
+                          const aept_owner_entry_t *arr, int n,
+                          const char *path,
+                          void (*fn)(const char *owner, void *userdata),
+                          void *userdata)
+{
+    aept_owner_entry_t key = { path, NULL };
+    const aept_owner_entry_t *hit;
+    int i, lo, hi;
+
+    if (n == 0)
+        return;
+
+    hit = bsearch(&key, arr, n, sizeof(*arr), entry_cmp);
+    if (!hit)
+        return;
+
+    lo = hi = (int)(hit - arr);
+    while (lo > 0 && strcmp(arr[lo - 1].path, path) == 0)
+        lo--;
+    while (hi + 1 < n && strcmp(arr[hi + 1].path, path) == 0)
+        hi++;
+
+    for (i = lo; i <= hi; i++) {
+        if (!is_dead(idx, arr[i].owner))
+            fn(arr[i].owner, userdata);
     }
+}
 
-    return NULL;
+void aept_owner_index_foreach_owner(aept_owner_index_t *idx, const char *path,
+                                    void (*fn)(const char *owner,
+                                               void *userdata),
+                                    void *userdata)
+{
+    foreach_entry(idx, idx->recent, idx->n_recent, path, fn, userdata);
+    table_owners(idx, path, fn, userdata);
 }
 
-int aept_owner_index_add_owner_files(aept_owner_index_t *idx,
-                                     const char *owner_name,
-                                     const char *list_path)
+void aept_owner_index_add_files(aept_owner_index_t *idx,
+                                const char *owner_name,
+                                const aept_ar_file_list_t *files)
 {
     const char *owner = intern_owner(idx, owner_name);
+    int n = idx->n_recent, m = 0;
 
-    read_list_into(list_path, owner,
-                   &idx->recent, &idx->n_recent, &idx->recent_alloc);
+    if (n + files->count > idx->recent_alloc) {
+        while (n + files->count > idx->recent_alloc)
+            idx->recent_alloc = idx->recent_alloc ? idx->recent_alloc * 2
+                                                  : 256;
+        idx->recent = aept_realloc(idx->recent, idx->recent_alloc *
+                                   sizeof(*idx->recent));
+    }
 
-    qsort(idx->recent, idx->n_recent, sizeof(*idx->recent), entry_cmp);
-    return 0;
+    for (int i = 0; i < files->count; i++) {
+        const char *path = files->entries[i].path;
+
+        if (path[0] == '\0')
+            continue;
+
+        /* The root directory is recorded as "." */
+        path = strip_leading(path);
+        idx->recent[n + m].path = aept_arena_strdup(&idx->recent_paths,
+                                                    path[0] ? path : ".");
+        idx->recent[n + m].owner = owner;
+        m++;
+    }
+    idx->n_recent = n + m;
+
+    /* Sort the additions and merge them with the earlier ones */
+    qsort(idx->recent + n, m, sizeof(*idx->recent), entry_cmp);
+    if (n == 0 || m == 0 || entry_cmp(&idx->recent[n - 1],
+                                      &idx->recent[n]) <= 0)
+        return;
+
+    aept_owner_entry_t *merged = aept_malloc(idx->recent_alloc *
+                                             sizeof(*merged));
+    int i = 0, j = n, k = 0;
+    while (i < n && j < n + m) {
+        if (entry_cmp(&idx->recent[i], &idx->recent[j]) <= 0)
+            merged[k++] = idx->recent[i++];
+        else
+            merged[k++] = idx->recent[j++];
+    }
+    while (i < n)
+        merged[k++] = idx->recent[i++];
+    while (j < n + m)
+        merged[k++] = idx->recent[j++];
+
+    free(idx->recent);
+    idx->recent = merged;
 }
 
 void aept_owner_index_drop_owner(aept_owner_index_t *idx,
@@ -233,3 +638,407 @@ void aept_owner_index_drop_owner(aept_owner_index_t *idx,
         idx->owners[i] = idx->owners[--idx->n_owners];
     }
 }
+
+/*
+ * Persistent index.  The file is written in native byte order and laid
+ * out to be used directly from a read-only mapping:
+ *
+ *   header
+ *   uint32_t owner name offsets [n_owners]
+ *   uint32_t block offsets [n_blocks]
+ *   uint32_t owner slot of each record [n_recs]
+ *   owner names [names_size]                    (NUL-terminated strings)
+ *   paths [paths_size]                          (front coded, see above)
+ *
+ * The header records the info_dir inode and mtime at save time.  Every
+ * change to the database renames or unlinks a file in info_dir, so an
+ * index saved for a different state is detected and rebuilt.
+ */
+
+#define OWNER_INDEX_MAGIC   "AEPTOWNS"
+#define OWNER_INDEX_VERSION 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_owners;
+    uint64_t n_recs;
+    uint64_t n_blocks;
+    uint64_t names_size;
+    uint64_t paths_size;
+    uint64_t dir_dev;
+    uint64_t dir_ino;
+    int64_t dir_mtime_sec;
+    int64_t dir_mtime_nsec;
+} owner_index_header_t;
+
+static char *index_path(struct aept_ctx *ctx)
+{
+    char *path = NULL;
+    aept_asprintf(&path, "%s.owners", ctx->config.info_dir);
+    return path;
+}
+
+static int stat_info_dir(struct aept_ctx *ctx, owner_index_header_t *hdr)
+{
+    struct stat st;
+
+    if (stat(ctx->config.info_dir, &st) != 0)
+        return -1;
+
+    hdr->dir_dev = (uint64_t)st.st_dev;
+    hdr->dir_ino = (uint64_t)st.st_ino;
+    hdr->dir_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    hdr->dir_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/* Check that the front-coded paths decode within their table and that
+ * the blocks point where they start */
+static int validate_paths(const uint32_t *blocks, uint64_t n_recs,
+                          const char *paths, uint64_t paths_size)
+{
+    uint64_t pos = 0, prev_len = 0;
+
+    for (uint64_t i = 0; i < n_recs; i++) {
+        uint64_t shared = 0;
+
+        if (i % AEPT_OWNER_INDEX_BLOCK == 0) {
+            if (blocks[i / AEPT_OWNER_INDEX_BLOCK] != pos)
+                return -1;
+        } else {
+            const unsigned char *p = (const unsigned char *)paths + pos;
+            if (paths_size - pos < 2)
+                return -1;
+            shared = (uint64_t)p[0] | (uint64_t)p[1] << 8;
+            if (shared > prev_len)
+                return -1;
+            pos += 2;
+        }
+
+        const char *end = memchr(paths + pos, '\0', paths_size - pos);
+        if (!end)
+            return -1;
+
+        prev_len = shared + (uint64_t)(end - (paths + pos));
+        if (prev_len >= OWNER_PATH_MAX)
+            return -1;
+        pos = (uint64_t)(end - paths) + 1;
+    }
+
+    return pos == paths_size ? 0 : -1;
+}
+
+/* Check that the mapped file is self-consistent, so that lookups never
+ * read outside of it. */
+static int validate_map(const void *map, size_t size)
+{
+    const owner_index_header_t *hdr = map;
+
+    if (size < sizeof(*hdr) ||
+            memcmp(hdr->magic, OWNER_INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != OWNER_INDEX_VERSION)
+        return -1;
+
+    uint64_t words = size / 4;
+    if (hdr->n_recs > words || hdr->n_blocks > words ||
+            hdr->n_blocks != (hdr->n_recs + AEPT_OWNER_INDEX_BLOCK - 1) /
+                             AEPT_OWNER_INDEX_BLOCK ||
+            hdr->names_size > size || hdr->paths_size > size)
+        return -1;
+
+    uint64_t tables = sizeof(*hdr) +
+        4 * ((uint64_t)hdr->n_owners + hdr->n_blocks + hdr->n_recs);
+    if (tables + hdr->names_size + hdr->paths_size != size)
+        return -1;
+
+    const uint32_t *owner_off =
+        (const uint32_t *)((const char *)map + sizeof(*hdr));
+    const uint32_t *blocks = owner_off + hdr->n_owners;
+    const uint32_t *slots = blocks + hdr->n_blocks;
+    const char *names = (const char *)(slots + hdr->n_recs);
+    const char *paths = names + hdr->names_size;
+
+    if (hdr->names_size > 0 && names[hdr->names_size - 1] != '\0')
+        return -1;
+    for (uint32_t i = 0; i < hdr->n_owners; i++) {
+        if (owner_off[i] >= hdr->names_size)
+            return -1;
+    }
+    for (uint64_t i = 0; i < hdr->n_recs; i++) {
+        if (slots[i] >= hdr->n_owners)
+            return -1;
+    }
+
+    return validate_paths(blocks, hdr->n_recs, paths, hdr->paths_size);
+}
+
+int aept_owner_index_load(struct aept_ctx *ctx, aept_owner_index_t *idx)
+{
+    owner_index_header_t cur;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (stat_info_dir(ctx, &cur) != 0)
+        return -1;
+
+    char *path = index_path(ctx);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(cur)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const owner_index_header_t *hdr = map;
+    if (hdr->version != OWNER_INDEX_VERSION) {
+        aept_log_debug("owner index has an older format");
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    if (hdr->dir_dev != cur.dir_dev || hdr->dir_ino != cur.dir_ino ||
+            hdr->dir_mtime_sec != cur.dir_mtime_sec ||
+            hdr->dir_mtime_nsec != cur.dir_mtime_nsec) {
+        aept_log_debug("owner index is out of date");
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    if (validate_map(map, (size_t)st.st_size) != 0) {
+        aept_log_warning("ignoring corrupt owner index");
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    const uint32_t *owner_off =
+        (const uint32_t *)((const char *)map + sizeof(*hdr));
+    const char *names;
+
+    idx->map = map;
+    idx->map_size = (size_t)st.st_size;
+    idx->blocks = owner_off + hdr->n_owners;
+    idx->n_blocks = hdr->n_blocks;
+    idx->rec_slots = idx->blocks + hdr->n_blocks;
+    idx->n_recs = hdr->n_recs;
+    names = (const char *)(idx->rec_slots + hdr->n_recs);
+    idx->paths = names + hdr->names_size;
+    idx->paths_size = hdr->paths_size;
+
+    /* Owner names are unique in the file, so they are interned without
+     * the duplicate search that intern_owner() does. */
+    idx->n_rec_owners = hdr->n_owners;
+    idx->rec_owners = aept_malloc((hdr->n_owners + 1) * sizeof(char *));
+    idx->owners_alloc = (int)hdr->n_owners + 64;
+    idx->owners = aept_realloc(idx->owners,
+                               idx->owners_alloc * sizeof(char *));
+    for (uint32_t i = 0; i < hdr->n_owners; i++) {
+        idx->owners[idx->n_owners] = aept_strdup(names + owner_off[i]);
+        idx->rec_owners[i] = idx->owners[idx->n_owners++];
+    }
+
+    aept_log_debug("loaded owner index with %zu entries", idx->n_recs);
+    return 0;
+}
+
+int aept_owner_index_open(struct aept_ctx *ctx, aept_owner_index_t *idx)
+{
+    if (aept_owner_index_load(ctx, idx) == 0)
+        return 0;
+    if (aept_owner_index_build(ctx, idx) < 0)
+        return -1;
+
+    if (!ctx->config.low_memory || idx->n_recs == 0 ||
+            aept_owner_index_save(ctx, idx) < 0)
+        return 0;
+
+    aept_owner_index_free(idx);
+    aept_owner_index_init(idx);
+    if (aept_owner_index_load(ctx, idx) == 0)
+        return 0;
+    return aept_owner_index_build(ctx, idx);
+}
+
+static int owner_name_cmp(const void *a, const void *b)
+{
+    const char *const *pa = a;
+    const char *const *pb = b;
+    return strcmp(*pa, *pb);
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    const char *const *pa = a;
+    const char *const *pb = b;
+    return (*pa > *pb) - (*pa < *pb);
+}
+
+/* Owners of one path collected while saving */
+typedef struct {
+    const char **owners;
+    size_t count;
+    size_t alloc;
+} owner_group_t;
+
+static void group_add(aept_owner_index_t *idx, owner_group_t *g,
+                      const char *owner)
+{
+    if (is_dead(idx, owner))
+        return;
+    if (g->count >= g->alloc) {
+        g->alloc = g->alloc ? g->alloc * 2 : 8;
+        g->owners = aept_realloc(g->owners, g->alloc * sizeof(*g->owners));
+    }
+    g->owners[g->count++] = owner;
+}
+
+/* Merge the main index with the additions of this transaction, minus
+ * dropped owners, into w.  Slots are positions in the sorted slots[]. */
+static int merge_tables(aept_owner_index_t *idx, const char **slots,
+                        table_writer_t *w)
+{
+    table_iter_t it;
+    owner_group_t g = {0};
+    char path[OWNER_PATH_MAX];
+    long slot;
+    int r = 0;
+
+    iter_seek(&it, idx, 0);
+    slot = iter_next(&it);
+
+    for (int i = 0; r == 0 && (slot >= 0 || i < idx->n_recent); ) {
+        /* Next path in order, with all its owners from both sides */
+        if (slot >= 0 && (i >= idx->n_recent ||
+                          strcmp(it.path, idx->recent[i].path) <= 0))
+            memcpy(path, it.path, strlen(it.path) + 1);
+        else
+            memcpy(path, idx->recent[i].path,
+                   strlen(idx->recent[i].path) + 1);
+
+        g.count = 0;
+        while (slot >= 0 && strcmp(it.path, path) == 0) {
+            group_add(idx, &g, idx->rec_owners[slot]);
+            slot = iter_next(&it);
+        }
+        while (i < idx->n_recent && strcmp(idx->recent[i].path, path) == 0)
+            group_add(idx, &g, idx->recent[i++].owner);
+
+        /* Drop exact duplicates, e.g. a package reinstalled in place */
+        qsort(g.owners, g.count, sizeof(*g.owners), owner_name_cmp);
+        for (size_t k = 0; r == 0 && k < g.count; k++) {
+            if (k > 0 && g.owners[k] == g.owners[k - 1])
+                continue;
+            const char **hit = bsearch(&g.owners[k], slots, idx->n_owners,
+                                       sizeof(*slots), ptr_cmp);
+            r = writer_add(w, path, (uint32_t)(hit - slots));
+        }
+    }
+
+    free(g.owners);
+    return r;
+}
+
+int aept_owner_index_save(struct aept_ctx *ctx, aept_owner_index_t *idx)
+{
+    owner_index_header_t hdr;
+    table_writer_t *w;
+    const char **slots = NULL;
+    uint32_t *owner_off = NULL;
+    char *path = NULL, *tmp = NULL;
+    FILE *fp = NULL;
+    size_t i;
+    int ret = -1;
+
+    /* Owner slots are the positions in owners[], looked up by pointer */
+    slots = aept_malloc((idx->n_owners + 1) * sizeof(*slots));
+    memcpy(slots, idx->owners, idx->n_owners * sizeof(*slots));
+    qsort(slots, idx->n_owners, sizeof(*slots), ptr_cmp);
+
+    w = aept_malloc(sizeof(*w));
+    memset(w, 0, sizeof(*w));
+    if (merge_tables(idx, slots, w) < 0) {
+        aept_log_warning("owner index too large, not saving it");
+        goto cleanup;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, OWNER_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = OWNER_INDEX_VERSION;
+    hdr.n_owners = (uint32_t)idx->n_owners;
+    hdr.n_recs = w->n_recs;
+    hdr.n_blocks = w->n_blocks;
+    hdr.paths_size = w->paths_size;
+
+    owner_off = aept_malloc((idx->n_owners + 1) * sizeof(uint32_t));
+    for (i = 0; i < (size_t)idx->n_owners; i++) {
+        owner_off[i] = (uint32_t)hdr.names_size;
+        hdr.names_size += strlen(slots[i]) + 1;
+    }
+    if (hdr.names_size > UINT32_MAX) {
+        aept_log_warning("owner index too large, not saving it");
+        goto cleanup;
+    }
+
+    if (stat_info_dir(ctx, &hdr) != 0)
+        goto cleanup;
+
+    path = index_path(ctx);
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        aept_log_debug("cannot write owner index '%s': %s", tmp,
+                  strerror(errno));
+        goto cleanup;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(owner_off, sizeof(uint32_t), idx->n_owners, fp);
+    fwrite(w->blocks, sizeof(uint32_t), w->n_blocks, fp);
+    fwrite(w->slots, sizeof(uint32_t), w->n_recs, fp);
+    for (i = 0; i < (size_t)idx->n_owners; i++)
+        fwrite(slots[i], 1, strlen(slots[i]) + 1, fp);
+    fwrite(w->paths, 1, w->paths_size, fp);
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        fp = NULL;
+        aept_log_debug("failed to write owner index '%s'", tmp);
+        goto cleanup;
+    }
+    fp = NULL;
+
+    if (rename(tmp, path) != 0) {
+        aept_log_debug("cannot rename '%s': %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (ret != 0 && tmp)
+        unlink(tmp);
+    writer_free(w);
+    free(w);
+    free(owner_off);
+    free(tmp);
+    free(path);
+    free(slots);
+    return ret;
+}
+
+void aept_owner_index_discard(struct aept_ctx *ctx)
+{
+    char *path = index_path(ctx);
+    unlink(path);
+    free(path);
+}
@@ -0,0 +1,108 @@
+/* progress.c - progress reports of downloads, unpacking and scripts
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "aept/aept.h"
+#include "aept/internal.h"
+#include "aept/event.h"
+#include "aept/progress.h"
+
+/* Innermost running item of this thread */
+static _Thread_local aept_progress_t *current_item;
+
+/* Callbacks from download workers never run concurrently */
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(aept_progress_t *p, long long now)
+{
+    struct aept_ctx *ctx = p->ctx;
+
+    p->next = now + AEPT_PROGRESS_INTERVAL_NS;
+
+    if (aept_event_push_progress(ctx, p->phase, p->package, p->done,
+                                 p->total) == 0)
+        return;
+
+    pthread_mutex_lock(&progress_lock);
+    ctx->progress_fn(p->phase, p->package, p->done, p->total,
+                     ctx->progress_userdata);
+    pthread_mutex_unlock(&progress_lock);
+}
+
+void aept_progress_begin(struct aept_ctx *ctx, aept_progress_t *p,
+                         int phase, const char *package,
+                         unsigned long long total)
+{
+    p->ctx = ctx;
+    p->parent = current_item;
+    p->package = package;
+    p->done = 0;
+    p->total = total;
+    p->phase = phase;
+    p->active = ctx->progress_fn != NULL || ctx->events != NULL;
+    current_item = p;
+
+    if (p->active)
+        report(p, now_ns());
+}
+
+static void update(aept_progress_t *p)
+{
+    long long now = now_ns();
+
+    if (now >= p->next)
+        report(p, now);
+}
+
+void aept_progress_add(unsigned long long n)
+{
+    aept_progress_t *p = current_item;
+
+    if (!p || !p->active)
+        return;
+    p->done += n;
+    update(p);
+}
+
+void aept_progress_set(unsigned long long done)
+{
+    aept_progress_t *p = current_item;
+
+    if (!p || !p->active)
+        return;
+    p->done = done;
+    update(p);
+}
+
+void aept_progress_total(unsigned long long total)
+{
+    aept_progress_t *p = current_item;
+
+    if (!p || !p->active)
+        return;
+    p->total = total;
+}
+
+void aept_progress_end(aept_progress_t *p, int ok)
+{
+    current_item = p->parent;
+
+    if (!p->active)
+        return;
+    if (ok && p->total > p->done)
+        p->done = p->total;
+    report(p, now_ns());
+}
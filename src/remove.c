@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,10 +26,33 @@
 #include "aept/remove.h"
 #include "aept/script.h"
 #include "aept/solver.h"
+#include "aept/stats.h"
 #include "aept/status.h"
 #include "aept/trigger.h"
 #include "aept/util.h"
 
+/* ── File removal ─────────────────────────────────────────────────── */
+
+/* Files of one directory removed by a single task */
+#define REMOVE_BATCH 256
+
+typedef struct {
+    const char *path;   /* relative to the root */
+    size_t dir_len;     /* length of the parent part, 0 at the top */
+} rm_file_t;
+
+typedef struct {
+    size_t first;
+    size_t count;
+} rm_batch_t;
+
+typedef struct {
+    int root_fd;
+    const char *root;
+    rm_file_t *files;
+    rm_batch_t *batches;
+} rm_run_t;
+
 /* Sort directories by path length descending (deepest first) */
 static int dir_depth_cmp(const void *a, const void *b)
 {
@@ -40,30 +64,121 @@ static int dir_depth_cmp(const void *a, const void *b)
     return 0;
 }
 
-int aept_remove_files(struct aept_ctx *ctx, const char *name,
-                      aept_fileset_t *protected)
+/* Order files by parent directory, then by name, so that the files of a
+ * directory are adjacent */
+static int file_dir_cmp(const void *a, const void *b)
+{
+    const rm_file_t *fa = a, *fb = b;
+    size_t n = fa->dir_len < fb->dir_len ? fa->dir_len : fb->dir_len;
+    int c = memcmp(fa->path, fb->path, n);
+
+    if (c != 0)
+        return c;
+    if (fa->dir_len != fb->dir_len)
+        return fa->dir_len < fb->dir_len ? -1 : 1;
+    return strcmp(fa->path + fa->dir_len, fb->path + fb->dir_len);
+}
+
+static int same_dir(const rm_file_t *a, const rm_file_t *b)
+{
+    return a->dir_len == b->dir_len &&
+           memcmp(a->path, b->path, a->dir_len) == 0;
+}
+
+/* Unlink the files of one batch relative to their directory.  Returns
+ * the number of files removed. */
+static int remove_batch_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    rm_run_t *run = arg;
+    rm_batch_t *b = &run->batches[i];
+    rm_file_t *first = &run->files[b->first];
+    int dfd = run->root_fd, removed = 0;
+
+    (void)ctx;
+
+    if (first->dir_len > 0) {
+        char *dir = NULL;
+
+        aept_asprintf(&dir, "%.*s", (int)first->dir_len - 1, first->path);
+
+        dfd = openat(run->root_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd < 0 && errno != ENOENT)
+            aept_log_debug("cannot open '%s/%s': %s", run->root, dir,
+                           strerror(errno));
+        free(dir);
+        if (dfd < 0)
+            return 0;
+    }
+
+    for (size_t k = 0; k < b->count; k++) {
+        rm_file_t *f = &first[k];
+
+        if (unlinkat(dfd, f->path + f->dir_len, 0) == 0)
+            removed++;
+        else if (errno != ENOENT)
+            aept_log_debug("cannot remove '%s/%s': %s", run->root,
+                           f->path, strerror(errno));
+    }
+
+    if (dfd != run->root_fd)
+        close(dfd);
+    return removed;
+}
+
+/* Keep a conffile the admin has changed, unless purging */
+static int keep_conffile(aept_conffile_set_t *conffiles, const char *root,
+                         const char *path)
+{
+    char *full_path = NULL, *cur_md5;
+    const char *saved_md5;
+    int keep = 0;
+
+    if (conffiles->count == 0)
+        return 0;
+
+    saved_md5 = aept_conffile_set_lookup(conffiles, path);
+    if (saved_md5) {
+        aept_asprintf(&full_path, "%s/%s", root, path);
+        cur_md5 = aept_conffile_md5(full_path);
+        if (cur_md5 && strcmp(saved_md5, cur_md5) != 0) {
+            aept_log_info("not removing modified conffile '/%s'", path);
+            keep = 1;
+        }
+        free(cur_md5);
+        free(full_path);
+    }
+    return keep;
+}
+
+/* Read {name}.list into files and dirs, leaving out protected paths and
+ * modified conffiles.  Returns 0, or -1 if there is no list. */
+static int read_remove_list(struct aept_ctx *ctx, const char *name,
+                            const char *root, aept_fileset_t *protected,
+                            aept_arena_t *strings,
+                            rm_file_t **files_out, size_t *n_files_out,
+                            const char ***dirs_out, int *n_dirs_out)
 {
     char *list_path = NULL;
     FILE *fp;
     char buf[4096];
     aept_conffile_set_t conffiles;
-    char **dirs = NULL;
+    rm_file_t *files = NULL;
+    size_t n_files = 0, files_cap = 0;
+    const char **dirs = NULL;
     int n_dirs = 0;
     int dirs_cap = 0;
 
-    aept_conffile_set_init(&conffiles);
-    if (!ctx->config.purge)
-        aept_conffile_load(ctx, name, &conffiles);
-
     aept_asprintf(&list_path, "%s/%s.list", ctx->config.info_dir, name);
 
     fp = fopen(list_path, "r");
     free(list_path);
 
-    if (!fp) {
-        aept_conffile_set_free(&conffiles);
-        return 0;
-    }
+    if (!fp)
+        return -1;
+
+    aept_conffile_set_init(&conffiles);
+    if (!ctx->config.purge)
+        aept_conffile_load(ctx, name, &conffiles);
 
     while (fgets(buf, sizeof(buf), fp)) {
         char *path;
@@ -103,64 +218,161 @@ int aept_remove_files(struct aept_ctx *ctx, const char *name,
         if (protected && aept_fileset_contains(protected, path))
             continue;
 
-        char *full_path = NULL;
-        aept_asprintf(&full_path, "%s/%s",
-                  ctx->config.offline_root ? ctx->config.offline_root : "", path);
-
         /* Collect directories for removal after files */
         if (S_ISDIR(mode)) {
             if (n_dirs >= dirs_cap) {
                 dirs_cap = dirs_cap ? dirs_cap * 2 : 32;
                 dirs = aept_realloc(dirs, dirs_cap * sizeof(char *));
             }
-            dirs[n_dirs++] = full_path;
+            dirs[n_dirs++] = aept_arena_strdup(strings, path);
             continue;
         }
 
-        /* Skip modified conffiles unless purging */
-        if (conffiles.count > 0) {
-            char *abs_path = NULL;
-            aept_asprintf(&abs_path, "/%s", path);
-            const char *saved_md5 = aept_conffile_set_lookup(&conffiles,
-                                                        abs_path);
-            if (saved_md5) {
-                char *cur_md5 = aept_conffile_md5(full_path);
-                if (cur_md5 && strcmp(saved_md5, cur_md5) != 0) {
-                    aept_log_info("not removing modified conffile '%s'",
-                             abs_path);
-                    free(cur_md5);
-                    free(abs_path);
-                    free(full_path);
-                    continue;
-                }
-                free(cur_md5);
-            }
-            free(abs_path);
-        }
+        if (keep_conffile(&conffiles, root, path))
+            continue;
 
-        if (unlink(full_path) < 0 && errno != ENOENT)
-            aept_log_debug("cannot remove '%s': %s",
-                      full_path, strerror(errno));
+        if (n_files >= files_cap) {
+            files_cap = files_cap ? files_cap * 2 : 64;
+            files = aept_realloc(files, files_cap * sizeof(*files));
+        }
 
-        free(full_path);
+        char *slash = strrchr(path, '/');
+        files[n_files].path = aept_arena_strdup(strings, path);
+        files[n_files].dir_len = slash ? (size_t)(slash - path) + 1 : 0;
+        n_files++;
     }
 
     fclose(fp);
     aept_conffile_set_free(&conffiles);
 
-    /* Remove directories deepest-first */
+    *files_out = files;
+    *n_files_out = n_files;
+    *dirs_out = dirs;
+    *n_dirs_out = n_dirs;
+    return 0;
+}
+
+/* Split the sorted files into batches of at most REMOVE_BATCH files of
+ * the same directory */
+static rm_batch_t *make_batches(rm_file_t *files, size_t n_files,
+                                int *n_batches_out)
+{
+    rm_batch_t *batches = NULL;
+    int n_batches = 0, cap = 0;
+
+    for (size_t i = 0; i < n_files; i++) {
+        rm_batch_t *last = n_batches > 0 ? &batches[n_batches - 1] : NULL;
+
+        if (last && last->count < REMOVE_BATCH &&
+                same_dir(&files[last->first], &files[i])) {
+            last->count++;
+            continue;
+        }
+
+        if (n_batches >= cap) {
+            cap = cap ? cap * 2 : 16;
+            batches = aept_realloc(batches, cap * sizeof(*batches));
+        }
+        batches[n_batches].first = i;
+        batches[n_batches].count = 1;
+        n_batches++;
+    }
+
+    *n_batches_out = n_batches;
+    return batches;
+}
+
+static int remove_jobs(struct aept_ctx *ctx)
+{
+    int jobs = ctx->config.remove_jobs;
+
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (int)n : 1;
+    }
+    return jobs;
+}
+
+int aept_remove_files(struct aept_ctx *ctx, const char *name,
+                      aept_fileset_t *protected)
+{
+    const char *root = ctx->config.offline_root ? ctx->config.offline_root
+                                                : "";
+    rm_file_t *files = NULL;
+    size_t n_files = 0;
+    const char **dirs = NULL;
+    int n_dirs = 0;
+    rm_batch_t *batches = NULL;
+    int n_batches = 0;
+    aept_arena_t strings = {0};
+    int *results = NULL;
+    unsigned long long n_removed = 0;
+    aept_stats_timer_t timer;
+    rm_run_t run;
+
+    if (read_remove_list(ctx, name, root, protected, &strings,
+                         &files, &n_files, &dirs, &n_dirs) < 0)
+        return 0;
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_REMOVE);
+
+    run.root = root;
+    run.root_fd = open(root[0] ? root : "/",
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (run.root_fd < 0) {
+        aept_log_debug("cannot open '%s': %s", root[0] ? root : "/",
+                       strerror(errno));
+        goto cleanup;
+    }
+
+    /* Unlink files directory by directory.  Batches touch disjoint
+     * directory entries, so they may run on several threads. */
+    if (n_files > 0) {
+        qsort(files, n_files, sizeof(*files), file_dir_cmp);
+        batches = make_batches(files, n_files, &n_batches);
+        results = aept_malloc(n_batches * sizeof(int));
+        for (int i = 0; i < n_batches; i++)
+            results[i] = -1;
+
+        run.files = files;
+        run.batches = batches;
+        aept_parallel_run(ctx, n_batches, remove_jobs(ctx),
+                          remove_batch_task, &run, results);
+
+        /* The workers stop taking batches on a cancel, but the package
+         * is dropped from the database after this all the same, so
+         * finish the ones they left rather than orphan their files. */
+        for (int i = 0; i < n_batches; i++) {
+            if (results[i] < 0)
+                results[i] = remove_batch_task(ctx, i, &run);
+            n_removed += (unsigned long long)results[i];
+        }
+    }
+
+    /* Remove directories deepest-first, once all files are gone */
     if (n_dirs > 0) {
         qsort(dirs, n_dirs, sizeof(char *), dir_depth_cmp);
 
         for (int i = 0; i < n_dirs; i++) {
-            if (rmdir(dirs[i]) < 0 && errno != ENOTEMPTY && errno != ENOENT)
-                aept_log_debug("cannot rmdir '%s': %s",
-                          dirs[i], strerror(errno));
-            free(dirs[i]);
+            if (unlinkat(run.root_fd, dirs[i], AT_REMOVEDIR) < 0 &&
+                    errno != ENOTEMPTY && errno != EEXIST &&
+                    errno != ENOENT)
+                aept_log_debug("cannot rmdir '%s/%s': %s",
+                               root, dirs[i], strerror(errno));
         }
-        free(dirs);
     }
 
+    close(run.root_fd);
+
+cleanup:
+    free(files);
+    free(dirs);
+    aept_arena_free(&strings);
+    free(batches);
+    free(results);
+
+    aept_stats_add(ctx, AEPT_STAT_FILES_REMOVED, n_removed);
+    aept_stats_end(&timer);
     return 0;
 }
 
@@ -220,6 +432,9 @@ int aept_do_remove(struct aept_ctx *ctx, const char *name,
     if (owners)
         aept_owner_index_drop_owner(owners, name);
 
+    if (!new_version)
+        aept_durability_barrier(ctx, AEPT_DURABILITY_PACKAGE);
+
     aept_log_debug("removed %s", name);
 
     return 0;
@@ -229,12 +444,15 @@ int aept_op_remove(struct aept_ctx *ctx, const char **names, int count)
 {
     Transaction *trans;
     Pool *pool;
+    int applied = 0;
     int i, r;
 
     r = aept_solver_init(ctx);
     if (r < 0)
         return -1;
 
+    aept_status_auto_begin(ctx);
+
     r = aept_status_load(ctx);
     if (r < 0)
         goto out;
@@ -290,7 +508,16 @@ int aept_op_remove(struct aept_ctx *ctx, const char **names, int count)
     aept_trigger_ctx_t tctx;
     aept_trigger_ctx_init(&tctx);
 
+    /* Keep the saved owner index current if there is one.  A stale
+     * index is left for the next install to rebuild. */
+    aept_owner_index_t owner_idx;
+    aept_owner_index_t *owners = NULL;
+    aept_owner_index_init(&owner_idx);
+    if (aept_owner_index_load(ctx, &owner_idx) == 0)
+        owners = &owner_idx;
+
     int had_error = 0;
+    applied = 1;
 
     for (i = 0; i < trans->steps.count; i++) {
         if (aept_cancelled()) {
@@ -311,7 +538,7 @@ int aept_op_remove(struct aept_ctx *ctx, const char **names, int count)
         const char *pkg_name = pool_id2str(pool, s->name);
 
         aept_trigger_ctx_collect_dirs(ctx, &tctx, pkg_name);
-        r = aept_do_remove(ctx, pkg_name, NULL, NULL, NULL);
+        r = aept_do_remove(ctx, pkg_name, NULL, NULL, owners);
         if (r < 0) {
             had_error = 1;
             if (!ctx->config.force_depends && !ctx->config.keep_going)
@@ -324,8 +551,19 @@ int aept_op_remove(struct aept_ctx *ctx, const char **names, int count)
 
 trigger_cleanup:
     aept_trigger_ctx_free(&tctx);
+    if (owners) {
+        if (r == 0)
+            aept_owner_index_save(ctx, owners);
+        else
+            aept_owner_index_discard(ctx);
+    }
+    aept_owner_index_free(&owner_idx);
 
 out:
+    if (aept_status_auto_commit(ctx) < 0)
+        r = -1;
+    if (applied)
+        aept_durability_barrier(ctx, AEPT_DURABILITY_TRANSACTION);
     aept_solver_fini(ctx);
     return r;
 }
@@ -11,7 +11,10 @@
 
 #include "aept/internal.h"
 #include "aept/msg.h"
+#include "aept/progress.h"
 #include "aept/script.h"
+#include "aept/stats.h"
+#include "aept/trace.h"
 #include "aept/util.h"
 
 static const char *strip_offline_root(struct aept_ctx *ctx, const char *path)
@@ -48,6 +51,16 @@ int aept_run_script(struct aept_ctx *ctx, const char *script_dir,
              action ? action : "",
              version ? version : "");
 
+    aept_stats_timer_t timer;
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_SCRIPTS);
+    aept_stats_add(ctx, AEPT_STAT_SCRIPTS_RUN, 1);
+
+    aept_progress_t progress;
+    aept_progress_begin(ctx, &progress, AEPT_PHASE_SCRIPTS, pkg_name, 0);
+
+    aept_trace_span_t span;
+    aept_trace_begin(ctx, &span, script, pkg_name);
+
     const char *run_path = path;
     if (ctx->config.offline_root)
         run_path = strip_offline_root(ctx, path);
@@ -63,6 +76,9 @@ int aept_run_script(struct aept_ctx *ctx, const char *script_dir,
         r = aept_system_offline_root(ctx, argv);
     }
 
+    aept_trace_end(&span);
+    aept_progress_end(&progress, r == 0);
+    aept_stats_end(&timer);
     free(path);
 
     if (r != 0) {
@@ -7,23 +7,58 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <solv/evr.h>
 #include <solv/pool.h>
 #include <solv/poolarch.h>
 #include <solv/repo.h>
 #include <solv/repo_deb.h>
+#include <solv/repodata.h>
+#include <solv/repo_solv.h>
+#include <solv/repo_write.h>
 #include <solv/solver.h>
 #include <solv/solvable.h>
 #include <solv/transaction.h>
 #include <solv/queue.h>
 #include <solv/problems.h>
 
+#include "aept/archive.h"
 #include "aept/internal.h"
 #include "aept/msg.h"
 #include "aept/solver.h"
+#include "aept/stats.h"
+#include "aept/trace.h"
 #include "aept/util.h"
 
+/* Configured architectures as a colon-separated list, as pool_setarch()
+ * expects it. Returns NULL if none are configured. */
+static char *arch_string(struct aept_ctx *ctx)
+{
+    int i;
+    size_t len = 0;
+    char *archstr;
+
+    if (ctx->config.narchs == 0)
+        return NULL;
+
+    for (i = 0; i < ctx->config.narchs; i++)
+        len += strlen(ctx->config.archs[i]) + 1;
+
+    archstr = aept_malloc(len);
+    archstr[0] = '\0';
+
+    for (i = 0; i < ctx->config.narchs; i++) {
+        if (i > 0)
+            strcat(archstr, ":");
+        strcat(archstr, ctx->config.archs[i]);
+    }
+
+    return archstr;
+}
+
 int aept_solver_init(struct aept_ctx *ctx)
 {
     aept_solver_t *s = aept_malloc(sizeof(*s));
@@ -36,43 +71,318 @@ int aept_solver_init(struct aept_ctx *ctx)
         return -1;
     }
 
-    if (ctx->config.narchs > 0) {
-        int i;
-        size_t len = 0;
-        char *archstr;
+    char *archstr = arch_string(ctx);
+    pool_setarch(s->pool, archstr ? archstr : "noarch");
+    free(archstr);
+
+    ctx->solver = s;
+    return 0;
+}
+
+/*
+ * Binary repo caches.  A parsed repo is saved with repo_write() behind a
+ * one-line header that identifies its source (the Packages list, or the
+ * info directory for @installed) by inode, mtime and size, plus the
+ * configured architectures.  The cache is only used if the header
+ * matches, so replacing the source or changing the arch config
+ * invalidates it without any explicit bookkeeping.
+ */
+
+#define SOLV_CACHE_VERSION 2
+
+char *aept_solver_cache_key(struct aept_ctx *ctx, const struct stat *st)
+{
+    char *archstr;
+    char *key = NULL;
+
+    /* A repo parsed in low-memory mode lacks fields, see lean_open() */
+    archstr = arch_string(ctx);
+    aept_asprintf(&key, "aept-solv %d %llu %lld.%09ld %lld %s%s\n",
+                  SOLV_CACHE_VERSION,
+                  (unsigned long long)st->st_ino,
+                  (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec,
+                  (long long)st->st_size, archstr ? archstr : "noarch",
+                  ctx->config.low_memory ? " lean" : "");
+    free(archstr);
+    return key;
+}
+
+static int load_solv_cache(Repo *repo, const char *cache_path,
+                           const char *key)
+{
+    size_t len = strlen(key);
+    char *line;
+    FILE *fp;
+    int ret = -1;
+
+    fp = fopen(cache_path, "r");
+    if (!fp)
+        return -1;
+
+    line = aept_malloc(len + 2);
+    if (!fgets(line, (int)len + 2, fp) || strcmp(line, key) != 0)
+        goto cleanup;
+
+    if (repo_add_solv(repo, fp, 0) != 0) {
+        aept_log_debug("ignoring unreadable cache '%s': %s",
+                  cache_path, pool_errstr(repo->pool));
+        repo_empty(repo, 1);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+/* Best effort: a read-only directory just means no caching. */
+static void write_solv_cache(Repo *repo, const char *cache_path,
+                             const char *key)
+{
+    char *tmp = NULL;
+    FILE *fp;
+    int ok;
+
+    aept_asprintf(&tmp, "%s.%d", cache_path, (int)getpid());
+
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        free(tmp);
+        return;
+    }
+
+    ok = fputs(key, fp) >= 0 && repo_write(repo, fp) == 0;
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    if (!ok || rename(tmp, cache_path) != 0) {
+        aept_log_debug("cannot write cache '%s'", cache_path);
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+/*
+ * libsolv drops the fields of a Packages list it does not know.  The
+ * Delta-From field (see download.c) is picked up by a second pass over
+ * the list and stored under AEPT_DELTA_FROM_KEY, which the binary cache
+ * then keeps like any other key.  Solvables are created in stanza
+ * order, so each stanza is matched from where the previous one was.
+ */
+
+static Id stanza_solvable(Repo *repo, Id *cursor, const char *name,
+                          const char *version)
+{
+    Pool *pool = repo->pool;
+    Id nameid = pool_str2id(pool, name, 0);
+    Id evrid = pool_str2id(pool, version, 0);
+    Id p;
+
+    if (!nameid || !evrid)
+        return 0;
+
+    for (p = *cursor; p < repo->end; p++) {
+        Solvable *s = pool->solvables + p;
+        if (s->repo == repo && s->name == nameid && s->evr == evrid) {
+            *cursor = p + 1;
+            return p;
+        }
+    }
+    return 0;
+}
+
+static void add_delta_fields(Repo *repo, FILE *fp)
+{
+    Id key = pool_str2id(repo->pool, AEPT_DELTA_FROM_KEY, 1);
+    Repodata *data = NULL;
+    char *name = NULL, *version = NULL, *delta = NULL;
+    size_t delta_len = 0;
+    int in_delta = 0, eof = 0;
+    Id cursor = repo->start;
+    char buf[4096];
+
+    rewind(fp);
+
+    while (!eof) {
+        eof = !fgets(buf, sizeof(buf), fp);
+        if (!eof && aept_fgets_is_truncated(buf, sizeof(buf))) {
+            aept_fgets_drain_line(fp);
+            in_delta = 0;
+            continue;
+        }
+        if (!eof)
+            buf[strcspn(buf, "\n")] = '\0';
+
+        if (eof || buf[0] == '\0') {
+            /* End of a stanza */
+            if (name && version) {
+                Id p = stanza_solvable(repo, &cursor, name, version);
+                if (p && delta && *delta) {
+                    if (!data)
+                        data = repo_last_repodata(repo);
+                    repodata_set_str(data, p, key, delta);
+                }
+            }
+            free(name);
+            free(version);
+            free(delta);
+            name = version = delta = NULL;
+            delta_len = 0;
+            in_delta = 0;
+            continue;
+        }
+
+        if (buf[0] == ' ' || buf[0] == '\t') {
+            if (in_delta) {
+                const char *line = buf + strspn(buf, " \t");
+                size_t n = strlen(line);
+
+                if (n == 0)
+                    continue;
+                delta = aept_realloc(delta, delta_len + n + 2);
+                if (delta_len > 0)
+                    delta[delta_len++] = '\n';
+                memcpy(delta + delta_len, line, n + 1);
+                delta_len += n;
+            }
+            continue;
+        }
+
+        in_delta = 0;
+        if (strncmp(buf, "Package:", 8) == 0) {
+            free(name);
+            name = aept_strdup(buf + 8 + strspn(buf + 8, " \t"));
+        } else if (strncmp(buf, "Version:", 8) == 0) {
+            free(version);
+            version = aept_strdup(buf + 8 + strspn(buf + 8, " \t"));
+        } else if (strncmp(buf, "Delta-From:", 11) == 0) {
+            const char *line = buf + 11 + strspn(buf + 11, " \t");
+
+            free(delta);
+            delta = aept_strdup(line);
+            delta_len = strlen(delta);
+            in_delta = 1;
+        }
+    }
+
+    if (data)
+        repo_internalize(repo);
+}
 
-        for (i = 0; i < ctx->config.narchs; i++)
-            len += strlen(ctx->config.archs[i]) + 1;
+/*
+ * In low-memory mode, stanzas are parsed without the fields that only
+ * show displays: the long description (the summary line is kept for
+ * list), Homepage, Maintainer and Section.  They are dropped from the
+ * text libsolv reads, so they never take up space in the pool.
+ */
 
-        archstr = aept_malloc(len);
-        archstr[0] = '\0';
+typedef struct {
+    FILE *in;
+    char *line;
+    size_t line_alloc;
+    size_t len;             /* of the line being passed on */
+    size_t pos;
+    int dropping;           /* continuation lines are dropped */
+} lean_stream_t;
 
-        for (i = 0; i < ctx->config.narchs; i++) {
-            if (i > 0)
-                strcat(archstr, ":");
-            strcat(archstr, ctx->config.archs[i]);
+static int lean_drops_field(const char *line)
+{
+    static const char *const fields[] = {
+        "Homepage:", "Maintainer:", "Section:", NULL
+    };
+
+    for (int i = 0; fields[i]; i++) {
+        if (strncasecmp(line, fields[i], strlen(fields[i])) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static ssize_t lean_read(void *cookie, char *buf, size_t size)
+{
+    lean_stream_t *ls = cookie;
+    size_t n = 0;
+
+    while (n < size) {
+        if (ls->pos == ls->len) {
+            ssize_t r = getline(&ls->line, &ls->line_alloc, ls->in);
+            if (r < 0)
+                break;
+            ls->len = (size_t)r;
+            ls->pos = 0;
+
+            if (ls->line[0] == ' ' || ls->line[0] == '\t') {
+                if (ls->dropping)
+                    ls->len = 0;
+            } else if (strncasecmp(ls->line, "Description:", 12) == 0) {
+                ls->dropping = 1;
+            } else {
+                ls->dropping = lean_drops_field(ls->line);
+                if (ls->dropping)
+                    ls->len = 0;
+            }
+            continue;
         }
 
-        pool_setarch(s->pool, archstr);
-        free(archstr);
-    } else {
-        pool_setarch(s->pool, "noarch");
+        size_t k = ls->len - ls->pos;
+        if (k > size - n)
+            k = size - n;
+        memcpy(buf + n, ls->line + ls->pos, k);
+        ls->pos += k;
+        n += k;
     }
 
-    ctx->solver = s;
+    return (ssize_t)n;
+}
+
+static int lean_close(void *cookie)
+{
+    lean_stream_t *ls = cookie;
+
+    free(ls->line);
+    free(ls);
     return 0;
 }
 
-int aept_solver_load_repo(struct aept_ctx *ctx, const char *name,
-                           FILE *fp, int source_index)
+/* Return a stream reading fp without the fields low-memory mode drops,
+ * or fp itself if that mode is off.  Close it with lean_close_stream(). */
+static FILE *lean_open(struct aept_ctx *ctx, FILE *fp)
 {
-    aept_solver_t *s = ctx->solver;
-    Repo *repo;
+    cookie_io_functions_t io = { lean_read, NULL, NULL, lean_close };
+    lean_stream_t *ls;
+    FILE *lean;
 
-    if (s->nrepos >= AEPT_MAX_REPOS) {
-        aept_log_error("too many repositories");
-        return -1;
+    if (!ctx->config.low_memory)
+        return fp;
+
+    ls = aept_malloc(sizeof(*ls));
+    memset(ls, 0, sizeof(*ls));
+    ls->in = fp;
+
+    lean = fopencookie(ls, "r", io);
+    if (!lean) {
+        free(ls);
+        return fp;
     }
+    return lean;
+}
+
+static void lean_close_stream(FILE *lean, FILE *fp)
+{
+    if (lean != fp)
+        fclose(lean);
+}
+
+static int load_repo(struct aept_ctx *ctx, const char *name, FILE *fp,
+                     const char *cache_path, int source_index)
+{
+    aept_solver_t *s = ctx->solver;
+    Repo *repo;
+    char *key = NULL;
 
     repo = repo_create(s->pool, name);
     if (!repo) {
@@ -80,10 +390,38 @@ int aept_solver_load_repo(struct aept_ctx *ctx, const char *name,
         return -1;
     }
 
-    if (repo_add_debpackages(repo, fp, 0)) {
-        aept_log_error("failed to parse Packages for '%s'", name);
-        repo_free(repo, 0);
-        return -1;
+    struct stat st;
+    if (cache_path && fstat(fileno(fp), &st) == 0)
+        key = aept_solver_cache_key(ctx, &st);
+
+    if (key && load_solv_cache(repo, cache_path, key) == 0) {
+        aept_log_debug("loaded '%s' from cache", name);
+    } else {
+        FILE *in = lean_open(ctx, fp);
+        int r = repo_add_debpackages(repo, in, 0);
+
+        lean_close_stream(in, fp);
+        if (r) {
+            aept_log_error("failed to parse Packages for '%s'", name);
+            repo_free(repo, 0);
+            free(key);
+            return -1;
+        }
+
+        add_delta_fields(repo, fp);
+
+        if (key)
+            write_solv_cache(repo, cache_path, key);
+    }
+
+    free(key);
+
+    if (s->nrepos >= s->repos_alloc) {
+        s->repos_alloc = s->repos_alloc ? s->repos_alloc * 2 : 8;
+        s->repos = aept_realloc(s->repos,
+                                s->repos_alloc * sizeof(*s->repos));
+        s->repo_source_index = aept_realloc(s->repo_source_index,
+                s->repos_alloc * sizeof(*s->repo_source_index));
     }
 
     s->repos[s->nrepos] = repo;
@@ -93,6 +431,19 @@ int aept_solver_load_repo(struct aept_ctx *ctx, const char *name,
     return 0;
 }
 
+int aept_solver_load_repo(struct aept_ctx *ctx, const char *name,
+                           FILE *fp, const char *cache_path,
+                           int source_index)
+{
+    aept_stats_timer_t timer;
+    int r;
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_LOAD);
+    r = load_repo(ctx, name, fp, cache_path, source_index);
+    aept_stats_end(&timer);
+    return r;
+}
+
 int aept_solver_load_installed(struct aept_ctx *ctx, FILE *fp)
 {
     aept_solver_t *s = ctx->solver;
@@ -103,7 +454,11 @@ int aept_solver_load_installed(struct aept_ctx *ctx, FILE *fp)
         return -1;
     }
 
-    if (repo_add_debpackages(s->installed_repo, fp, 0)) {
+    FILE *in = lean_open(ctx, fp);
+    int r = repo_add_debpackages(s->installed_repo, in, 0);
+
+    lean_close_stream(in, fp);
+    if (r) {
         aept_log_error("failed to parse status file");
         repo_free(s->installed_repo, 0);
         s->installed_repo = NULL;
@@ -115,35 +470,217 @@ int aept_solver_load_installed(struct aept_ctx *ctx, FILE *fp)
     return 0;
 }
 
-Id aept_solver_load_local(struct aept_ctx *ctx, const char *path)
+int aept_solver_load_installed_snapshot(struct aept_ctx *ctx,
+                                        const char *cache_path,
+                                        const char *key)
 {
     aept_solver_t *s = ctx->solver;
-    Id p;
+    Repo *repo;
 
-    if (s->ncmdline >= AEPT_MAX_CMDLINE) {
-        aept_log_error("too many local packages");
-        return 0;
+    repo = repo_create(s->pool, "@installed");
+    if (!repo) {
+        aept_log_error("failed to create installed repo");
+        return -1;
+    }
+
+    if (load_solv_cache(repo, cache_path, key) != 0) {
+        repo_free(repo, 1);
+        return -1;
+    }
+
+    s->installed_repo = repo;
+    pool_set_installed(s->pool, repo);
+    return 0;
+}
+
+void aept_solver_save_installed_snapshot(struct aept_ctx *ctx,
+                                         const char *cache_path,
+                                         const char *key)
+{
+    aept_solver_t *s = ctx->solver;
+
+    if (s->installed_repo)
+        write_solv_cache(s->installed_repo, cache_path, key);
+}
+
+/*
+ * Local packages.  Their control files are read in parallel and turned
+ * into Packages stanzas with the Filename and Size that repo_add_deb()
+ * would record, which are then added to the command line repo in order.
+ * The outer archive is read only up to the control member.
+ */
+
+typedef struct {
+    const char **paths;
+    char **stanzas;
+} local_load_t;
+
+/* Skip the field at p and its continuation lines. */
+static const char *skip_field(const char *p)
+{
+    for (;;) {
+        const char *eol = strchr(p, '\n');
+        if (!eol)
+            return p + strlen(p);
+        p = eol + 1;
+        if (*p != ' ' && *p != '\t')
+            return p;
+    }
+}
+
+static int field_is(const char *p, const char *name)
+{
+    size_t len = strlen(name);
+    return strncasecmp(p, name, len) == 0 && p[len] == ':';
+}
+
+static char *local_stanza(const char *control, const char *path, off_t size)
+{
+    const char *p = control;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem;
+
+    mem = open_memstream(&buf, &len);
+    if (!mem)
+        return NULL;
+
+    while (*p) {
+        const char *next = skip_field(p);
+
+        /* Blank lines would end the stanza early. */
+        if (!field_is(p, "Filename") && !field_is(p, "Size") &&
+                p[strspn(p, " \t")] != '\n') {
+            fwrite(p, 1, next - p, mem);
+            if (next[-1] != '\n')
+                fputc('\n', mem);
+        }
+        p = next;
+    }
+
+    fprintf(mem, "Filename: %s\nSize: %lld\n", path, (long long)size);
+
+    if (fclose(mem) != 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static int local_load_task(struct aept_ctx *ctx, int i, void *arg)
+{
+    local_load_t *ll = arg;
+    const char *path = ll->paths[i];
+    struct aept_ar *ar;
+    struct stat st;
+    char *control = NULL;
+    size_t len = 0;
+    FILE *mem;
+    int r;
+
+    (void)ctx;
+
+    if (strchr(path, '\n') || stat(path, &st) != 0) {
+        aept_log_error("failed to read '%s'", path);
+        return -1;
     }
 
+    ar = aept_ar_open_pkg_control_archive(path);
+    if (!ar) {
+        aept_log_error("failed to read '%s'", path);
+        return -1;
+    }
+
+    mem = open_memstream(&control, &len);
+    r = mem ? aept_ar_extract_file_to_stream(ar, "control", mem) : -1;
+    if (mem && fclose(mem) != 0)
+        r = -1;
+    aept_ar_close(ar);
+
+    if (r == 0)
+        ll->stanzas[i] = local_stanza(control, path, st.st_size);
+    free(control);
+
+    if (!ll->stanzas[i]) {
+        aept_log_error("failed to read '%s'", path);
+        return -1;
+    }
+    return 0;
+}
+
+int aept_solver_load_locals(struct aept_ctx *ctx, const char **paths,
+                            int count, Id *ids)
+{
+    aept_solver_t *s = ctx->solver;
+    local_load_t ll;
+    int *results;
+    int i, r = 0;
+
+    if (count <= 0)
+        return 0;
+
     if (!s->commandline_repo) {
         s->commandline_repo = repo_create(s->pool, "@commandline");
         if (!s->commandline_repo) {
             aept_log_error("failed to create commandline repo");
-            return 0;
+            return -1;
         }
     }
 
-    p = repo_add_deb(s->commandline_repo, path, 0);
-    if (!p) {
-        aept_log_error("failed to read '%s'", path);
-        return 0;
+    ll.paths = paths;
+    ll.stanzas = aept_malloc(count * sizeof(char *));
+    memset(ll.stanzas, 0, count * sizeof(char *));
+    results = aept_malloc(count * sizeof(int));
+    for (i = 0; i < count; i++)
+        results[i] = -1;
+
+    aept_parallel_run(ctx, count, ctx->config.install_jobs,
+                      local_load_task, &ll, results);
+
+    for (i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            r = -1;
+            goto cleanup;
+        }
+    }
+
+    if (s->ncmdline + count > s->cmdline_alloc) {
+        s->cmdline_alloc = s->ncmdline + count;
+        s->cmdline_entries = aept_realloc(s->cmdline_entries,
+                s->cmdline_alloc * sizeof(*s->cmdline_entries));
+    }
+
+    /* Each stanza adds one solvable at the end of the pool, so ids
+     * stay ascending and aept_solver_commandline_path() can bisect. */
+    for (i = 0; i < count; i++) {
+        Id p = s->pool->nsolvables;
+        FILE *fp = fmemopen(ll.stanzas[i], strlen(ll.stanzas[i]), "r");
+
+        if (!fp || repo_add_debpackages(s->commandline_repo, fp,
+                    REPO_NO_INTERNALIZE | REPO_REUSE_REPODATA) != 0 ||
+                s->pool->nsolvables != p + 1) {
+            aept_log_error("failed to read '%s'", paths[i]);
+            if (fp)
+                fclose(fp);
+            r = -1;
+            break;
+        }
+        fclose(fp);
+
+        ids[i] = p;
+        s->cmdline_entries[s->ncmdline].id = p;
+        s->cmdline_entries[s->ncmdline].path = aept_strdup(paths[i]);
+        s->ncmdline++;
     }
 
-    s->cmdline_entries[s->ncmdline].id = p;
-    s->cmdline_entries[s->ncmdline].path = aept_strdup(path);
-    s->ncmdline++;
+    repo_internalize(s->commandline_repo);
 
-    return p;
+cleanup:
+    for (i = 0; i < count; i++)
+        free(ll.stanzas[i]);
+    free(ll.stanzas);
+    free(results);
+    return r;
 }
 
 int aept_solver_is_commandline(aept_solver_t *s, Id p)
@@ -159,11 +696,17 @@ int aept_solver_is_commandline(aept_solver_t *s, Id p)
 
 const char *aept_solver_commandline_path(aept_solver_t *s, Id p)
 {
-    int i;
+    int lo = 0, hi = s->ncmdline;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
 
-    for (i = 0; i < s->ncmdline; i++) {
-        if (s->cmdline_entries[i].id == p)
-            return s->cmdline_entries[i].path;
+        if (s->cmdline_entries[mid].id == p)
+            return s->cmdline_entries[mid].path;
+        if (s->cmdline_entries[mid].id < p)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
     return NULL;
@@ -372,6 +915,8 @@ int aept_solver_resolve_install(struct aept_ctx *ctx,
 {
     aept_solver_t *s = ctx->solver;
     Pool *pool = s->pool;
+    aept_stats_timer_t timer;
+    aept_trace_span_t span;
     Queue job;
     int i, r;
 
@@ -436,10 +981,14 @@ int aept_solver_resolve_install(struct aept_ctx *ctx,
                         SOLVER_INSTALL | SOLVER_SOLVABLE, local_ids[i]);
     }
 
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_SOLVE);
+    aept_trace_begin(ctx, &span, "solve", NULL);
     r = do_solve(ctx, &job, count > 0 || local_count > 0);
     if (r == 0 && (count > 0 || local_count > 0))
         reorder_transaction(s->trans, s->pool, names, count,
                             local_ids, local_count);
+    aept_trace_end(&span);
+    aept_stats_end(&timer);
 
     queue_free(&job);
 
@@ -450,6 +999,8 @@ int aept_solver_resolve_remove(struct aept_ctx *ctx,
                                 const char **names, int count)
 {
     aept_solver_t *s = ctx->solver;
+    aept_stats_timer_t timer;
+    aept_trace_span_t span;
     Queue job;
     int i, r;
 
@@ -460,7 +1011,11 @@ int aept_solver_resolve_remove(struct aept_ctx *ctx,
         queue_push2(&job, SOLVER_ERASE | SOLVER_SOLVABLE_PROVIDES, id);
     }
 
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_SOLVE);
+    aept_trace_begin(ctx, &span, "solve", NULL);
     r = do_solve(ctx, &job, 0);
+    aept_trace_end(&span);
+    aept_stats_end(&timer);
     queue_free(&job);
 
     return r;
@@ -581,6 +1136,9 @@ void aept_solver_fini(struct aept_ctx *ctx)
 
     for (i = 0; i < s->ncmdline; i++)
         free(s->cmdline_entries[i].path);
+    free(s->cmdline_entries);
+    free(s->repos);
+    free(s->repo_source_index);
 
     free(s);
     ctx->solver = NULL;
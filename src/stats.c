@@ -0,0 +1,83 @@
+/* stats.c - phase timers and counters
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "aept/aept.h"
+#include "aept/internal.h"
+#include "aept/stats.h"
+
+/* Innermost running timer of this thread */
+static _Thread_local aept_stats_timer_t *current_timer;
+
+static unsigned long long ns_between(const struct timespec *a,
+                                     const struct timespec *b)
+{
+    long long d = (long long)(b->tv_sec - a->tv_sec) * 1000000000LL
+        + (b->tv_nsec - a->tv_nsec);
+
+    return d > 0 ? (unsigned long long)d : 0;
+}
+
+static void read_clocks(struct timespec *wall, struct timespec *cpu)
+{
+    clock_gettime(CLOCK_MONOTONIC, wall);
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, cpu) < 0)
+        memset(cpu, 0, sizeof(*cpu));
+}
+
+/* Charge t's phase with the time since t was last (re)started. */
+static void charge(aept_stats_timer_t *t, const struct timespec *wall,
+                   const struct timespec *cpu)
+{
+    struct aept_stats *st = &t->ctx->stats;
+
+    st->wall_ns[t->phase] += ns_between(&t->wall, wall);
+    st->cpu_ns[t->phase] += ns_between(&t->cpu, cpu);
+}
+
+void aept_stats_begin(struct aept_ctx *ctx, aept_stats_timer_t *t,
+                      int phase)
+{
+    read_clocks(&t->wall, &t->cpu);
+    t->ctx = ctx;
+    t->phase = phase;
+    t->parent = current_timer;
+
+    if (t->parent)
+        charge(t->parent, &t->wall, &t->cpu);
+
+    ctx->stats.count[phase]++;
+    current_timer = t;
+}
+
+void aept_stats_end(aept_stats_timer_t *t)
+{
+    struct timespec wall, cpu;
+
+    read_clocks(&wall, &cpu);
+    charge(t, &wall, &cpu);
+
+    current_timer = t->parent;
+    if (t->parent) {
+        t->parent->wall = wall;
+        t->parent->cpu = cpu;
+    }
+}
+
+void aept_stats_add(struct aept_ctx *ctx, int counter, unsigned long long n)
+{
+    ctx->stats.counter[counter] += n;
+}
+
+double aept_stats_elapsed(const aept_stats_timer_t *t)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ns_between(&t->wall, &now) / 1e9;
+}
@@ -6,15 +6,19 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "aept/infodb.h"
 #include "aept/internal.h"
 #include "aept/msg.h"
+#include "aept/owner_index.h"
 #include "aept/solver.h"
+#include "aept/stats.h"
 #include "aept/status.h"
 #include "aept/util.h"
 
@@ -51,98 +55,237 @@ static char *slurp_file(const char *path, size_t *out_len)
     return buf;
 }
 
-int aept_status_load(struct aept_ctx *ctx)
+/*
+ * The installed repo is snapshotted to {info_dir}.solv, keyed on the
+ * info_dir inode and mtime.  Every change to the database renames or
+ * unlinks a file in info_dir, which bumps its mtime and so invalidates
+ * the snapshot.  A snapshot written in the same timestamp tick as the
+ * last change could miss a later change within that tick, so it is
+ * only trusted once it is strictly newer than the directory.
+ */
+static int snapshot_is_settled(const char *cache_path,
+                               const struct stat *dir_st)
 {
-    DIR *dir;
-    struct dirent *ent;
-    char *buf = NULL;
-    size_t buf_size = 0;
-    FILE *mem;
-    int r = 0;
+    struct stat st;
 
-    dir = opendir(ctx->config.info_dir);
-    if (!dir)
+    if (stat(cache_path, &st) != 0)
         return 0;
 
-    mem = open_memstream(&buf, &buf_size);
-    if (!mem) {
-        closedir(dir);
-        return -1;
+    if (st.st_mtim.tv_sec != dir_st->st_mtim.tv_sec)
+        return st.st_mtim.tv_sec > dir_st->st_mtim.tv_sec;
+    return st.st_mtim.tv_nsec > dir_st->st_mtim.tv_nsec;
+}
+
+/* Write a control stanza to the feed, normalizing "unpacked" to
+ * "installed" for libsolv and adding a default Status line if the file
+ * lacks one (pre-migration .control files written by an older aept). */
+static void feed_stanza(FILE *mem, const char *content)
+{
+    const char *p = content;
+    int found_status = 0;
+
+    while (*p) {
+        const char *eol = strchr(p, '\n');
+        size_t llen = eol ? (size_t)(eol - p) : strlen(p);
+
+        if (llen == sizeof(unpacked_status) - 1 &&
+                strncmp(p, unpacked_status,
+                        sizeof(unpacked_status) - 1) == 0) {
+            fputs(installed_status, mem);
+            found_status = 1;
+        } else {
+            fwrite(p, 1, llen, mem);
+            if (llen >= 7 && strncmp(p, "Status:", 7) == 0)
+                found_status = 1;
+        }
+
+        if (!eol) {
+            fputc('\n', mem);
+            break;
+        }
+        fputc('\n', mem);
+        p = eol + 1;
+    }
+
+    if (!found_status)
+        fprintf(mem, "%s\n", installed_status);
+
+    /* Blank-line stanza separator */
+    fputc('\n', mem);
+}
+
+/*
+ * The stanzas are handed to libsolv through a stream that reads one
+ * .control file at a time, so that they are never all in memory at
+ * once.  With the consolidated database, they are read from its
+ * mapping in the order it has them.
+ */
+
+typedef struct {
+    struct aept_ctx *ctx;
+    DIR *dir;
+    int from_db;
+    aept_infodb_file_t *files;  /* .control files in the database */
+    size_t n_files;
+    size_t files_alloc;
+    size_t next;
+    char *buf;                  /* the current stanza, normalized */
+    size_t size;
+    size_t pos;
+} stanza_stream_t;
+
+static int collect_db_control(const aept_infodb_file_t *f, void *userdata)
+{
+    stanza_stream_t *ss = userdata;
+
+    if (ss->n_files >= ss->files_alloc) {
+        ss->files_alloc = ss->files_alloc ? ss->files_alloc * 2 : 256;
+        ss->files = aept_realloc(ss->files,
+                                 ss->files_alloc * sizeof(*ss->files));
     }
+    ss->files[ss->n_files++] = *f;
+    return 0;
+}
 
-    while ((ent = readdir(dir)) != NULL) {
+/* Read the content of the next .control file.  Returns NULL at the end.
+ * Sets *owned if the caller must free it. */
+static const char *stanza_next_content(stanza_stream_t *ss, int *owned)
+{
+    struct dirent *ent;
+
+    *owned = 0;
+    if (ss->from_db)
+        return ss->next < ss->n_files ? ss->files[ss->next++].data : NULL;
+
+    while ((ent = readdir(ss->dir)) != NULL) {
         const char *dot = strrchr(ent->d_name, '.');
         if (!dot || strcmp(dot, ".control") != 0)
             continue;
 
         char *path = NULL;
-        aept_asprintf(&path, "%s/%s", ctx->config.info_dir, ent->d_name);
+        aept_asprintf(&path, "%s/%s", ss->ctx->config.info_dir, ent->d_name);
 
-        size_t len = 0;
-        char *content = slurp_file(path, &len);
+        char *content = slurp_file(path, NULL);
         free(path);
 
-        if (!content)
-            continue;
-
-        /* Write the control stanza to the feed, normalizing
-         * "unpacked" to "installed" for libsolv and adding a
-         * default Status line if the file lacks one (pre-migration
-         * .control files written by an older aept). */
-        const char *p = content;
-        int found_status = 0;
-
-        while (*p) {
-            const char *eol = strchr(p, '\n');
-            size_t llen = eol ? (size_t)(eol - p) : strlen(p);
-
-            if (llen == sizeof(unpacked_status) - 1 &&
-                    strncmp(p, unpacked_status,
-                            sizeof(unpacked_status) - 1) == 0) {
-                fputs(installed_status, mem);
-                found_status = 1;
-            } else {
-                fwrite(p, 1, llen, mem);
-                if (llen >= 7 && strncmp(p, "Status:", 7) == 0)
-                    found_status = 1;
-            }
-
-            if (!eol) {
-                fputc('\n', mem);
-                break;
-            }
-            fputc('\n', mem);
-            p = eol + 1;
+        if (content) {
+            *owned = 1;
+            return content;
         }
+    }
+    return NULL;
+}
 
-        if (!found_status)
-            fprintf(mem, "%s\n", installed_status);
+/* Make the next stanza current.  Returns 0, or -1 after the last. */
+static int stanza_next(stanza_stream_t *ss)
+{
+    const char *content;
+    FILE *mem;
+    int owned;
 
-        /* Blank-line stanza separator */
-        fputc('\n', mem);
+    free(ss->buf);
+    ss->buf = NULL;
+    ss->size = 0;
+    ss->pos = 0;
+
+    content = stanza_next_content(ss, &owned);
+    if (!content)
+        return -1;
 
-        free(content);
+    mem = open_memstream(&ss->buf, &ss->size);
+    if (mem) {
+        feed_stanza(mem, content);
+        fclose(mem);
     }
+    if (owned)
+        free((char *)content);
+    return mem ? 0 : -1;
+}
 
-    closedir(dir);
+static ssize_t stanza_read(void *cookie, char *buf, size_t size)
+{
+    stanza_stream_t *ss = cookie;
+    size_t n = 0;
+
+    while (n < size) {
+        if (ss->pos == ss->size && stanza_next(ss) < 0)
+            break;
+
+        size_t k = ss->size - ss->pos;
+        if (k > size - n)
+            k = size - n;
+        memcpy(buf + n, ss->buf + ss->pos, k);
+        ss->pos += k;
+        n += k;
+    }
 
-    if (fflush(mem) != 0 || ferror(mem)) {
-        fclose(mem);
-        free(buf);
-        return -1;
+    return (ssize_t)n;
+}
+
+int aept_status_load(struct aept_ctx *ctx)
+{
+    cookie_io_functions_t io = { stanza_read, NULL, NULL, NULL };
+    stanza_stream_t ss;
+    DIR *dir;
+    struct stat dir_st;
+    char *cache_path = NULL;
+    char *key = NULL;
+    aept_infodb_t *db = NULL;
+    aept_stats_timer_t timer;
+    int r = 0;
+
+    dir = opendir(ctx->config.info_dir);
+    if (!dir)
+        return 0;
+
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_LOAD);
+
+    if (fstat(dirfd(dir), &dir_st) == 0) {
+        aept_asprintf(&cache_path, "%s.solv", ctx->config.info_dir);
+        key = aept_solver_cache_key(ctx, &dir_st);
+
+        if (snapshot_is_settled(cache_path, &dir_st) &&
+                aept_solver_load_installed_snapshot(ctx, cache_path,
+                                                    key) == 0) {
+            aept_log_debug("loaded installed packages from '%s'",
+                      cache_path);
+            goto done;
+        }
     }
-    fclose(mem);
 
-    if (buf_size > 0) {
-        FILE *fp = fmemopen(buf, buf_size, "r");
+    memset(&ss, 0, sizeof(ss));
+    ss.ctx = ctx;
+    ss.dir = dir;
+
+    db = aept_infodb_open(ctx);
+    if (db) {
+        ss.from_db = 1;
+        aept_infodb_foreach(db, "control", collect_db_control, &ss);
+    }
+
+    /* Nothing installed leaves the solver without an installed repo */
+    if (stanza_next(&ss) == 0) {
+        FILE *fp = fopencookie(&ss, "r", io);
         if (!fp) {
-            free(buf);
-            return -1;
+            r = -1;
+        } else {
+            r = aept_solver_load_installed(ctx, fp);
+            fclose(fp);
         }
-        r = aept_solver_load_installed(ctx, fp);
-        fclose(fp);
+
+        if (r == 0 && key)
+            aept_solver_save_installed_snapshot(ctx, cache_path, key);
     }
-    free(buf);
+
+    free(ss.buf);
+    free(ss.files);
+
+done:
+    aept_infodb_close(db);
+    closedir(dir);
+    free(key);
+    free(cache_path);
+    aept_stats_end(&timer);
     return r;
 }
 
@@ -197,48 +340,25 @@ int aept_status_add(struct aept_ctx *ctx, const char *control_src,
     return r;
 }
 
-int aept_status_mark_auto(struct aept_ctx *ctx, const char *name)
-{
-    if (aept_status_is_auto(ctx, name))
-        return 0;
-
-    FILE *fp = fopen(ctx->config.auto_file, "a");
-    if (!fp) {
-        aept_log_error("cannot open auto-installed file '%s': %s",
-                  ctx->config.auto_file, strerror(errno));
-        return -1;
-    }
-
-    fprintf(fp, "%s\n", name);
+/* ── Auto-installed set ──────────────────────────────────────────── */
 
-    int err = ferror(fp);
-    if (fclose(fp) != 0 || err) {
-        aept_log_error("failed to write auto-installed file '%s'",
-                  ctx->config.auto_file);
-        return -1;
-    }
-
-    return 0;
-}
+/* The auto-installed marks of the running transaction.  The file is
+ * read once when the outermost transaction begins, changed in memory,
+ * and written back once when it commits. */
+struct aept_auto_set {
+    aept_fileset_t names;
+    int depth;
+    int dirty;
+};
 
-int aept_status_unmark_auto(struct aept_ctx *ctx, const char *name)
+static void read_auto_file(const char *path, aept_fileset_t *set)
 {
-    FILE *fp, *tmp;
-    char *tmp_path = NULL;
+    FILE *fp;
     char buf[256];
-    int found = 0;
 
-    fp = fopen(ctx->config.auto_file, "r");
+    fp = fopen(path, "r");
     if (!fp)
-        return 0;
-
-    aept_asprintf(&tmp_path, "%s.tmp", ctx->config.auto_file);
-    tmp = fopen(tmp_path, "w");
-    if (!tmp) {
-        fclose(fp);
-        free(tmp_path);
-        return -1;
-    }
+        return;
 
     while (fgets(buf, sizeof(buf), fp)) {
         if (aept_fgets_is_truncated(buf, sizeof(buf))) {
@@ -246,32 +366,41 @@ int aept_status_unmark_auto(struct aept_ctx *ctx, const char *name)
             continue;
         }
         char pkg_name[256];
-        if (sscanf(buf, "%255s", pkg_name) != 1)
-            continue;
-        if (strcmp(pkg_name, name) == 0) {
-            found = 1;
-            continue;
-        }
-        fputs(buf, tmp);
+        if (sscanf(buf, "%255s", pkg_name) == 1)
+            aept_fileset_add(set, pkg_name);
     }
 
     fclose(fp);
+    aept_fileset_sort(set);
+}
 
-    if (!found) {
-        fclose(tmp);
-        unlink(tmp_path);
+static int write_auto_file(const char *path, aept_fileset_t *set)
+{
+    char *tmp_path = NULL;
+    FILE *fp;
+    int i;
+
+    aept_asprintf(&tmp_path, "%s.tmp", path);
+    fp = fopen(tmp_path, "w");
+    if (!fp) {
+        aept_log_error("cannot open auto-installed file '%s': %s",
+                  tmp_path, strerror(errno));
         free(tmp_path);
-        return 0;
+        return -1;
     }
 
-    if (ferror(tmp) || fclose(tmp) != 0) {
+    aept_fileset_sort(set);
+    for (i = 0; i < set->count; i++)
+        fprintf(fp, "%s\n", set->paths[i]);
+
+    if (ferror(fp) || fclose(fp) != 0) {
         aept_log_error("failed to write auto-installed file '%s'", tmp_path);
         unlink(tmp_path);
         free(tmp_path);
         return -1;
     }
 
-    if (rename(tmp_path, ctx->config.auto_file) < 0) {
+    if (rename(tmp_path, path) < 0) {
         aept_log_error("cannot rename auto-installed file: %s", strerror(errno));
         unlink(tmp_path);
         free(tmp_path);
@@ -282,65 +411,414 @@ int aept_status_unmark_auto(struct aept_ctx *ctx, const char *name)
     return 0;
 }
 
+void aept_status_auto_begin(struct aept_ctx *ctx)
+{
+    struct aept_auto_set *set = ctx->auto_set;
+
+    if (set) {
+        set->depth++;
+        return;
+    }
+
+    set = aept_malloc(sizeof(*set));
+    aept_fileset_init(&set->names);
+    set->depth = 1;
+    set->dirty = 0;
+    read_auto_file(ctx->config.auto_file, &set->names);
+    ctx->auto_set = set;
+}
+
+int aept_status_auto_commit(struct aept_ctx *ctx)
+{
+    struct aept_auto_set *set = ctx->auto_set;
+    int r = 0;
+
+    if (!set || --set->depth > 0)
+        return 0;
+
+    if (set->dirty)
+        r = write_auto_file(ctx->config.auto_file, &set->names);
+
+    aept_fileset_free(&set->names);
+    free(set);
+    ctx->auto_set = NULL;
+    return r;
+}
+
+int aept_status_mark_auto(struct aept_ctx *ctx, const char *name)
+{
+    struct aept_auto_set *set;
+
+    aept_status_auto_begin(ctx);
+    set = ctx->auto_set;
+
+    if (!aept_fileset_contains(&set->names, name)) {
+        aept_fileset_add(&set->names, name);
+        set->dirty = 1;
+    }
+
+    return aept_status_auto_commit(ctx);
+}
+
+int aept_status_unmark_auto(struct aept_ctx *ctx, const char *name)
+{
+    struct aept_auto_set *set;
+
+    aept_status_auto_begin(ctx);
+    set = ctx->auto_set;
+
+    while (aept_fileset_remove(&set->names, name))
+        set->dirty = 1;
+
+    return aept_status_auto_commit(ctx);
+}
+
 int aept_status_is_auto(struct aept_ctx *ctx, const char *name)
 {
+    int found;
+
+    aept_status_auto_begin(ctx);
+    found = aept_fileset_contains(&ctx->auto_set->names, name);
+    aept_status_auto_commit(ctx);
+    return found;
+}
+
+int aept_status_clear_auto(struct aept_ctx *ctx)
+{
+    struct aept_auto_set *set;
+
+    aept_status_auto_begin(ctx);
+    set = ctx->auto_set;
+
+    aept_fileset_free(&set->names);
+    set->dirty = 1;
+
+    return aept_status_auto_commit(ctx);
+}
+
+int aept_status_load_auto_set(struct aept_ctx *ctx, aept_fileset_t *set)
+{
+    aept_fileset_t *names;
+    int i;
+
+    aept_status_auto_begin(ctx);
+    names = &ctx->auto_set->names;
+
+    for (i = 0; i < names->count; i++)
+        aept_fileset_add(set, names->paths[i]);
+
+    aept_fileset_sort(set);
+    return aept_status_auto_commit(ctx);
+}
+
+/* ── Published generations ───────────────────────────────────────── */
+
+/*
+ * Queries read the package database from a generation, a copy of
+ * info_dir published at the end of every transaction:
+ *
+ *   {info_dir}.gen/<n>/         the files of info_dir
+ *   {info_dir}.gen/<n>.owners   their owner index
+ *   {info_dir}.generation       "<n> <dev> <ino> <mtime sec> <mtime nsec>"
+ *
+ * The generation file names the current generation and the stamp of
+ * info_dir it was copied from.  It is replaced by renaming once the
+ * copy is complete, so a reader sees one generation or the next in
+ * full, and a generation is never changed after that.  Some files of
+ * info_dir are rewritten in place, so they are copied; a file with the
+ * size and mtime of its copy in the previous generation is linked to
+ * that copy instead.  The previous generation stays for readers still
+ * using it, older ones are removed.
+ */
+
+typedef struct {
+    unsigned long n;
+    unsigned long long dev;
+    unsigned long long ino;
+    long long sec;
+    long nsec;
+} generation_t;
+
+static int generation_read(struct aept_ctx *ctx, generation_t *g)
+{
+    char *path = NULL;
     FILE *fp;
-    char buf[256];
+    int ok;
 
-    fp = fopen(ctx->config.auto_file, "r");
+    aept_asprintf(&path, "%s.generation", ctx->config.info_dir);
+    fp = fopen(path, "r");
+    free(path);
     if (!fp)
-        return 0;
+        return -1;
 
-    while (fgets(buf, sizeof(buf), fp)) {
-        if (aept_fgets_is_truncated(buf, sizeof(buf))) {
-            aept_fgets_drain_line(fp);
-            continue;
+    ok = fscanf(fp, "%lu %llu %llu %lld %ld", &g->n, &g->dev, &g->ino,
+                &g->sec, &g->nsec) == 5;
+    fclose(fp);
+    return ok && g->n > 0 ? 0 : -1;
+}
+
+static int generation_write(struct aept_ctx *ctx, const generation_t *g)
+{
+    char *path = NULL, *tmp = NULL;
+    FILE *fp;
+    int r = -1;
+
+    aept_asprintf(&path, "%s.generation", ctx->config.info_dir);
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        aept_log_error("cannot write '%s': %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+
+    fprintf(fp, "%lu %llu %llu %lld %ld\n", g->n, g->dev, g->ino,
+            g->sec, g->nsec);
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        aept_log_error("failed to write '%s'", tmp);
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    if (rename(tmp, path) < 0) {
+        aept_log_error("cannot rename '%s': %s", tmp, strerror(errno));
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    r = 0;
+
+cleanup:
+    free(tmp);
+    free(path);
+    return r;
+}
+
+static int generation_is_of(const generation_t *g, const struct stat *st)
+{
+    return g->dev == (unsigned long long)st->st_dev &&
+           g->ino == (unsigned long long)st->st_ino &&
+           g->sec == (long long)st->st_mtim.tv_sec &&
+           g->nsec == st->st_mtim.tv_nsec;
+}
+
+static char *generation_dir(struct aept_ctx *ctx, unsigned long n)
+{
+    char *dir = NULL;
+
+    aept_asprintf(&dir, "%s.gen/%lu", ctx->config.info_dir, n);
+    return dir;
+}
+
+/* Remove generation dir and the files kept next to it */
+static void generation_remove(const char *dir)
+{
+    static const char *const exts[] = {
+        ".owners", ".solv", ".db", ".dbview"
+    };
+    struct dirent *ent;
+    DIR *d;
+    size_t i;
+
+    d = opendir(dir);
+    if (d) {
+        while ((ent = readdir(d)) != NULL) {
+            char *path = NULL;
+
+            if (ent->d_name[0] == '.')
+                continue;
+            aept_asprintf(&path, "%s/%s", dir, ent->d_name);
+            unlink(path);
+            free(path);
         }
-        char pkg_name[256];
-        if (sscanf(buf, "%255s", pkg_name) != 1)
+        closedir(d);
+        rmdir(dir);
+    }
+
+    for (i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        char *path = NULL;
+
+        aept_asprintf(&path, "%s%s", dir, exts[i]);
+        unlink(path);
+        free(path);
+    }
+}
+
+/* Fill the empty dir with the regular files of info_dir, linking those
+ * that are unchanged since prev, if given. */
+static int generation_fill(struct aept_ctx *ctx, const char *dir,
+                           const char *prev)
+{
+    struct dirent *ent;
+    DIR *d;
+    int r = 0;
+
+    d = opendir(ctx->config.info_dir);
+    if (!d)
+        return -1;
+
+    while (r == 0 && (ent = readdir(d)) != NULL) {
+        char *src = NULL, *dst = NULL, *old = NULL;
+        struct stat st, ost;
+
+        if (ent->d_name[0] == '.')
             continue;
-        if (strcmp(pkg_name, name) == 0) {
-            fclose(fp);
-            return 1;
+
+        aept_asprintf(&src, "%s/%s", ctx->config.info_dir, ent->d_name);
+        aept_asprintf(&dst, "%s/%s", dir, ent->d_name);
+
+        if (lstat(src, &st) != 0 || !S_ISREG(st.st_mode))
+            goto next;
+
+        if (prev) {
+            aept_asprintf(&old, "%s/%s", prev, ent->d_name);
+            if (lstat(old, &ost) == 0 && ost.st_size == st.st_size &&
+                    ost.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+                    ost.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+                    link(old, dst) == 0)
+                goto next;
         }
+
+        if (aept_file_copy(src, dst) < 0) {
+            aept_log_error("cannot copy '%s' to '%s'", src, dst);
+            r = -1;
+        } else {
+            struct timespec times[2] = { st.st_atim, st.st_mtim };
+
+            utimensat(AT_FDCWD, dst, times, 0);
+        }
+
+next:
+        free(old);
+        free(dst);
+        free(src);
     }
 
-    fclose(fp);
-    return 0;
+    closedir(d);
+    return r;
 }
 
-int aept_status_clear_auto(struct aept_ctx *ctx)
+/* Drop the generations before the one preceding n */
+static void generation_prune(struct aept_ctx *ctx, unsigned long n)
 {
-    FILE *fp = fopen(ctx->config.auto_file, "w");
-    if (!fp) {
-        aept_log_error("cannot open auto-installed file '%s': %s",
-                  ctx->config.auto_file, strerror(errno));
-        return -1;
+    char *base = NULL;
+    struct dirent *ent;
+    DIR *d;
+
+    aept_asprintf(&base, "%s.gen", ctx->config.info_dir);
+    d = opendir(base);
+    if (!d) {
+        free(base);
+        return;
     }
-    fclose(fp);
-    return 0;
+
+    while ((ent = readdir(d)) != NULL) {
+        char *end, *dir;
+        unsigned long k = strtoul(ent->d_name, &end, 10);
+
+        if (end == ent->d_name || *end != '\0' || k + 1 >= n)
+            continue;
+
+        dir = generation_dir(ctx, k);
+        generation_remove(dir);
+        free(dir);
+    }
+
+    closedir(d);
+    free(base);
 }
 
-int aept_status_load_auto_set(struct aept_ctx *ctx, aept_fileset_t *set)
+int aept_status_publish(struct aept_ctx *ctx)
 {
-    FILE *fp;
-    char buf[256];
+    generation_t cur, next;
+    aept_owner_index_t idx;
+    struct stat st;
+    char *dir = NULL, *prev = NULL, *live;
+    int have, r = -1;
 
-    fp = fopen(ctx->config.auto_file, "r");
-    if (!fp)
+    if (stat(ctx->config.info_dir, &st) != 0)
         return 0;
 
-    while (fgets(buf, sizeof(buf), fp)) {
-        if (aept_fgets_is_truncated(buf, sizeof(buf))) {
-            aept_fgets_drain_line(fp);
-            continue;
-        }
-        char pkg_name[256];
-        if (sscanf(buf, "%255s", pkg_name) == 1)
-            aept_fileset_add(set, pkg_name);
+    /* The generation shares the consolidated database, see infodb.h */
+    if (ctx->config.info_db)
+        aept_infodb_sync(ctx);
+
+    have = generation_read(ctx, &cur) == 0;
+    if (have && generation_is_of(&cur, &st))
+        return 0;
+
+    memset(&next, 0, sizeof(next));
+    next.n = have ? cur.n + 1 : 1;
+    next.dev = (unsigned long long)st.st_dev;
+    next.ino = (unsigned long long)st.st_ino;
+    next.sec = (long long)st.st_mtim.tv_sec;
+    next.nsec = st.st_mtim.tv_nsec;
+
+    dir = generation_dir(ctx, next.n);
+    if (have)
+        prev = generation_dir(ctx, cur.n);
+
+    /* Left over from a publish that did not finish */
+    generation_remove(dir);
+
+    if (aept_file_mkdir_hier(dir, 0755) < 0) {
+        aept_log_error("cannot create '%s': %s", dir, strerror(errno));
+        goto cleanup;
     }
 
-    fclose(fp);
-    aept_fileset_sort(set);
-    return 0;
+    if (generation_fill(ctx, dir, prev) < 0)
+        goto cleanup;
+
+    /* The owner index of the transaction, saved for the new copy */
+    aept_owner_index_init(&idx);
+    if (aept_owner_index_load(ctx, &idx) < 0)
+        aept_owner_index_build(ctx, &idx);
+    live = ctx->config.info_dir;
+    ctx->config.info_dir = dir;
+    aept_owner_index_save(ctx, &idx);
+    ctx->config.info_dir = live;
+    aept_owner_index_free(&idx);
+
+    aept_infodb_publish(ctx, dir);
+
+    aept_durability_barrier(ctx, AEPT_DURABILITY_TRANSACTION);
+
+    if (generation_write(ctx, &next) < 0)
+        goto cleanup;
+
+    aept_log_debug("published generation %lu of '%s'", next.n,
+                   ctx->config.info_dir);
+    generation_prune(ctx, next.n);
+    r = 0;
+
+cleanup:
+    if (r < 0)
+        generation_remove(dir);
+    free(prev);
+    free(dir);
+    return r;
+}
+
+char *aept_status_read_dir(struct aept_ctx *ctx)
+{
+    generation_t g;
+    struct stat st;
+    int tries;
+
+    /* A reader racing a publish may find the generation it read about
+     * pruned already; the file names a newer one by then. */
+    for (tries = 0; tries < 2; tries++) {
+        char *dir;
+
+        if (generation_read(ctx, &g) < 0)
+            break;
+
+        dir = generation_dir(ctx, g.n);
+        if (stat(dir, &st) == 0)
+            return dir;
+        free(dir);
+    }
+
+    return aept_strdup(ctx->config.info_dir);
 }
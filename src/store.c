@@ -0,0 +1,627 @@
+/* store.c - unpacked package store
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * An entry of the unpacked store is a directory named after the
+ * package's checksum, <type>-<hex>, holding a manifest and the content
+ * of each regular file as a file named after its line in the manifest.
+ * The manifest lists every archive entry in order as
+ *
+ *   path mode uid gid uname gname mtime.nsec size sha256 symlink hardlink
+ *
+ * separated by tabs, with empty fields for what does not apply.
+ *
+ * An entry is built in a temporary directory next to it and renamed
+ * into place once complete, so an entry that exists is whole.
+ * Installing from it goes through extract.c, with the content of each
+ * file filled in by FICLONE, copy_file_range(2) or, with
+ * store_hardlinks, a hard link to the store.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <solv/chksum.h>
+#include <solv/solvable.h>
+#include <solv/util.h>
+
+#include "aept/extract.h"
+#include "aept/internal.h"
+#include "aept/msg.h"
+#include "aept/progress.h"
+#include "aept/store.h"
+#include "aept/util.h"
+
+#define MANIFEST_NAME    "manifest"
+#define MANIFEST_HEADER  "aept-store 1\n"
+#define MANIFEST_FIELDS  11
+
+typedef struct {
+    char *path;
+    char *link_target;
+    char *hardlink;
+    char *uname;
+    char *gname;
+    char *digest;               /* NULL unless a regular file with data */
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    long long size;
+    long long mtime;
+    long mtime_nsec;
+} store_entry_t;
+
+typedef struct {
+    store_entry_t *entries;
+    int count;
+    int alloc;
+} manifest_t;
+
+static void manifest_free(manifest_t *m)
+{
+    for (int i = 0; i < m->count; i++) {
+        store_entry_t *e = &m->entries[i];
+        free(e->path);
+        free(e->link_target);
+        free(e->hardlink);
+        free(e->uname);
+        free(e->gname);
+        free(e->digest);
+    }
+    free(m->entries);
+    memset(m, 0, sizeof(*m));
+}
+
+static store_entry_t *manifest_add(manifest_t *m)
+{
+    if (m->count >= m->alloc) {
+        m->alloc = m->alloc ? m->alloc * 2 : 64;
+        m->entries = aept_realloc(m->entries,
+                                  m->alloc * sizeof(*m->entries));
+    }
+    memset(&m->entries[m->count], 0, sizeof(*m->entries));
+    return &m->entries[m->count++];
+}
+
+static char *dup_or_null(const char *s)
+{
+    return s && *s ? aept_strdup(s) : NULL;
+}
+
+/* Regular files with content of their own get a data file */
+static int has_data(const store_entry_t *e)
+{
+    return S_ISREG(e->mode) && !e->hardlink;
+}
+
+/* ── Manifest ─────────────────────────────────────────────────────── */
+
+static int write_manifest(const manifest_t *m, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    int ok;
+
+    if (!fp) {
+        aept_log_error("cannot create '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    ok = fputs(MANIFEST_HEADER, fp) >= 0;
+    for (int i = 0; ok && i < m->count; i++) {
+        const store_entry_t *e = &m->entries[i];
+
+        ok = fprintf(fp, "%s\t%o\t%u\t%u\t%s\t%s\t%lld.%09ld\t%lld\t"
+                     "%s\t%s\t%s\n", e->path, e->mode, e->uid, e->gid,
+                     e->uname ? e->uname : "", e->gname ? e->gname : "",
+                     e->mtime, e->mtime_nsec, e->size,
+                     e->digest ? e->digest : "",
+                     e->link_target ? e->link_target : "",
+                     e->hardlink ? e->hardlink : "") > 0;
+    }
+
+    if (fclose(fp) != 0 || !ok) {
+        aept_log_error("failed to write '%s'", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_line(char *line, store_entry_t *e)
+{
+    char *field[MANIFEST_FIELDS];
+    char *end;
+    int n = 0;
+
+    line[strcspn(line, "\n")] = '\0';
+    while (n < MANIFEST_FIELDS && line)
+        field[n++] = strsep(&line, "\t");
+    if (n != MANIFEST_FIELDS || line)
+        return -1;
+
+    if (!aept_archive_path_is_safe(field[0]) ||
+            (field[10][0] && !aept_archive_path_is_safe(field[10])))
+        return -1;
+
+    errno = 0;
+    e->mode = (unsigned int)strtoul(field[1], &end, 8);
+    if (*end)
+        return -1;
+    e->uid = (unsigned int)strtoul(field[2], &end, 10);
+    if (*end)
+        return -1;
+    e->gid = (unsigned int)strtoul(field[3], &end, 10);
+    if (*end)
+        return -1;
+    e->mtime = strtoll(field[6], &end, 10);
+    if (*end != '.')
+        return -1;
+    e->mtime_nsec = strtol(end + 1, &end, 10);
+    if (*end)
+        return -1;
+    e->size = strtoll(field[7], &end, 10);
+    if (*end || errno || e->size < 0)
+        return -1;
+
+    e->path = aept_strdup(field[0]);
+    e->uname = dup_or_null(field[4]);
+    e->gname = dup_or_null(field[5]);
+    e->digest = dup_or_null(field[8]);
+    e->link_target = dup_or_null(field[9]);
+    e->hardlink = dup_or_null(field[10]);
+
+    if (e->hardlink)
+        return 0;
+    if (S_ISLNK(e->mode) ? !e->link_target :
+            has_data(e) ? !e->digest || strlen(e->digest) != 64 :
+            !S_ISDIR(e->mode) && !S_ISREG(e->mode))
+        return -1;
+    return 0;
+}
+
+static int load_manifest(const char *entry, manifest_t *m)
+{
+    char *path = NULL, *line = NULL;
+    size_t cap = 0;
+    FILE *fp;
+    int ret = -1;
+
+    aept_asprintf(&path, "%s/" MANIFEST_NAME, entry);
+    fp = fopen(path, "r");
+    if (!fp) {
+        aept_log_error("cannot open '%s': %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    if (getline(&line, &cap, fp) < 0 || strcmp(line, MANIFEST_HEADER) != 0)
+        goto cleanup;
+
+    while (getline(&line, &cap, fp) >= 0) {
+        if (parse_line(line, manifest_add(m)) < 0)
+            goto cleanup;
+    }
+    ret = ferror(fp) ? -1 : 0;
+
+cleanup:
+    if (ret < 0) {
+        aept_log_error("invalid store manifest '%s'", path);
+        manifest_free(m);
+    }
+    fclose(fp);
+    free(line);
+    free(path);
+    return ret;
+}
+
+/* ── Lookup ───────────────────────────────────────────────────────── */
+
+char *aept_store_entry_path(struct aept_ctx *ctx, Pool *pool, Id p)
+{
+    const unsigned char *sum;
+    char hex[2 * 64 + 1];
+    char *path = NULL;
+    Id type = 0;
+    int len;
+
+    if (!ctx->config.unpacked_store)
+        return NULL;
+
+    sum = solvable_lookup_bin_checksum(pool_id2solvable(pool, p),
+                                       SOLVABLE_CHECKSUM, &type);
+    len = sum ? solv_chksum_len(type) : 0;
+    if (len <= 0 || len > 64)
+        return NULL;
+    solv_bin2hex(sum, len, hex);
+
+    aept_asprintf(&path, "%s/%s-%s", ctx->config.unpacked_store,
+                  solv_chksum_type2str(type), hex);
+    return path;
+}
+
+int aept_store_exists(const char *entry)
+{
+    char *path = NULL;
+    int r;
+
+    aept_asprintf(&path, "%s/" MANIFEST_NAME, entry);
+    r = access(path, F_OK) == 0;
+    free(path);
+    return r;
+}
+
+int aept_store_list(const char *entry, aept_ar_file_list_t *out)
+{
+    manifest_t m = {0};
+
+    if (load_manifest(entry, &m) < 0)
+        return -1;
+
+    for (int i = 0; i < m.count; i++) {
+        store_entry_t *e = &m.entries[i];
+        aept_ar_file_entry_t *fe;
+
+        if (S_ISDIR(e->mode))
+            continue;
+
+        if (out->count >= out->alloc) {
+            out->alloc = out->alloc ? out->alloc * 2 : 64;
+            out->entries = aept_realloc(out->entries,
+                                        out->alloc * sizeof(*out->entries));
+        }
+        fe = &out->entries[out->count++];
+        memset(fe, 0, sizeof(*fe));
+        fe->path = aept_arena_strdup(&out->strings, e->path);
+        fe->link_target = e->link_target ?
+            aept_arena_strdup(&out->strings, e->link_target) : NULL;
+        fe->mode = e->mode;
+    }
+
+    manifest_free(&m);
+    return 0;
+}
+
+/* ── Adding packages ──────────────────────────────────────────────── */
+
+typedef struct {
+    const char *dir;
+    manifest_t manifest;
+} add_state_t;
+
+/* Fields are tab-separated, so a tab or newline cannot be stored */
+static int storable_string(const char *s)
+{
+    return !s || aept_symlink_target_is_recordable(s);
+}
+
+static int add_entry(void *userdata, struct aept_ar *ar,
+                     const aept_ar_header_t *hdr)
+{
+    add_state_t *st = userdata;
+    store_entry_t *e;
+    char *path = NULL;
+    int fd, r;
+
+    /* Hard links keep whatever mode the archive gives them */
+    if ((!hdr->hardlink && !S_ISDIR(hdr->mode) && !S_ISREG(hdr->mode) &&
+            !S_ISLNK(hdr->mode)) ||
+            (S_ISLNK(hdr->mode) && !hdr->link_target) ||
+            !storable_string(hdr->link_target) ||
+            !storable_string(hdr->uname) || !storable_string(hdr->gname) ||
+            (hdr->hardlink && !aept_archive_path_is_safe(hdr->hardlink))) {
+        aept_log_debug("cannot store '%s'", hdr->path);
+        return 1;
+    }
+
+    e = manifest_add(&st->manifest);
+    e->path = aept_strdup(hdr->path);
+    e->link_target = dup_or_null(hdr->link_target);
+    e->hardlink = dup_or_null(hdr->hardlink);
+    e->uname = dup_or_null(hdr->uname);
+    e->gname = dup_or_null(hdr->gname);
+    e->mode = hdr->mode;
+    e->uid = hdr->uid;
+    e->gid = hdr->gid;
+    e->size = S_ISREG(hdr->mode) ? hdr->size : 0;
+    e->mtime = hdr->mtime;
+    e->mtime_nsec = hdr->mtime_nsec;
+
+    if (!has_data(e))
+        return 0;
+
+    aept_asprintf(&path, "%s/%d", st->dir, st->manifest.count - 1);
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        aept_log_error("cannot create '%s': %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    e->digest = aept_malloc(65);
+    r = aept_ar_copy_data(ar, fd, e->size, e->digest);
+
+    /* Keep mode and mtime so store_hardlinks can use the file as is */
+    if (r == 0) {
+        struct timespec ts[2] = {
+            { .tv_nsec = UTIME_OMIT },
+            { .tv_sec = (time_t)e->mtime, .tv_nsec = e->mtime_nsec },
+        };
+        if (fchmod(fd, (e->mode & 0777) | 0400) < 0 ||
+                futimens(fd, ts) < 0)
+            r = -1;
+    }
+    if (close(fd) != 0)
+        r = -1;
+    if (r < 0)
+        aept_log_error("failed to write '%s'", path);
+
+    free(path);
+    return r;
+}
+
+static void remove_tree(const char *path)
+{
+    const char *rm_argv[] = {"rm", "-rf", path, NULL};
+    aept_system(rm_argv);
+}
+
+int aept_store_add(struct aept_ctx *ctx, const char *entry,
+                   struct aept_ar *ar)
+{
+    add_state_t st = {0};
+    char *tmp = NULL, *manifest = NULL;
+    int r;
+
+    if (aept_file_mkdir_hier(ctx->config.unpacked_store, 0755) < 0) {
+        aept_log_error("cannot create '%s': %s",
+                       ctx->config.unpacked_store, strerror(errno));
+        return -1;
+    }
+
+    aept_asprintf(&tmp, "%s.tmp.XXXXXX", entry);
+    if (!mkdtemp(tmp)) {
+        aept_log_error("cannot create '%s': %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+
+    st.dir = tmp;
+    r = aept_ar_walk(ar, add_entry, &st);
+
+    if (r == 0) {
+        aept_asprintf(&manifest, "%s/" MANIFEST_NAME, tmp);
+        r = write_manifest(&st.manifest, manifest);
+    }
+
+    if (r == 0 && rename(tmp, entry) != 0) {
+        /* Someone else's copy is just as good */
+        if (errno != EEXIST && errno != ENOTEMPTY) {
+            aept_log_error("rename '%s' -> '%s': %s", tmp, entry,
+                           strerror(errno));
+            r = -1;
+        }
+    } else if (r == 0) {
+        aept_log_debug("stored '%s'", entry);
+        free(tmp);
+        tmp = NULL;
+    }
+
+    if (tmp) {
+        remove_tree(tmp);
+        free(tmp);
+    }
+    free(manifest);
+    manifest_free(&st.manifest);
+    return r < 0 ? -1 : r;
+}
+
+/* ── Extraction ───────────────────────────────────────────────────── */
+
+typedef struct {
+    int in;
+    long long size;
+} copy_arg_t;
+
+static int copy_content(void *userdata, int out)
+{
+    copy_arg_t *c = userdata;
+    long long done = 0;
+    char buf[0x10000];
+
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, c->in) == 0)
+        return 0;
+#endif
+
+    while (done < c->size) {
+        ssize_t n = copy_file_range(c->in, NULL, out, NULL,
+                                    (size_t)(c->size - done), 0);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n == 0 || done > 0 || (errno != ENOSYS && errno != EXDEV &&
+                errno != EINVAL && errno != EOPNOTSUPP))
+            return -1;
+        break;
+    }
+
+    /* No copy offload at all: plain read and write */
+    while (done < c->size) {
+        ssize_t n = pread(c->in, buf, sizeof(buf), (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        for (ssize_t w = 0; w < n; ) {
+            ssize_t m = pwrite(out, buf + w, (size_t)(n - w),
+                               (off_t)(done + w));
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0)
+                return -1;
+            w += m;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static void entry_header(const store_entry_t *e, aept_ar_header_t *hdr)
+{
+    hdr->path = e->path;
+    hdr->link_target = e->link_target;
+    hdr->hardlink = e->hardlink;
+    hdr->uname = e->uname;
+    hdr->gname = e->gname;
+    hdr->mode = e->mode;
+    hdr->uid = e->uid;
+    hdr->gid = e->gid;
+    hdr->size = e->size;
+    hdr->mtime = e->mtime;
+    hdr->mtime_nsec = e->mtime_nsec;
+}
+
+/* Create regular file e from data file index, as a hard link to the
+ * store if allowed and the data file fits. */
+static int extract_file(struct aept_ctx *ctx, aept_extract_t *x,
+                        int entry_fd, const store_entry_t *e,
+                        const aept_ar_header_t *hdr, int index,
+                        const char *suffix, aept_fileset_t *no_link)
+{
+    char obj[32];
+    struct stat ost;
+    copy_arg_t c;
+    int r;
+
+    snprintf(obj, sizeof(obj), "%d", index);
+    c.in = openat(entry_fd, obj, O_RDONLY | O_CLOEXEC);
+    c.size = e->size;
+    if (c.in < 0 || fstat(c.in, &ost) < 0 || ost.st_size != e->size) {
+        aept_log_error("store data for '%s' is missing or damaged", e->path);
+        if (c.in >= 0)
+            close(c.in);
+        return -1;
+    }
+
+    r = 1;
+    if (ctx->config.store_hardlinks && !(e->mode & 07000) &&
+            !(no_link && aept_fileset_contains(no_link, e->path)))
+        r = aept_extract_link(x, hdr, suffix, entry_fd, obj, &ost);
+    if (r == 1)
+        r = aept_extract_entry(x, hdr, suffix, copy_content, &c);
+
+    close(c.in);
+    return r;
+}
+
+static void record_entry(aept_ar_file_list_t *recorded,
+                         const store_entry_t *e)
+{
+    aept_arena_t *strings = &recorded->strings;
+    aept_ar_file_entry_t *fe;
+
+    if (recorded->count >= recorded->alloc) {
+        recorded->alloc = recorded->alloc ? recorded->alloc * 2 : 256;
+        recorded->entries = aept_realloc(recorded->entries,
+                recorded->alloc * sizeof(*recorded->entries));
+    }
+
+    fe = &recorded->entries[recorded->count++];
+    fe->path = aept_arena_strdup(strings, e->path);
+    fe->link_target = NULL;
+    if (e->link_target)
+        fe->link_target = aept_arena_strdup(strings,
+            aept_symlink_target_is_recordable(e->link_target) ?
+            e->link_target : "<redacted>");
+    fe->mode = e->mode;
+    fe->digest = e->digest ? aept_arena_strdup(strings, e->digest) : NULL;
+    fe->size = e->digest ? (unsigned long long)e->size : 0;
+    fe->mtime = e->digest ? e->mtime : 0;
+}
+
+int aept_store_extract(struct aept_ctx *ctx, const char *entry,
+                       const char *prefix, unsigned long *size,
+                       aept_fileset_t *conffiles, const char *cf_suffix,
+                       aept_fileset_t *no_link,
+                       aept_ar_file_list_t *recorded,
+                       aept_ar_installed_t *installed)
+{
+    aept_extract_t *x = NULL;
+    manifest_t m = {0};
+    int entry_fd;
+    int ret = -1;
+
+    entry_fd = open(entry, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (entry_fd < 0) {
+        aept_log_error("cannot open '%s': %s", entry, strerror(errno));
+        return -1;
+    }
+
+    if (load_manifest(entry, &m) < 0)
+        goto cleanup;
+
+    x = aept_extract_begin(prefix, !ctx->config.ignore_uid);
+    if (!x)
+        goto cleanup;
+
+    for (int i = 0; i < m.count; i++) {
+        const store_entry_t *e = &m.entries[i];
+        const char *suffix = NULL;
+        aept_ar_header_t hdr;
+        int kept = 0;
+        int r;
+
+        if (cf_suffix && conffiles && conffiles->count > 0 &&
+                !S_ISDIR(e->mode) &&
+                aept_fileset_contains(conffiles, e->path))
+            suffix = cf_suffix;
+
+        entry_header(e, &hdr);
+        if (has_data(e) && installed && !suffix)
+            kept = aept_extract_keep(x, &hdr,
+                                     aept_ar_installed_find(installed,
+                                                            e->path),
+                                     e->digest) == 0;
+
+        if (kept) {
+            installed->unchanged++;
+            r = 0;
+        } else if (has_data(e)) {
+            r = extract_file(ctx, x, entry_fd, e, &hdr, i, suffix, no_link);
+        } else {
+            r = aept_extract_entry(x, &hdr, suffix, NULL, NULL);
+        }
+
+        if (r < 0)
+            goto cleanup;
+        if (r == 1)
+            continue;
+
+        if (size && !kept)
+            *size += (unsigned long)e->size;
+        aept_progress_add(e->size);
+        if (recorded)
+            record_entry(recorded, e);
+    }
+
+    ret = 0;
+
+cleanup:
+    aept_extract_end(x);
+    close(entry_fd);
+    manifest_free(&m);
+    return ret;
+}
@@ -0,0 +1,144 @@
+/* trace.c - trace-event spans for profiling transactions
+ *
+ * Copyright (C) 2026 Tobias Koch
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aept/internal.h"
+#include "aept/msg.h"
+#include "aept/trace.h"
+#include "aept/util.h"
+
+struct aept_trace {
+    pthread_mutex_t lock;
+    FILE *fp;
+    int pid;
+    int empty;                  /* no event written yet */
+};
+
+static _Thread_local int trace_tid;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int aept_trace_open(struct aept_ctx *ctx)
+{
+    const char *path = getenv("AEPT_TRACE");
+    aept_trace_t *t;
+    FILE *fp;
+
+    if (ctx->trace)
+        return 0;
+    if (!path || !*path)
+        path = ctx->config.trace_file;
+    if (!path || !*path)
+        return 0;
+
+    fp = fopen(path, "we");
+    if (!fp) {
+        aept_log_error("cannot create trace file '%s': %s", path,
+                       strerror(errno));
+        return -1;
+    }
+
+    t = aept_malloc(sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    t->fp = fp;
+    t->pid = (int)getpid();
+    t->empty = 1;
+    fputs("{\"traceEvents\":[", fp);
+
+    ctx->trace = t;
+    return 0;
+}
+
+void aept_trace_close(struct aept_ctx *ctx)
+{
+    aept_trace_t *t = ctx->trace;
+
+    if (!t)
+        return;
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", t->fp);
+    if (fclose(t->fp) != 0)
+        aept_log_warning("cannot write trace file: %s", strerror(errno));
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+    ctx->trace = NULL;
+}
+
+void aept_trace_begin(struct aept_ctx *ctx, aept_trace_span_t *span,
+                      const char *what, const char *package)
+{
+    span->ctx = ctx;
+    span->what = what;
+    span->package = package;
+    span->start = ctx->trace ? now_ns() : 0;
+}
+
+/* Write s as the contents of a JSON string. */
+static void put_escaped(FILE *fp, const char *s)
+{
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+}
+
+void aept_trace_end(aept_trace_span_t *span)
+{
+    aept_trace_t *t;
+    long long end;
+
+    if (!span->start)
+        return;
+
+    end = now_ns();
+    t = span->ctx->trace;
+    if (!trace_tid)
+        trace_tid = (int)syscall(SYS_gettid);
+
+    pthread_mutex_lock(&t->lock);
+
+    fputs(t->empty ? "\n{\"name\":\"" : ",\n{\"name\":\"", t->fp);
+    put_escaped(t->fp, span->what);
+    if (span->package) {
+        fputc(' ', t->fp);
+        put_escaped(t->fp, span->package);
+    }
+    fputs("\",\"cat\":\"", t->fp);
+    put_escaped(t->fp, span->what);
+    fprintf(t->fp, "\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,"
+            "\"pid\":%d,\"tid\":%d", span->start / 1000, span->start % 1000,
+            (end - span->start) / 1000, (end - span->start) % 1000,
+            t->pid, trace_tid);
+    if (span->package) {
+        fputs(",\"args\":{\"package\":\"", t->fp);
+        put_escaped(t->fp, span->package);
+        fputs("\"}", t->fp);
+    }
+    fputc('}', t->fp);
+    t->empty = 0;
+
+    pthread_mutex_unlock(&t->lock);
+}
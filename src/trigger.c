@@ -13,8 +13,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "aept/infodb.h"
 #include "aept/internal.h"
 #include "aept/msg.h"
+#include "aept/stats.h"
+#include "aept/trace.h"
 #include "aept/trigger.h"
 #include "aept/util.h"
 
@@ -47,11 +50,10 @@ void aept_trigger_ctx_add_dir(aept_trigger_ctx_t *ctx, const char *dir)
     if (dir[0] == '\0')
         return;
 
-    /* Deduplicate */
-    for (int i = 0; i < ctx->n_dirs; i++) {
-        if (strcmp(ctx->dirs[i], dir) == 0)
-            return;
-    }
+    /* Consecutive files usually share a directory; the rest of the
+     * duplicates go in aept_trigger_run_all(). */
+    if (ctx->n_dirs > 0 && strcmp(ctx->dirs[ctx->n_dirs - 1], dir) == 0)
+        return;
 
     if (ctx->n_dirs >= ctx->dirs_alloc) {
         ctx->dirs_alloc = ctx->dirs_alloc ? ctx->dirs_alloc * 2 : 32;
@@ -171,15 +173,6 @@ static void sort_and_dedup(char **arr, int *count)
     *count = out;
 }
 
-static int is_fresh(aept_trigger_ctx_t *ctx, const char *name)
-{
-    for (int i = 0; i < ctx->n_fresh; i++) {
-        if (strcmp(ctx->fresh_pkgs[i], name) == 0)
-            return 1;
-    }
-    return 0;
-}
-
 static int has_glob_chars(const char *s)
 {
     for (; *s; s++) {
@@ -216,6 +209,9 @@ static int run_trigger_script(struct aept_ctx *ctx, const char *pkg_name,
 
     aept_log_info("running trigger for %s", pkg_name);
 
+    aept_trace_span_t span;
+    aept_trace_begin(ctx, &span, "trigger", pkg_name);
+
     const char *run_path = strip_offline_root(ctx, path);
 
     /* Build argv: /bin/sh <script> <dir1> <dir2> ... NULL */
@@ -228,6 +224,7 @@ static int run_trigger_script(struct aept_ctx *ctx, const char *pkg_name,
     argv[argc] = NULL;
 
     r = aept_system_offline_root(ctx, argv);
+    aept_trace_end(&span);
 
     free(argv);
     free(path);
@@ -241,31 +238,199 @@ static int run_trigger_script(struct aept_ctx *ctx, const char *pkg_name,
     return 0;
 }
 
+/* ── Trigger index ───────────────────────────────────────────────── */
+
 /* A single trigger pattern entry. */
 typedef struct {
     char *pattern;
-    char *pkg_name;
     int modify_only;    /* pattern had '+' prefix */
 } trigger_entry_t;
 
-/* Scan info_dir for *.triggers files and build the entry list on the
- * fly, without an intermediate index file on disk. */
-static void load_trigger_entries(struct aept_ctx *ctx,
-                                 trigger_entry_t **out_entries,
-                                 int *out_count)
+/* A package with a .triggers file and the range of its entries.  The
+ * file's mtime and size tell whether a saved index is still current. */
+typedef struct {
+    char *name;
+    long long mtime_sec;
+    long mtime_nsec;
+    long long size;
+    int first;
+    int count;
+} trigger_pkg_t;
+
+/* All trigger patterns of the installed packages, grouped by package
+ * and sorted by package name.  Persisted in {info_dir}.triggers. */
+typedef struct {
+    trigger_pkg_t *pkgs;
+    int n_pkgs;
+    int pkgs_alloc;
+    trigger_entry_t *entries;
+    int n_entries;
+    int entries_alloc;
+} trigger_index_t;
+
+#define TRIGGER_INDEX_MAGIC "aept-triggers 1"
+
+static char *trigger_index_path(struct aept_ctx *ctx)
+{
+    char *path = NULL;
+    aept_asprintf(&path, "%s.triggers", ctx->config.info_dir);
+    return path;
+}
+
+static void trigger_index_free(trigger_index_t *idx)
+{
+    for (int i = 0; i < idx->n_pkgs; i++)
+        free(idx->pkgs[i].name);
+    free(idx->pkgs);
+
+    for (int i = 0; i < idx->n_entries; i++)
+        free(idx->entries[i].pattern);
+    free(idx->entries);
+
+    memset(idx, 0, sizeof(*idx));
+}
+
+static trigger_pkg_t *trigger_index_add_pkg(trigger_index_t *idx,
+                                            const char *name)
+{
+    if (idx->n_pkgs >= idx->pkgs_alloc) {
+        idx->pkgs_alloc = idx->pkgs_alloc ? idx->pkgs_alloc * 2 : 16;
+        idx->pkgs = aept_realloc(idx->pkgs,
+                                 idx->pkgs_alloc * sizeof(*idx->pkgs));
+    }
+
+    trigger_pkg_t *pkg = &idx->pkgs[idx->n_pkgs++];
+    memset(pkg, 0, sizeof(*pkg));
+    pkg->name = aept_strdup(name);
+    pkg->first = idx->n_entries;
+    return pkg;
+}
+
+static void trigger_index_add_entry(trigger_index_t *idx, const char *pattern,
+                                    int modify_only)
+{
+    if (idx->n_entries >= idx->entries_alloc) {
+        idx->entries_alloc = idx->entries_alloc ? idx->entries_alloc * 2 : 16;
+        idx->entries = aept_realloc(idx->entries,
+                                    idx->entries_alloc * sizeof(*idx->entries));
+    }
+
+    idx->entries[idx->n_entries].pattern = aept_strdup(pattern);
+    idx->entries[idx->n_entries].modify_only = modify_only;
+    idx->n_entries++;
+    idx->pkgs[idx->n_pkgs - 1].count++;
+}
+
+/* stat() {info_dir}/{name}.triggers.  Returns 0 on success. */
+static int stat_triggers_file(struct aept_ctx *ctx, const char *name,
+                              struct stat *st)
+{
+    char *path = NULL;
+    int r;
+
+    aept_asprintf(&path, "%s/%s.triggers", ctx->config.info_dir, name);
+    r = stat(path, st);
+    free(path);
+    return r;
+}
+
+/* Add the trigger patterns in fp to the last package of idx */
+static void read_trigger_patterns(trigger_index_t *idx, FILE *fp)
+{
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        int modify_only = 0;
+        if (p[0] == '+') {
+            modify_only = 1;
+            p++;
+        }
+
+        trigger_index_add_entry(idx, p, modify_only);
+    }
+}
+
+typedef struct {
+    aept_infodb_file_t *files;
+    size_t count;
+    size_t alloc;
+} db_triggers_t;
+
+static int collect_db_triggers(const aept_infodb_file_t *f, void *userdata)
+{
+    db_triggers_t *dt = userdata;
+
+    if (dt->count >= dt->alloc) {
+        dt->alloc = dt->alloc ? dt->alloc * 2 : 16;
+        dt->files = aept_realloc(dt->files, dt->alloc * sizeof(*dt->files));
+    }
+    dt->files[dt->count++] = *f;
+    return 0;
+}
+
+static int db_file_cmp(const void *a, const void *b)
+{
+    const aept_infodb_file_t *fa = a;
+    const aept_infodb_file_t *fb = b;
+    return strcmp(fa->name, fb->name);
+}
+
+/* Parse the .triggers files kept in the consolidated database */
+static void build_trigger_index_db(trigger_index_t *idx, aept_infodb_t *db)
+{
+    db_triggers_t dt = {0};
+
+    aept_infodb_foreach(db, "triggers", collect_db_triggers, &dt);
+    qsort(dt.files, dt.count, sizeof(*dt.files), db_file_cmp);
+
+    for (size_t i = 0; i < dt.count; i++) {
+        const aept_infodb_file_t *f = &dt.files[i];
+        trigger_pkg_t *pkg = trigger_index_add_pkg(idx, f->name);
+
+        pkg->mtime_sec = f->mtime_sec;
+        pkg->mtime_nsec = f->mtime_nsec;
+        pkg->size = (long long)f->len;
+
+        if (f->len == 0)
+            continue;
+
+        FILE *tfp = fmemopen((void *)f->data, f->len, "r");
+        if (!tfp)
+            continue;
+        read_trigger_patterns(idx, tfp);
+        fclose(tfp);
+    }
+
+    free(dt.files);
+}
+
+/* Scan info_dir for *.triggers files and parse them. */
+static void build_trigger_index(struct aept_ctx *ctx, trigger_index_t *idx)
 {
     DIR *dp;
     struct dirent *de;
-    trigger_entry_t *entries = NULL;
-    int n_entries = 0;
-    int entries_alloc = 0;
+    char **names = NULL;
+    int n_names = 0, names_alloc = 0;
+    aept_infodb_t *db;
+
+    db = aept_infodb_open(ctx);
+    if (db) {
+        build_trigger_index_db(idx, db);
+        aept_infodb_close(db);
+        return;
+    }
 
     dp = opendir(ctx->config.info_dir);
-    if (!dp) {
-        *out_entries = NULL;
-        *out_count = 0;
+    if (!dp)
         return;
-    }
 
     while ((de = readdir(dp)) != NULL) {
         const char *suffix = ".triggers";
@@ -277,132 +442,269 @@ static void load_trigger_entries(struct aept_ctx *ctx,
         if (strcmp(de->d_name + nlen - slen, suffix) != 0)
             continue;
 
-        char *pkg_name = strndup(de->d_name, nlen - slen);
-        if (!pkg_name)
-            continue;
+        if (n_names >= names_alloc) {
+            names_alloc = names_alloc ? names_alloc * 2 : 16;
+            names = aept_realloc(names, names_alloc * sizeof(char *));
+        }
+        names[n_names++] = aept_strndup(de->d_name, nlen - slen);
+    }
+
+    closedir(dp);
+
+    sort_and_dedup(names, &n_names);
 
+    for (int i = 0; i < n_names; i++) {
         char *trig_path = NULL;
-        aept_asprintf(&trig_path, "%s/%s", ctx->config.info_dir, de->d_name);
+        struct stat st;
+
+        aept_asprintf(&trig_path, "%s/%s.triggers",
+                      ctx->config.info_dir, names[i]);
 
         FILE *tfp = fopen(trig_path, "r");
         free(trig_path);
 
-        if (!tfp) {
-            free(pkg_name);
+        if (!tfp || fstat(fileno(tfp), &st) != 0) {
+            if (tfp)
+                fclose(tfp);
+            free(names[i]);
             continue;
         }
 
-        char line[1024];
-        while (fgets(line, sizeof(line), tfp)) {
-            line[strcspn(line, "\n")] = '\0';
+        trigger_pkg_t *pkg = trigger_index_add_pkg(idx, names[i]);
+        pkg->mtime_sec = (long long)st.st_mtim.tv_sec;
+        pkg->mtime_nsec = st.st_mtim.tv_nsec;
+        pkg->size = (long long)st.st_size;
 
-            const char *p = line;
-            while (*p == ' ' || *p == '\t')
-                p++;
-            if (*p == '\0' || *p == '#')
-                continue;
+        read_trigger_patterns(idx, tfp);
 
-            if (n_entries >= entries_alloc) {
-                entries_alloc = entries_alloc ? entries_alloc * 2 : 16;
-                entries = aept_realloc(entries,
-                                       entries_alloc * sizeof(*entries));
-            }
+        fclose(tfp);
+        free(names[i]);
+    }
 
-            int modify_only = 0;
-            if (p[0] == '+') {
-                modify_only = 1;
-                p++;
-            }
+    free(names);
+}
+
+/* Load the saved index.  Returns 0 if it exists and every listed
+ * .triggers file is unchanged, -1 otherwise (idx is left empty). */
+static int load_trigger_index(struct aept_ctx *ctx, trigger_index_t *idx)
+{
+    char *path = trigger_index_path(ctx);
+    FILE *fp = fopen(path, "r");
+    char line[1100];
+    int valid = 0;
 
-            entries[n_entries].pattern = aept_strdup(p);
-            entries[n_entries].pkg_name = aept_strdup(pkg_name);
-            entries[n_entries].modify_only = modify_only;
-            n_entries++;
+    free(path);
+    if (!fp)
+        return -1;
+
+    if (!fgets(line, sizeof(line), fp) ||
+            strcmp(line, TRIGGER_INDEX_MAGIC "\n") != 0)
+        goto out;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (aept_fgets_is_truncated(line, sizeof(line)))
+            goto out;
+        line[strcspn(line, "\n")] = '\0';
+
+        if (line[0] == 'P' && line[1] == ' ') {
+            char name[256];
+            long long sec, size;
+            long nsec;
+            struct stat st;
+
+            if (sscanf(line + 2, "%255s %lld.%ld %lld",
+                       name, &sec, &nsec, &size) != 4)
+                goto out;
+            if (stat_triggers_file(ctx, name, &st) != 0 ||
+                    (long long)st.st_mtim.tv_sec != sec ||
+                    st.st_mtim.tv_nsec != nsec ||
+                    (long long)st.st_size != size)
+                goto out;
+
+            trigger_pkg_t *pkg = trigger_index_add_pkg(idx, name);
+            pkg->mtime_sec = sec;
+            pkg->mtime_nsec = nsec;
+            pkg->size = size;
+        } else if ((line[0] == 'T' || line[0] == 'M') && line[1] == ' ') {
+            if (idx->n_pkgs == 0)
+                goto out;
+            trigger_index_add_entry(idx, line + 2, line[0] == 'M');
+        } else {
+            goto out;
         }
+    }
 
-        fclose(tfp);
-        free(pkg_name);
+    valid = !ferror(fp);
+
+out:
+    fclose(fp);
+    if (!valid) {
+        aept_log_debug("trigger index is out of date");
+        trigger_index_free(idx);
+        return -1;
     }
+    return 0;
+}
 
-    closedir(dp);
+/* Write the index atomically.  Failure only costs a rebuild next time. */
+static void save_trigger_index(struct aept_ctx *ctx, trigger_index_t *idx)
+{
+    char *path = trigger_index_path(ctx);
+    char *tmp = NULL;
+    FILE *fp;
+
+    aept_asprintf(&tmp, "%s.%d", path, (int)getpid());
+
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        aept_log_debug("cannot write trigger index '%s': %s", tmp,
+                  strerror(errno));
+        goto out;
+    }
+
+    fprintf(fp, "%s\n", TRIGGER_INDEX_MAGIC);
+    for (int i = 0; i < idx->n_pkgs; i++) {
+        trigger_pkg_t *pkg = &idx->pkgs[i];
+
+        fprintf(fp, "P %s %lld.%09ld %lld\n", pkg->name,
+                pkg->mtime_sec, pkg->mtime_nsec, pkg->size);
+        for (int e = pkg->first; e < pkg->first + pkg->count; e++)
+            fprintf(fp, "%c %s\n", idx->entries[e].modify_only ? 'M' : 'T',
+                    idx->entries[e].pattern);
+    }
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        aept_log_debug("failed to write trigger index '%s'", tmp);
+        unlink(tmp);
+    } else if (rename(tmp, path) != 0) {
+        aept_log_debug("cannot rename '%s': %s", tmp, strerror(errno));
+        unlink(tmp);
+    }
+
+out:
+    free(tmp);
+    free(path);
+}
+
+void aept_trigger_index_invalidate(struct aept_ctx *ctx)
+{
+    char *path = trigger_index_path(ctx);
+    unlink(path);
+    free(path);
+}
+
+/* ── Matching ────────────────────────────────────────────────────── */
+
+typedef struct {
+    char **dirs;
+    int n;
+    int alloc;
+} matched_dirs_t;
+
+static void matched_add(matched_dirs_t *m, char *abs_dir)
+{
+    if (m->n >= m->alloc) {
+        m->alloc = m->alloc ? m->alloc * 2 : 8;
+        m->dirs = aept_realloc(m->dirs, m->alloc * sizeof(char *));
+    }
+    m->dirs[m->n++] = abs_dir;
+}
 
-    *out_entries = entries;
-    *out_count = n_entries;
+/* Index of the first of the sorted dirs that compares >= key. */
+static int lower_bound(char **dirs, int n, const char *key)
+{
+    int lo = 0, hi = n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(dirs[mid], key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Add the collected directories matching pat to m.  Trigger patterns
+ * are absolute and dirs are relative and sorted, so only the run of
+ * dirs sharing the pattern's literal prefix needs to be looked at. */
+static void match_dirs(aept_trigger_ctx_t *tctx, const char *pat,
+                       matched_dirs_t *m)
+{
+    /* Under FNM_PATHNAME no wildcard matches the leading '/'. */
+    if (pat[0] != '/')
+        return;
+    pat++;
+
+    size_t plen = strcspn(pat, "*?[\\");
+    char *prefix = aept_strndup(pat, plen);
+
+    int d = lower_bound(tctx->dirs, tctx->n_dirs, prefix);
+
+    for (; d < tctx->n_dirs; d++) {
+        const char *dir = tctx->dirs[d];
+
+        if (strncmp(dir, prefix, plen) != 0)
+            break;
+
+        if (pat[plen] == '\0') {
+            if (dir[plen] != '\0')
+                break;
+        } else if (fnmatch(pat, dir, FNM_PATHNAME) != 0) {
+            continue;
+        }
+
+        char *abs_dir = NULL;
+        aept_asprintf(&abs_dir, "/%s", dir);
+        matched_add(m, abs_dir);
+    }
+
+    free(prefix);
+}
+
+static int is_fresh(aept_trigger_ctx_t *ctx, const char *name)
+{
+    return bsearch(&name, ctx->fresh_pkgs, ctx->n_fresh, sizeof(char *),
+                   str_cmp) != NULL;
 }
 
 int aept_trigger_run_all(struct aept_ctx *ctx, aept_trigger_ctx_t *tctx)
 {
-    trigger_entry_t *entries = NULL;
-    int n_entries = 0;
+    trigger_index_t idx;
+    aept_stats_timer_t timer;
+    aept_trace_span_t span;
 
     if (tctx->n_dirs == 0)
         return 0;
 
+    aept_stats_begin(ctx, &timer, AEPT_PHASE_TRIGGERS);
+    aept_trace_begin(ctx, &span, "triggers", NULL);
+
     /* Sort & deduplicate collected directories */
     sort_and_dedup(tctx->dirs, &tctx->n_dirs);
+    tctx->dirs_sorted = 1;
+    sort_and_dedup(tctx->fresh_pkgs, &tctx->n_fresh);
 
-    load_trigger_entries(ctx, &entries, &n_entries);
+    memset(&idx, 0, sizeof(idx));
+    if (load_trigger_index(ctx, &idx) != 0) {
+        build_trigger_index(ctx, &idx);
+        save_trigger_index(ctx, &idx);
+    }
 
-    if (n_entries == 0)
-        return 0;
+    for (int i = 0; i < idx.n_pkgs; i++) {
+        const trigger_pkg_t *pkg = &idx.pkgs[i];
+        int pkg_is_fresh = is_fresh(tctx, pkg->name);
+        matched_dirs_t m = {0};
 
-    /* Process entries grouped by package.  Since the set is small,
-     * a simple O(n*m) approach is fine: for each unique package,
-     * collect matching directories across all its patterns. */
-    for (int i = 0; i < n_entries; i++) {
-        if (!entries[i].pkg_name)
-            continue;   /* already processed */
-
-        const char *pkg = entries[i].pkg_name;
-        int pkg_is_fresh = is_fresh(tctx, pkg);
-
-        /* Collect matched directories for this package */
-        const char **matched = NULL;
-        int n_matched = 0;
-        int matched_alloc = 0;
-
-        for (int e = i; e < n_entries; e++) {
-            if (!entries[e].pkg_name)
-                continue;
-            if (strcmp(entries[e].pkg_name, pkg) != 0)
-                continue;
-
-            const char *pat = entries[e].pattern;
-
-            /* Match against collected directories */
-            for (int d = 0; d < tctx->n_dirs; d++) {
-                /* Trigger patterns are absolute, dirs are relative */
-                char *abs_dir = NULL;
-                aept_asprintf(&abs_dir, "/%s", tctx->dirs[d]);
-
-                if (fnmatch(pat, abs_dir, FNM_PATHNAME) == 0) {
-                    /* Deduplicate matched dirs */
-                    int dup = 0;
-                    for (int m = 0; m < n_matched; m++) {
-                        if (strcmp(matched[m], abs_dir) == 0) {
-                            dup = 1;
-                            break;
-                        }
-                    }
-                    if (!dup) {
-                        if (n_matched >= matched_alloc) {
-                            matched_alloc = matched_alloc
-                                ? matched_alloc * 2 : 8;
-                            matched = aept_realloc(matched,
-                                matched_alloc * sizeof(char *));
-                        }
-                        matched[n_matched++] = abs_dir;
-                        abs_dir = NULL;  /* ownership transferred */
-                    }
-                }
-
-                free(abs_dir);
-            }
+        for (int e = pkg->first; e < pkg->first + pkg->count; e++) {
+            const char *pat = idx.entries[e].pattern;
+
+            match_dirs(tctx, pat, &m);
 
             /* For fresh packages with non-modify-only patterns:
              * if the pattern is a concrete path and exists on disk,
              * add it even if it wasn't in tctx->dirs. */
-            if (pkg_is_fresh && !entries[e].modify_only
+            if (pkg_is_fresh && !idx.entries[e].modify_only
                     && !has_glob_chars(pat)) {
                 char *full_path = NULL;
                 if (ctx->config.offline_root)
@@ -412,52 +714,25 @@ int aept_trigger_run_all(struct aept_ctx *ctx, aept_trigger_ctx_t *tctx)
                     full_path = aept_strdup(pat);
 
                 struct stat st;
-                if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode)) {
-                    int dup = 0;
-                    for (int m = 0; m < n_matched; m++) {
-                        if (strcmp(matched[m], pat) == 0) {
-                            dup = 1;
-                            break;
-                        }
-                    }
-                    if (!dup) {
-                        if (n_matched >= matched_alloc) {
-                            matched_alloc = matched_alloc
-                                ? matched_alloc * 2 : 8;
-                            matched = aept_realloc(matched,
-                                matched_alloc * sizeof(char *));
-                        }
-                        matched[n_matched++] = aept_strdup(pat);
-                    }
-                }
+                if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode))
+                    matched_add(&m, aept_strdup(pat));
 
                 free(full_path);
             }
-
-            /* Mark this entry as consumed so we don't process
-             * this package again. */
-            if (e != i) {
-                free(entries[e].pkg_name);
-                entries[e].pkg_name = NULL;
-            }
         }
 
-        if (n_matched > 0)
-            run_trigger_script(ctx, pkg, matched, n_matched);
+        sort_and_dedup(m.dirs, &m.n);
 
-        for (int m = 0; m < n_matched; m++)
-            free((char *)matched[m]);
-        free(matched);
-
-        free(entries[i].pkg_name);
-        entries[i].pkg_name = NULL;
-    }
+        if (m.n > 0)
+            run_trigger_script(ctx, pkg->name, (const char **)m.dirs, m.n);
 
-    for (int i = 0; i < n_entries; i++) {
-        free(entries[i].pattern);
-        free(entries[i].pkg_name);
+        for (int j = 0; j < m.n; j++)
+            free(m.dirs[j]);
+        free(m.dirs);
     }
-    free(entries);
 
+    trigger_index_free(&idx);
+    aept_trace_end(&span);
+    aept_stats_end(&timer);
     return 0;
 }
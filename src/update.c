@@ -6,43 +6,60 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "aept/internal.h"
-#include "aept/archive.h"
 #include "aept/download.h"
+#include "aept/mirror.h"
 #include "aept/msg.h"
+#include "aept/stats.h"
 #include "aept/update.h"
 #include "aept/util.h"
 #include "aept/verify.h"
 
-static int decompress_gz(const char *gz_path, const char *out_path)
+/*
+ * Lists carry the Last-Modified time of the index they were fetched from
+ * as their mtime, which is what the next update sends as If-Modified-Since.
+ * Returns 0 (unconditional fetch) if there is no usable local copy.
+ */
+static time_t list_mtime(struct aept_ctx *ctx, const char *list_path)
 {
-    struct aept_ar *ar;
-    FILE *fp;
-    int r;
-
-    ar = aept_ar_open_compressed_file(gz_path);
-    if (!ar)
-        return -1;
-
-    fp = fopen(out_path, "w");
-    if (!fp) {
-        aept_ar_close(ar);
-        return -1;
+    struct stat st;
+    char *sig_path = NULL;
+    int have_sig;
+
+    if (stat(list_path, &st) < 0 || st.st_size == 0)
+        return 0;
+
+    if (ctx->config.check_signature) {
+        aept_asprintf(&sig_path, "%s.sig", list_path);
+        have_sig = access(sig_path, F_OK) == 0;
+        free(sig_path);
+        if (!have_sig)
+            return 0;
     }
 
-    r = aept_ar_copy_to_stream(ar, fp);
+    return st.st_mtime;
+}
 
-    if (fclose(fp) != 0 && r == 0)
-        r = -1;
+static void set_list_mtime(const char *list_path, time_t mtime)
+{
+    struct timespec ts[2];
+
+    if (mtime <= 0)
+        return;
 
-    aept_ar_close(ar);
+    ts[0].tv_sec = ts[1].tv_sec = mtime;
+    ts[0].tv_nsec = ts[1].tv_nsec = 0;
 
-    return r;
+    if (utimensat(AT_FDCWD, list_path, ts, 0) < 0)
+        aept_log_debug("cannot set mtime of '%s': %s", list_path,
+                       strerror(errno));
 }
 
 static int is_active_source(struct aept_ctx *ctx, const char *name)
@@ -75,13 +92,15 @@ static void prune_stale_lists(struct aept_ctx *ctx)
         if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
             continue;
 
-        /* Strip .sig suffix to get the source name */
+        /* Strip .sig or .solv suffix to get the source name */
         copy = aept_strdup(name);
         base = copy;
 
         size_t len = strlen(base);
         if (len > 4 && strcmp(base + len - 4, ".sig") == 0)
             base[len - 4] = '\0';
+        else if (len > 5 && strcmp(base + len - 5, ".solv") == 0)
+            base[len - 5] = '\0';
 
         if (!is_active_source(ctx, base)) {
             aept_asprintf(&path, "%s/%s", ctx->config.lists_dir, name);
@@ -95,106 +114,135 @@ static void prune_stale_lists(struct aept_ctx *ctx)
     closedir(d);
 }
 
-int aept_op_update(struct aept_ctx *ctx)
+/* Fetch and verify the list of src from one of its mirrors.  Returns 0
+ * after an update, 1 if the list is up to date and -1 on error. */
+static int update_from(struct aept_ctx *ctx, aept_source_t *src,
+                       aept_mirror_t *mirror, const char *list_path)
 {
-    int i;
-    int errors = 0;
+    char *url = NULL;
+    aept_stats_timer_t timer;
+    time_t mtime;
+    int r;
 
-    aept_file_mkdir_hier(ctx->config.lists_dir, 0755);
+    mtime = list_mtime(ctx, list_path);
 
-    for (i = 0; i < ctx->config.nsources; i++) {
-        if (strncmp(ctx->config.sources[i].url, "https://", 8) != 0)
-            aept_log_warning("source '%s' uses insecure transport",
-                        ctx->config.sources[i].name);
+    if (src->gzip) {
+        aept_asprintf(&url, "%s/Packages.gz", mirror->url);
+        r = aept_download_gunzip(ctx, url, list_path, url, &mtime, mirror);
+    } else {
+        aept_asprintf(&url, "%s/Packages", mirror->url);
+        r = aept_download_if_modified(ctx, url, list_path, "Packages",
+                                      &mtime, mirror);
     }
+    free(url);
 
-    for (i = 0; i < ctx->config.nsources; i++) {
-        aept_source_t *src = &ctx->config.sources[i];
-        char *url = NULL;
-        char *dest = NULL;
-        char *list_path = NULL;
-        int r;
+    if (r != 0)
+        return r;
 
-        if (aept_cancelled()) {
-            aept_log_warning("interrupted, stopping");
-            errors++;
-            break;
-        }
-
-        aept_asprintf(&list_path, "%s/%s", ctx->config.lists_dir, src->name);
+    set_list_mtime(list_path, mtime);
 
-        if (src->gzip) {
-            char *gz_path = NULL;
+    if (ctx->config.check_signature) {
+        char *sig_url = NULL;
+        char *sig_path = NULL;
 
-            aept_asprintf(&url, "%s/Packages.gz", src->url);
-            aept_asprintf(&gz_path, "%s.gz", list_path);
+        aept_asprintf(&sig_url, "%s/Packages.sig", mirror->url);
+        aept_asprintf(&sig_path, "%s.sig", list_path);
 
-            r = aept_download(ctx,url, gz_path, url);
+        r = aept_download(ctx, sig_url, sig_path, sig_url, mirror);
+        if (r < 0) {
+            aept_log_error("failed to download signature for '%s'",
+                      src->name);
+            unlink(list_path);
+        } else {
+            aept_stats_begin(ctx, &timer, AEPT_PHASE_VERIFY);
+            r = aept_verify_signature(ctx, list_path, sig_path);
+            aept_stats_end(&timer);
             if (r < 0) {
-                errors++;
-                goto next;
+                unlink(list_path);
+                unlink(sig_path);
             }
+        }
 
-            r = decompress_gz(gz_path, list_path);
-            unlink(gz_path);
-            free(gz_path);
+        free(sig_url);
+        free(sig_path);
+    }
 
-            if (r < 0) {
-                aept_log_error("failed to decompress Packages.gz for '%s'",
-                          src->name);
-                errors++;
-                goto next;
-            }
-        } else {
-            aept_asprintf(&url, "%s/Packages", src->url);
+    return r;
+}
 
-            r = aept_download(ctx,url, list_path, "Packages");
-            if (r < 0) {
-                errors++;
-                goto next;
-            }
-        }
+/* Fetch and verify the list of source i, trying its mirrors in turn.
+ * Runs on an update worker. */
+static int update_source(struct aept_ctx *ctx, int i, void *arg)
+{
+    aept_source_t *src = &ctx->config.sources[i];
+    char *list_path = NULL;
+    int *order;
+    int n, k, r = -1;
 
-        if (ctx->config.check_signature) {
-            char *sig_url = NULL;
-            char *sig_path = NULL;
+    (void)arg;
+    aept_asprintf(&list_path, "%s/%s", ctx->config.lists_dir, src->name);
 
-            aept_asprintf(&sig_url, "%s/Packages.sig", src->url);
-            aept_asprintf(&sig_path, "%s.sig", list_path);
+    order = aept_malloc(src->nmirrors * sizeof(int));
+    n = aept_mirror_order(ctx, i, 0, order);
 
-            r = aept_download(ctx,sig_url, sig_path, sig_url);
-            if (r < 0) {
-                aept_log_error("failed to download signature for '%s'",
-                          src->name);
-                unlink(list_path);
-                errors++;
-                free(sig_url);
-                free(sig_path);
-                goto next;
-            }
+    for (k = 0; k < n; k++) {
+        aept_mirror_t *mirror = &src->mirrors[order[k]];
 
-            r = aept_verify_signature(ctx,list_path, sig_path);
-            if (r < 0) {
-                unlink(list_path);
-                unlink(sig_path);
-                errors++;
-                free(sig_url);
-                free(sig_path);
-                goto next;
-            }
+        if (k > 0)
+            aept_log_info("trying mirror %s for '%s'", mirror->url,
+                          src->name);
 
-            free(sig_url);
-            free(sig_path);
-        }
+        r = update_from(ctx, src, mirror, list_path);
+        if (r >= 0 || aept_cancelled())
+            break;
+    }
 
+    if (r > 0)
+        aept_log_info("source '%s' is up to date", src->name);
+    else if (r == 0)
         aept_log_info("updated source '%s'", src->name);
 
-    next:
-        free(url);
-        free(dest);
-        free(list_path);
+    free(order);
+    free(list_path);
+    return r < 0 ? -1 : 0;
+}
+
+int aept_op_update(struct aept_ctx *ctx)
+{
+    int *results;
+    int i;
+    int errors = 0;
+
+    aept_file_mkdir_hier(ctx->config.lists_dir, 0755);
+
+    aept_mirror_check_transport(ctx);
+
+    /* Sources are independent, so a slow mirror only holds up its own
+     * worker.  A source that never started counts as one error. */
+    results = aept_malloc(ctx->config.nsources * sizeof(int));
+    for (i = 0; i < ctx->config.nsources; i++)
+        results[i] = 1;
+
+    aept_download_init(ctx);
+    aept_mirror_probe(ctx);
+    aept_parallel_run(ctx, ctx->config.nsources, ctx->config.download_jobs,
+                      update_source, NULL, results);
+
+    for (i = 0; i < ctx->config.nsources; i++) {
+        if (results[i] < 0)
+            errors++;
     }
 
+    for (i = 0; i < ctx->config.nsources; i++) {
+        if (results[i] > 0) {
+            aept_log_warning("interrupted, stopping");
+            errors++;
+            break;
+        }
+    }
+
+    free(results);
+
     prune_stale_lists(ctx);
 
     return errors ? -1 : 0;
@@ -8,11 +8,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -53,6 +56,16 @@ char *aept_strdup(const char *s)
     return p;
 }
 
+char *aept_strndup(const char *s, size_t n)
+{
+    char *p = strndup(s, n);
+    if (!p) {
+        fprintf(stderr, "aept: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
 int aept_asprintf(char **strp, const char *fmt, ...)
 {
     va_list ap;
@@ -70,6 +83,53 @@ int aept_asprintf(char **strp, const char *fmt, ...)
     return r;
 }
 
+/* ── String arena ─────────────────────────────────────────────────── */
+
+#define ARENA_CHUNK_SIZE 0x10000
+
+struct aept_arena_chunk {
+    aept_arena_chunk_t *next;
+    char data[];
+};
+
+char *aept_arena_strndup(aept_arena_t *a, const char *s, size_t len)
+{
+    char *p;
+
+    if (!a->head || a->size - a->used < len + 1) {
+        size_t size = len + 1 > ARENA_CHUNK_SIZE ? len + 1
+                                                 : ARENA_CHUNK_SIZE;
+        aept_arena_chunk_t *c = aept_malloc(sizeof(*c) + size);
+
+        c->next = a->head;
+        a->head = c;
+        a->used = 0;
+        a->size = size;
+    }
+
+    p = a->head->data + a->used;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    a->used += len + 1;
+    return p;
+}
+
+char *aept_arena_strdup(aept_arena_t *a, const char *s)
+{
+    return aept_arena_strndup(a, s, strlen(s));
+}
+
+void aept_arena_free(aept_arena_t *a)
+{
+    while (a->head) {
+        aept_arena_chunk_t *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->used = 0;
+    a->size = 0;
+}
+
 int aept_pkg_name_is_safe(const char *name)
 {
     if (!name || name[0] == '\0')
@@ -222,6 +282,60 @@ int aept_file_mkdir_hier(const char *path, mode_t mode)
     return 0;
 }
 
+/* syncfs() the filesystem holding path unless one of the first *n
+ * devices in seen[] is the same. */
+static void sync_fs_of(const char *path, dev_t *seen, int *n)
+{
+    struct stat st;
+    int fd, i;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    if (fstat(fd, &st) == 0) {
+        for (i = 0; i < *n; i++) {
+            if (seen[i] == st.st_dev)
+                break;
+        }
+        if (i == *n) {
+            seen[(*n)++] = st.st_dev;
+            if (syncfs(fd) < 0)
+                aept_log_warning("cannot sync '%s': %s", path,
+                            strerror(errno));
+        }
+    }
+
+    close(fd);
+}
+
+void aept_durability_barrier(struct aept_ctx *ctx, int scope)
+{
+    const char *root = ctx->config.offline_root ?
+                       ctx->config.offline_root : "/";
+    dev_t seen[3];
+    int n = 0;
+
+    if (ctx->config.durability == AEPT_DURABILITY_NONE)
+        return;
+    if (scope == AEPT_DURABILITY_PACKAGE &&
+            ctx->config.durability != AEPT_DURABILITY_PACKAGE)
+        return;
+
+    /* One syncfs() per filesystem covers all extracted files and
+     * database writes at once, instead of an fsync() per file. */
+    sync_fs_of(root, seen, &n);
+    sync_fs_of(ctx->config.info_dir, seen, &n);
+
+    char *auto_dir = aept_strdup(ctx->config.auto_file);
+    char *slash = strrchr(auto_dir, '/');
+    if (slash && slash != auto_dir) {
+        *slash = '\0';
+        sync_fs_of(auto_dir, seen, &n);
+    }
+    free(auto_dir);
+}
+
 int aept_system(const char *argv[])
 {
     pid_t pid = fork();
@@ -255,119 +369,157 @@ int aept_system(const char *argv[])
     return -1;
 }
 
-static int unshare_and_map_user(void)
+static const char *normalize_path(const char *path)
 {
-    int fd, ret = -1;
-    char *mapfile = NULL;
-    char *content = NULL;
-
-    pid_t pid = getpid();
-    uid_t uid = geteuid();
-    gid_t gid = getegid();
+    while (path[0] == '.' && path[1] == '/')
+        path += 2;
+    while (path[0] == '/')
+        path++;
+    return path;
+}
 
-    if (unshare(CLONE_NEWUSER) != 0) {
-        aept_log_error("failed to unshare user namespace: %s",
-                  strerror(errno));
-        return -1;
-    }
+static int path_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
 
-    /* Write uid_map: map real uid to 0 inside the namespace */
-    aept_asprintf(&mapfile, "/proc/%ld/uid_map", (long)pid);
-    ret = fd = open(mapfile, O_RDWR);
-    if (ret == -1) {
-        aept_log_error("failed to open '%s': %s", mapfile, strerror(errno));
-        goto error;
-    }
+/* ── Path map ────────────────────────────────────────────────────── */
 
-    aept_asprintf(&content, "0 %lu 1", (unsigned long)uid);
-    ret = write(fd, content, strlen(content));
-    close(fd);
-    free(content);
-    content = NULL;
+/* 32-bit FNV-1a */
+static unsigned int path_hash(const char *path)
+{
+    unsigned int h = 2166136261u;
 
-    if (ret < 0) {
-        aept_log_error("failed to write uid_map: %s", strerror(errno));
-        goto error;
+    for (; *path; path++) {
+        h ^= (unsigned char)*path;
+        h *= 16777619u;
     }
+    return h;
+}
+
+void aept_pathmap_init(aept_pathmap_t *m)
+{
+    m->slots = NULL;
+    m->mask = 0;
+    m->count = 0;
+    m->used = 0;
+}
 
-    free(mapfile);
-    mapfile = NULL;
+void aept_pathmap_free(aept_pathmap_t *m)
+{
+    free(m->slots);
+    aept_pathmap_init(m);
+}
 
-    /* Write "deny" to setgroups (required before writing gid_map) */
-    aept_asprintf(&mapfile, "/proc/%ld/setgroups", (long)pid);
-    ret = fd = open(mapfile, O_RDWR);
-    if (ret == -1) {
-        aept_log_error("failed to open '%s': %s", mapfile, strerror(errno));
-        goto error;
-    }
+/* The live slot holding key, or else the free slot ending its probe
+ * sequence.  Linear probing; deleted slots are stepped over. */
+static aept_pathmap_slot_t *pathmap_find(const aept_pathmap_t *m,
+                                         const char *key, unsigned int hash)
+{
+    unsigned int i = hash & m->mask;
 
-    ret = write(fd, "deny", 4);
-    close(fd);
+    for (;;) {
+        aept_pathmap_slot_t *sl = &m->slots[i];
 
-    if (ret != 4) {
-        aept_log_error("failed to disable setgroups");
-        goto error;
+        if (!sl->key)
+            return sl;
+        if (sl->hash == hash && sl->value >= 0 && strcmp(sl->key, key) == 0)
+            return sl;
+        i = (i + 1) & m->mask;
     }
+}
 
-    free(mapfile);
-    mapfile = NULL;
+/* Rebuild m at a quarter full, dropping deleted entries */
+static void pathmap_resize(aept_pathmap_t *m)
+{
+    aept_pathmap_slot_t *old = m->slots;
+    unsigned int n = old ? m->mask + 1 : 0;
+    unsigned int size = 16, i;
 
-    /* Write gid_map: map real gid to 0 inside the namespace */
-    aept_asprintf(&mapfile, "/proc/%ld/gid_map", (long)pid);
-    ret = fd = open(mapfile, O_RDWR);
-    if (ret == -1) {
-        aept_log_error("failed to open '%s': %s", mapfile, strerror(errno));
-        goto error;
-    }
+    while (size < (unsigned int)(m->count + 1) * 4)
+        size *= 2;
 
-    aept_asprintf(&content, "0 %lu 1\n", (unsigned long)gid);
-    ret = write(fd, content, strlen(content));
-    close(fd);
-    free(content);
-    content = NULL;
+    m->slots = aept_malloc(size * sizeof(*m->slots));
+    memset(m->slots, 0, size * sizeof(*m->slots));
+    m->mask = size - 1;
+    m->used = m->count;
 
-    if (ret < 0) {
-        aept_log_error("failed to write gid_map: %s", strerror(errno));
-        goto error;
+    for (i = 0; i < n; i++) {
+        if (old[i].key && old[i].value >= 0)
+            *pathmap_find(m, old[i].key, old[i].hash) = old[i];
     }
+    free(old);
+}
+
+void aept_pathmap_put(aept_pathmap_t *m, const char *key, int value)
+{
+    aept_pathmap_slot_t *sl;
+    unsigned int hash;
 
-    free(mapfile);
-    mapfile = NULL;
+    key = normalize_path(key);
+    hash = path_hash(key);
 
-    ret = 0;
+    if (!m->slots || (unsigned int)(m->used + 1) * 2 > m->mask + 1)
+        pathmap_resize(m);
 
-error:
-    free(mapfile);
-    free(content);
-    return ret;
+    sl = pathmap_find(m, key, hash);
+    if (!sl->key) {
+        sl->key = key;
+        sl->hash = hash;
+        m->count++;
+        m->used++;
+    }
+    sl->value = value;
 }
 
-static const char *normalize_path(const char *path)
+int aept_pathmap_get(const aept_pathmap_t *m, const char *key)
 {
-    while (path[0] == '.' && path[1] == '/')
-        path += 2;
-    while (path[0] == '/')
-        path++;
-    return path;
+    const aept_pathmap_slot_t *sl;
+
+    if (m->count == 0)
+        return -1;
+
+    key = normalize_path(key);
+    sl = pathmap_find(m, key, path_hash(key));
+    return sl->key ? sl->value : -1;
 }
 
-static int path_cmp(const void *a, const void *b)
+int aept_pathmap_del(aept_pathmap_t *m, const char *key)
 {
-    return strcmp(*(const char **)a, *(const char **)b);
+    aept_pathmap_slot_t *sl;
+    int value;
+
+    if (m->count == 0)
+        return -1;
+
+    key = normalize_path(key);
+    sl = pathmap_find(m, key, path_hash(key));
+    if (!sl->key)
+        return -1;
+
+    value = sl->value;
+    sl->value = -1;
+    m->count--;
+    return value;
 }
 
+/* ── File sets ───────────────────────────────────────────────────── */
+
 void aept_fileset_init(aept_fileset_t *fs)
 {
     fs->paths = NULL;
     fs->count = 0;
     fs->alloc = 0;
-    fs->sorted = 0;
+    aept_pathmap_init(&fs->index);
+    memset(&fs->strings, 0, sizeof(fs->strings));
 }
 
 void aept_fileset_add(aept_fileset_t *fs, const char *path)
 {
+    char *copy;
+
     path = normalize_path(path);
-    if (path[0] == '\0')
+    if (path[0] == '\0' || aept_pathmap_get(&fs->index, path) >= 0)
         return;
 
     if (fs->count >= fs->alloc) {
@@ -375,44 +527,402 @@ void aept_fileset_add(aept_fileset_t *fs, const char *path)
         fs->paths = aept_realloc(fs->paths, fs->alloc * sizeof(char *));
     }
 
-    fs->paths[fs->count++] = aept_strdup(path);
-    fs->sorted = 0;
+    copy = aept_arena_strdup(&fs->strings, path);
+    aept_pathmap_put(&fs->index, copy, fs->count);
+    fs->paths[fs->count++] = copy;
 }
 
 void aept_fileset_sort(aept_fileset_t *fs)
 {
-    if (fs->sorted || fs->count <= 1)
-        return;
+    int i;
+
     qsort(fs->paths, fs->count, sizeof(char *), path_cmp);
-    fs->sorted = 1;
+    for (i = 0; i < fs->count; i++)
+        aept_pathmap_put(&fs->index, fs->paths[i], i);
 }
 
 int aept_fileset_contains(aept_fileset_t *fs, const char *path)
 {
-    path = normalize_path(path);
-    if (fs->count == 0 || path[0] == '\0')
+    return aept_pathmap_get(&fs->index, path) >= 0;
+}
+
+/* Remove path.  Returns 1 if it was present.  The last path takes its
+ * place. */
+int aept_fileset_remove(aept_fileset_t *fs, const char *path)
+{
+    int i = aept_pathmap_del(&fs->index, path);
+
+    if (i < 0)
         return 0;
-    aept_fileset_sort(fs);
-    return bsearch(&path, fs->paths, fs->count, sizeof(char *),
-                   path_cmp) != NULL;
+
+    if (i != --fs->count) {
+        fs->paths[i] = fs->paths[fs->count];
+        aept_pathmap_put(&fs->index, fs->paths[i], i);
+    }
+    return 1;
 }
 
 void aept_fileset_free(aept_fileset_t *fs)
 {
-    int i;
-
-    for (i = 0; i < fs->count; i++)
-        free(fs->paths[i]);
     free(fs->paths);
+    aept_pathmap_free(&fs->index);
+    aept_arena_free(&fs->strings);
     aept_fileset_init(fs);
 }
 
+/* ── Offline root helper ─────────────────────────────────────────── */
+
+/*
+ * Entering the user namespace and the chroot is done once per
+ * transaction by a helper process forked on the first command run in
+ * the offline root.  The helper keeps only stdio and its end of a
+ * socketpair open, and then serves requests: the parent sends an argv
+ * and the helper forks and execs it and answers with the wait status.
+ * It exits when the parent closes the socket.
+ *
+ * A request is a uint32_t argc followed by argc strings, each as a
+ * uint32_t length and its bytes.  The reply is an int32_t holding the
+ * wait status, or -1 if the helper could not fork.
+ *
+ * Before serving, the helper reports its setup as two int32_t: the step
+ * that failed (SETUP_*) and its errno, or two zeros.  It may have been
+ * forked while another thread held the log lock or malloc's, so until
+ * then it only makes system calls and leaves the logging to the parent.
+ */
+
+#define ROOT_HELPER_MAX_ARGS  4096
+#define ROOT_HELPER_MAX_ARG   65536
+
+enum {
+    SETUP_OK,
+    SETUP_UNSHARE,
+    SETUP_UID_MAP,
+    SETUP_SETGROUPS,
+    SETUP_GID_MAP,
+    SETUP_CHROOT,
+    SETUP_CHDIR,
+};
+
+static const char *const setup_steps[] = {
+    [SETUP_UNSHARE]   = "unshare user namespace",
+    [SETUP_UID_MAP]   = "write uid_map",
+    [SETUP_SETGROUPS] = "disable setgroups",
+    [SETUP_GID_MAP]   = "write gid_map",
+    [SETUP_CHDIR]     = "chdir to '/'",
+};
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Returns 0, or -1 on error or if the peer closed the socket. */
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Write buf to /proc/self/name.  Returns 0 or -1 with errno set. */
+static int write_proc_self(const char *name, const char *buf, size_t len)
+{
+    char path[32] = "/proc/self/";
+    ssize_t n;
+    int fd, saved;
+
+    strcat(path, name);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    n = write(fd, buf, len);
+    saved = errno;
+    close(fd);
+    if (n != (ssize_t)len) {
+        errno = n < 0 ? saved : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Map id to 0 in the id map name, formatted without stdio. */
+static int write_id_map(const char *name, unsigned long id)
+{
+    char digits[24], buf[32] = "0 ";
+    size_t n = 0, len = 2;
+
+    do {
+        digits[n++] = '0' + id % 10;
+        id /= 10;
+    } while (id > 0);
+    while (n > 0)
+        buf[len++] = digits[--n];
+    buf[len++] = ' ';
+    buf[len++] = '1';
+    buf[len++] = '\n';
+
+    return write_proc_self(name, buf, len);
+}
+
+/* Enter a user namespace mapping the caller to root.  Returns SETUP_OK,
+ * or the step that failed with errno set. */
+static int unshare_and_map_user(void)
+{
+    uid_t uid = geteuid();
+    gid_t gid = getegid();
+
+    if (unshare(CLONE_NEWUSER) != 0)
+        return SETUP_UNSHARE;
+    if (write_id_map("uid_map", uid) != 0)
+        return SETUP_UID_MAP;
+    /* Required before an unprivileged process may write gid_map */
+    if (write_proc_self("setgroups", "deny", 4) != 0)
+        return SETUP_SETGROUPS;
+    if (write_id_map("gid_map", gid) != 0)
+        return SETUP_GID_MAP;
+    return SETUP_OK;
+}
+
+/* Close everything but stdio and keep, so that the helper does not pin
+ * the lock file, partial downloads or deleted temporary files for the
+ * rest of the transaction. */
+static void close_other_fds(int keep)
+{
+    int max = (int)sysconf(_SC_OPEN_MAX);
+    int fd;
+
+    if (max < 0 || max > 65536)
+        max = 65536;
+    for (fd = 3; fd < max; fd++) {
+        if (fd != keep)
+            close(fd);
+    }
+}
+
+static char **read_request(int fd)
+{
+    uint32_t argc, len, i;
+    char **argv;
+
+    if (read_full(fd, &argc, sizeof(argc)) < 0 || argc == 0 ||
+            argc > ROOT_HELPER_MAX_ARGS)
+        return NULL;
+
+    argv = calloc(argc + 1, sizeof(char *));
+    if (!argv)
+        return NULL;
+
+    for (i = 0; i < argc; i++) {
+        if (read_full(fd, &len, sizeof(len)) < 0 ||
+                len > ROOT_HELPER_MAX_ARG)
+            goto error;
+        argv[i] = malloc(len + 1);
+        if (!argv[i] || read_full(fd, argv[i], len) < 0)
+            goto error;
+        argv[i][len] = '\0';
+    }
+    return argv;
+
+error:
+    for (i = 0; i < argc; i++)
+        free(argv[i]);
+    free(argv);
+    return NULL;
+}
+
+/* Body of the helper process. Never returns. */
+static void root_helper_main(struct aept_ctx *ctx, int sock)
+{
+    char **argv;
+    int32_t reply, setup[2] = { SETUP_OK, 0 };
+    int status, i;
+    pid_t pid;
+
+    close_other_fds(sock);
+
+    if (geteuid() != 0)
+        setup[0] = unshare_and_map_user();
+    if (setup[0] == SETUP_OK && chroot(ctx->config.offline_root) != 0)
+        setup[0] = SETUP_CHROOT;
+    if (setup[0] == SETUP_OK && chdir("/") != 0)
+        setup[0] = SETUP_CHDIR;
+    if (setup[0] != SETUP_OK)
+        setup[1] = errno;
+
+    if (write_full(sock, setup, sizeof(setup)) < 0 || setup[0] != SETUP_OK)
+        _exit(AEPT_EXIT_SETUP_FAILED);
+
+    while ((argv = read_request(sock)) != NULL) {
+        pid = fork();
+        if (pid == 0) {
+            close(sock);
+            execvp(argv[0], argv);
+            _exit(AEPT_EXIT_EXEC_FAILED);
+        }
+
+        reply = -1;
+        if (pid > 0) {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            reply = status;
+        }
+
+        for (i = 0; argv[i]; i++)
+            free(argv[i]);
+        free(argv);
+
+        if (write_full(sock, &reply, sizeof(reply)) < 0)
+            break;
+    }
+
+    _exit(0);
+}
+
+/* Close the socket and reap the helper.  Returns its wait status, or
+ * -1 if it could not be reaped. */
+static int root_helper_reap(struct aept_ctx *ctx)
+{
+    int status = -1;
+
+    if (ctx->root_helper_fd >= 0)
+        close(ctx->root_helper_fd);
+    ctx->root_helper_fd = -1;
+
+    if (ctx->root_helper_pid > 0) {
+        while (waitpid(ctx->root_helper_pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = -1;
+                break;
+            }
+        }
+    }
+    ctx->root_helper_pid = 0;
+    return status;
+}
+
+/* Start the helper and wait for its setup.  Returns 0, -1, or the wait
+ * status of a helper that could not set up. */
+static int root_helper_start(struct aept_ctx *ctx)
+{
+    int32_t setup[2] = { -1, 0 };
+    int sv[2], status;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        aept_log_error("socketpair: %s", strerror(errno));
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        aept_log_error("fork: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        root_helper_main(ctx, sv[1]);
+    }
+
+    close(sv[1]);
+    ctx->root_helper_fd = sv[0];
+    ctx->root_helper_pid = pid;
+
+    if (read_full(sv[0], setup, sizeof(setup)) == 0 && setup[0] == SETUP_OK)
+        return 0;
+
+    if (setup[0] == SETUP_CHROOT)
+        aept_log_error("failed to chroot to '%s': %s",
+                       ctx->config.offline_root, strerror(setup[1]));
+    else if (setup[0] > SETUP_OK && setup[0] <= SETUP_CHDIR)
+        aept_log_error("failed to %s: %s", setup_steps[setup[0]],
+                       strerror(setup[1]));
+    else
+        aept_log_error("offline root helper exited during setup");
+
+    status = root_helper_reap(ctx);
+    return status == 0 ? -1 : status;
+}
+
+void aept_root_helper_stop(struct aept_ctx *ctx)
+{
+    if (ctx->root_helper_pid > 0)
+        root_helper_reap(ctx);
+}
+
+/* Run argv through the helper.  Returns a wait status, or -1. */
+static int root_helper_run(struct aept_ctx *ctx, const char *argv[])
+{
+    uint32_t argc = 0, len;
+    int32_t reply;
+    int status, i;
+
+    if (ctx->root_helper_pid <= 0) {
+        status = root_helper_start(ctx);
+        if (status != 0)
+            return status;
+    }
+
+    while (argv[argc])
+        argc++;
+
+    int r = write_full(ctx->root_helper_fd, &argc, sizeof(argc));
+    for (i = 0; r == 0 && argv[i]; i++) {
+        len = strlen(argv[i]);
+        r = write_full(ctx->root_helper_fd, &len, sizeof(len));
+        if (r == 0)
+            r = write_full(ctx->root_helper_fd, argv[i], len);
+    }
+
+    if (r == 0 && read_full(ctx->root_helper_fd, &reply, sizeof(reply)) == 0)
+        return reply;
+
+    /* The helper is gone: pass on its exit status as the result, and
+     * start a new one next time. */
+    status = root_helper_reap(ctx);
+    if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        return status;
+
+    aept_log_error("%s: offline root helper failed", argv[0]);
+    return -1;
+}
+
 int aept_system_offline_root(struct aept_ctx *ctx, const char *argv[])
 {
     int status;
     pid_t pid;
     int r;
 
+    if (ctx->config.offline_root) {
+        status = root_helper_run(ctx, argv);
+        if (status == -1)
+            return -1;
+        goto done;
+    }
+
     pid = fork();
 
     switch (pid) {
@@ -420,22 +930,6 @@ int aept_system_offline_root(struct aept_ctx *ctx, const char *argv[])
         aept_log_error("%s: fork: %s", argv[0], strerror(errno));
         return -1;
     case 0:
-        if (ctx->config.offline_root) {
-            if (geteuid() != 0) {
-                if (unshare_and_map_user() != 0)
-                    _exit(AEPT_EXIT_SETUP_FAILED);
-            }
-
-            if (chroot(ctx->config.offline_root) != 0) {
-                aept_log_error("failed to chroot to '%s': %s",
-                          ctx->config.offline_root, strerror(errno));
-                _exit(AEPT_EXIT_SETUP_FAILED);
-            }
-            if (chdir("/") != 0) {
-                aept_log_error("failed to chdir to '/': %s", strerror(errno));
-                _exit(AEPT_EXIT_SETUP_FAILED);
-            }
-        }
         execvp(argv[0], (char *const *)argv);
         _exit(AEPT_EXIT_EXEC_FAILED);
     default:
@@ -448,6 +942,7 @@ int aept_system_offline_root(struct aept_ctx *ctx, const char *argv[])
         return -1;
     }
 
+done:
     if (WIFSIGNALED(status)) {
         aept_log_error("%s: killed by signal %d", argv[0], WTERMSIG(status));
         return -1;
@@ -460,3 +955,67 @@ int aept_system_offline_root(struct aept_ctx *ctx, const char *argv[])
 
     return WEXITSTATUS(status);
 }
+
+typedef struct {
+    struct aept_ctx *ctx;
+    aept_task_fn fn;
+    void *arg;
+    int *results;
+    int count;
+    _Atomic int next;
+} parallel_run_t;
+
+static void parallel_drain(parallel_run_t *pr)
+{
+    int i;
+
+    while (!aept_cancelled()) {
+        i = pr->next++;
+        if (i >= pr->count)
+            break;
+        pr->results[i] = pr->fn(pr->ctx, i, pr->arg);
+    }
+}
+
+static void *parallel_worker(void *arg)
+{
+    parallel_run_t *pr = arg;
+
+    aept_log_set_ctx(pr->ctx);
+    parallel_drain(pr);
+    return NULL;
+}
+
+void aept_parallel_run(struct aept_ctx *ctx, int count, int jobs,
+                       aept_task_fn fn, void *arg, int *results)
+{
+    parallel_run_t pr;
+    pthread_t *threads = NULL;
+    int i, nthreads = 0;
+
+    pr.ctx = ctx;
+    pr.fn = fn;
+    pr.arg = arg;
+    pr.results = results;
+    pr.count = count;
+    pr.next = 0;
+
+    if (jobs > count)
+        jobs = count;
+
+    if (jobs > 1) {
+        threads = aept_malloc((jobs - 1) * sizeof(*threads));
+        for (nthreads = 0; nthreads < jobs - 1; nthreads++) {
+            if (pthread_create(&threads[nthreads], NULL,
+                               parallel_worker, &pr) != 0)
+                break;
+        }
+    }
+
+    parallel_drain(&pr);
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
@@ -4,53 +4,202 @@
  * SPDX-License-Identifier: MIT
  */
 
+/*
+ * Signatures and keys use the usign formats: an "untrusted comment:"
+ * line followed by one line of base64.  A key decodes to the algorithm
+ * tag "Ed", an 8-byte fingerprint and the 32-byte Ed25519 public key; a
+ * signature to the tag, the fingerprint of the signing key and the
+ * 64-byte Ed25519 signature of the file.  The key is looked up in
+ * usign_keydir under the fingerprint in lowercase hex, as "usign -V -P"
+ * does, and the check itself is done by OpenSSL.
+ */
+
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <openssl/evp.h>
+
 #include "aept/internal.h"
 #include "aept/msg.h"
 #include "aept/util.h"
 #include "aept/verify.h"
 
-int aept_verify_signature(struct aept_ctx *ctx, const char *file,
-                          const char *sigfile)
-{
-    int r;
-    pid_t pid;
-    int status;
+#define USIGN_FINGERPRINT_LEN 8
+#define USIGN_PUBKEY_LEN      32
+#define USIGN_SIG_LEN         64
 
-    pid = fork();
+typedef struct {
+    unsigned char pkalg[2];
+    unsigned char fingerprint[USIGN_FINGERPRINT_LEN];
+    unsigned char data[USIGN_SIG_LEN];   /* key or signature */
+} usign_blob_t;
 
-    if (pid < 0) {
-        aept_log_error("failed to fork usign process: %s", strerror(errno));
+/* Decode the base64 line of a usign file at path into blob, which must
+ * come out at exactly want bytes. */
+static int read_usign_file(const char *path, usign_blob_t *blob, size_t want)
+{
+    char line[512];
+    unsigned char raw[sizeof(line)];
+    size_t len;
+    int n, pad = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        aept_log_error("cannot open '%s': %s", path, strerror(errno));
         return -1;
     }
 
-    if (pid == 0) {
-        execl(AEPT_USIGN_BIN, "usign", "-q", "-V",
-              "-P", ctx->config.usign_keydir,
-              "-m", file,
-              "-x", sigfile,
-              NULL);
-        _exit(AEPT_EXIT_EXEC_FAILED);
+    /* Skip the comment line; the first base64 line is the payload */
+    do {
+        if (!fgets(line, sizeof(line), fp)) {
+            fclose(fp);
+            aept_log_error("'%s' is empty or truncated", path);
+            return -1;
+        }
+    } while (strncmp(line, "untrusted comment:", 18) == 0);
+    fclose(fp);
+
+    len = strcspn(line, "\r\n");
+    line[len] = '\0';
+    while (len > 0 && line[len - 1] == '=') {
+        pad++;
+        len--;
     }
 
-    do {
-        r = waitpid(pid, &status, 0);
-    } while (r == -1 && errno == EINTR);
+    n = EVP_DecodeBlock(raw, (const unsigned char *)line, strlen(line));
+    if (n < 0 || (size_t)(n - pad) != want) {
+        aept_log_error("'%s' is not a valid usign key or signature", path);
+        return -1;
+    }
+
+    memset(blob, 0, sizeof(*blob));
+    memcpy(blob, raw, want);
 
-    if (r == -1) {
-        aept_log_error("usign: waitpid: %s", strerror(errno));
+    if (memcmp(blob->pkalg, "Ed", 2) != 0) {
+        aept_log_error("'%s' uses an unsupported algorithm", path);
         return -1;
     }
+    return 0;
+}
+
+/* Map file read-only.  An empty file gives a NULL map of length 0. */
+static int map_file(const char *path, void **map, size_t *len)
+{
+    struct stat st;
+    int fd;
 
-    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
-        aept_log_error("signature verification failed for '%s'", file);
+    *map = NULL;
+    *len = 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        aept_log_error("cannot open '%s': %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
         return -1;
     }
 
+    if (st.st_size > 0) {
+        *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*map == MAP_FAILED) {
+            aept_log_error("cannot map '%s': %s", path, strerror(errno));
+            close(fd);
+            *map = NULL;
+            return -1;
+        }
+        *len = st.st_size;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int ed25519_verify(const unsigned char *pubkey,
+                          const unsigned char *sig,
+                          const void *msg, size_t len)
+{
+    EVP_PKEY *pkey;
+    EVP_MD_CTX *md;
+    int ok = 0;
+
+    pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, pubkey,
+                                       USIGN_PUBKEY_LEN);
+    if (!pkey)
+        return 0;
+
+    md = EVP_MD_CTX_new();
+    if (md && EVP_DigestVerifyInit(md, NULL, NULL, NULL, pkey) == 1)
+        ok = EVP_DigestVerify(md, sig, USIGN_SIG_LEN,
+                              len ? msg : (const void *)"", len) == 1;
+
+    EVP_MD_CTX_free(md);
+    EVP_PKEY_free(pkey);
+    return ok;
+}
+
+int aept_verify_signature(struct aept_ctx *ctx, const char *file,
+                          const char *sigfile)
+{
+    usign_blob_t sig, key;
+    char *key_path = NULL;
+    uint64_t fp = 0;
+    void *msg;
+    size_t len;
+    int i, ok;
+
+    if (read_usign_file(sigfile, &sig,
+                        2 + USIGN_FINGERPRINT_LEN + USIGN_SIG_LEN) < 0)
+        goto fail;
+
+    for (i = 0; i < USIGN_FINGERPRINT_LEN; i++)
+        fp = (fp << 8) | sig.fingerprint[i];
+    aept_asprintf(&key_path, "%s/%016llx", ctx->config.usign_keydir,
+                  (unsigned long long)fp);
+
+    /* usign itself omits leading zeros */
+    if (!aept_file_exists(key_path)) {
+        free(key_path);
+        aept_asprintf(&key_path, "%s/%llx", ctx->config.usign_keydir,
+                      (unsigned long long)fp);
+    }
+
+    if (!aept_file_exists(key_path)) {
+        aept_log_error("no trusted key %016llx for '%s'",
+                       (unsigned long long)fp, file);
+        goto fail;
+    }
+
+    if (read_usign_file(key_path, &key,
+                        2 + USIGN_FINGERPRINT_LEN + USIGN_PUBKEY_LEN) < 0)
+        goto fail;
+
+    if (memcmp(key.fingerprint, sig.fingerprint, USIGN_FINGERPRINT_LEN)) {
+        aept_log_error("key '%s' does not match its name", key_path);
+        goto fail;
+    }
+
+    if (map_file(file, &msg, &len) < 0)
+        goto fail;
+
+    ok = ed25519_verify(key.data, sig.data, msg, len);
+    if (msg)
+        munmap(msg, len);
+    if (!ok)
+        goto fail;
+
+    free(key_path);
     return 0;
+
+fail:
+    aept_log_error("signature verification failed for '%s'", file);
+    free(key_path);
+    return -1;
 }